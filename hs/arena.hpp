@@ -0,0 +1,123 @@
+#pragma once
+
+#include <memory_resource>
+#include <type_traits>
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+
+namespace hs {
+    // Bump allocator, memory is handed out from large chunks and only
+    // given back all at once by release(). Deallocating does nothing.
+    //
+    // Objects on the arena are never destroyed, so whatever they own
+    // has to come from the arena too (i.e. std::pmr containers using
+    // it, see ast_string_t)
+    class arena_t : public std::pmr::memory_resource {
+        struct chunk_t {
+            chunk_t* next;
+            size_t size;
+        };
+
+        chunk_t* m_chunks = nullptr;
+
+        uintptr_t m_ptr = 0, m_end = 0;
+
+        // Chunks double in size up to m_max_chunk_size, larger
+        // allocations get a chunk of their own
+        static constexpr size_t m_min_chunk_size = 0x10000;
+        static constexpr size_t m_max_chunk_size = 0x400000;
+
+        size_t m_chunk_size = m_min_chunk_size;
+        size_t m_allocated = 0, m_reserved = 0;
+
+        void grow(size_t bytes, size_t alignment) {
+            size_t size = m_chunk_size;
+
+            if ((bytes + alignment + sizeof(chunk_t)) > size)
+                size = bytes + alignment + sizeof(chunk_t);
+
+            chunk_t* chunk = (chunk_t*)std::malloc(size);
+
+            if (!chunk) throw std::bad_alloc();
+
+            chunk->next = m_chunks;
+            chunk->size = size;
+
+            m_chunks = chunk;
+            m_ptr = (uintptr_t)(chunk + 1);
+            m_end = (uintptr_t)chunk + size;
+            m_reserved += size;
+
+            if (m_chunk_size < m_max_chunk_size)
+                m_chunk_size *= 2;
+        }
+
+    protected:
+        void* do_allocate(size_t bytes, size_t alignment) override {
+            uintptr_t ptr = (m_ptr + alignment - 1) & ~(uintptr_t)(alignment - 1);
+
+            if ((ptr + bytes) > m_end) {
+                grow(bytes, alignment);
+
+                ptr = (m_ptr + alignment - 1) & ~(uintptr_t)(alignment - 1);
+            }
+
+            m_ptr = ptr + bytes;
+            m_allocated += bytes;
+
+            return (void*)ptr;
+        }
+
+        void do_deallocate(void*, size_t, size_t) override {}
+
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+            return this == &other;
+        }
+
+    public:
+        arena_t() = default;
+        arena_t(const arena_t&) = delete;
+        arena_t& operator=(const arena_t&) = delete;
+
+        ~arena_t() {
+            release();
+        }
+
+        // Objects that own memory take the arena on their constructor
+        template <class T> T* create() {
+            void* ptr = allocate(sizeof(T), alignof(T));
+
+            if constexpr (std::is_constructible_v <T, std::pmr::memory_resource*>) {
+                return new (ptr) T(this);
+            } else {
+                return new (ptr) T;
+            }
+        }
+
+        void release() {
+            while (m_chunks) {
+                chunk_t* next = m_chunks->next;
+
+                std::free(m_chunks);
+
+                m_chunks = next;
+            }
+
+            m_ptr = 0;
+            m_end = 0;
+            m_chunk_size = m_min_chunk_size;
+            m_allocated = 0;
+            m_reserved = 0;
+        }
+
+        // Bytes handed out, and bytes taken from the system
+        size_t get_allocated() {
+            return m_allocated;
+        }
+
+        size_t get_reserved() {
+            return m_reserved;
+        }
+    };
+}
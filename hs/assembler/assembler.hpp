@@ -2,6 +2,7 @@
 
 #include "../error.hpp"
 #include "../cli.hpp"
+#include "../ir/generator.hpp"
 
 #include <vector>
 
@@ -10,5 +11,10 @@ namespace hs {
     public:
         virtual void init(std::istream*, std::ostream*, error_logger_t*, cli_parser_t*) {};
         virtual void assemble() {};
+
+        // Encode IR straight to machine code, skipping translation
+        // and assembly. Targets return false if they can't, the
+        // compiler then translates and assembles instead
+        virtual bool encode(ir_generator_t*, std::ostream*, error_logger_t*, cli_parser_t*) { return false; };
     };
 }
\ No newline at end of file
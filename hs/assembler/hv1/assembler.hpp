@@ -92,7 +92,7 @@ namespace hs {
                 // Error mnemonic not found
             }
 
-            hyrisc_mnemonic_t id = hyrisc_mnemonic_id[m_instruction.mnemonic];
+            hyrisc_mnemonic_t id = hyrisc_mnemonic_id.at(m_instruction.mnemonic);
 
             switch (id) {
                 case IM_ADD: {
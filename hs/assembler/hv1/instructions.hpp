@@ -171,7 +171,7 @@ namespace hs {
         IM_DEBUG      
     };
 
-    std::unordered_map <std::string, hyrisc_mnemonic_t> hyrisc_mnemonic_id = {
+    const std::unordered_map <std::string, hyrisc_mnemonic_t> hyrisc_mnemonic_id = {
         { "mov"   , IM_MOV },
         { "li"    , IM_LI },
         { "lui"   , IM_LUI },
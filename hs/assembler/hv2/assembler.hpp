@@ -8,9 +8,16 @@
 
 #include "log.hpp"
 
+// Errors are thrown instead of exiting right away so they don't
+// take down a batch worker or the compile server, the compiler
+// catches these and exits with the error code
+struct hv2a_error_t {
+    int code;
+};
+
 #define ERROR(ec, ...) \
     _hv2_log(error, __VA_ARGS__); \
-    std::exit(ec)
+    throw hv2a_error_t { (int)(ec) }
 
 struct symbol_t {
     std::string name;
@@ -114,7 +121,7 @@ struct elf_symbol_t {
     elf32_sym_t hdr;
 };
 
-static std::unordered_map <std::string, uint32_t> mips_abi_register_names = {
+static const std::unordered_map <std::string, uint32_t> mips_abi_register_names = {
     { "zero", 0  },
     { "at"  , 1  },
     { "v0"  , 2  },
@@ -156,7 +163,7 @@ static std::unordered_map <std::string, uint32_t> mips_abi_register_names = {
     { "cop0_xpc", 0x040 }
 };
 
-static std::unordered_map <std::string, uint32_t> default_abi_register_names = {
+static const std::unordered_map <std::string, uint32_t> default_abi_register_names = {
     // Registers and aliases
     // Default     HS default
     { "r0" , 0  }, { "zero", 0  },
@@ -209,7 +216,7 @@ struct elf_section_t {
 };
 
 struct hv2a_t {
-    std::unordered_map <std::string, uint32_t>* register_names = &default_abi_register_names;
+    const std::unordered_map <std::string, uint32_t>* register_names = &default_abi_register_names;
 
     std::iostream* output;
     uint32_t pos = 0;
@@ -287,7 +294,7 @@ struct mnemonic_data_t {
 #define SCR(o)           { "", 0x0b, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, o }
 
 
-std::unordered_map <std::string, mnemonic_data_t> mnemonic_data_map = {
+const std::unordered_map <std::string, mnemonic_data_t> mnemonic_data_map = {
     // ALU register/immediate
     { "add",  ALU(0x0, 1, 0) }, { "add.u",  ALU(0x0, 0, 0) }, { "add.s",  ALU(0x0, 1, 0) },
     { "addi", ALU(0x0, 1, 1) }, { "addi.u", ALU(0x0, 0, 1) }, { "addi.s", ALU(0x0, 1, 1) },
@@ -391,7 +398,7 @@ std::unordered_map <std::string, mnemonic_data_t> mnemonic_data_map = {
 #define PSD_BI      16
 #define PSD_XCH     17
 
-std::unordered_map <std::string, mnemonic_data_t> pseudo_data_map = {
+const std::unordered_map <std::string, mnemonic_data_t> pseudo_data_map = {
     // Branch always
     { "b", PSD0(PSD_B) }, { "bra", PSD0(PSD_B) },
     
@@ -702,7 +709,7 @@ uint32_t hv2a_parse_integer(hv2a_t* as, int* type = nullptr) {
             return 0x0;
         
         if (as->register_names->contains(buf)) {
-            uint32_t rn = (*as->register_names)[buf];
+            uint32_t rn = as->register_names->at(buf);
 
             if (type) *type = INT_TYPE_REGISTER;
 
@@ -1079,7 +1086,7 @@ uint32_t encode_instruction(mnemonic_data_t* md, operand_data_t* od, size_t* siz
 #define AD_ALIGN    0x000a
 #define AD_ESECT    0x0100
 
-std::unordered_map <std::string, int> directive_id_map = {
+const std::unordered_map <std::string, int> directive_id_map = {
     { "org"    , AD_ORG    },
     { "db"     , AD_DB     }, { "byte" , AD_DB },
     { "ds"     , AD_DS     }, { "short", AD_DS },
@@ -1209,7 +1216,7 @@ void hv2a_handle_data(hv2a_t* as, int s) {
 #define SHT_NUM                 0x13
 #define SHT_LOOS                0x60000000
 
-std::unordered_map <std::string, uint32_t> section_flags_map = {
+const std::unordered_map <std::string, uint32_t> section_flags_map = {
     { ".bss",           SHF_ALLOC | SHF_WRITE           },
     { ".comment",       SHF_NONE                        },
     { ".data",          SHF_ALLOC | SHF_WRITE           },
@@ -1243,7 +1250,7 @@ std::unordered_map <std::string, uint32_t> section_flags_map = {
     { ".text",          SHF_ALLOC | SHF_EXECINSTR       }
 };
 
-std::unordered_map <std::string, uint32_t> section_type_map = {
+const std::unordered_map <std::string, uint32_t> section_type_map = {
     { ".bss",           SHT_NOBITS        },
     { ".comment",       SHT_PROGBITS      },
     { ".data",          SHT_PROGBITS      },
@@ -1277,7 +1284,7 @@ std::unordered_map <std::string, uint32_t> section_type_map = {
     { ".text",          SHT_PROGBITS      }
 };
 
-std::unordered_map <std::string, uint32_t> section_type_name_map = {
+const std::unordered_map <std::string, uint32_t> section_type_name_map = {
     { "null",          0x0        },
     { "progbits",      0x1        },
     { "symtab",        0x2        },
@@ -1324,8 +1331,8 @@ void hv2a_handle_section(hv2a_t* as) {
     bool standard_section = false;
 
     if (section_flags_map.contains(sect.name)) {
-        sect.hdr.sh_flags = section_flags_map[sect.name];
-        sect.hdr.sh_type = section_type_map[sect.name];
+        sect.hdr.sh_flags = section_flags_map.at(sect.name);
+        sect.hdr.sh_type = section_type_map.at(sect.name);
 
         standard_section = true;
     } else {
@@ -1402,7 +1409,7 @@ void hv2a_handle_section(hv2a_t* as) {
         ERROR(0 /* To-do */, "Invalid type mask name \"%s\"", type.c_str());
     }
 
-    sect.hdr.sh_type = section_type_name_map[type];
+    sect.hdr.sh_type = section_type_name_map.at(type);
 
     as->sections.push_back(sect);
 }
@@ -1464,7 +1471,7 @@ bool hv2a_handle_directive(hv2a_t* as) {
         return true;
     }
 
-    int id = directive_id_map[buf];
+    int id = directive_id_map.at(buf);
 
     hv2a_consume_whitespace(as);
 
@@ -1717,7 +1724,7 @@ void hv2a_assemble(hv2a_t* as) {
     if (mnemonic_data_map.contains(buf)) {
         // Encode normal instruction
         if (as->pass == 1) {
-            md = mnemonic_data_map[buf];
+            md = mnemonic_data_map.at(buf);
 
             md.mnemonic = buf;
 
@@ -1731,7 +1738,7 @@ void hv2a_assemble(hv2a_t* as) {
         as->vaddr += 4;
         as->pos += 4;
     } else if (pseudo_data_map.contains(buf)) {
-        md = pseudo_data_map[buf];
+        md = pseudo_data_map.at(buf);
 
         md.mnemonic = buf;
 
@@ -1819,12 +1826,9 @@ uint32_t hv2a_assemble_stream_impl(hv2a_t* as, std::istream* input, std::iostrea
     return pos;
 }
 
-void hv2a_assemble_raw(hv2a_t* as, std::istream* input, std::ostream* output) {
-    std::stringstream buf;
-
-    // Assemble input to buffer
-    hv2a_assemble_stream_impl(as, input, &buf);
-
+// Writers take an already assembled program on as->output, either
+// from hv2a_assemble_stream_impl or the IR encoder (see encoder.hpp)
+void hv2a_write_raw(hv2a_t* as, std::ostream* output) {
     // Write text section
     as->output->clear();
     as->output->seekg(0);
@@ -1838,15 +1842,24 @@ void hv2a_assemble_raw(hv2a_t* as, std::istream* input, std::ostream* output) {
     }
 }
 
+void hv2a_assemble_raw(hv2a_t* as, std::istream* input, std::ostream* output) {
+    std::stringstream buf;
+
+    // Assemble input to buffer
+    hv2a_assemble_stream_impl(as, input, &buf);
+
+    hv2a_write_raw(as, output);
+}
+
 #define ST_OBJECT   1
 #define ST_FUNCTION 2
 
-static std::unordered_map <int, std::string> st_section_map = {
+static const std::unordered_map <int, std::string> st_section_map = {
     { ST_OBJECT  , ".rodata" },
     { ST_FUNCTION, ".text"   }
 };
 
-static std::unordered_map <char, uint8_t> symtag_st_map = {
+static const std::unordered_map <char, uint8_t> symtag_st_map = {
     { 'D', ST_OBJECT   },
     { 'F', ST_FUNCTION }
 };
@@ -1870,7 +1883,7 @@ void hv2a_gather_symbols(hv2a_t* as) {
     }
 }
 
-void hv2a_assemble_elf32(hv2a_t* as, std::istream* input, std::ostream* output) {
+void hv2a_write_elf32(hv2a_t* as, uint32_t pos, std::ostream* output) {
     elf32_hdr_t hdr;
 
     // 0 = text
@@ -1878,11 +1891,6 @@ void hv2a_assemble_elf32(hv2a_t* as, std::istream* input, std::ostream* output)
     // 2 = stack
     elf32_phdr_t phdr[PHDR_COUNT];
 
-    std::stringstream buf;
-
-    // Assemble input to buffer
-    uint32_t pos = hv2a_assemble_stream_impl(as, input, &buf);
-
     hv2a_gather_symbols(as);
     
     // Prepare ELF data
@@ -2033,12 +2041,22 @@ void hv2a_assemble_elf32(hv2a_t* as, std::istream* input, std::ostream* output)
 
     // Write symtab
     for (elf_symbol_t& sym : as->symbols) {
-        int type = symtag_st_map[sym.name[0]];
+        // Untagged symbols (i.e. local labels) don't belong to
+        // any particular section
+        auto tag = symtag_st_map.find(sym.name[0]);
+        auto section = st_section_map.end();
+
+        int type = 0;
+
+        if (tag != symtag_st_map.end()) {
+            type = tag->second;
+            section = st_section_map.find(type);
+        }
 
         sym.hdr.st_info = (((int)sym.global) << 4) | (type & 0xf);
         sym.hdr.st_size = 4;
         sym.hdr.st_value = sym.addr;
-        sym.hdr.st_shndx = hv2a_get_section_index(as, st_section_map[type]);
+        sym.hdr.st_shndx = hv2a_get_section_index(as, section != st_section_map.end() ? section->second : "");
 
         output->write((char*)&sym.hdr, sizeof(elf32_sym_t));
     }
@@ -2069,8 +2087,18 @@ void hv2a_assemble_elf32(hv2a_t* as, std::istream* input, std::ostream* output)
     }
 }
 
+void hv2a_assemble_elf32(hv2a_t* as, std::istream* input, std::ostream* output) {
+    std::stringstream buf;
+
+    // Assemble input to buffer
+    uint32_t pos = hv2a_assemble_stream_impl(as, input, &buf);
+
+    hv2a_write_elf32(as, pos, output);
+}
+
 // This file is part of the hs compiler
 #include "../assembler.hpp"
+#include "encoder.hpp"
 
 namespace hs {
     class assembler_hv2_t : public assembler_t {
@@ -2078,25 +2106,13 @@ namespace hs {
         std::ostream* m_output;
         error_logger_t* m_logger;
         cli_parser_t* m_cli;
-        hv2a_t* m_assembler;
+        hv2a_t* m_assembler = nullptr;
 
         int pipeline_size = 3;
         bool pipeline_flush = false;
+        bool text_only = false;
 
-    public:
-        ~assembler_hv2_t() {
-            delete(m_assembler);
-        }
-
-        void init(std::istream* input, std::ostream* output, error_logger_t* logger, cli_parser_t* cli) override {
-            _hv2_log::init("hv2_assembler");
-
-            m_input = input;
-            m_output = output;
-            m_logger = logger;
-            m_cli = cli;
-            m_assembler = new hv2a_t;
-
+        void parse_options() {
             std::string opt = m_cli->get_setting(ST_XASM);
 
             // Parse options
@@ -2138,6 +2154,11 @@ namespace hs {
                             pipeline_flush = o[1] == 'F';
                         } break;
 
+                        // Always assemble translated text
+                        case 'T': {
+                            text_only = true;
+                        } break;
+
                         default: {
                             _hv2_log(warning, "Unknown assembler setting \'%c\'", o[1]);
                         };
@@ -2149,6 +2170,56 @@ namespace hs {
             m_assembler->flush = pipeline_flush;
         }
 
+    public:
+        ~assembler_hv2_t() {
+            delete(m_assembler);
+        }
+
+        void init(std::istream* input, std::ostream* output, error_logger_t* logger, cli_parser_t* cli) override {
+            _hv2_log::init("hv2_assembler");
+
+            m_input = input;
+            m_output = output;
+            m_logger = logger;
+            m_cli = cli;
+
+            delete(m_assembler);
+
+            m_assembler = new hv2a_t;
+
+            parse_options();
+        }
+
+        bool encode(ir_generator_t* irg, std::ostream* output, error_logger_t* logger, cli_parser_t* cli) override {
+            init(nullptr, output, logger, cli);
+
+            if (text_only)
+                return false;
+
+            // Work on a copy, the text path needs a clean assembler
+            // if we can't encode this program
+            hv2a_t as = *m_assembler;
+
+            hv2_encoder_t encoder;
+
+            encoder.init(&as, irg);
+
+            if (!encoder.encode())
+                return false;
+
+            std::stringstream buf(*encoder.get_output());
+
+            as.output = &buf;
+
+            if (m_cli->get_setting(ST_OUTPUT_FORMAT) == "elf32") {
+                hv2a_write_elf32(&as, encoder.get_size(), m_output);
+            } else {
+                hv2a_write_raw(&as, m_output);
+            }
+
+            return true;
+        }
+
         void assemble() override {
             if (m_cli->get_setting(ST_OUTPUT_FORMAT) == "elf32") {
                 hv2a_assemble_elf32(m_assembler, m_input, m_output);
@@ -2157,4 +2228,4 @@ namespace hs {
             }
         };
     };
-}
\ No newline at end of file
+}
@@ -0,0 +1,745 @@
+#pragma once
+
+#include "../../ir/generator.hpp"
+#include "../../ir/translators/hv2.hpp"
+#include "../../preprocessor/preprocessor.hpp"
+
+#include <string>
+#include <sstream>
+#include <cstring>
+#include <unordered_map>
+
+// Encodes IR straight to hv2 machine code, skipping the translator
+// and the assembler's parser. Output is the same the translator and
+// assembler would produce:
+//
+//  - Common instructions are encoded right away, references to
+//    labels are recorded as fixups and patched once every label
+//    is known
+//  - Everything else (inline assembly, ELF directives, unusual
+//    operands) is translated to text and assembled in place by
+//    the regular assembler, pass 0 runs right away, pass 1 runs
+//    along with the rest of the fixups
+//
+// Assembly containing preprocessor directives can't be handled
+// this way, encode() returns false and the caller should use
+// the text path instead
+namespace hs {
+    class hv2_encoder_t {
+        enum fixup_type_t {
+            FX_INSTRUCTION, // Patch an operand of an instruction
+            FX_LOAD_WORD,   // Patch a li.w pair
+            FX_DATA,        // Patch a .long
+            FX_TEXT         // Assemble text (pass 1)
+        };
+
+        struct fixup_t {
+            fixup_type_t type;
+
+            uint32_t pos, vaddr, size;
+
+            // Local labels are looked up relative to the last
+            // global label seen
+            std::string scope;
+
+            // Symbol name, or assembly for FX_TEXT
+            std::string text;
+
+            bool absolute = false;
+
+            mnemonic_data_t* md = nullptr;
+            operand_data_t od;
+            int operand = 0;
+        };
+
+        enum operand_kind_t {
+            OK_LITERAL,
+            OK_SYMBOL,
+            OK_OTHER
+        };
+
+        hv2a_t* m_as;
+        ir_generator_t* m_irg;
+        ir_tr_hv2_t m_translator;
+        symbol_table_t* m_symbols;
+
+        std::string m_output;
+        std::vector <fixup_t> m_fixups;
+        std::unordered_map <std::string, std::string> m_defines;
+        std::unordered_map <std::string, mnemonic_data_t> m_mnemonics;
+        std::unordered_map <uint32_t, uint32_t> m_registers;
+
+        mnemonic_data_t *m_add, *m_sub, *m_or, *m_li, *m_load, *m_store, *m_lea, *m_beq;
+
+        uint32_t m_r0, m_zero, m_at, m_sp, m_fp, m_pc;
+
+        mnemonic_data_t* get_mnemonic(const std::string& name) {
+            auto it = m_mnemonics.find(name);
+
+            if (it != m_mnemonics.end())
+                return &it->second;
+
+            auto md = mnemonic_data_map.find(name);
+
+            if (md == mnemonic_data_map.end())
+                return nullptr;
+
+            mnemonic_data_t& entry = m_mnemonics[name];
+
+            entry = md->second;
+            entry.mnemonic = name;
+
+            return &entry;
+        }
+
+        bool get_register(uint32_t reg, uint32_t* r) {
+            auto it = m_registers.find(reg);
+
+            if (it != m_registers.end()) {
+                *r = it->second;
+
+                return true;
+            }
+
+            auto rn = m_as->register_names->find(ir_tr_hv2_t::map_register(reg));
+
+            if (rn == m_as->register_names->end())
+                return false;
+
+            m_registers[reg] = rn->second;
+
+            *r = rn->second;
+
+            return true;
+        }
+
+        // Parse an operand the same way hv2a_parse_integer would,
+        // symbols are left for later
+        operand_kind_t parse_operand(const std::string& str, uint32_t* value, std::string* symbol = nullptr, bool* absolute = nullptr) {
+            size_t i = 0;
+
+            bool abs = (i < str.size()) && (str[i] == '!');
+
+            if (abs) i++;
+
+            bool negative = (i < str.size()) && (str[i] == '-');
+
+            if (negative) i++;
+
+            if (i >= str.size())
+                return OK_OTHER;
+
+            if (std::isdigit(str[i])) {
+                bool decimal = true;
+
+                for (size_t j = i; j < str.size(); j++)
+                    decimal = decimal && std::isdigit(str[j]);
+
+                if (decimal) {
+                    uint32_t v = std::stoul(str.substr(i), nullptr, 0);
+
+                    *value = negative ? -v : v;
+
+                    return OK_LITERAL;
+                }
+
+                // Hex and binary literals
+                std::istringstream stream(str);
+
+                m_as->stream = &stream;
+                m_as->c = stream.get();
+
+                *value = hv2a_parse_integer(m_as);
+
+                return stream.eof() ? OK_LITERAL : OK_OTHER;
+            }
+
+            if (!(std::isalpha(str[i]) || (str[i] == '_')))
+                return OK_OTHER;
+
+            for (size_t j = i; j < str.size(); j++)
+                if (!(std::isalnum(str[j]) || (str[j] == '_')))
+                    return OK_OTHER;
+
+            std::string name = str.substr(i);
+
+            auto rn = m_as->register_names->find(name);
+
+            if (rn != m_as->register_names->end()) {
+                *value = negative ? -rn->second : rn->second;
+
+                return OK_LITERAL;
+            }
+
+            if (!symbol)
+                return OK_OTHER;
+
+            *symbol = name;
+
+            if (absolute) *absolute = abs;
+
+            return OK_SYMBOL;
+        }
+
+        static operand_data_t int1(uint32_t a) {
+            operand_data_t od;
+
+            od.mode = OPR_INT1;
+            od.integer[0] = a;
+
+            return od;
+        }
+
+        static operand_data_t int2(uint32_t a, uint32_t b) {
+            operand_data_t od;
+
+            od.mode = OPR_INT2;
+            od.integer[0] = a;
+            od.integer[1] = b;
+
+            return od;
+        }
+
+        static operand_data_t int3(uint32_t a, uint32_t b, uint32_t c) {
+            operand_data_t od;
+
+            od.mode = OPR_INT3;
+            od.integer[0] = a;
+            od.integer[1] = b;
+            od.integer[2] = c;
+
+            return od;
+        }
+
+        // [base] or [base-fix]
+        static operand_data_t idx(uint32_t reg, uint32_t base) {
+            operand_data_t od;
+
+            od.mode = OPR_IDX_INT;
+            od.integer[0] = reg;
+            od.idx_base = base;
+
+            return od;
+        }
+
+        static operand_data_t idx(uint32_t reg, uint32_t base, uint32_t fix) {
+            operand_data_t od = idx(reg, base);
+
+            od.fixed = true;
+            od.idx_fix = fix;
+
+            return od;
+        }
+
+        void emit(uint32_t opcode) {
+            m_output.append((char*)&opcode, sizeof(uint32_t));
+
+            m_as->pos += 4;
+            m_as->vaddr += 4;
+        }
+
+        void emit(mnemonic_data_t* md, operand_data_t od) {
+            emit(encode_instruction(md, &od));
+        }
+
+        void add_fixup(fixup_type_t type, std::string symbol, bool absolute, mnemonic_data_t* md = nullptr, operand_data_t od = {}, int operand = 0) {
+            fixup_t fixup;
+
+            fixup.type = type;
+            fixup.pos = m_as->pos;
+            fixup.vaddr = m_as->vaddr;
+            fixup.scope = m_as->current_symbol;
+            fixup.text = symbol;
+            fixup.absolute = absolute;
+            fixup.md = md;
+            fixup.od = od;
+            fixup.operand = operand;
+
+            m_fixups.push_back(fixup);
+        }
+
+        // Pseudo-instructions, expanded exactly like hv2a_encode_pseudo_op
+        void move(uint32_t d, uint32_t s) {
+            emit(m_add, int3(d, m_r0, s));
+        }
+
+        void load_word(uint32_t d, uint32_t v) {
+            emit(m_li, int2(d, v & 0xffff0000));
+            emit(m_or, int2(d, v & 0x0000ffff));
+        }
+
+        void push(uint32_t r) {
+            emit(m_sub, int2(m_sp, 4));
+            emit(m_store, idx(r, m_sp));
+        }
+
+        void pop(uint32_t r) {
+            emit(m_add, int2(m_sp, 4));
+            emit(m_load, idx(r, m_sp, 4));
+        }
+
+        // Run the preprocessor over assembly with the defines
+        // currently in effect (i.e. function arguments)
+        std::string substitute(const std::string& text) {
+            if (!m_defines.size())
+                return text;
+
+            preprocessor_t pp;
+
+            *pp.get_define_map() = m_defines;
+
+            pp.init(text, nullptr, "", nullptr);
+            pp.preprocess();
+
+            return pp.get_output()->str();
+        }
+
+        void assemble_line(std::string& line) {
+            std::istringstream stream(line);
+
+            m_as->stream = &stream;
+
+            hv2a_assemble(m_as);
+        }
+
+        void assemble_lines(const std::string& text) {
+            std::istringstream input(text);
+            std::string line;
+
+            while (std::getline(input, line))
+                assemble_line(line);
+        }
+
+        bool assemble_text(const std::string& text) {
+            if (!text.size())
+                return true;
+
+            if (text.find('#') != std::string::npos)
+                return false;
+
+            fixup_t fixup;
+
+            fixup.type = FX_TEXT;
+            fixup.pos = m_as->pos;
+            fixup.vaddr = m_as->vaddr;
+            fixup.scope = m_as->current_symbol;
+            fixup.text = substitute(text);
+
+            assemble_lines(fixup.text);
+
+            fixup.size = m_as->pos - fixup.pos;
+
+            // Reserve space, filled in on pass 1
+            m_output.append(fixup.size, '\0');
+
+            m_fixups.push_back(fixup);
+
+            return true;
+        }
+
+        bool assemble_translated(ir_instruction_t& i) {
+            std::ostringstream ss;
+
+            m_translator.translate_instruction(ss, i);
+
+            return assemble_text(ss.str());
+        }
+
+        std::string operand(ir_instruction_t& i, int n) {
+            return print_ir_operand(m_symbols, i, n);
+        }
+
+        bool encode_label(ir_instruction_t& i) {
+            std::string label = ir_tr_hv2_t::fmt_label(operand(i, 0));
+
+            bool local = label.size() && (label[0] == '.');
+
+            std::string name = local ? label.substr(1) : label;
+
+            bool simple = name.size() && (std::isalpha(name[0]) || (name[0] == '_'));
+
+            for (char c : name)
+                simple = simple && (std::isalnum(c) || (c == '_') || (!local && (c == '.')));
+
+            if (!simple || (local && directive_id_map.contains(name)))
+                return assemble_translated(i);
+
+            if (local) {
+                m_as->local_symbols.insert({ name + m_as->current_symbol, m_as->vaddr });
+            } else {
+                m_as->current_symbol = name;
+                m_as->global_symbols.insert({ name, m_as->vaddr });
+            }
+
+            return true;
+        }
+
+        bool encode_instruction_ir(ir_instruction_t& i) {
+            uint32_t a, b, v;
+            std::string symbol;
+            bool absolute;
+
+            switch (i.opcode) {
+                case IR_MISC_BEGIN_INDENT:
+                case IR_MISC_END_INDENT: {
+                    return true;
+                } break;
+
+                case IR_LABEL: {
+                    return encode_label(i);
+                } break;
+
+                case IR_ADDSP: case IR_SUBSP: case IR_ADDFP: {
+                    if (i.types[0] != IO_IMMEDIATE) break;
+
+                    v = i.args[0];
+
+                    emit(i.opcode == IR_SUBSP ? m_sub : m_add, int2(i.opcode == IR_ADDFP ? m_fp : m_sp, v));
+                } return true;
+
+                case IR_DECSP: {
+                    emit(m_sub, int2(m_sp, 4));
+                } return true;
+
+                case IR_ALU: case IR_CMPR: {
+                    mnemonic_data_t* md = get_mnemonic(
+                        i.opcode == IR_ALU ?
+                            m_translator.map_binary_op(i.args[0]) :
+                            m_translator.map_comp_op(i.args[0])
+                    );
+
+                    if (!(md && get_register(i.args[1], &a) && get_register(i.args[2], &b))) break;
+
+                    emit(md, int3(a, a, b));
+                } return true;
+
+                case IR_CALLR: {
+                    if (!get_register(i.args[0], &a)) break;
+
+                    emit(m_sub, int2(m_sp, 4));
+                    emit(m_store, idx(m_pc, m_sp));
+                    move(m_r0, m_r0);
+                    move(m_pc, a);
+                } return true;
+
+                case IR_LEAF: case IR_LOADF: {
+                    if (!get_register(i.args[0], &a)) break;
+                    if (i.types[1] != IO_IMMEDIATE) break;
+
+                    v = i.args[1];
+
+                    emit(i.opcode == IR_LEAF ? m_lea : m_load, idx(a, m_fp, v));
+                } return true;
+
+                case IR_LOADR: {
+                    if (!(get_register(i.args[0], &a) && get_register(i.args[1], &b))) break;
+
+                    emit(m_load, idx(a, b));
+                } return true;
+
+                case IR_STORE: {
+                    if (!(get_register(i.args[0], &a) && get_register(i.args[1], &b))) break;
+
+                    emit(m_store, idx(b, a));
+                } return true;
+
+                case IR_MOV: {
+                    if (!(get_register(i.args[0], &a) && get_register(i.args[1], &b))) break;
+
+                    move(a, b);
+                } return true;
+
+                case IR_MOVI: {
+                    if (!get_register(i.args[0], &a)) break;
+
+                    if (i.types[1] == IO_IMMEDIATE) {
+                        load_word(a, i.args[1]);
+
+                        return true;
+                    }
+
+                    switch (parse_operand("!" + ir_tr_hv2_t::fmt_label(operand(i, 1)), &v, &symbol, &absolute)) {
+                        case OK_LITERAL: {
+                            load_word(a, v);
+                        } return true;
+
+                        case OK_SYMBOL: {
+                            add_fixup(FX_LOAD_WORD, symbol, absolute, nullptr, int2(a, 0));
+
+                            load_word(a, 0);
+                        } return true;
+
+                        default: break;
+                    }
+                } break;
+
+                case IR_NOP: {
+                    move(m_r0, m_r0);
+                } return true;
+
+                case IR_PUSHR: case IR_POPR: {
+                    if (!get_register(i.args[0], &a)) break;
+
+                    if (i.opcode == IR_PUSHR) {
+                        push(a);
+                    } else {
+                        pop(a);
+                    }
+                } return true;
+
+                case IR_RET: {
+                    pop(m_at);
+
+                    emit(m_add, int2(m_at, 4));
+
+                    move(m_pc, m_at);
+                } return true;
+
+                case IR_BRANCH: case IR_CMPZB: {
+                    std::string branch = ir_tr_hv2_t::map_branch(i.args[0]);
+
+                    operand_data_t od;
+
+                    if ((i.opcode == IR_BRANCH) && (branch == "b")) {
+                        od = int3(m_r0, m_r0, 0);
+                    } else if ((i.opcode == IR_CMPZB) && ((branch == "beq") || (branch == "bne"))) {
+                        if (!get_register(i.args[1], &a)) break;
+
+                        od = int3(a, m_zero, 0);
+                    } else {
+                        break;
+                    }
+
+                    mnemonic_data_t* md = (branch == "bne") ? get_mnemonic("bne") : m_beq;
+
+                    switch (parse_operand(operand(i, i.opcode == IR_BRANCH ? 1 : 2), &v, &symbol, &absolute)) {
+                        case OK_LITERAL: {
+                            od.integer[2] = v;
+
+                            emit(md, od);
+                        } return true;
+
+                        case OK_SYMBOL: {
+                            add_fixup(FX_INSTRUCTION, symbol, absolute, md, od, 2);
+
+                            emit(0);
+                        } return true;
+
+                        default: break;
+                    }
+                } break;
+
+                case IR_DEFSTR: {
+                    std::string text = "\"" + operand(i, 0) + "\"";
+
+                    if (text.find('#') != std::string::npos)
+                        return false;
+
+                    text = substitute(text);
+
+                    std::istringstream stream(text);
+
+                    m_as->stream = &stream;
+                    m_as->c = stream.get();
+
+                    std::string str = hv2a_parse_string(m_as);
+
+                    m_output.append(str.c_str(), str.size() + 1);
+
+                    m_as->pos += str.size() + 1;
+                    m_as->vaddr += str.size() + 1;
+                } return true;
+
+                case IR_DEFINE: {
+                    const std::string& key = m_symbols->get_name(i.args[0]);
+
+                    bool name = key.size() && (std::isalpha(key[0]) || (key[0] == '_'));
+
+                    for (char c : key)
+                        name = name && (std::isalnum(c) || (c == '_'));
+
+                    // Values are trimmed by the preprocessor
+                    const std::string& value = m_symbols->get_name(i.args[1]);
+
+                    if (value.size() && (std::isspace(value.front()) || std::isspace(value.back())))
+                        name = false;
+
+                    if (!name || (value.find_first_of("\r\n") != std::string::npos))
+                        return false;
+
+                    m_defines.insert({ key, value });
+                } return true;
+
+                case IR_UNDEF: {
+                    m_defines.erase(m_symbols->get_name(i.args[0]));
+                } return true;
+
+                case IR_DEFV: {
+                    if (i.types[0] == IO_IMMEDIATE) {
+                        emit(i.args[0]);
+
+                        return true;
+                    }
+
+                    switch (parse_operand(ir_tr_hv2_t::fmt_label(operand(i, 0)), &v, &symbol, &absolute)) {
+                        case OK_LITERAL: {
+                            emit(v);
+                        } return true;
+
+                        case OK_SYMBOL: {
+                            add_fixup(FX_DATA, symbol, absolute);
+
+                            emit(0);
+                        } return true;
+
+                        default: break;
+                    }
+                } break;
+
+                case IR_ALIGN: {
+                    if (i.types[0] != IO_IMMEDIATE) break;
+
+                    v = i.args[0];
+
+                    if ((!v) || (v & (v - 1))) break;
+
+                    uint32_t unaligned = m_as->pos & (v - 1);
+
+                    if (!unaligned)
+                        return true;
+
+                    m_output.append(v - unaligned, '\0');
+
+                    m_as->pos += v - unaligned;
+                    m_as->vaddr += v - unaligned;
+                } return true;
+
+                case IR_DEBUG: {
+                    mnemonic_data_t* md = get_mnemonic("debug");
+
+                    if (!md || (parse_operand(ir_tr_hv2_t::fmt_label(operand(i, 0)), &v) != OK_LITERAL)) break;
+
+                    emit(md, int1(v));
+                } return true;
+
+                default: break;
+            }
+
+            return assemble_translated(i);
+        }
+
+        void resolve(fixup_t& fixup) {
+            m_as->current_symbol = fixup.scope;
+
+            if (fixup.type == FX_TEXT) {
+                std::stringstream output;
+
+                m_as->output = &output;
+                m_as->pos = fixup.pos;
+                m_as->vaddr = fixup.vaddr;
+
+                assemble_lines(fixup.text);
+
+                std::string data = output.str();
+
+                std::memcpy(&m_output[fixup.pos], data.data(), std::min((size_t)fixup.size, data.size()));
+
+                return;
+            }
+
+            symbol_t sym = hv2a_symbol_lookup(m_as, fixup.text);
+
+            if (!sym.name.size()) {
+                ERROR(E_EXP_INT_OR_SYMBOL, "Undefined symbol \"%s\"", fixup.text.c_str());
+            }
+
+            uint32_t v = fixup.absolute ? sym.value : (sym.value - (fixup.vaddr + (4 + hv2a_get_pipeline_offset(m_as))));
+
+            uint32_t opcode[2] = { v, 0 };
+            size_t size = sizeof(uint32_t);
+
+            switch (fixup.type) {
+                case FX_INSTRUCTION: {
+                    fixup.od.integer[fixup.operand] = v;
+
+                    opcode[0] = encode_instruction(fixup.md, &fixup.od);
+                } break;
+
+                case FX_LOAD_WORD: {
+                    operand_data_t hi = int2(fixup.od.integer[0], v & 0xffff0000);
+                    operand_data_t lo = int2(fixup.od.integer[0], v & 0x0000ffff);
+
+                    opcode[0] = encode_instruction(m_li, &hi);
+                    opcode[1] = encode_instruction(m_or, &lo);
+
+                    size *= 2;
+                } break;
+
+                default: break;
+            }
+
+            std::memcpy(&m_output[fixup.pos], opcode, size);
+        }
+
+    public:
+        void init(hv2a_t* as, ir_generator_t* irg) {
+            m_as = as;
+            m_irg = irg;
+            m_symbols = irg->get_symbols();
+
+            m_translator.init(irg, nullptr);
+
+            m_add   = get_mnemonic("add.u");
+            m_sub   = get_mnemonic("sub.u");
+            m_or    = get_mnemonic("or.u");
+            m_li    = get_mnemonic("li.u");
+            m_load  = get_mnemonic("load.l");
+            m_store = get_mnemonic("store.l");
+            m_lea   = get_mnemonic("lea.l");
+            m_beq   = get_mnemonic("beq");
+
+            m_r0 = m_as->register_names->at("r0");
+            m_zero = m_as->register_names->at("zero");
+            m_at = m_as->register_names->at("at");
+            m_sp = m_as->register_names->at("sp");
+            m_fp = m_as->register_names->at("fp");
+            m_pc = m_as->register_names->at("pc");
+        }
+
+        // Returns false if the program has to go through the text
+        // path, nothing is written to the assembler in that case
+        bool encode() {
+            m_as->pass = 0;
+
+            for (std::vector <ir_instruction_t>& f : *m_irg->get_functions())
+                for (ir_instruction_t& i : f)
+                    if (!encode_instruction_ir(i))
+                        return false;
+
+            uint32_t size = m_as->pos;
+
+            hv2a_setup_next_pass(m_as);
+
+            for (fixup_t& fixup : m_fixups)
+                resolve(fixup);
+
+            m_as->pos = size;
+
+            hv2a_setup_next_pass(m_as);
+
+            return true;
+        }
+
+        std::string* get_output() {
+            return &m_output;
+        }
+
+        uint32_t get_size() {
+            return m_output.size();
+        }
+
+        size_t get_fixup_count() {
+            return m_fixups.size();
+        }
+    };
+}
@@ -3,17 +3,25 @@
 #include <vector>
 #include <fstream>
 #include <cstdio>
+#include <atomic>
+#include <string>
 
 #include "../../error.hpp"
 #include "../assembler.hpp"
 
 namespace hs {
+    // Batch mode may run several assemblers at once, give each
+    // one its own pair of temporary files
+    static std::atomic <int> x86_64_temp_counter = 0;
+
     class assembler_x86_64_t : public assembler_t {
         std::istream* m_input;
         std::ostream* m_output;
         error_logger_t* m_logger;
         std::ofstream m_temp_out_file;
         std::ifstream m_temp_in_file;
+        std::string m_temp_assembly;
+        std::string m_temp_assembled;
 
     public:
         void init(std::istream* input, std::ostream* output, error_logger_t* logger, cli_parser_t*) override {
@@ -21,27 +29,32 @@ namespace hs {
             m_output = output;
             m_logger = logger;
 
-            m_temp_out_file.open("__TEMP_ASSEMBLY__", std::ios::binary);
+            std::string id = std::to_string(x86_64_temp_counter++);
+
+            m_temp_assembly = "__TEMP_ASSEMBLY_" + id + "__";
+            m_temp_assembled = "__TEMP_ASSEMBLED_" + id + "__";
+
+            m_temp_out_file.open(m_temp_assembly, std::ios::binary);
 
             while (!m_input->eof())
                 m_temp_out_file.put(m_input->get());
         }
 
         void assemble() {
-            system("as __TEMP_ASSEMBLY__ -o __TEMP_ASSEMBLED__");
+            system(("as " + m_temp_assembly + " -o " + m_temp_assembled).c_str());
 
             m_temp_out_file.close();
 
-            std::remove("__TEMP_ASSEMBLY__");
+            std::remove(m_temp_assembly.c_str());
 
-            m_temp_in_file.open("__TEMP_ASSEMBLED__", std::ios::binary);
+            m_temp_in_file.open(m_temp_assembled, std::ios::binary);
 
             while (!m_temp_in_file.eof())
                 m_output->put(m_temp_in_file.get());
 
             m_temp_in_file.close();
 
-            std::remove("__TEMP_ASSEMBLED__");
+            std::remove(m_temp_assembled.c_str());
         };
     };
 }
\ No newline at end of file
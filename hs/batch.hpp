@@ -0,0 +1,165 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <atomic>
+
+#include "compiler.hpp"
+
+namespace hs {
+    struct batch_job_t {
+        std::string input;
+        std::string output;
+    };
+
+    class batch_compiler_t {
+        cli_parser_t*               m_cli;
+        error_logger_t*             m_logger;
+        include_cache_t*            m_cache = nullptr;
+        std::vector <batch_job_t>   m_jobs;
+        unsigned int                m_workers = 1;
+        std::atomic <size_t>        m_next_job = 0;
+        std::atomic <bool>          m_failed = false;
+
+        // "a/b/test.hs" -> "a/b/test.out"
+        std::string get_default_output(std::string input) {
+            size_t slash = input.find_last_of("/\\");
+            size_t dot = input.find_last_of('.');
+
+            if ((dot == std::string::npos) || ((slash != std::string::npos) && (dot < slash)))
+                return input + ".out";
+
+            return input.substr(0, dot) + ".out";
+        }
+
+        void add_job(std::string input, std::string output = "") {
+            if (!output.size())
+                output = get_default_output(input);
+
+            m_jobs.push_back({ input, output });
+        }
+
+        bool parse_manifest(std::string path) {
+            std::ifstream file(path);
+
+            if (!(file.is_open() && file.good())) {
+                m_logger->print_error("hs", fmt("Couldn't open batch manifest \"%s\"", path.c_str()), 0, 0, 0, false, true);
+
+                return false;
+            }
+
+            std::string line;
+
+            while (std::getline(file, line)) {
+                std::istringstream iss(line);
+                std::string input, output;
+
+                iss >> input >> output;
+
+                // Skip empty lines and comments
+                if (!input.size() || (input[0] == '#'))
+                    continue;
+
+                add_job(input, output);
+            }
+
+            return true;
+        }
+
+        void worker() {
+            size_t i;
+
+            while ((i = m_next_job++) < m_jobs.size()) {
+                compiler_t compiler;
+
+                compiler.set_include_cache(m_cache);
+
+                if (!compiler.init(*m_cli, m_jobs[i].input, m_jobs[i].output)) {
+                    m_failed = true;
+
+                    continue;
+                }
+
+                if (!compiler.compile())
+                    m_failed = true;
+            }
+        }
+
+    public:
+        bool init(cli_parser_t* cli, error_logger_t* logger, include_cache_t* cache = nullptr) {
+            m_cli = cli;
+            m_logger = logger;
+            m_cache = cache;
+
+            if (m_cli->get_switch(SW_STDIN) || m_cli->get_switch(SW_STDOUT) || m_cli->get_switch(SW_STDIO)) {
+                m_logger->print_error("hs", "Can't use standard I/O when compiling multiple inputs", 0, 0, 0, false, true);
+
+                return false;
+            }
+
+            if (m_cli->is_set(ST_BATCH)) {
+                if (!parse_manifest(m_cli->get_setting(ST_BATCH)))
+                    return false;
+            }
+
+            for (std::string& input : m_cli->get_inputs())
+                add_job(input);
+
+            // A single output file only makes sense for a single job
+            if (m_cli->is_set(ST_OUTPUT)) {
+                if (m_jobs.size() > 1) {
+                    m_logger->print_error("hs", "Can't specify an output file when compiling multiple inputs", 0, 0, 0, false, true);
+
+                    return false;
+                }
+
+                for (batch_job_t& job : m_jobs)
+                    job.output = m_cli->get_setting(ST_OUTPUT);
+            }
+
+            if (!m_jobs.size()) {
+                m_logger->print_error("hs", "No input files", 0, 0, 0, false, true);
+
+                return false;
+            }
+
+            if (m_cli->is_set(ST_JOBS)) {
+                int jobs = std::atoi(m_cli->get_setting(ST_JOBS).c_str());
+
+                if (jobs < 0) {
+                    m_logger->print_error("hs", fmt("Invalid number of jobs \"%s\"", m_cli->get_setting(ST_JOBS).c_str()), 0, 0, 0, false, true);
+
+                    return false;
+                }
+
+                m_workers = jobs ? jobs : std::thread::hardware_concurrency();
+            }
+
+            if (!m_workers)
+                m_workers = 1;
+
+            if (m_workers > m_jobs.size())
+                m_workers = m_jobs.size();
+
+            return true;
+        }
+
+        bool compile() {
+            std::vector <std::thread> workers;
+
+            // The calling thread works too
+            for (unsigned int i = 1; i < m_workers; i++)
+                workers.push_back(std::thread(&batch_compiler_t::worker, this));
+
+            worker();
+
+            for (std::thread& t : workers)
+                t.join();
+
+            return !m_failed;
+        }
+    };
+}
@@ -0,0 +1,389 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <filesystem>
+#include <unordered_map>
+
+#include "sha256.hpp"
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#endif
+
+namespace hs {
+    // Content-addressed cache of compiler outputs, keyed by a SHA-256
+    // of the preprocessed source and everything else that affects
+    // the output (target, format, translator/assembler options and
+    // the compiler build itself).
+    //
+    // Every entry is a pair of files on the cache directory:
+    //   <dir>/<xx>/<hash>.out  Output binary
+    //   <dir>/<xx>/<hash>.s    Translated assembly
+    //
+    // Entries are touched when used, eviction removes the least
+    // recently used entries first
+    class output_cache_t {
+        std::filesystem::path m_dir;
+
+        uintmax_t m_limit = 256 * 1024 * 1024;
+
+        bool m_enabled = false;
+
+        // <dir>/stats holds "<hits> <misses> <size>", shared by all
+        // compilations on this process (i.e. batch workers) and
+        // other processes through <dir>/stats.lock. Hits and misses
+        // are counted in memory and added by flush_stats(), size is
+        // kept up to date by store() so it only has to scan the
+        // directory when the cache goes over its limit
+        struct counters_t {
+            std::atomic <uint64_t> hits = 0, misses = 0;
+        };
+
+        static inline std::mutex m_stats_lock;
+        static inline std::atomic <int> m_temp_counter = 0;
+
+        // Keyed by directory, nodes don't move so m_counters stays valid
+        static inline std::mutex m_pending_lock;
+        static inline std::unordered_map <std::string, counters_t> m_pending;
+
+        counters_t* m_counters = nullptr;
+
+        // Entries are trusted on their name alone, so this has to be
+        // collision resistant
+        sha256_t m_hash;
+
+        std::filesystem::path get_entry_path(std::string key, std::string ext) {
+            return m_dir / key.substr(0, 2) / (key + ext);
+        }
+
+        static int get_process_id() {
+#ifdef _WIN32
+            return _getpid();
+#else
+            return getpid();
+#endif
+        }
+
+        // Holds the in-process lock and an exclusive lock on
+        // <dir>/stats.lock for as long as it's alive
+        class stats_lock_t {
+            std::lock_guard <std::mutex> m_guard;
+
+            int m_fd = -1;
+
+        public:
+            stats_lock_t(std::filesystem::path dir) : m_guard(m_stats_lock) {
+#ifndef _WIN32
+                m_fd = open((dir / "stats.lock").c_str(), O_RDWR | O_CREAT, 0644);
+
+                if (m_fd >= 0) flock(m_fd, LOCK_EX);
+#endif
+            }
+
+            ~stats_lock_t() {
+#ifndef _WIN32
+                if (m_fd >= 0) close(m_fd);
+#endif
+            }
+        };
+
+        // Size is -1 if the file doesn't have it yet
+        static void read_stats(std::filesystem::path dir, uint64_t& hits, uint64_t& misses, intmax_t& size) {
+            std::ifstream file(dir / "stats");
+
+            hits = misses = 0;
+
+            file >> hits >> misses;
+
+            if (!(file >> size)) size = -1;
+        }
+
+        static void write_stats(std::filesystem::path dir, uint64_t hits, uint64_t misses, intmax_t size) {
+            write_file(dir / "stats", std::to_string(hits) + " " + std::to_string(misses) + " " + std::to_string(size) + "\n");
+        }
+
+        static uintmax_t get_size(std::filesystem::path path) {
+            std::error_code ec;
+
+            uintmax_t size = std::filesystem::file_size(path, ec);
+
+            return ec ? 0 : size;
+        }
+
+        // Write to a temporary file first so other compilations
+        // never see partially written entries. Temporary names are
+        // unique across processes sharing the cache directory
+        static bool write_file(std::filesystem::path path, const std::string& data) {
+            std::error_code ec;
+
+            std::filesystem::create_directories(path.parent_path(), ec);
+
+            std::filesystem::path temp = path;
+
+            temp += "." + std::to_string(get_process_id()) + "." + std::to_string(m_temp_counter++) + ".tmp";
+
+            {
+                std::ofstream file(temp, std::ios::binary);
+
+                if (!(file.is_open() && file.good())) return false;
+
+                file.write(data.data(), data.size());
+
+                if (!file.good()) return false;
+            }
+
+            std::filesystem::rename(temp, path, ec);
+
+            if (ec) std::filesystem::remove(temp, ec);
+
+            return !ec;
+        }
+
+        bool read_file(std::filesystem::path path, std::string& data) {
+            std::ifstream file(path, std::ios::binary);
+
+            if (!(file.is_open() && file.good())) return false;
+
+            std::ostringstream ss;
+
+            ss << file.rdbuf();
+
+            data = ss.str();
+
+            return true;
+        }
+
+        // Both files of an entry, path doesn't include the extension
+        struct entry_info_t {
+            std::filesystem::path path;
+            std::filesystem::file_time_type time;
+            uintmax_t size = 0;
+        };
+
+        std::vector <entry_info_t> get_entries(uintmax_t* total) {
+            std::vector <entry_info_t> entries;
+            std::unordered_map <std::string, size_t> index;
+            std::error_code ec;
+
+            *total = 0;
+
+            for (auto& entry : std::filesystem::recursive_directory_iterator(m_dir, ec)) {
+                if (!entry.is_regular_file(ec)) continue;
+
+                std::string ext = entry.path().extension().string();
+
+                if ((ext != ".out") && (ext != ".s")) continue;
+
+                std::filesystem::path path = entry.path();
+
+                path.replace_extension();
+
+                auto it = index.find(path.string());
+
+                if (it == index.end()) {
+                    it = index.insert({ path.string(), entries.size() }).first;
+
+                    entries.push_back({ path, entry.last_write_time(ec), 0 });
+                }
+
+                entry_info_t& info = entries[it->second];
+
+                uintmax_t size = entry.file_size(ec);
+
+                // Both files are touched together, use the newest
+                info.time = std::max(info.time, entry.last_write_time(ec));
+                info.size += size;
+
+                *total += size;
+            }
+
+            return entries;
+        }
+
+        // Returns the size of what's left
+        uintmax_t evict() {
+            uintmax_t total;
+
+            std::vector <entry_info_t> entries = get_entries(&total);
+
+            if (total <= m_limit) return total;
+
+            std::sort(entries.begin(), entries.end(), [](const entry_info_t& a, const entry_info_t& b) {
+                return a.time < b.time;
+            });
+
+            // Leave some room so we don't evict on every store
+            uintmax_t target = m_limit - (m_limit / 10);
+
+            for (entry_info_t& info : entries) {
+                if (total <= target) break;
+
+                std::error_code ec;
+
+                std::filesystem::path out = info.path, assembly = info.path;
+
+                out += ".out";
+                assembly += ".s";
+
+                // Output goes first, entries without it are misses
+                std::filesystem::remove(out, ec);
+                std::filesystem::remove(assembly, ec);
+
+                total -= info.size;
+            }
+
+            return total;
+        }
+
+    public:
+        static std::string get_default_dir() {
+            const char* xdg = std::getenv("XDG_CACHE_HOME");
+            const char* home = std::getenv("HOME");
+
+            if (xdg && *xdg) return std::string(xdg) + "/hs";
+            if (home && *home) return std::string(home) + "/.cache/hs";
+
+            return ".hs-cache";
+        }
+
+        void init(std::string dir, uintmax_t limit) {
+            m_dir = dir;
+            m_limit = limit;
+            m_enabled = true;
+
+            std::lock_guard <std::mutex> guard(m_pending_lock);
+
+            m_counters = &m_pending[m_dir.string()];
+        }
+
+        // Adds the hits and misses counted by this process to each
+        // cache's stats file, call once it's done compiling
+        static void flush_stats() {
+            std::lock_guard <std::mutex> guard(m_pending_lock);
+
+            for (auto& [dir, counters] : m_pending) {
+                uint64_t hits = counters.hits.exchange(0), misses = counters.misses.exchange(0);
+
+                if (!(hits || misses))
+                    continue;
+
+                std::error_code ec;
+
+                std::filesystem::create_directories(dir, ec);
+
+                stats_lock_t lock(dir);
+
+                uint64_t total_hits, total_misses;
+                intmax_t size;
+
+                read_stats(dir, total_hits, total_misses, size);
+                write_stats(dir, total_hits + hits, total_misses + misses, size);
+            }
+        }
+
+        bool is_enabled() {
+            return m_enabled;
+        }
+
+        // Fields are length-prefixed so different splits of the
+        // same bytes don't collide
+        void add_key(const std::string& str) {
+            uint64_t size = str.size();
+
+            m_hash.update(&size, sizeof(size));
+            m_hash.update(str.data(), str.size());
+        }
+
+        // Only valid once, after all fields were added
+        std::string get_key() {
+            return m_hash.get_digest();
+        }
+
+        bool load(std::string key, std::string& output, std::string& assembly) {
+            bool hit = read_file(get_entry_path(key, ".out"), output) &&
+                       read_file(get_entry_path(key, ".s"), assembly);
+
+            (hit ? m_counters->hits : m_counters->misses)++;
+
+            if (hit) {
+                std::error_code ec;
+
+                auto now = std::filesystem::file_time_type::clock::now();
+
+                std::filesystem::last_write_time(get_entry_path(key, ".out"), now, ec);
+                std::filesystem::last_write_time(get_entry_path(key, ".s"), now, ec);
+            }
+
+            return hit;
+        }
+
+        void store(std::string key, const std::string& output, const std::string& assembly) {
+            // Another compilation might have stored it already
+            intmax_t replaced = get_size(get_entry_path(key, ".s")) + get_size(get_entry_path(key, ".out"));
+
+            if (!write_file(get_entry_path(key, ".s"), assembly)) return;
+            if (!write_file(get_entry_path(key, ".out"), output)) return;
+
+            stats_lock_t lock(m_dir);
+
+            uint64_t hits, misses;
+            intmax_t size;
+
+            read_stats(m_dir, hits, misses, size);
+
+            if (size < 0) {
+                size = evict();
+            } else {
+                size = std::max((intmax_t)0, size + (intmax_t)(output.size() + assembly.size()) - replaced);
+
+                if ((uintmax_t)size > m_limit)
+                    size = evict();
+            }
+
+            write_stats(m_dir, hits, misses, size);
+        }
+
+        void print_stats(std::ostream& out) {
+            uint64_t hits = 0, misses = 0;
+            uintmax_t total;
+
+            {
+                intmax_t size;
+
+                read_stats(m_dir, hits, misses, size);
+            }
+
+            std::vector <entry_info_t> entries = get_entries(&total);
+
+            size_t count = entries.size();
+
+            double rate = (hits + misses) ? ((100.0 * hits) / (hits + misses)) : 0.0;
+
+            std::ostringstream ss;
+
+            ss << "Cache directory:  " << m_dir.string() << "\n"
+               << "Entries:          " << count << "\n"
+               << "Size:             " << std::fixed << std::setprecision(1) << (total / 1024.0) << " KiB\n"
+               << "Size limit:       " << std::fixed << std::setprecision(1) << (m_limit / 1024.0) << " KiB\n"
+               << "Hits:             " << hits << "\n"
+               << "Misses:           " << misses << "\n"
+               << "Hit rate:         " << std::fixed << std::setprecision(1) << rate << "%\n";
+
+            out << ss.str();
+        }
+    };
+}
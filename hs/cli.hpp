@@ -33,7 +33,18 @@ namespace hs {
         SW_STDOUT,
         SW_STDIO,
         SW_PRINT_SUCCESS,
-        SW_OUTPUT_SYMBOLS
+        SW_OUTPUT_SYMBOLS,
+        SW_TIME_REPORT,
+        SW_SERVER,
+        SW_CLIENT,
+        SW_CACHE,
+        SW_CACHE_STATS,
+        SW_STREAMING,
+        SW_PRECOMPILE,
+        SW_BENCH_LEXER,
+        SW_INTEGRATED_PP,
+        SW_BENCH_AST,
+        SW_DEBUG_PASSES
     };
 
     enum cli_setting_t {
@@ -45,7 +56,16 @@ namespace hs {
         ST_SYSTEM_INCLUDE,
         ST_XLAT,
         ST_XASM,
-        ST_HELP_TARGET
+        ST_HELP_TARGET,
+        ST_JOBS,
+        ST_BATCH,
+        ST_TRACE,
+        ST_SOCKET,
+        ST_CACHE_DIR,
+        ST_CACHE_SIZE,
+        ST_CTFE_STEPS,
+        ST_OPT_LEVEL,
+        ST_PASSES
     };
 
     class cli_parser_t {
@@ -58,6 +78,8 @@ namespace hs {
         std::unordered_map <cli_setting_t, std::string> m_settings;
         std::unordered_map <cli_switch_t , bool>        m_switches;
 
+        std::vector <std::string> m_inputs;
+
 #define WSHORTHAND(shortname, longname, st) \
     { shortname, st }, \
     { longname , st }
@@ -83,6 +105,17 @@ namespace hs {
             LONG_ONLY (      "--stdout"              , SW_STDOUT             ),
             LONG_ONLY (      "--stdio"               , SW_STDIO              ),
             LONG_ONLY (      "--print-success"       , SW_PRINT_SUCCESS      ),
+            LONG_ONLY (      "--time-report"         , SW_TIME_REPORT        ),
+            LONG_ONLY (      "--server"              , SW_SERVER             ),
+            LONG_ONLY (      "--client"              , SW_CLIENT             ),
+            LONG_ONLY (      "--cache"               , SW_CACHE              ),
+            LONG_ONLY (      "--cache-stats"         , SW_CACHE_STATS        ),
+            LONG_ONLY (      "--streaming"           , SW_STREAMING          ),
+            LONG_ONLY (      "--precompile"          , SW_PRECOMPILE         ),
+            LONG_ONLY (      "--bench-lexer"         , SW_BENCH_LEXER        ),
+            LONG_ONLY (      "--integrated-pp"       , SW_INTEGRATED_PP      ),
+            LONG_ONLY (      "--bench-ast"           , SW_BENCH_AST          ),
+            LONG_ONLY (      "--debug-passes"        , SW_DEBUG_PASSES       ),
         };
 
         std::unordered_map <std::string, cli_setting_t> m_settings_map = {
@@ -94,7 +127,15 @@ namespace hs {
             LONG_ONLY (      "--Xlat"                , ST_XLAT               ),
             LONG_ONLY (      "--Xasm"                , ST_XASM               ),
             LONG_ONLY (      "--system-include"      , ST_SYSTEM_INCLUDE     ),
-            LONG_ONLY (      "--help-target"         , ST_HELP_TARGET        )
+            LONG_ONLY (      "--help-target"         , ST_HELP_TARGET        ),
+            WSHORTHAND("-j", "--jobs"                , ST_JOBS               ),
+            LONG_ONLY (      "--batch"               , ST_BATCH              ),
+            LONG_ONLY (      "--trace"               , ST_TRACE              ),
+            LONG_ONLY (      "--socket"              , ST_SOCKET             ),
+            LONG_ONLY (      "--cache-dir"           , ST_CACHE_DIR          ),
+            LONG_ONLY (      "--cache-size"          , ST_CACHE_SIZE         ),
+            LONG_ONLY (      "--ctfe-steps"          , ST_CTFE_STEPS         ),
+            LONG_ONLY (      "--passes"              , ST_PASSES             )
         };
 
 #undef WSHORTHAND
@@ -107,6 +148,12 @@ namespace hs {
             m_logger = logger;
         }
 
+        // Parsers are copied over to each job's compiler in batch
+        // mode, errors should go to that compiler's logger
+        void set_logger(error_logger_t* logger) {
+            m_logger = logger;
+        }
+
         bool get_switch(cli_switch_t sw) {
             return m_switches.contains(sw);
         }
@@ -115,8 +162,19 @@ namespace hs {
             return m_settings.contains(st);
         }
 
+        // Doesn't insert, unset settings would show up in is_set()
         std::string get_setting(cli_setting_t st) {
-            return m_settings[st];
+            auto it = m_settings.find(st);
+
+            return (it != m_settings.end()) ? it->second : "";
+        }
+
+        void set_setting(cli_setting_t st, std::string value) {
+            m_settings[st] = value;
+        }
+
+        std::vector <std::string>& get_inputs() {
+            return m_inputs;
         }
 
         bool parse() {
@@ -141,13 +199,25 @@ namespace hs {
                     continue;
                 }
 
-                if (m_settings.contains(ST_INPUT)) {
-                    ERROR(fmt("Unknown setting \"%s\"", arg.c_str()));
-                } else {
-                    m_settings[ST_INPUT] = arg;
+                // -O<level> takes its argument without a space, like
+                // other compilers. Validated by compiler_t
+                if (arg.starts_with("-O")) {
+                    m_settings[ST_OPT_LEVEL] = arg.size() > 2 ? arg.substr(2) : "1";
+
+                    continue;
                 }
+
+                m_inputs.push_back(arg);
             }
 
+            // Inputs passed with -i go first, the first input is
+            // the one compiled when not in batch mode
+            if (m_settings.contains(ST_INPUT))
+                m_inputs.insert(m_inputs.begin(), m_settings[ST_INPUT]);
+
+            if (m_inputs.size())
+                m_settings[ST_INPUT] = m_inputs[0];
+
             return true;
         }
     };
@@ -8,6 +8,10 @@
 #include <string>
 #include <cctype>
 #include <stack>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <cstdio>
 
 #include "lexer/lexer.hpp"
 #include "parser/parser.hpp"
@@ -15,9 +19,14 @@
 #include "preprocessor/preprocessor.hpp"
 #include "ir/generator.hpp"
 #include "ir/instruction.hpp"
+#include "ir/passes/manager.hpp"
+#include "ir/allocator.hpp"
 #include "ir/translators/translator.hpp"
 #include "assembler/assembler.hpp"
 #include "cli.hpp"
+#include "report.hpp"
+#include "cache.hpp"
+#include "pipeline.hpp"
 
 // IR Translators
 #include "ir/translators/hv1.hpp"
@@ -58,8 +67,12 @@ namespace hs {
         "This is free software; see the source for copying conditions.  There is NO\n"
         "warranty; not even for MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.\n";
     
+    // Compiler builds can't share cached outputs
+    static std::string m_cache_version_text =
+        STR(HS_VERSION) "-" STR(HS_COMMIT_HASH) " " __DATE__ " " __TIME__;
+
     static std::string m_help_text =
-        "Usage: hs [options] file\n"
+        "Usage: hs [options] file...\n"
         "Options:\n"
         "  -i, --input <file>        Specify an input file\n"
         "  -o, --output <file>       Specify an output file (extension doesn't specify\n"
@@ -79,13 +92,16 @@ namespace hs {
         "  -V, --verbose             Display maximal/all information output\n"
         "  -a, --assemble            Assemble input using the target's assembler\n"
         "  -L, --log                 Log compiler information output to a file (a.log)\n"
-        "  -A, --output-assembly     Output source's assembly to a file (a.s)\n"
+        "  -A, --output-assembly     Output source's assembly to a file (a.s,\n"
+        "                            <output>.s for each input in batch mode)\n"
         "  -S, --output-symbols      Output source's symbols to a file (a.sym)\n"
         "      --only-symbols        Only output a.sym\n"
         "      --help                Display this information\n"
         "      --debug-lexer         Display lexer debugging information\n"
         "      --debug-parser        Display parser debugging information\n"
         "      --debug-ir            Display IR generator debugging information\n"
+        "      --debug-passes        Display the time taken by each IR pass and the\n"
+        "                            number of instructions it removed\n"
         "      --debug-irt           Display target's IR translator debugging\n"
         "                            information\n"
         "      --debug-all           Display debugging information from all stages\n"
@@ -93,6 +109,54 @@ namespace hs {
         "      --stdout              Compile output to stdout\n"
         "      --stdio               Get input stream from stdin and compile output to\n"
         "                            stdout\n"
+        "  -j, --jobs <n>            Compile multiple inputs using n parallel jobs\n"
+        "                            (default 1, 0 uses one job per CPU core)\n"
+        "      --batch <file>        Compile the inputs listed in a manifest file, one\n"
+        "                            \"input [output]\" pair per line\n"
+        "      --time-report         Display time, peak memory and work done by each\n"
+        "                            compilation stage\n"
+        "      --server              Run a compile server, keeping preprocessed\n"
+        "                            includes in memory between compilations\n"
+        "      --client              Compile on a running server, falls back to\n"
+        "                            compiling locally if there's no server\n"
+        "      --socket <path>       Server socket path (default\n"
+        "                            $XDG_RUNTIME_DIR/hs.sock or /tmp/hs-<uid>/hs.sock)\n"
+        "      --cache               Reuse outputs of previous compilations of the same\n"
+        "                            preprocessed source and options\n"
+        "      --cache-dir <path>    Cache directory, implies --cache (default\n"
+        "                            ~/.cache/hs)\n"
+        "      --cache-size <MiB>    Maximum cache size (default 256)\n"
+        "      --cache-stats         Display cache statistics\n"
+        "      --ctfe-steps <n>      Maximum number of expressions evaluated when\n"
+        "                            running a call with constant arguments at\n"
+        "                            compile time (default 100000, 0 disables it)\n"
+        "  -O<level>                 Optimize the IR, 0 runs no passes, 1 keeps\n"
+        "                            locals in registers, removes redundant moves\n"
+        "                            and dead code and runs the peephole optimizer,\n"
+        "                            2 also removes unreachable functions (default\n"
+        "                            0, -O is -O1)\n"
+        "      --passes <pass,pass,...>\n"
+        "                            Run these IR passes in order instead of the\n"
+        "                            ones picked by -O (mem2reg, redundant-moves,\n"
+        "                            dead-code, peephole, dead-functions)\n"
+        "      --trace <file>        Write a Chrome trace of the compilation stages and\n"
+        "                            functions to a file (<output>.trace.json for\n"
+        "                            each input in batch mode)\n"
+        "      --precompile          Precompile a header into an image that #include\n"
+        "                            uses while it's up to date (<header>.hpch next\n"
+        "                            to the header, i.e. -o std/string.hpch)\n"
+        "      --streaming           Run the preprocessor, lexer and parser\n"
+        "                            concurrently, passing text and tokens through\n"
+        "                            bounded queues (ignored with --cache and\n"
+        "                            --integrated-pp)\n"
+        "      --bench-lexer         Lex the preprocessed input repeatedly and display\n"
+        "                            the lexer's throughput\n"
+        "      --integrated-pp       Preprocess while lexing instead of on a separate\n"
+        "                            pass, includes are lexed in place and diagnostics\n"
+        "                            point into them (ignored with --cache)\n"
+        "      --bench-ast           Parse the preprocessed input repeatedly and display\n"
+        "                            how long parsing, contextualization and IR\n"
+        "                            generation take\n"
         "\n"
         "Options need to be specified individually (i.e. no \"-VvqaL...\") and\n"
         "arguments to options need to be passed leaving a space between the option\n"
@@ -115,7 +179,7 @@ namespace hs {
         TGT_ARCH_RV64
     };
 
-    std::unordered_map <std::string, target_arch_t> m_target_arch_map = {
+    const std::unordered_map <std::string, target_arch_t> m_target_arch_map = {
           { "hyrisc"  , TGT_ARCH_HV1       },
           { "hyrisc1" , TGT_ARCH_HV1       },
           { "hyriscv1", TGT_ARCH_HV1       },
@@ -151,15 +215,26 @@ namespace hs {
         parser_t                    m_parser;
         contextualizer_t            m_context;
         ir_generator_t              m_irg;
+        ir_pass_manager_t           m_passes;
+        ir_register_allocator_t     m_allocator;
         ir_translator_t*            m_translator;
         assembler_t*                m_assembler;
+        time_report_t               m_report;
+        include_cache_t*            m_include_cache = nullptr;
+        output_cache_t              m_cache;
+        target_arch_t               m_target_arch = TGT_ARCH_HV2;
+        int                         m_exit_code = -1;
         std::ostream*               m_output = nullptr;
-        std::istream*               m_input = nullptr;
-        std::ifstream               m_input_file;
+        source_buffer_t             m_source;
         std::ofstream               m_output_file;
         std::vector <std::string>   m_include_paths = { "." };
         std::string                 m_system_include;
         std::string                 m_filename;
+        std::string                 m_assembly_path = "a.s";
+        token_stream_t              m_tokens;
+        symbol_table_t              m_symbols;
+        arena_t                     m_arena;
+        line_map_t                  m_line_map;
 
         void parse_csv(std::string str, std::vector <std::string>& dest) {
             std::string value;
@@ -202,34 +277,7 @@ namespace hs {
             }
         }
     
-    public:
-        bool init(int argc, const char** argv) {
-            m_cli.init(argc, argv, &m_logger);
-
-            if (!m_cli.parse()) {
-                m_logger.print_error("hs", "compilation terminated", 0, 0, 0, false, true);
-
-                return false;
-            }
-
-            if (m_cli.get_switch(SW_VERSION)) {
-                std::cout << m_version_text << std::endl;
-
-                return false;
-            }
-
-            if (m_cli.get_switch(SW_HELP)) {
-                std::cout << m_help_text << std::endl;
-
-                return false;
-            }
-
-            if (m_cli.is_set(ST_HELP_TARGET)) {
-                std::cout << m_cli.get_setting(ST_HELP_TARGET) << "-specific help unimplemented :(\n" << std::endl;
-
-                return false;
-            }
-
+        bool configure() {
             if (m_cli.is_set(ST_TARGET_ARCH)) {
                 std::string tgt = m_cli.get_setting(ST_TARGET_ARCH);
 
@@ -243,11 +291,11 @@ namespace hs {
                     return false;
                 }
 
-                load_target_specific_code(m_target_arch_map[m_cli.get_setting(ST_TARGET_ARCH)]);
-            } else {
-                load_target_specific_code(TGT_ARCH_HV2);
+                m_target_arch = m_target_arch_map.at(tgt);
             }
 
+            load_target_specific_code(m_target_arch);
+
             if (!m_translator) {
                 m_logger.print_error(
                     "hs",
@@ -284,32 +332,73 @@ namespace hs {
 #endif
             }
 
-            if (m_cli.get_switch(SW_STDIN) || m_cli.get_switch(SW_STDIO)) m_input = &std::cin;
+            if (m_cli.is_set(ST_CTFE_STEPS)) {
+                std::string steps = m_cli.get_setting(ST_CTFE_STEPS);
+
+                if (steps.empty() || (steps.size() > 18) || (steps.find_first_not_of("0123456789") != std::string::npos)) {
+                    m_logger.print_error("hs", fmt("Invalid number of CTFE steps \"%s\"", steps.c_str()), 0, 0, 0, false, true);
+
+                    return false;
+                }
+            }
+
+            if (m_cli.is_set(ST_PASSES)) {
+                std::vector <std::string> passes;
+
+                // parse_csv only takes values followed by a comma
+                parse_csv(m_cli.get_setting(ST_PASSES) + ",", passes);
+
+                for (std::string& pass : passes) {
+                    if (pass.size() && !m_passes.add(pass)) {
+                        m_logger.print_error("hs", fmt("Unknown IR pass \"%s\"", pass.c_str()), 0, 0, 0, false, true);
+
+                        return false;
+                    }
+                }
+            } else if (m_cli.is_set(ST_OPT_LEVEL)) {
+                std::string level = m_cli.get_setting(ST_OPT_LEVEL);
+
+                if ((level.size() != 1) || (level[0] < '0') || (level[0] >= ('0' + (int)m_ir_pass_levels.size()))) {
+                    m_logger.print_error("hs", fmt("Invalid optimization level \"%s\"", level.c_str()), 0, 0, 0, false, true);
+
+                    return false;
+                }
+
+                m_passes.add_level(level[0] - '0');
+            }
+
+            bool has_input = m_cli.get_switch(SW_STDIN) || m_cli.get_switch(SW_STDIO);
+
+            // stdin can't be read twice, read it all at once
+            if (has_input) m_source.read(&std::cin);
+
             if (m_cli.get_switch(SW_STDOUT) || m_cli.get_switch(SW_STDIO)) m_output = &std::cout;
 
-            if (m_cli.is_set(ST_INPUT) && !(m_cli.get_switch(SW_STDIN) || m_cli.get_switch(SW_STDIO))) {
+            if (m_cli.is_set(ST_INPUT) && !has_input) {
                 m_filename = m_cli.get_setting(ST_INPUT);
 
-                m_input_file.open(m_filename, std::ios::binary);
-
-                if (!(m_input_file.is_open() && m_input_file.good())) {
+                if (!m_source.open(m_filename)) {
                     m_logger.print_error("hs", fmt("Couldn't open input file \"%s\"", m_cli.get_setting(ST_INPUT).c_str()), 0, 0, 0, false, true);
                     m_logger.print_error("hs", "compilation terminated", 0, 0, 0, false, true);
 
                     return false;
                 }
 
-                m_input = &m_input_file;
+                has_input = true;
             }
 
-            if (!m_input) {
+            if (!has_input) {
                 m_logger.print_error("hs", "No input files", 0, 0, 0, false, true);
                 m_logger.print_error("hs", "compilation terminated", 0, 0, 0, false, true);
 
                 return false;
             }
 
-            if (m_cli.is_set(ST_OUTPUT) && !(m_cli.get_switch(SW_STDOUT) || m_cli.get_switch(SW_STDIO))) {
+            // Output was already set to stdout above
+            if (m_output)
+                return true;
+
+            if (m_cli.is_set(ST_OUTPUT)) {
                 m_output_file.open(m_cli.get_setting(ST_OUTPUT), std::ios::binary);
 
                 if (!(m_output_file.is_open() && m_output_file.good())) {
@@ -327,41 +416,561 @@ namespace hs {
             return true;
         }
 
-        bool compile() {
-            m_logger.init(m_input, m_filename);
+        bool finish_time_report() {
+            m_report.end();
+
+            if (m_cli.get_switch(SW_TIME_REPORT))
+                m_report.print_table(std::cout, m_filename);
+
+            if (m_cli.is_set(ST_TRACE)) {
+                std::ofstream trace(m_cli.get_setting(ST_TRACE), std::ios::binary);
+
+                if (!(trace.is_open() && trace.good())) {
+                    m_logger.print_error("hs", fmt("Couldn't open trace file \"%s\"", m_cli.get_setting(ST_TRACE).c_str()), 0, 0, 0, false, true);
+
+                    return false;
+                }
+
+                m_report.write_trace(trace);
+            }
+
+            return true;
+        }
+
+        bool init_cache() {
+            if (!(m_cli.get_switch(SW_CACHE) || m_cli.get_switch(SW_CACHE_STATS) || m_cli.is_set(ST_CACHE_DIR)))
+                return true;
+
+            uintmax_t size = 256;
+
+            if (m_cli.is_set(ST_CACHE_SIZE)) {
+                int mib = std::atoi(m_cli.get_setting(ST_CACHE_SIZE).c_str());
+
+                if (mib <= 0) {
+                    m_logger.print_error("hs", fmt("Invalid cache size \"%s\"", m_cli.get_setting(ST_CACHE_SIZE).c_str()), 0, 0, 0, false, true);
+
+                    return false;
+                }
+
+                size = mib;
+            }
+
+            m_cache.init(
+                m_cli.is_set(ST_CACHE_DIR) ? m_cli.get_setting(ST_CACHE_DIR) : output_cache_t::get_default_dir(),
+                size * 1024 * 1024
+            );
+
+            return true;
+        }
+
+        // Debug output of most stages can't be reproduced from a
+        // cached output. Blob contents aren't part of the
+        // preprocessed source either, so sources using blobs
+        // (or anything that looks like one) are never cached
+        bool is_cacheable(const std::string& source) {
+            if (!(m_cli.get_switch(SW_CACHE) || m_cli.is_set(ST_CACHE_DIR)))
+                return false;
+
+            if (m_cli.get_switch(SW_DEBUG_LEXER_OUTPUT) ||
+                m_cli.get_switch(SW_DEBUG_PARSER_OUTPUT) ||
+                m_cli.get_switch(SW_DEBUG_IR_OUTPUT) ||
+                m_cli.get_switch(SW_DEBUG_ALL))
+                return false;
+
+            return source.find("blob") == std::string::npos;
+        }
+
+        // The output cache needs the whole preprocessed source
+        // before lexing
+        bool is_streaming() {
+            if (!m_cli.get_switch(SW_STREAMING) || is_integrated())
+                return false;
+
+            return !(m_cli.get_switch(SW_CACHE) || m_cli.is_set(ST_CACHE_DIR));
+        }
+
+        bool is_integrated() {
+            if (!m_cli.get_switch(SW_INTEGRATED_PP))
+                return false;
+
+            return !(m_cli.get_switch(SW_CACHE) || m_cli.is_set(ST_CACHE_DIR));
+        }
+
+        // Preprocess while lexing, the lexer hands directives and
+        // identifiers to the preprocessor and lexes includes in
+        // place. There's no preprocessed text, so lines are mapped
+        // back to their files for diagnostics instead
+        void parse_integrated() {
+            m_line_map.clear();
+            m_line_map.enter(0, m_line_map.add_file(m_filename, &m_source), 0);
+
+            m_logger.set_line_map(&m_line_map);
+
+            m_hspp.init(m_source.view(), &m_include_paths, m_system_include, &m_logger);
+
+            m_lexer.set_preprocessor(&m_hspp, &m_line_map);
+
+            parse_lazy(m_source.view());
+        }
+
+        // Tokens are dumped as the parser pulls them in, tokens
+        // before from are already out
+        void debug_tokens(const token_buffer_t& tokens, size_t from) {
+            if (!(m_cli.get_switch(SW_DEBUG_LEXER_OUTPUT) || m_cli.get_switch(SW_DEBUG_ALL)))
+                return;
+
+            for (size_t i = from; i < tokens.size(); i++) {
+                hs::lexer_token_t token = tokens[i];
+
+                std::cout << "(" << token.line + 1 << ", " << token.offset + 1 << "): "
+                          << "type: " << hs::lexer_token_type_names[token.type] << ", "
+                          << "text: " << token.text << ")\n";
+            }
+        }
+
+        // Lex as the parser goes, the parser pulls the next few
+        // tokens whenever it runs out. Only those are kept around
+        // instead of the whole file's
+        void parse_lazy(std::string_view source) {
+            if (m_cli.get_switch(SW_DEBUG_LEXER_OUTPUT) || m_cli.get_switch(SW_DEBUG_ALL))
+                _log(debug, "Lexer output:");
+
+            m_lexer.init(source, &m_logger);
+
+            m_lexer.get_output()->set_source([&](token_buffer_t& tokens) {
+                size_t from = tokens.size();
+
+                if (!m_lexer.lex(0x100))
+                    return false;
+
+                debug_tokens(tokens, from);
+
+                return true;
+            });
+
+            m_parser.init(m_lexer.get_output(), &m_logger);
+            m_parser.parse();
+
+            m_report.counter("tokens", m_lexer.get_token_count());
+        }
+
+        // Preprocess, lex and parse concurrently:
+        //
+        //   preprocessor -> text chunks -> lexer -> token batches -> parser
+        //
+        // The preprocessor and lexer get a thread each, the parser
+        // runs on ours. Queues are bounded, so at most a few chunks
+        // of text and batches of tokens are alive at any time
+        void parse_streaming() {
+            m_report.begin("stream");
+
+            text_queue_t text(4);
+            token_queue_t tokens(4);
+
+            text_queue_writer_t writer(&text);
+
+            std::ostream preprocessor_output(&writer);
+
+            std::thread preprocessor([&] {
+                m_hspp.init(m_source.view(), &m_include_paths, m_system_include, &m_logger);
+                m_hspp.set_output(&preprocessor_output);
+                m_hspp.preprocess();
+
+                writer.close();
+            });
+
+            // init() reads the first character, which blocks until
+            // the preprocessor sends something
+            std::thread lexer([&] {
+                m_lexer.set_output(&tokens);
+                m_lexer.init(&text, &m_logger);
+                m_lexer.lex();
+            });
+
+            if (m_cli.get_switch(SW_DEBUG_LEXER_OUTPUT) || m_cli.get_switch(SW_DEBUG_ALL))
+                _log(debug, "Lexer output:");
+
+            // Batches only get appended to an empty buffer when
+            // nobody's peeking
+            m_tokens.set_source([&](token_buffer_t& buffer) {
+                if (buffer.empty()) {
+                    if (!tokens.pop(buffer))
+                        return false;
+
+                    debug_tokens(buffer, 0);
+
+                    return true;
+                }
+
+                token_buffer_t batch;
+
+                if (!tokens.pop(batch))
+                    return false;
+
+                debug_tokens(batch, 0);
+
+                for (size_t i = 0; i < batch.size(); i++)
+                    buffer.push(batch[i]);
+
+                return true;
+            });
+
+            m_parser.init(&m_tokens, &m_logger);
+            m_parser.parse();
+
+            // Stop the other stages if the parser bailed out early
+            tokens.close();
+            text.close();
+
+            lexer.join();
+            preprocessor.join();
+
+            m_report.counter("bytes", writer.get_written());
+            m_report.counter("tokens", m_lexer.get_token_count());
+        }
+
+        bool write_assembly(const std::string& assembly) {
+            if (!m_cli.get_switch(SW_OUTPUT_ASSEMBLY))
+                return true;
+
+            std::ofstream file(m_assembly_path, std::ios::binary);
+
+            if (!(file.is_open() && file.good())) {
+                m_logger.print_error("hs", fmt("Couldn't open assembly output file \"%s\"", m_assembly_path.c_str()), 0, 0, 0, false, true);
+
+                return false;
+            }
+
+            file.write(assembly.data(), assembly.size());
+
+            return true;
+        }
+
+        bool translate(std::string& assembly) {
+            m_report.begin("translate");
+
+            m_translator->init(&m_irg, &m_logger);
+            assembly = m_translator->translate();
+
+            m_report.counter("bytes", assembly.size());
+            m_report.counter("lines", std::count(assembly.begin(), assembly.end(), '\n'));
+            m_report.end();
+
+            if (m_cli.get_switch(SW_DEBUG_IRT_OUTPUT) || m_cli.get_switch(SW_DEBUG_ALL)) {
+                _log(debug, "IR Translator output:");
+
+                std::cout << assembly;
+            }
+
+            return write_assembly(assembly);
+        }
+
+        // Write the input's define map, tokens and AST to a
+        // precompiled header image
+        bool precompile() {
+            if (!m_filename.size()) {
+                m_logger.print_error("hs", "Can't precompile standard input", 0, 0, 0, false, true);
+
+                return false;
+            }
+
+            m_report.begin("preprocess");
+
+            m_hspp.init(m_source.view(), &m_include_paths, m_system_include, &m_logger);
+            m_hspp.preprocess();
+
+            m_report.counter("bytes", m_hspp.get_output()->tellp());
+            m_report.begin("lex");
+
+            m_lexer.init(m_hspp.get_output()->view(), &m_logger);
+            m_lexer.lex();
+
+            m_report.counter("tokens", m_lexer.get_output()->data()->size());
+            m_report.begin("parse");
+
+            m_parser.init(m_lexer.get_output(), &m_logger);
+
+            if (!m_parser.parse() || m_logger.get_diagnostic_count())
+                return false;
+
+            m_report.counter("expressions", m_parser.get_output()->source.size());
+            m_report.begin("write");
+
+            precompiled_contents_t contents;
+            include_dependency_t dep;
+            std::error_code ec;
+
+            std::filesystem::path path = std::filesystem::weakly_canonical(m_filename, ec);
+
+            if (!include_cache_t::get_dependency(ec ? m_filename : path.string(), dep)) {
+                m_logger.print_error("hs", fmt("Couldn't stat \"%s\"", m_filename.c_str()), 0, 0, 0, false, true);
+
+                return false;
+            }
+
+            contents.dependencies.push_back(dep);
+            contents.dependencies.insert(contents.dependencies.end(), m_hspp.get_dependencies()->begin(), m_hspp.get_dependencies()->end());
+            contents.defines.assign(m_hspp.get_define_map()->begin(), m_hspp.get_define_map()->end());
+            contents.tokens = m_lexer.get_output()->data();
+            contents.source = &m_parser.get_output()->source;
+            contents.guard = preprocessor_t::get_include_guard(m_source.view());
+            contents.once = m_hspp.is_once() || contents.guard.size();
+            contents.anonymous_functions = m_parser.get_anonymous_function_count();
+
+            precompiled_writer_t writer;
+
+            writer.write(m_output, contents);
+
+            m_report.counter("output_bytes", std::max((std::streamoff)m_output->tellp(), (std::streamoff)0));
+
+            return finish_time_report();
+        }
+
+        // Lex the preprocessed input repeatedly for about a second
+        // and display the lexer's throughput
+        bool bench_lexer() {
+            m_hspp.init(m_source.view(), &m_include_paths, m_system_include, &m_logger);
+            m_hspp.preprocess();
+
+            if (m_logger.get_diagnostic_count())
+                return false;
+
+            std::string_view text = m_hspp.get_output()->view();
+
+            size_t iterations = 0, tokens = 0;
+
+            auto start = std::chrono::steady_clock::now();
+            std::chrono::duration <double> elapsed;
+
+            do {
+                // Fresh lexer each time, lexers don't reset their
+                // line/offset or output on init
+                lexer_t lexer;
+                symbol_table_t symbols;
+
+                lexer.set_symbols(&symbols);
+                lexer.init(text, &m_logger);
+                lexer.lex();
+
+                tokens = lexer.get_output()->data()->size();
+
+                iterations++;
+
+                elapsed = std::chrono::steady_clock::now() - start;
+            } while ((elapsed.count() < 1.0) || (iterations < 3));
+
+            double seconds = elapsed.count() / iterations;
+
+            // std::cout, the server redirects it to its clients
+            std::cout << fmt("%zu bytes, %zu tokens, %zu iterations\n", text.size(), tokens, iterations);
+            std::cout << fmt("%.3f ms per iteration, %.1f MB/s, %.2f Mtokens/s\n",
+                seconds * 1000.0,
+                (text.size() / seconds) / 1e6,
+                (tokens / seconds) / 1e6
+            );
+
+            return !m_logger.get_diagnostic_count();
+        }
+
+        // Parse the preprocessed input repeatedly for about a second
+        // and display the time spent parsing, contextualizing and
+        // generating IR
+        bool bench_ast() {
+            m_hspp.init(m_source.view(), &m_include_paths, m_system_include, &m_logger);
+            m_hspp.preprocess();
+
+            if (m_logger.get_diagnostic_count())
+                return false;
+
+            std::string_view text = m_hspp.get_output()->view();
+
+            size_t iterations = 0, expressions = 0, nodes = 0;
+
+            std::chrono::duration <double> parse(0), context(0), irgen(0), elapsed;
+
+            auto start = std::chrono::steady_clock::now();
+
+            do {
+                // The contextualizer rewrites names in place, so every
+                // iteration needs a fresh AST
+                lexer_t lexer;
+                parser_t parser;
+                symbol_table_t symbols;
+                arena_t arena;
+                contextualizer_t ctx;
+                ir_generator_t irg;
+
+                lexer.set_symbols(&symbols);
+                parser.set_symbols(&symbols);
+                parser.set_arena(&arena);
+
+                lexer.init(text, &m_logger);
+                lexer.lex();
+
+                auto tp = std::chrono::steady_clock::now();
+
+                parser.init(lexer.get_output(), &m_logger);
+
+                if (!parser.parse() || m_logger.get_diagnostic_count())
+                    return false;
+
+                auto t0 = std::chrono::steady_clock::now();
+
+                ctx.init(&parser, &m_logger);
+                ctx.contextualize();
+
+                auto t1 = std::chrono::steady_clock::now();
+
+                irg.init(&parser, &m_logger, &m_cli);
+                irg.generate();
+
+                auto t2 = std::chrono::steady_clock::now();
+
+                parse += t0 - tp;
+                context += t1 - t0;
+                irgen += t2 - t1;
+
+                expressions = parser.get_output()->source.size();
+                nodes = ctx.m_nodes;
+
+                iterations++;
+
+                elapsed = t2 - start;
+            } while ((elapsed.count() < 1.0) || (iterations < 3));
+
+            std::cout << fmt("%zu expressions, %zu AST nodes, %zu iterations\n", expressions, nodes, iterations);
+            std::cout << fmt("parse %.3f ms, contextualize %.3f ms, irgen %.3f ms per iteration (%.1f ns per node)\n",
+                (parse.count() / iterations) * 1000.0,
+                (context.count() / iterations) * 1000.0,
+                (irgen.count() / iterations) * 1000.0,
+                ((context + irgen).count() / iterations / nodes) * 1e9
+            );
+
+            return !m_logger.get_diagnostic_count();
+        }
+
+        bool compile_impl() {
+            if (m_cli.get_switch(SW_TIME_REPORT) || m_cli.is_set(ST_TRACE)) {
+                m_report.enable();
+
+                m_irg.set_time_report(&m_report);
+                m_passes.set_time_report(&m_report);
+                m_allocator.set_time_report(&m_report);
+                m_translator->set_time_report(&m_report);
+            }
+
+            m_hspp.set_include_cache(m_include_cache);
+            m_hspp.set_use_precompiled(true);
+            m_aspp.set_include_cache(m_include_cache);
+
+            m_lexer.set_symbols(&m_symbols);
+            m_parser.set_symbols(&m_symbols);
+            m_parser.set_arena(&m_arena);
+
+            m_logger.init(&m_source, m_filename);
+
+            if (m_cli.get_switch(SW_PRECOMPILE))
+                return precompile();
+
+            if (m_cli.get_switch(SW_BENCH_LEXER))
+                return bench_lexer();
+
+            if (m_cli.get_switch(SW_BENCH_AST))
+                return bench_ast();
 
             if (m_cli.get_switch(SW_ASSEMBLE)) {
-                m_aspp.init(m_input, &m_include_paths, m_system_include, &m_logger);
+                m_report.begin("preprocess-asm");
+
+                m_aspp.init(m_source.view(), &m_include_paths, m_system_include, &m_logger);
                 m_aspp.preprocess();
 
+                m_report.counter("bytes", m_aspp.get_output()->tellp());
+                m_report.begin("assemble");
+
                 m_assembler->init(m_aspp.get_output(), m_output, &m_logger, &m_cli);
                 m_assembler->assemble();
 
-                return true;
+                m_report.counter("output_bytes", std::max((std::streamoff)m_output->tellp(), (std::streamoff)0));
+
+                return finish_time_report();
             }
-            
-            m_hspp.init(m_input, &m_include_paths, m_system_include, &m_logger);
-            m_hspp.preprocess();
 
-            m_lexer.init(m_hspp.get_output(), &m_logger);
-            m_lexer.lex();
+            std::string cache_key;
 
-            if (m_cli.get_switch(SW_DEBUG_LEXER_OUTPUT) || m_cli.get_switch(SW_DEBUG_ALL)) {
-                _log(debug, "Lexer output:");
+            if (is_integrated()) {
+                m_report.begin("parse");
+
+                parse_integrated();
+            } else if (is_streaming()) {
+                parse_streaming();
+            } else {
+                m_report.begin("preprocess");
+
+                m_hspp.init(m_source.view(), &m_include_paths, m_system_include, &m_logger);
+                m_hspp.preprocess();
+
+                m_report.counter("bytes", m_hspp.get_output()->tellp());
 
-                for (hs::lexer_token_t token : *m_lexer.get_output()) {
-                    std::cout << "(" << token.line + 1 << ", " << token.offset + 1 << "): "
-                              << "type: " << hs::lexer_token_type_names[token.type] << ", "
-                              << "text: " << token.text << ")\n";
+                if (is_cacheable(m_hspp.get_output()->str())) {
+                    m_report.begin("cache");
+
+                    m_cache.add_key(m_cache_version_text);
+                    m_cache.add_key(std::to_string(m_target_arch));
+                    m_cache.add_key(m_cli.get_setting(ST_OUTPUT_FORMAT));
+                    m_cache.add_key(m_cli.get_setting(ST_XLAT));
+                    m_cache.add_key(m_cli.get_setting(ST_XASM));
+                    m_cache.add_key(m_cli.get_setting(ST_CTFE_STEPS));
+                    m_cache.add_key(m_cli.get_setting(ST_OPT_LEVEL));
+                    m_cache.add_key(m_cli.get_setting(ST_PASSES));
+                    m_cache.add_key(m_hspp.get_output()->str());
+
+                    cache_key = m_cache.get_key();
+
+                    std::string output, assembly;
+
+                    if (m_cache.load(cache_key, output, assembly)) {
+                        m_report.counter("hit", 1);
+                        m_report.counter("output_bytes", output.size());
+                        m_report.end();
+
+                        if (m_cli.get_switch(SW_DEBUG_IRT_OUTPUT)) {
+                            _log(debug, "IR Translator output:");
+
+                            std::cout << assembly;
+                        }
+
+                        if (!write_assembly(assembly))
+                            return false;
+
+                        m_output->write(output.data(), output.size());
+
+                        if (!finish_time_report())
+                            return false;
+
+                        if (m_cli.get_switch(SW_PRINT_SUCCESS)) {
+                            _log(ok, "Done compiling");
+                        }
+
+                        return true;
+                    }
+
+                    m_report.counter("hit", 0);
                 }
+
+                m_report.begin("parse");
+
+                parse_lazy(m_hspp.get_output()->view());
             }
 
-            m_parser.init(m_lexer.get_output(), &m_logger);
-            m_parser.parse();
+            m_report.counter("expressions", m_parser.get_output()->source.size());
+            m_report.begin("contextualize");
 
             m_context.init(&m_parser, &m_logger);
             m_context.contextualize();
 
+            m_report.counter("ast_nodes", m_context.m_nodes);
+            m_report.end();
+
             if (m_cli.get_switch(SW_DEBUG_PARSER_OUTPUT) || m_cli.get_switch(SW_DEBUG_ALL)) {
                 _log(debug, "Contextualized parser output:");
 
@@ -370,9 +979,79 @@ namespace hs {
                 }
             }
 
+            m_report.begin("irgen");
+
             m_irg.init(&m_parser, &m_logger, &m_cli);
             m_irg.generate();
 
+            size_t instructions = 0;
+
+            for (std::vector <ir_instruction_t>& f : *m_irg.get_functions())
+                instructions += f.size();
+
+            m_report.counter("instructions", instructions);
+            m_report.counter("arena_bytes", m_arena.get_reserved());
+
+            // Nothing looks at the AST past IR generation, give its
+            // memory back before translating
+            m_parser.get_output()->source.clear();
+            m_arena.release();
+
+            m_report.end();
+
+            if (m_passes.get_pass_count()) {
+                m_report.begin("optimize");
+
+                m_passes.run(&m_irg);
+
+                size_t optimized = 0;
+
+                for (std::vector <ir_instruction_t>& f : *m_irg.get_functions())
+                    optimized += f.size();
+
+                m_report.counter("passes", m_passes.get_pass_count());
+                m_report.counter("instructions", optimized);
+                m_report.end();
+
+                if (m_cli.get_switch(SW_DEBUG_PASSES) || m_cli.get_switch(SW_DEBUG_ALL)) {
+                    _log(debug, "IR passes:");
+
+                    for (ir_pass_stats_t& stats : m_passes.get_stats()) {
+                        std::cout << fmt("  %-18s %10.3f ms %10zu -> %-10zu (%+lld)\n",
+                            stats.name.c_str(),
+                            stats.ms,
+                            stats.before,
+                            stats.after,
+                            (long long)stats.after - (long long)stats.before
+                        );
+
+                        for (auto& c : stats.counters)
+                            std::cout << fmt("    %-16s %10zu\n", c.first.c_str(), c.second);
+                    }
+                }
+            }
+
+            m_report.begin("regalloc");
+
+            if (!m_allocator.init(m_translator->get_registers(), m_irg.get_symbols())) {
+                m_logger.print_error("hs", "Target doesn't have enough registers to allocate", 0, 0, 0, false, true);
+
+                return false;
+            }
+
+            bool allocated = m_allocator.run(*m_irg.get_functions());
+
+            m_report.counter("spilled", m_allocator.get_spilled());
+            m_report.counter("reloads", m_allocator.get_reloads());
+            m_report.counter("stores", m_allocator.get_stores());
+            m_report.end();
+
+            if (!allocated) {
+                m_logger.print_error("hs", m_allocator.get_error(), 0, 0, 0, false, true);
+
+                return false;
+            }
+
             if (m_cli.get_switch(SW_DEBUG_IR_OUTPUT) || m_cli.get_switch(SW_DEBUG_ALL)) {
                 _log(debug, "IR Generator output:");
                 // To-do
@@ -384,34 +1063,61 @@ namespace hs {
                     for (int j = 0; j < function->size(); j++) {
                         ir_instruction_t* instruction = &function->at(j);
 
-                        std::cout << m_ir_mnemonic_map[instruction->opcode] << " ";
-
-                        if (instruction->args[0].size()) std::cout << '\t' << instruction->args[0];
-                        if (instruction->args[1].size()) std::cout << ", " << instruction->args[1];
-                        if (instruction->args[2].size()) std::cout << ", " << instruction->args[2];
-                        if (instruction->args[3].size()) std::cout << ", " << instruction->args[3];
-                        
-                        std::cout << std::endl;
+                        std::cout << print_ir_instruction(m_irg.get_symbols(), *instruction) << std::endl;
                     }
                 }
             }
 
-            m_translator->init(&m_irg, &m_logger);
-            std::string assembly = m_translator->translate();
+            // Assembly is only needed for debugging output, -A and the
+            // output cache. Targets that can encode IR straight to
+            // machine code skip translation otherwise
+            bool need_assembly = m_cli.get_switch(SW_DEBUG_IRT_OUTPUT) ||
+                                 m_cli.get_switch(SW_DEBUG_ALL) ||
+                                 m_cli.get_switch(SW_OUTPUT_ASSEMBLY) ||
+                                 cache_key.size();
 
-            if (m_cli.get_switch(SW_DEBUG_IRT_OUTPUT) || m_cli.get_switch(SW_DEBUG_ALL)) {
-                _log(debug, "IR Translator output:");
+            std::string assembly;
 
-                std::cout << assembly;
+            if (need_assembly && !translate(assembly))
+                return false;
+
+            // Keep a copy of the output for the cache
+            std::stringstream output;
+            std::ostream* out = cache_key.size() ? &output : m_output;
+
+            m_report.begin("encode");
+
+            if (!m_assembler->encode(&m_irg, out, &m_logger, &m_cli)) {
+                if (!need_assembly && !translate(assembly))
+                    return false;
+
+                m_report.begin("preprocess-asm");
+
+                m_aspp.init(assembly, &m_include_paths, m_system_include, &m_logger);
+                m_aspp.preprocess();
+
+                m_report.counter("bytes", m_aspp.get_output()->tellp());
+                m_report.begin("assemble");
+
+                m_assembler->init(m_aspp.get_output(), out, &m_logger, &m_cli);
+                m_assembler->assemble();
             }
 
-            std::stringstream assembly_stream(assembly);
+            if (cache_key.size()) {
+                std::string data = output.str();
+
+                m_output->write(data.data(), data.size());
+
+                // Diagnostics wouldn't be shown again on cache hits
+                if (!m_logger.get_diagnostic_count())
+                    m_cache.store(cache_key, data, assembly);
+            }
 
-            m_aspp.init(&assembly_stream, &m_include_paths, m_system_include, &m_logger);
-            m_aspp.preprocess();
+            // tellp() fails on stdout
+            m_report.counter("output_bytes", std::max((std::streamoff)m_output->tellp(), (std::streamoff)0));
 
-            m_assembler->init(m_aspp.get_output(), m_output, &m_logger, &m_cli);
-            m_assembler->assemble();
+            if (!finish_time_report())
+                return false;
 
             if (m_cli.get_switch(SW_PRINT_SUCCESS)) {
                 _log(ok, "Done compiling");
@@ -419,5 +1125,117 @@ namespace hs {
 
             return true;
         }
+
+    public:
+        bool compile() {
+            try {
+                return compile_impl();
+            } catch (hv2a_error_t& e) {
+                m_exit_code = e.code;
+            }
+
+            return false;
+        }
+
+        // Exit code for a failed compilation
+        int get_exit_code() {
+            return m_exit_code;
+        }
+
+        // Share preprocessed includes with other compilations
+        void set_include_cache(include_cache_t* cache) {
+            m_include_cache = cache;
+        }
+
+        bool init(int argc, const char** argv) {
+            m_cli.init(argc, argv, &m_logger);
+
+            if (!m_cli.parse()) {
+                m_logger.print_error("hs", "compilation terminated", 0, 0, 0, false, true);
+
+                return false;
+            }
+
+            if (m_cli.get_switch(SW_VERSION)) {
+                std::cout << m_version_text << std::endl;
+
+                return false;
+            }
+
+            if (m_cli.get_switch(SW_HELP)) {
+                std::cout << m_help_text << std::endl;
+
+                return false;
+            }
+
+            if (m_cli.is_set(ST_HELP_TARGET)) {
+                std::cout << m_cli.get_setting(ST_HELP_TARGET) << "-specific help unimplemented :(\n" << std::endl;
+
+                return false;
+            }
+
+            if (!init_cache())
+                return false;
+
+            if (m_cli.get_switch(SW_CACHE_STATS) && !m_cli.get_inputs().size()) {
+                print_cache_stats();
+
+                return false;
+            }
+
+            // Each job gets its own compiler, see batch.hpp
+            if (is_batch())
+                return true;
+
+            // Compilation happens on the server, see server.hpp
+            if (is_server() || is_client())
+                return true;
+
+            return configure();
+        }
+
+        // Initialize a batch job, settings are taken from the
+        // main compiler's command line
+        bool init(const cli_parser_t& cli, std::string input, std::string output) {
+            m_cli = cli;
+            m_cli.set_logger(&m_logger);
+            m_cli.get_inputs().clear();
+            m_cli.set_setting(ST_INPUT, input);
+            m_cli.set_setting(ST_OUTPUT, output);
+
+            if (m_cli.is_set(ST_TRACE))
+                m_cli.set_setting(ST_TRACE, output + ".trace.json");
+
+            m_assembly_path = output + ".s";
+
+            if (!init_cache())
+                return false;
+
+            return configure();
+        }
+
+        void print_cache_stats() {
+            m_cache.print_stats(std::cout);
+        }
+
+        bool is_server() {
+            return m_cli.get_switch(SW_SERVER);
+        }
+
+        bool is_client() {
+            return m_cli.get_switch(SW_CLIENT);
+        }
+
+        bool is_batch() {
+            return m_cli.is_set(ST_BATCH) || (m_cli.get_inputs().size() > 1);
+        }
+
+        cli_parser_t* get_cli() {
+            return &m_cli;
+        }
+
+        error_logger_t* get_logger() {
+            return &m_logger;
+        }
     };
 }
\ No newline at end of file
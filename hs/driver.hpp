@@ -0,0 +1,84 @@
+#pragma once
+
+#include "compiler.hpp"
+#include "batch.hpp"
+#include "server.hpp"
+
+namespace hs {
+    static int run(int argc, const char** argv, include_cache_t* cache = nullptr);
+
+    static int run_impl(compiler_t& compiler, int argc, const char** argv, include_cache_t* cache) {
+        if (compiler.is_server()) {
+            server_t server;
+
+            if (!server.init(compiler.get_cli(), compiler.get_logger(), run)) {
+                return -1;
+            }
+
+            server.serve();
+
+            return 0;
+        }
+
+        if (compiler.is_client()) {
+            client_t client;
+
+            int ec;
+
+            client.init(compiler.get_cli(), compiler.get_logger());
+
+            if (client.compile(argc, argv, &ec)) {
+                return ec;
+            }
+
+            // No server running, compile locally instead
+            std::vector <const char*> args;
+
+            for (int i = 0; i < argc; i++) {
+                std::string arg(argv[i]);
+
+                if (arg == "--client") continue;
+                if (arg == "--socket") { i++; continue; }
+
+                args.push_back(argv[i]);
+            }
+
+            return run(args.size(), args.data(), cache);
+        }
+
+        if (compiler.is_batch()) {
+            batch_compiler_t batch;
+
+            if (!batch.init(compiler.get_cli(), compiler.get_logger(), cache)) {
+                return -1;
+            }
+
+            return batch.compile() ? 0 : -1;
+        }
+
+        compiler.set_include_cache(cache);
+
+        if (!compiler.compile()) {
+            return compiler.get_exit_code();
+        }
+
+        return 0;
+    }
+
+    static int run(int argc, const char** argv, include_cache_t* cache) {
+        compiler_t compiler;
+
+        if (!compiler.init(argc, argv)) {
+            return -1;
+        }
+
+        int ec = run_impl(compiler, argc, argv, cache);
+
+        output_cache_t::flush_stats();
+
+        if (compiler.get_cli()->get_switch(SW_CACHE_STATS))
+            compiler.print_cache_stats();
+
+        return ec;
+    }
+}
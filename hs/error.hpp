@@ -1,9 +1,11 @@
 #pragma once
 
 #include "log.hpp"
+#include "source.hpp"
 
 #include <vector>
 #include <string>
+#include <atomic>
 
 namespace hs {
     template <class... Args> static std::string fmt(std::string fmt, Args... args) {
@@ -17,9 +19,16 @@ namespace hs {
     }
 
     struct error_logger_t {
-        std::vector <std::string> m_source;
+        source_buffer_t* m_source = nullptr;
         std::string m_filename = "";
 
+        // Lines are mapped back to their files when set
+        line_map_t* m_line_map = nullptr;
+
+        // Warnings and errors printed so far, stages may run on
+        // separate threads (see --streaming)
+        std::atomic <int> m_diagnostics = 0;
+
         std::string get_error_highlighted_string(std::string str, int start, int end) {
             return str.substr(0, start) + ESCAPE(31;1) + str.substr(start, end - start) + ESCAPE(0) + str.substr(end);
         }
@@ -29,25 +38,50 @@ namespace hs {
         }
 
     public:
-        void init(std::istream* input, std::string filename = "") {
-            while (!input->eof()) {
-                std::string line;
+        void init(source_buffer_t* source, std::string filename = "") {
+            m_source = source;
+            m_filename = filename;
+        }
+
+        void set_line_map(line_map_t* line_map) {
+            m_line_map = line_map;
+        }
+
+        std::string get_line(int line) {
+            return m_source ? std::string(m_source->get_line(line)) : "";
+        }
+
+        // Filename, line and line text for a location
+        void locate(int& line, std::string& filename, std::string& text) {
+            uint32_t file;
+            unsigned int file_line;
 
-                std::getline(*input, line);
+            if (m_line_map && m_line_map->lookup(line, file, file_line)) {
+                line = file_line;
+                filename = m_line_map->get_name(file);
+                text = m_line_map->get_source(file)->get_line(line);
 
-                m_source.push_back(line);
+                return;
             }
 
-            m_filename = filename;
-            
-            input->clear();
-            input->seekg(0);
+            filename = m_filename;
+            text = get_line(line);
+        }
+
+        int get_diagnostic_count() {
+            return m_diagnostics;
         }
 
         void print_warning(std::string module, std::string warn, int line, int col, int len, bool print_hint) {
-            if (m_filename.size()) {
+            m_diagnostics++;
+
+            std::string filename, text;
+
+            locate(line, filename, text);
+
+            if (filename.size()) {
                 _log(warning, "in " ESCAPE(37;1) "%s: " ESCAPE(0) "%s: %s (at " ESCAPE(37;1) "L%u" ESCAPE(0) ", " ESCAPE(37;1) "C%u" ESCAPE(0) ")",
-                    m_filename.c_str(),
+                    filename.c_str(),
                     module.c_str(),
                     warn.c_str(),
                     line + 1,
@@ -64,7 +98,7 @@ namespace hs {
 
             if (!print_hint) return;
 
-            std::string highlighted = get_warning_highlighted_string(m_source[line], col, col + len);
+            std::string highlighted = get_warning_highlighted_string(text, col, col + len);
             std::string marker;
 
             if (col) marker = std::string(col, ' ');
@@ -84,10 +118,16 @@ namespace hs {
         }
 
         void print_error(std::string module, std::string err, int line, int col, int len, bool print_hint = true, bool without_loc_info = false) {
-            if (m_filename.size()) {
+            m_diagnostics++;
+
+            std::string filename, text;
+
+            locate(line, filename, text);
+
+            if (filename.size()) {
                 if (!without_loc_info) { 
                     _log(error, "in " ESCAPE(37;1) "%s: " ESCAPE(0) "%s: %s (at " ESCAPE(37;1) "L%u" ESCAPE(0) ", " ESCAPE(37;1) "C%u" ESCAPE(0) ")",
-                        m_filename.c_str(),
+                        filename.c_str(),
                         module.c_str(),
                         err.c_str(),
                         line + 1,
@@ -95,7 +135,7 @@ namespace hs {
                     );
                 } else {
                     _log(error, "in " ESCAPE(37;1) "%s: " ESCAPE(0) "%s: %s",
-                        m_filename.c_str(),
+                        filename.c_str(),
                         module.c_str(),
                         err.c_str()
                     );
@@ -118,7 +158,7 @@ namespace hs {
 
             if (!print_hint) return;
 
-            std::string highlighted = get_error_highlighted_string(m_source[line], col, col + len);
+            std::string highlighted = get_error_highlighted_string(text, col, col + len);
             std::string marker;
 
             if (col) marker = std::string(col, ' ');
@@ -0,0 +1,562 @@
+#pragma once
+
+#include "passes/pass.hpp"
+#include "passes/cfg.hpp"
+#include "../report.hpp"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace hs {
+    // Linear scan register allocation (Poletto and Sarkar), maps the
+    // generator's virtual registers to the ones the target has (see
+    // ir_translator_t::get_registers) one function at a time.
+    //
+    // Calls and inline assembly might overwrite any register, values
+    // live across them are kept on the stack, as are the ones left
+    // out when more values are live than there are registers. Spill
+    // slots go below the function's frame, whose size is on its
+    // label. The last two target registers are used to load and
+    // store spilled values
+    class ir_register_allocator_t {
+        static constexpr uint32_t m_none = 0xffffffff;
+
+        struct interval_t {
+            uint32_t reg;
+
+            // Instruction n reads its operands at 2n and writes them
+            // at 2n + 1
+            uint32_t start, end;
+
+            // Target register or spill slot
+            uint32_t location = 0;
+
+            bool spilled = false;
+        };
+
+        std::vector <uint32_t> m_registers;
+
+        uint32_t m_scratch[2] = { 0, 0 };
+
+        symbol_table_t* m_symbols = nullptr;
+        time_report_t* m_report = nullptr;
+
+        std::string m_error;
+
+        size_t m_spilled = 0, m_reloads = 0, m_stores = 0;
+
+        std::vector <ir_instruction_t> m_out;
+
+        std::vector <interval_t> m_intervals;
+        std::vector <uint32_t> m_index;
+        std::vector <uint32_t> m_order;
+        std::vector <uint32_t> m_active;
+        std::vector <uint32_t> m_free;
+
+        ir_cfg_t m_cfg;
+
+        // Where each block's registers start in m_gen and m_kill
+        std::vector <size_t> m_gen_begin, m_kill_begin;
+        std::vector <size_t> m_calls;
+
+        // Liveness of registers used in more than one block
+        std::vector <uint32_t> m_stamp;
+        std::vector <uint32_t> m_global;
+        std::vector <uint32_t> m_global_regs;
+        std::vector <uint32_t> m_gen, m_kill;
+        std::vector <uint64_t> m_live_in, m_live_out, m_live;
+
+        static bool is_read(const ir_access_t& a, int k) {
+            return (a.reads & (1 << k)) || !(a.writes & (1 << k));
+        }
+
+        static bool is_written(const ir_access_t& a, int k) {
+            return a.writes & (1 << k);
+        }
+
+        static bool is_virtual_operand(const ir_instruction_t& i, int k) {
+            return (i.types[k] == IO_REGISTER) && is_virtual_register(i.args[k]);
+        }
+
+        void touch(uint32_t reg, uint32_t position) {
+            if (m_index[reg] == m_none) {
+                m_index[reg] = m_intervals.size();
+
+                m_intervals.push_back({ reg, position, position });
+
+                return;
+            }
+
+            interval_t& it = m_intervals[m_index[reg]];
+
+            it.start = std::min(it.start, position);
+            it.end = std::max(it.end, position);
+        }
+
+        // True if a call or inline assembly runs while it's live
+        bool crosses_call(const interval_t& it) {
+            // First one after the interval starts
+            auto c = std::upper_bound(m_calls.begin(), m_calls.end(), it.start / 2);
+
+            return (c != m_calls.end()) && (((*c * 2) + 1) < it.end);
+        }
+
+        // Registers read before being written in some block can be
+        // live across blocks, only those take part in the data flow
+        // analysis. Intervals are then extended over the blocks they
+        // are live through
+        void find_live_ranges(const ir_instruction_t* code) {
+            m_gen.clear();
+            m_kill.clear();
+            m_global_regs.clear();
+
+            std::vector <ir_block_t>& blocks = m_cfg.get_blocks();
+
+            m_gen_begin.resize(blocks.size() + 1);
+            m_kill_begin.resize(blocks.size() + 1);
+
+            for (size_t b = 0; b < blocks.size(); b++) {
+                ir_block_t& block = blocks[b];
+
+                m_gen_begin[b] = m_gen.size();
+                m_kill_begin[b] = m_kill.size();
+
+                for (size_t n = block.begin; n < block.end; n++) {
+                    const ir_instruction_t& i = code[n];
+
+                    ir_access_t a = get_ir_access(i);
+
+                    for (int k = 0; k < 3; k++) {
+                        if (!is_virtual_operand(i, k) || !is_read(a, k))
+                            continue;
+
+                        uint32_t reg = i.args[k];
+
+                        if (m_stamp[reg] == (b + 1))
+                            continue;
+
+                        // Read before being written here
+                        if (m_global[reg] == m_none) {
+                            m_global[reg] = m_global_regs.size();
+                            m_global_regs.push_back(reg);
+                        }
+
+                        m_gen.push_back(reg);
+                        m_stamp[reg] = b + 1;
+                    }
+
+                    for (int k = 0; k < 3; k++) {
+                        if (!is_virtual_operand(i, k) || !is_written(a, k))
+                            continue;
+
+                        if (m_stamp[i.args[k]] != (b + 1))
+                            m_kill.push_back(i.args[k]);
+
+                        m_stamp[i.args[k]] = b + 1;
+                    }
+                }
+            }
+
+            m_gen_begin[blocks.size()] = m_gen.size();
+            m_kill_begin[blocks.size()] = m_kill.size();
+
+            size_t globals = m_global_regs.size();
+
+            if (!globals)
+                return;
+
+            size_t words = (globals + 63) / 64;
+
+            m_live_in.assign(blocks.size() * words, 0);
+            m_live_out.assign(blocks.size() * words, 0);
+            m_live.resize(words);
+
+            for (bool changed = true; changed;) {
+                changed = false;
+
+                for (size_t b = blocks.size(); b--;) {
+                    ir_block_t& block = blocks[b];
+
+                    uint64_t* out = &m_live_out[b * words];
+                    uint64_t* in = &m_live_in[b * words];
+
+                    for (size_t next : block.next) {
+                        if (next == m_ir_no_block)
+                            continue;
+
+                        for (size_t w = 0; w < words; w++)
+                            out[w] |= m_live_in[(next * words) + w];
+                    }
+
+                    std::copy(out, out + words, m_live.begin());
+
+                    for (size_t n = m_kill_begin[b]; n < m_kill_begin[b + 1]; n++) {
+                        uint32_t g = m_global[m_kill[n]];
+
+                        if (g != m_none)
+                            m_live[g / 64] &= ~(1ull << (g % 64));
+                    }
+
+                    for (size_t n = m_gen_begin[b]; n < m_gen_begin[b + 1]; n++) {
+                        uint32_t g = m_global[m_gen[n]];
+
+                        m_live[g / 64] |= 1ull << (g % 64);
+                    }
+
+                    if (!std::equal(m_live.begin(), m_live.end(), in)) {
+                        std::copy(m_live.begin(), m_live.end(), in);
+
+                        changed = true;
+                    }
+                }
+            }
+
+            for (size_t b = 0; b < blocks.size(); b++) {
+                for (size_t w = 0; w < words; w++) {
+                    uint64_t in = m_live_in[(b * words) + w];
+                    uint64_t out = m_live_out[(b * words) + w];
+
+                    for (size_t g = w * 64; (in | out) && (g < globals); g++, in >>= 1, out >>= 1) {
+                        if (in & 1) touch(m_global_regs[g], blocks[b].begin * 2);
+                        if (out & 1) touch(m_global_regs[g], ((blocks[b].end - 1) * 2) + 1);
+                    }
+                }
+            }
+        }
+
+        void spill(interval_t& it) {
+            it.spilled = true;
+
+            m_spilled++;
+        }
+
+        void scan() {
+            m_order.resize(m_intervals.size());
+
+            for (uint32_t n = 0; n < m_intervals.size(); n++)
+                m_order[n] = n;
+
+            std::sort(m_order.begin(), m_order.end(), [this](uint32_t a, uint32_t b) {
+                return m_intervals[a].start < m_intervals[b].start;
+            });
+
+            m_active.clear();
+            m_free.assign(m_registers.rbegin(), m_registers.rend());
+
+            for (uint32_t n : m_order) {
+                interval_t& it = m_intervals[n];
+
+                std::erase_if(m_active, [this, &it](uint32_t a) {
+                    if (m_intervals[a].end >= it.start)
+                        return false;
+
+                    m_free.push_back(m_intervals[a].location);
+
+                    return true;
+                });
+
+                if (crosses_call(it)) {
+                    spill(it);
+
+                    continue;
+                }
+
+                if (m_free.size()) {
+                    it.location = m_free.back();
+
+                    m_free.pop_back();
+                    m_active.push_back(n);
+
+                    continue;
+                }
+
+                // Keep whichever ends first in a register
+                auto last = std::max_element(m_active.begin(), m_active.end(), [this](uint32_t a, uint32_t b) {
+                    return m_intervals[a].end < m_intervals[b].end;
+                });
+
+                if (m_intervals[*last].end > it.end) {
+                    it.location = m_intervals[*last].location;
+
+                    spill(m_intervals[*last]);
+
+                    *last = n;
+                } else {
+                    spill(it);
+                }
+            }
+        }
+
+        // Spilled intervals that don't overlap share a slot, returns
+        // the number of slots
+        uint32_t assign_slots() {
+            m_order.clear();
+
+            for (uint32_t n = 0; n < m_intervals.size(); n++)
+                if (m_intervals[n].spilled)
+                    m_order.push_back(n);
+
+            std::sort(m_order.begin(), m_order.end(), [this](uint32_t a, uint32_t b) {
+                return m_intervals[a].start < m_intervals[b].start;
+            });
+
+            m_active.clear();
+            m_free.clear();
+
+            uint32_t slots = 0;
+
+            for (uint32_t n : m_order) {
+                interval_t& it = m_intervals[n];
+
+                std::erase_if(m_active, [this, &it](uint32_t a) {
+                    if (m_intervals[a].end >= it.start)
+                        return false;
+
+                    m_free.push_back(m_intervals[a].location);
+
+                    return true;
+                });
+
+                if (m_free.size()) {
+                    it.location = m_free.back();
+
+                    m_free.pop_back();
+                } else {
+                    it.location = slots++;
+                }
+
+                m_active.push_back(n);
+            }
+
+            return slots;
+        }
+
+        bool rewrite(const ir_instruction_t* code, size_t size, uint32_t slots) {
+            bool function = is_function_label(m_symbols, code[0]) && (code[0].types[1] == IO_IMMEDIATE);
+
+            if (slots && !function) {
+                m_error = "Code outside of functions needs more registers than the target has";
+
+                return false;
+            }
+
+            uint32_t frame = function ? code[0].args[1] : 0;
+            uint32_t reserved = slots * 4;
+
+            size_t prologue = 1;
+
+            while ((prologue < size) && ((code[prologue].opcode == IR_MISC_BEGIN_INDENT) || (code[prologue].opcode == IR_DEFINE)))
+                prologue++;
+
+            size_t out = m_out.size();
+
+            // FP belongs to the callee from MOV FP, SP to POPR FP
+            bool call = false;
+
+            for (size_t n = 0; n < size; n++) {
+                ir_instruction_t i = code[n];
+
+                ir_access_t a = get_ir_access(i);
+
+                if (reserved && (n == prologue)) {
+                    if ((i.opcode == IR_SUBSP) && (i.types[0] == IO_IMMEDIATE)) {
+                        i.args[0] += reserved;
+                    } else {
+                        m_out.push_back({IR_SUBSP, ir_imm(reserved)});
+                    }
+                }
+
+                if (reserved && (i.opcode == IR_RET)) {
+                    size_t e = m_out.size();
+
+                    while ((e > out) && (m_out[e - 1].opcode == IR_UNDEF))
+                        e--;
+
+                    if ((e > out) && (m_out[e - 1].opcode == IR_ADDSP) && (m_out[e - 1].types[0] == IO_IMMEDIATE)) {
+                        m_out[e - 1].args[0] += reserved;
+                    } else {
+                        m_out.push_back({IR_ADDSP, ir_imm(reserved)});
+                    }
+                }
+
+                uint32_t scratch[3] = { m_none, m_none, m_none };
+                uint32_t stores[3];
+
+                int loads = 0, pending = 0;
+
+                for (int k = 0; k < 3; k++) {
+                    if (!is_virtual_operand(code[n], k))
+                        continue;
+
+                    interval_t& it = m_intervals[m_index[code[n].args[k]]];
+
+                    if (!it.spilled) {
+                        i.args[k] = it.location;
+
+                        continue;
+                    }
+
+                    if (call) {
+                        m_error = "Can't spill registers inside of a call sequence";
+
+                        return false;
+                    }
+
+                    uint32_t offset = frame + ((it.location + 1) * 4);
+
+                    if (is_read(a, k)) {
+                        for (int j = 0; j < k; j++)
+                            if ((code[n].args[j] == code[n].args[k]) && (scratch[j] != m_none) && is_read(a, j))
+                                scratch[k] = scratch[j];
+
+                        if (scratch[k] == m_none) {
+                            scratch[k] = m_scratch[loads++];
+
+                            m_out.push_back({IR_LOADF, ir_reg(scratch[k]), ir_imm(offset), ir_imm(4)});
+
+                            m_reloads++;
+                        }
+                    }
+
+                    if (is_written(a, k)) {
+                        if (scratch[k] == m_none)
+                            scratch[k] = m_scratch[0];
+
+                        stores[pending++] = k;
+                    }
+
+                    i.args[k] = scratch[k];
+                }
+
+                if ((i.opcode == IR_MOV) && (i.args[0] == IR_REG_FP)) call = true;
+                if ((i.opcode == IR_POPR) && (i.args[0] == IR_REG_FP)) call = false;
+
+                // Both ended up in the same register
+                if ((i.opcode == IR_MOV) && (i.args[0] == i.args[1]) && !pending)
+                    continue;
+
+                m_out.push_back(i);
+
+                for (int s = 0; s < pending; s++) {
+                    int k = stores[s];
+
+                    interval_t& it = m_intervals[m_index[code[n].args[k]]];
+
+                    uint32_t address = (scratch[k] == m_scratch[0]) ? m_scratch[1] : m_scratch[0];
+
+                    m_out.push_back({IR_LEAF, ir_reg(address), ir_imm(frame + ((it.location + 1) * 4)), ir_imm(4)});
+                    m_out.push_back({IR_STORE, ir_reg(address), ir_reg(scratch[k])});
+
+                    m_stores++;
+                }
+            }
+
+            return true;
+        }
+
+        bool allocate(const ir_instruction_t* code, size_t size) {
+            uint32_t registers = 0;
+
+            for (size_t n = 0; n < size; n++)
+                for (int k = 0; k < 3; k++)
+                    if (is_virtual_operand(code[n], k))
+                        registers = std::max(registers, code[n].args[k] + 1);
+
+            if (!registers) {
+                m_out.insert(m_out.end(), code, code + size);
+
+                return true;
+            }
+
+            m_intervals.clear();
+            m_calls.clear();
+            m_index.assign(registers, m_none);
+            m_stamp.assign(registers, 0);
+            m_global.assign(registers, m_none);
+
+            for (size_t n = 0; n < size; n++) {
+                ir_access_t a = get_ir_access(code[n]);
+
+                if (a.barrier || a.call)
+                    m_calls.push_back(n);
+
+                for (int k = 0; k < 3; k++) {
+                    if (!is_virtual_operand(code[n], k))
+                        continue;
+
+                    if (is_read(a, k)) touch(code[n].args[k], n * 2);
+                    if (is_written(a, k)) touch(code[n].args[k], (n * 2) + 1);
+                }
+            }
+
+            m_cfg.build(code, size);
+            find_live_ranges(code);
+            scan();
+
+            return rewrite(code, size, assign_slots());
+        }
+
+    public:
+        // The target needs at least three registers
+        bool init(std::vector <uint32_t> registers, symbol_table_t* symbols) {
+            m_symbols = symbols;
+
+            if (registers.size() < 3)
+                return false;
+
+            m_scratch[1] = registers.back(); registers.pop_back();
+            m_scratch[0] = registers.back(); registers.pop_back();
+
+            m_registers = registers;
+
+            return true;
+        }
+
+        void set_time_report(time_report_t* report) {
+            m_report = report;
+        }
+
+        bool run(std::vector <std::vector <ir_instruction_t>>& functions) {
+            for (std::vector <ir_instruction_t>& f : functions) {
+                m_out.clear();
+                m_out.reserve(f.size());
+
+                size_t begin = 0;
+
+                for (size_t n = 1; n <= f.size(); n++) {
+                    if ((n != f.size()) && !is_function_label(m_symbols, f[n]))
+                        continue;
+
+                    if (m_report) m_report->begin_span("regalloc", (f[begin].types[0] == IO_SYMBOL) ? m_symbols->get_name(f[begin].args[0]) : "<code>");
+
+                    bool ok = allocate(&f[begin], n - begin);
+
+                    if (m_report) {
+                        m_report->count(n - begin);
+                        m_report->end_span();
+                    }
+
+                    if (!ok)
+                        return false;
+
+                    begin = n;
+                }
+
+                f.swap(m_out);
+            }
+
+            return true;
+        }
+
+        const std::string& get_error() {
+            return m_error;
+        }
+
+        // Intervals kept on the stack, loads and stores they needed
+        size_t get_spilled() { return m_spilled; }
+        size_t get_reloads() { return m_reloads; }
+        size_t get_stores() { return m_stores; }
+    };
+}
@@ -2,8 +2,10 @@
 
 #include "../parser/expressions/type.hpp"
 #include "../parser/parser.hpp"
+#include "../parser/fold.hpp"
 #include "../error.hpp"
 #include "../cli.hpp"
+#include "../report.hpp"
 
 #include "instruction.hpp"
 
@@ -13,10 +15,31 @@
 #include <cstdint>
 
 namespace hs {
+    // Nodes waiting on their children, the generator keeps its own
+    // stack instead of recursing (see parser_frame_t)
+    struct ir_frame_t {
+        expression_t* expr;
+        int base;
+        bool pointer, inside_fn;
+
+        int state = 0;
+
+        // Register of the first operand, loop number or next child,
+        // depending on the node
+        int a = 0;
+
+        // Register of a condition
+        uint32_t cond = 0;
+
+        // What the last child frame returned
+        uint32_t result = 0;
+    };
+
     class ir_generator_t {
         parser_output_t* m_po;
         error_logger_t* m_logger;
         cli_parser_t* m_cli;
+        time_report_t* m_report = nullptr;
 
         std::vector <ir_instruction_t> m_dummy;
 
@@ -25,6 +48,17 @@ namespace hs {
         std::stack <function_def_t*> m_function_defs;
 
         int m_current_function = 0;
+
+        std::vector <ir_frame_t> m_frames;
+
+        // Returned by frames that are waiting on a child
+        static constexpr uint32_t m_pending = 0xffffffff;
+
+        uint32_t enter(expression_t* expr, int base, bool pointer, bool inside_fn) {
+            m_frames.push_back({ expr, base, pointer, inside_fn });
+
+            return m_pending;
+        }
         
         std::stack <int> m_current_loops;
 
@@ -33,11 +67,11 @@ namespace hs {
             m_blobs = 0;
 
         struct string_t {
-            std::string name, value;
+            symbol_id_t name, value;
         };
 
         struct blob_def_t {
-            std::string name, file;
+            symbol_id_t name, file;
         };
         
         std::vector <string_t> m_pending_strings;
@@ -51,39 +85,76 @@ namespace hs {
             std::string type;
         };
 
-        std::unordered_map <std::string, variable_t> m_dummy_local_map;
+        // Locals by symbol of their qualified name (see contextualizer_t)
+        std::unordered_map <symbol_id_t, variable_t> m_dummy_local_map;
+
+        std::stack <std::unordered_map <symbol_id_t, variable_t>> m_local_maps;
 
-        std::stack <std::unordered_map <std::string, variable_t>> m_local_maps;
+        symbol_table_t* m_symbols;
+        arena_t* m_arena;
+
+        constant_folder_t m_folder;
+        interpreter_t m_interpreter;
 
         std::stack <int> m_current_num_locals;
         std::stack <int> m_current_num_args;
 
-        std::string get_variable_name(std::string str) {
-            return "arg_" + str.substr(str.find_last_of('.') + 1);
+        // Virtual registers are numbered from 0 in every function,
+        // the allocator maps them to the target's registers
+        std::stack <uint32_t> m_current_num_registers;
+
+        // Instructions that depend on the size of the current
+        // function's frame, patched when it ends
+        struct frame_fixups_t {
+            size_t label;
+
+            std::vector <size_t> adjustments;
+        };
+
+        std::stack <frame_fixups_t> m_frame_fixups;
+
+        uint32_t new_register() {
+            return m_current_num_registers.top()++;
+        }
+
+        std::vector <ir_instruction_t>& current_function() {
+            return m_functions.at(m_current_function);
         }
 
-        std::string new_string(std::string str) {
+        symbol_id_t get_variable_name(std::string_view str) {
+            return m_symbols->intern("arg_" + std::string(str.substr(str.find_last_of('.') + 1)));
+        }
+
+        // Literals that don't fit an immediate are passed as text
+        ir_operand_t get_immediate(uint64_t value) {
+            if (value <= 0xffffffff)
+                return ir_imm(value);
+
+            return ir_sym(m_symbols->intern(std::to_string(value)));
+        }
+
+        symbol_id_t new_string(std::string_view str) {
             string_t string;
 
-            string.name = "DS" + std::to_string(m_strings++);
-            string.value = str;
+            string.name = m_symbols->intern("DS" + std::to_string(m_strings++));
+            string.value = m_symbols->intern(str);
 
             m_pending_strings.push_back(string);
 
             return string.name; 
         }
 
-        std::string new_array(array_t arr) {
+        symbol_id_t new_array(array_t arr) {
             m_pending_arrays.push_back(arr);
 
-            return "DA" + std::to_string(m_arrays++);
+            return m_symbols->intern("DA" + std::to_string(m_arrays++));
         }
         
-        std::string new_blob(std::string file) {
+        symbol_id_t new_blob(std::string_view file) {
             blob_def_t blob_def;
 
-            blob_def.file = file;
-            blob_def.name = "DB" + std::to_string(m_blobs++);
+            blob_def.file = m_symbols->intern(file);
+            blob_def.name = m_symbols->intern("DB" + std::to_string(m_blobs++));
 
             m_pending_blobs.push_back(blob_def);
 
@@ -92,18 +163,55 @@ namespace hs {
         
         void begin_function(function_def_t* def) {
             m_current_loops.push(0);
+            m_current_num_registers.push(0);
 
             m_current_function++;
             m_function_defs.push(def);
             m_functions.push_back(m_dummy);
+
+            if (m_report) m_report->begin_span("irgen", m_symbols->get_name(def->symbol));
         }
 
         void append(ir_instruction_t ins) {
-            m_functions.at(m_current_function).push_back(ins);
+            current_function().push_back(ins);
+
+            if (m_report) m_report->count();
+        }
+
+        // SUBSP or ADDSP by the size of the current function's locals
+        void append_frame_adjustment(ir_opcode_t opcode) {
+            m_frame_fixups.top().adjustments.push_back(current_function().size());
+
+            append({opcode, ir_imm(0)});
+        }
+
+        // Function labels carry the size of their frame (arguments,
+        // return address and locals), spill slots go below it.
+        // Adjustments are dropped if there are no locals
+        void patch_frame() {
+            std::vector <ir_instruction_t>& function = current_function();
+            frame_fixups_t& fixups = m_frame_fixups.top();
+
+            uint32_t locals = m_current_num_locals.top() * 4;
+
+            function[fixups.label].args[1] = locals + (m_current_num_args.top() * 4);
+
+            for (size_t n = fixups.adjustments.size(); n--;) {
+                if (locals) {
+                    function[fixups.adjustments[n]].args[0] = locals;
+                } else {
+                    function.erase(function.begin() + fixups.adjustments[n]);
+                }
+            }
+
+            m_frame_fixups.pop();
         }
 
         void end_function() {
+            if (m_report) m_report->end_span();
+
             m_current_loops.pop();
+            m_current_num_registers.pop();
             m_function_defs.pop();
 
             m_current_function--;
@@ -114,49 +222,110 @@ namespace hs {
             return &m_functions;
         }
 
+        // Names of IO_SYMBOL operands
+        symbol_table_t* get_symbols() {
+            return m_symbols;
+        }
+
         void init(parser_t* parser, error_logger_t* logger, cli_parser_t* cli) {
             m_po = parser->get_output();
+            m_symbols = parser->get_symbols();
+            m_arena = parser->get_arena();
+
+            m_folder.init(m_arena, &m_interpreter);
+
+            // Validated by compiler_t
+            if (cli->is_set(ST_CTFE_STEPS))
+                m_interpreter.set_budget(std::stoull(cli->get_setting(ST_CTFE_STEPS)));
 
             m_cli = cli;
             m_logger = logger;
 
             m_functions.resize(1);
+
+            // Code outside of functions
+            m_current_num_registers.push(0);
+        }
+
+        void set_time_report(time_report_t* report) {
+            m_report = report;
         }
 
+        // Run frames until the one entered here returns
         uint32_t generate_impl(expression_t* expr, int base, bool pointer = false, bool inside_fn = false) {
+            size_t bottom = m_frames.size();
+
+            uint32_t result = 0;
+
+            enter(expr, base, pointer, inside_fn);
+
+            while (m_frames.size() > bottom) {
+                ir_frame_t& f = m_frames.back();
+
+                f.result = result;
+
+                uint32_t r = generate_node(f);
+
+                if (r == m_pending)
+                    continue;
+
+                m_frames.pop_back();
+
+                result = r;
+            }
+
+            return result;
+        }
+
+        uint32_t generate_node(ir_frame_t& f) {
+            expression_t* expr = f.expr;
+            int base = f.base;
+            bool pointer = f.pointer;
+            bool inside_fn = f.inside_fn;
+
             switch (expr->get_type()) {
                 case EX_IF_ELSE: {
                     if_else_t* ie = (if_else_t*)expr;
 
-                    int m_this_loop = m_current_loops.top()++;
+                    switch (f.state) {
+                        case 0: {
+                            f.a = m_current_loops.top()++;
+                            f.cond = new_register();
+                            f.state = 1;
+
+                            return enter(ie->cond, f.cond, false, inside_fn);
+                        } break;
+
+                        case 1: {
+                            append({IR_CMPZB, ir_cond(IR_COND_EQ), ir_reg(f.cond), ir_label(f.a, ie->else_expr)});
 
-                    generate_impl(ie->cond, base, false, inside_fn);
+                            f.state = 2;
 
-                    append({IR_CMPZB,
-                        "EQ",
-                        "R" + std::to_string(base),
-                        (ie->else_expr ? "E" : "L") + std::to_string(m_this_loop)
-                    });
+                            return enter(ie->if_expr, base, false, inside_fn);
+                        } break;
 
-                    generate_impl(ie->if_expr, base, false, inside_fn);
+                        case 2: {
+                            if (ie->else_expr) {
+                                append({IR_BRANCH, ir_cond(IR_COND_AL), ir_label(f.a)});
 
-                    if (ie->else_expr) {
-                        append({IR_BRANCH, "AL", "L" + std::to_string(m_this_loop)});
+                                append({IR_LABEL, ir_label(f.a, true)});
 
-                        append({IR_LABEL, "!E" + std::to_string(m_this_loop)});
+                                f.state = 3;
 
-                        generate_impl(ie->else_expr, base, false, inside_fn);
+                                return enter(ie->else_expr, base, false, inside_fn);
+                            }
+                        } break;
                     }
 
-                    append({IR_LABEL, "!L" + std::to_string(m_this_loop)});
+                    append({IR_LABEL, ir_label(f.a)});
                 } break;
                 
                 case EX_STRING_LITERAL: {
                     string_literal_t* sl = (string_literal_t*)expr;
 
-                    std::string label = new_string(sl->str);
+                    symbol_id_t label = new_string(sl->str);
 
-                    append({IR_MOVI, "R" + std::to_string(base), label});
+                    append({IR_MOVI, ir_reg(base), ir_sym(label)});
 
                     return 1;
                 } break;
@@ -164,80 +333,100 @@ namespace hs {
                 case EX_WHILE_LOOP: {
                     while_loop_t* wl = (while_loop_t*)expr;
 
-                    int m_this_loop = m_current_loops.top()++;
+                    switch (f.state) {
+                        case 0: {
+                            f.a = m_current_loops.top()++;
+
+                            // To-do: clean this up
+                            append({IR_LABEL, ir_label(f.a)});
+
+                            f.state = 1;
 
-                    // To-do: clean this up
-                    append({IR_LABEL, "!L" + std::to_string(m_this_loop)});
+                            return enter(wl->condition, base, false, inside_fn);
+                        } break;
 
-                    generate_impl(wl->condition, base, false, inside_fn);
+                        case 1: {
+                            append({IR_CMPZB, ir_cond(IR_COND_EQ), ir_reg(base), ir_label(f.a, true)});
 
-                    append({IR_CMPZB,
-                        "EQ",
-                        "R" + std::to_string(base),
-                        "E" + std::to_string(m_this_loop)
-                    });
+                            f.state = 2;
 
-                    generate_impl(wl->body, base, false, inside_fn);
+                            // The body's value isn't used, keeping it
+                            // out of base keeps base from living
+                            // through the loop
+                            return enter(wl->body, new_register(), false, inside_fn);
+                        } break;
+                    }
 
-                    append({IR_BRANCH, "AL", "L" + std::to_string(m_this_loop)});
+                    append({IR_BRANCH, ir_cond(IR_COND_AL), ir_label(f.a)});
 
-                    append({IR_LABEL, "!E" + std::to_string(m_this_loop)});
+                    append({IR_LABEL, ir_label(f.a, true)});
                 } break;
 
                 case EX_FUNCTION_DEF: {
                     function_def_t* fd = (function_def_t*)expr;
 
-                    begin_function(fd);
+                    if (!f.state) {
+                        begin_function(fd);
 
-                    m_current_num_locals.push(0);
-                    m_current_num_args.push(0);
+                        m_current_num_locals.push(0);
+                        m_current_num_args.push(0);
 
-                    m_local_maps.push(m_dummy_local_map);
+                        m_local_maps.push(m_dummy_local_map);
 
-                    append({IR_LABEL, fd->name});
+                        m_frame_fixups.push({ current_function().size(), {} });
 
-                    append({IR_MISC_BEGIN_INDENT});
+                        append({IR_LABEL, ir_sym(fd->symbol), ir_imm(0)});
 
-                    int arg_frame_pos = 1;
+                        append({IR_MISC_BEGIN_INDENT});
 
-                    for (function_arg_t& arg : fd->args) {
-                        m_current_num_args.top()++;
+                        int arg_frame_pos = 1;
+
+                        for (function_arg_t& arg : fd->args) {
+                            m_current_num_args.top()++;
                         
-                        append({IR_DEFINE, get_variable_name(arg.name), "[fp-" + std::to_string(4 * (arg_frame_pos++)) + "]"});
+                            append({IR_DEFINE, ir_sym(get_variable_name(arg.name)), ir_sym(m_symbols->intern("[fp-" + std::to_string(4 * (arg_frame_pos++)) + "]"))});
 
-                        variable_t var;
+                            variable_t var;
 
-                        var.address = m_current_num_args.top() * 4;
-                        var.type = arg.type;
+                            var.address = m_current_num_args.top() * 4;
+                            var.type = arg.type;
 
-                        m_local_maps.top().insert({arg.name, var});
-                    }
+                            m_local_maps.top().insert({arg.symbol, var});
+                        }
 
-                    variable_t return_address;
+                        variable_t return_address;
 
-                    return_address.address = m_current_num_args.top() * 4;
-                    return_address.type = "u32";
+                        return_address.address = m_current_num_args.top() * 4;
+                        return_address.type = "u32";
 
-                    m_current_num_args.top()++;
+                        m_current_num_args.top()++;
 
-                    m_local_maps.top().insert({"<return_address>", return_address});
+                        m_local_maps.top().insert({m_symbols->intern("<return_address>"), return_address});
 
-                    generate_impl(fd->body, base, false, true);
+                        // Locals are reserved here, they're only known
+                        // once the body is generated
+                        append_frame_adjustment(IR_SUBSP);
 
-                    // Generate return
-                    append({IR_MOV, "A0", "R" + std::to_string(base)});
+                        f.a = new_register();
+                        f.state = 1;
 
-                    if (m_current_num_locals.top()) {
-                        append({IR_ADDSP, std::to_string(m_current_num_locals.top() * 4)});
+                        return enter(fd->body, f.a, false, true);
                     }
 
+                    // Generate return
+                    append({IR_MOV, ir_reg(IR_REG_A0), ir_reg(f.a)});
+
                     for (function_arg_t& arg : fd->args) {
-                        append({IR_UNDEF, get_variable_name(arg.name)});
+                        append({IR_UNDEF, ir_sym(get_variable_name(arg.name))});
                     }
 
+                    append_frame_adjustment(IR_ADDSP);
+
                     append({IR_RET});
                     append({IR_MISC_END_INDENT});
 
+                    patch_frame();
+
                     end_function();
 
                     m_current_num_locals.pop();
@@ -245,7 +434,7 @@ namespace hs {
 
                     m_local_maps.pop();
 
-                    append({IR_MOVI, "R" + std::to_string(base), fd->name});
+                    append({IR_MOVI, ir_reg(base), ir_sym(fd->symbol)});
 
                     return 1;
                 } break;
@@ -253,14 +442,16 @@ namespace hs {
                 case EX_RETURN: {
                     return_expr_t* re = (return_expr_t*)expr;
 
-                    generate_impl(re->value, base, false, true);
-
-                    append({IR_MOV, "A0", "R" + std::to_string(base)});
+                    if (!f.state) {
+                        f.state = 1;
 
-                    if (m_current_num_locals.top()) {
-                        append({IR_ADDSP, std::to_string(m_current_num_locals.top() * 4)});
+                        return enter(re->value, base, false, true);
                     }
 
+                    append({IR_MOV, ir_reg(IR_REG_A0), ir_reg(base)});
+
+                    append_frame_adjustment(IR_ADDSP);
+
                     append({IR_RET});
 
                     return 1;
@@ -275,8 +466,12 @@ namespace hs {
                         return 0;
                     }
 
-                    for (int i = 0; i < eb->block.size(); i++) {
-                        generate_impl(eb->block[i], base, pointer, true);
+                    // f.a is the next expression, only the last one's
+                    // value ends up in base
+                    if ((size_t)f.a < eb->block.size()) {
+                        uint32_t r = ((size_t)(f.a + 1) < eb->block.size()) ? new_register() : base;
+
+                        return enter(eb->block[f.a++], r, pointer, true);
                     }
 
                     return 1;
@@ -285,7 +480,7 @@ namespace hs {
                 case EX_ASM_BLOCK: {
                     asm_block_t* ab = (asm_block_t*)expr;
 
-                    append({IR_PASSTHROUGH, ab->assembly});
+                    append({IR_PASSTHROUGH, ir_sym(m_symbols->intern(ab->assembly))});
 
                     // Possible improvement, account for registers
                     // used within asm block
@@ -295,9 +490,6 @@ namespace hs {
                 case EX_VARIABLE_DEF: {
                     variable_def_t* vd = (variable_def_t*)expr;
 
-                    append({IR_DECSP});
-                    append({IR_MOV, "R" + std::to_string(base), "SP"});
-
                     if (inside_fn) {
                         m_current_num_locals.top()++;
 
@@ -306,7 +498,14 @@ namespace hs {
                         var.address = (m_current_num_locals.top() + m_current_num_args.top()) * 4;
                         var.type = vd->type;
 
-                        m_local_maps.top().insert({vd->name, var});
+                        m_local_maps.top().insert({vd->symbol, var});
+
+                        // Space for locals is reserved when entering
+                        // the function
+                        append({IR_LEAF, ir_reg(base), ir_imm(var.address), ir_imm(get_type_size(var.type))});
+                    } else {
+                        append({IR_DECSP});
+                        append({IR_MOV, ir_reg(base), ir_reg(IR_REG_SP)});
                     }
 
                     return 1;
@@ -315,24 +514,36 @@ namespace hs {
                 case EX_FUNCTION_CALL: {
                     function_call_t* fc = (function_call_t*)expr;
 
-                    int r = generate_impl(fc->addr, base, true, inside_fn);
+                    size_t args = fc->args.size();
 
-                    append({IR_PUSHR, "FP"});
+                    // Arguments go first and the address last, so no
+                    // register but the address is live between setting
+                    // FP and popping it back. f.a is the register of the
+                    // last argument or the address, state the next one
+                    if ((size_t)f.state <= args) {
+                        append({IR_PUSHR, ir_reg(f.state ? (uint32_t)f.a : (uint32_t)IR_REG_FP)});
 
-                    for (expression_t* exp : fc->args) {
-                        generate_impl(exp, base + r, true, inside_fn);
+                        if ((size_t)f.state < args) {
+                            f.a = new_register();
+
+                            return enter(fc->args[f.state++], f.a, true, inside_fn);
+                        }
 
-                        append({IR_PUSHR, "R" + std::to_string(base + r)});
+                        f.a = new_register();
+                        f.state++;
+
+                        return enter(fc->addr, f.a, true, inside_fn);
                     }
 
-                    append({IR_MOV, "FP", "SP"});
-                    append({IR_ADDFP, std::to_string(fc->args.size() * 4)});
+                    append({IR_MOV, ir_reg(IR_REG_FP), ir_reg(IR_REG_SP)});
+                    append({IR_ADDFP, ir_imm(args * 4)});
+
+                    append({IR_CALLR, ir_reg(f.a)});
 
-                    append({IR_CALLR, "R" + std::to_string(base)});
-                    append({IR_MOV, "R" + std::to_string(base), "A0"});
+                    append({IR_MOV, ir_reg(IR_REG_SP), ir_reg(IR_REG_FP)});
+                    append({IR_POPR, ir_reg(IR_REG_FP)});
 
-                    append({IR_MOV, "SP", "FP"});
-                    append({IR_POPR, "FP"});
+                    append({IR_MOV, ir_reg(base), ir_reg(IR_REG_A0)});
 
                     return 1;
                 } break;
@@ -340,7 +551,7 @@ namespace hs {
                 case EX_NUMERIC_LITERAL: {
                     numeric_literal_t* nl = (numeric_literal_t*)expr;
 
-                    append({IR_MOVI, "R" + std::to_string(base), std::to_string(nl->value)});
+                    append({IR_MOVI, ir_reg(base), get_immediate(nl->value)});
 
                     return 1;
                 } break;
@@ -348,34 +559,34 @@ namespace hs {
                 case EX_NAME_REF: {
                     name_ref_t* nr = (name_ref_t*)expr;
 
-                    bool local = m_local_maps.top().contains(nr->name);
+                    bool local = m_local_maps.top().contains(nr->symbol);
 
                     if (local) {
                         if (!pointer) {
                             // If referring by value, then load the value from
                             // stack
 
-                            variable_t var = m_local_maps.top()[nr->name];
+                            variable_t var = m_local_maps.top()[nr->symbol];
 
-                            std::string size = std::to_string(types[var.type]);
+                            uint32_t size = get_type_size(var.type);
 
-                            append({IR_LOADF, "R" + std::to_string(base), std::to_string(var.address), size});
+                            append({IR_LOADF, ir_reg(base), ir_imm(var.address), ir_imm(size)});
                         } else {
-                            variable_t var = m_local_maps.top()[nr->name];
+                            variable_t var = m_local_maps.top()[nr->symbol];
 
-                            std::string size = std::to_string(types[var.type]);
+                            uint32_t size = get_type_size(var.type);
 
                             // Else, load the address in stack 
-                            append({IR_LEAF, "R" + std::to_string(base), std::to_string(var.address), size});
+                            append({IR_LEAF, ir_reg(base), ir_imm(var.address), ir_imm(size)});
                         }
                     } else {
                         // If its a global variable, then load it's address
-                        append({IR_MOVI, "R" + std::to_string(base), nr->name});
+                        append({IR_MOVI, ir_reg(base), ir_sym(nr->symbol)});
 
                         // If referring by value, then load the value at that
                         // address                        
                         if (!pointer) {
-                            append({IR_LOADR, "R" + std::to_string(base), "R" + std::to_string(base), "4"});
+                            append({IR_LOADR, ir_reg(base), ir_reg(base), ir_imm(4)});
                         }
                     }
 
@@ -385,74 +596,106 @@ namespace hs {
                 case EX_BINARY_OP: {
                     binary_op_t* bo = (binary_op_t*)expr;
 
-                    int rhs = generate_impl(bo->rhs, base, false, inside_fn);
-                    int lhs = generate_impl(bo->lhs, base + rhs, false, inside_fn);
-                    
+                    switch (f.state) {
+                        case 0: {
+                            f.state = 1;
+
+                            return enter(bo->rhs, base, false, inside_fn);
+                        } break;
+
+                        case 1: {
+                            f.a = new_register();
+                            f.state = 2;
+
+                            return enter(bo->lhs, f.a, false, inside_fn);
+                        } break;
+                    }
+
                     // To-do: Check this
-                    append({IR_ALU, bo->op, "R" + std::to_string(base + rhs), "R" + std::to_string(base)});
-                    append({IR_MOV, "R" + std::to_string(base), "R" + std::to_string(base + rhs)});
+                    append({IR_ALU, ir_alu(get_ir_alu_op(bo->op)), ir_reg(f.a), ir_reg(base)});
+                    append({IR_MOV, ir_reg(base), ir_reg(f.a)});
 
-                    return lhs + rhs;
+                    return 1;
                 } break;
 
                 case EX_COMP_OP: {
                     comp_op_t* co = (comp_op_t*)expr;
 
-                    int rhs = generate_impl(co->rhs, base, false, inside_fn);
-                    int lhs = generate_impl(co->lhs, base + rhs, false, inside_fn);
-                    
+                    switch (f.state) {
+                        case 0: {
+                            f.state = 1;
+
+                            return enter(co->rhs, base, false, inside_fn);
+                        } break;
+
+                        case 1: {
+                            f.a = new_register();
+                            f.state = 2;
+
+                            return enter(co->lhs, f.a, false, inside_fn);
+                        } break;
+                    }
+
                     // To-do: Check this
-                    append({IR_CMPR, co->op, "R" + std::to_string(base + rhs), "R" + std::to_string(base)});
-                    append({IR_MOV, "R" + std::to_string(base), "R" + std::to_string(base + rhs)});
+                    append({IR_CMPR, ir_comp(get_ir_comp_op(co->op)), ir_reg(f.a), ir_reg(base)});
+                    append({IR_MOV, ir_reg(base), ir_reg(f.a)});
 
-                    return lhs + rhs;
+                    return 1;
                 } break;
 
                 case EX_ARRAY_ACCESS: {
                     array_access_t* aa = (array_access_t*)expr;
 
-                    if (aa->type_or_name->get_type() != EX_TYPE) {
-                        binary_op_t* bo = new binary_op_t;
+                    if (!f.state) {
+                        f.state = 1;
 
-                        bo->lhs = aa->addr;
-                        bo->rhs = aa->type_or_name;
-                        bo->op = "+";
+                        if (aa->type_or_name->get_type() != EX_TYPE) {
+                            binary_op_t* bo = m_arena->create <binary_op_t> ();
 
-                        int a = generate_impl(bo, base, false, inside_fn);
+                            bo->lhs = aa->addr;
+                            bo->rhs = aa->type_or_name;
+                            bo->op = "+";
 
-                        if (!pointer) { 
-                            append({IR_LOADR, "R" + std::to_string(base), "R" + std::to_string(base)});
-                        }
-
-                        return a;
-                    } else {
-                        int addr = generate_impl(aa->addr, base, false, inside_fn);
-
-                        if (!pointer) { 
-                            append({IR_LOADR, "R" + std::to_string(base), "R" + std::to_string(base)});
+                            return enter(bo, base, false, inside_fn);
+                        } else {
+                            return enter(aa->addr, base, false, inside_fn);
                         }
+                    }
 
-                        return addr;
+                    if (!pointer) { 
+                        append({IR_LOADR, ir_reg(base), ir_reg(base)});
                     }
+
+                    return f.result;
                 } break;
 
                 case EX_ASSIGNMENT: {
                     assignment_t* ae = (assignment_t*)expr;
 
-                    ae->assignee->get_type();
+                    switch (f.state) {
+                        case 0: {
+                            f.state = 1;
 
-                    int rhs = generate_impl(ae->value, base, false, inside_fn);
-                    int lhs = generate_impl(ae->assignee, base + rhs, true, inside_fn);
+                            return enter(ae->value, base, false, inside_fn);
+                        } break;
 
-                    append({IR_STORE, "R" + std::to_string(base + rhs), "R" + std::to_string(base)});
+                        case 1: {
+                            f.a = new_register();
+                            f.state = 2;
 
-                    return lhs + rhs;
+                            return enter(ae->assignee, f.a, true, inside_fn);
+                        } break;
+                    }
+
+                    append({IR_STORE, ir_reg(f.a), ir_reg(base)});
+
+                    return 1;
                 } break;
 
                 case EX_ARRAY: {
-                    std::string label = new_array(*((array_t*)expr));
+                    symbol_id_t label = new_array(*((array_t*)expr));
 
-                    append({IR_MOVI, "R" + std::to_string(base), label});
+                    append({IR_MOVI, ir_reg(base), ir_sym(label)});
 
                     return 1;
                 } break;
@@ -460,9 +703,9 @@ namespace hs {
                 case EX_BLOB: {
                     blob_t* blob = (blob_t*)expr;
 
-                    std::string label = new_blob(blob->file);
+                    symbol_id_t label = new_blob(blob->file);
 
-                    append({IR_MOVI, "R" + std::to_string(base), label});
+                    append({IR_MOVI, ir_reg(base), ir_sym(label)});
 
                     return 1;
                 } break;
@@ -475,30 +718,39 @@ namespace hs {
 
         void generate() {
             if (m_cli->get_setting(ST_OUTPUT_FORMAT) == "elf32") {
-                m_functions.front().push_back({IR_ENTRY, "<ENTRY>"});
+                m_functions.front().push_back({IR_ENTRY, ir_sym(m_symbols->intern("<ENTRY>"))});
 
-                m_functions.front().push_back({IR_ORG, "0x40000"});
-                m_functions.front().push_back({IR_SECTION, ".text"});
+                m_functions.front().push_back({IR_ORG, ir_sym(m_symbols->intern("0x40000"))});
+                m_functions.front().push_back({IR_SECTION, ir_sym(m_symbols->intern(".text"))});
             }
 
-            m_functions.front().push_back({IR_LABEL, "<ENTRY>"});
+            m_functions.front().push_back({IR_LABEL, ir_sym(m_symbols->intern("<ENTRY>"))});
             m_functions.front().push_back({IR_MISC_BEGIN_INDENT});
 
-            for (expression_t* expr : m_po->source) {
-                generate_impl(expr, 0);
+            // Calls can come before the function's definition
+            for (expression_t* expr : m_po->source)
+                if (expr->get_type() == EX_FUNCTION_DEF)
+                    m_interpreter.add_function((function_def_t*)expr);
+
+            for (expression_t*& expr : m_po->source) {
+                m_folder.fold(expr);
+
+                generate_impl(expr, new_register());
             }
             
             // Function call semantics
-            m_functions.front().push_back({IR_PUSHR, "FP"});
-            m_functions.front().push_back({IR_MOV, "FP", "SP"});
-            m_functions.front().push_back({IR_MOVI, "R0", "F<global>.main"});
-            m_functions.front().push_back({IR_CALLR, "R0"});
-            m_functions.front().push_back({IR_MOV, "R0", "A0"});
-            m_functions.front().push_back({IR_MOV, "SP", "FP"});
-            m_functions.front().push_back({IR_POPR, "FP"});
+            m_functions.front().push_back({IR_PUSHR, ir_reg(IR_REG_FP)});
+            m_functions.front().push_back({IR_MOV, ir_reg(IR_REG_FP), ir_reg(IR_REG_SP)});
+            uint32_t main = new_register();
+
+            m_functions.front().push_back({IR_MOVI, ir_reg(main), ir_sym(m_symbols->intern("F<global>.main"))});
+            m_functions.front().push_back({IR_CALLR, ir_reg(main)});
+            m_functions.front().push_back({IR_MOV, ir_reg(IR_REG_SP), ir_reg(IR_REG_FP)});
+            m_functions.front().push_back({IR_POPR, ir_reg(IR_REG_FP)});
+            m_functions.front().push_back({IR_MOV, ir_reg(new_register()), ir_reg(IR_REG_A0)});
 
             // Debug program end software breakpoint
-            m_functions.front().push_back({IR_DEBUG, "0xdeadc0de"});
+            m_functions.front().push_back({IR_DEBUG, ir_sym(m_symbols->intern("0xdeadc0de"))});
 
             m_functions.front().push_back({IR_MISC_END_INDENT});
 
@@ -509,41 +761,41 @@ namespace hs {
             int i = 0;
 
             // Align .rodata to 4-byte boundary
-            m_functions.back().push_back({IR_ALIGN, "4"});
+            m_functions.back().push_back({IR_ALIGN, ir_imm(4)});
 
             if (m_cli->get_setting(ST_OUTPUT_FORMAT) == "elf32") {
-                m_functions.back().push_back({IR_SECTION, ".rodata"});
+                m_functions.back().push_back({IR_SECTION, ir_sym(m_symbols->intern(".rodata"))});
             }
 
             for (array_t& arr : m_pending_arrays) {
-                m_functions.back().push_back({IR_LABEL, "DA" + std::to_string(i++)});
+                m_functions.back().push_back({IR_LABEL, ir_sym(m_symbols->intern("DA" + std::to_string(i++)))});
                 
                 for (expression_t* expr : arr.values) {
                     switch (expr->get_type()) {
                         case EX_NUMERIC_LITERAL: {
                             numeric_literal_t* nl = (numeric_literal_t*)expr;
 
-                            m_functions.back().push_back({IR_DEFV, "l", std::to_string(nl->value)});
+                            m_functions.back().push_back({IR_DEFV, get_immediate(nl->value)});
                         } break;
 
                         case EX_STRING_LITERAL: {
                             string_literal_t* sl = (string_literal_t*)expr;
 
-                            std::string label = new_string(sl->str);
+                            symbol_id_t label = new_string(sl->str);
 
-                            m_functions.back().push_back({IR_DEFV, "l", label});
+                            m_functions.back().push_back({IR_DEFV, ir_sym(label)});
                         } break;
 
                         case EX_NAME_REF: {
                             name_ref_t* nr = (name_ref_t*)expr;
                             
-                            m_functions.back().push_back({IR_DEFV, "l", nr->name});
+                            m_functions.back().push_back({IR_DEFV, ir_sym(nr->symbol)});
                         } break;
 
                         case EX_FUNCTION_DEF: {
                             function_def_t* fd = (function_def_t*)expr;
 
-                            m_functions.back().push_back({IR_DEFV, "l", fd->name});
+                            m_functions.back().push_back({IR_DEFV, ir_sym(fd->symbol)});
                         } break;
 
                         default: {
@@ -552,23 +804,23 @@ namespace hs {
                     }
                 }
 
-                m_functions.back().push_back({IR_ALIGN, "4"});
+                m_functions.back().push_back({IR_ALIGN, ir_imm(4)});
             }
             
             for (string_t& str : m_pending_strings) {
-                m_functions.back().push_back({IR_LABEL, str.name});
-                m_functions.back().push_back({IR_DEFSTR, str.value});
-                m_functions.back().push_back({IR_ALIGN, "4"});
+                m_functions.back().push_back({IR_LABEL, ir_sym(str.name)});
+                m_functions.back().push_back({IR_DEFSTR, ir_sym(str.value)});
+                m_functions.back().push_back({IR_ALIGN, ir_imm(4)});
             }
             
             for (blob_def_t& blob : m_pending_blobs) {
-                m_functions.back().push_back({IR_LABEL, blob.name});
-                m_functions.back().push_back({IR_DEFBLOB, blob.file});
-                m_functions.back().push_back({IR_ALIGN, "4"});
+                m_functions.back().push_back({IR_LABEL, ir_sym(blob.name)});
+                m_functions.back().push_back({IR_DEFBLOB, ir_sym(blob.file)});
+                m_functions.back().push_back({IR_ALIGN, ir_imm(4)});
             }
 
             // Align assembler generated sections to 4-byte boundary
-            m_functions.back().push_back({IR_ALIGN, "4"});
+            m_functions.back().push_back({IR_ALIGN, ir_imm(4)});
         }
     };
 }
@@ -1,9 +1,14 @@
 #pragma once
 
+#include "../symbols.hpp"
+
 #include <string>
+#include <string_view>
+#include <sstream>
+#include <cstdint>
 
 namespace hs {
-    enum ir_opcode_t {
+    enum ir_opcode_t : uint8_t {
         IR_LABEL,       // Generate a label
         IR_MOV,         // Move registers
         IR_MOVI,        // Move register to immediate
@@ -77,23 +82,161 @@ namespace hs {
         "IR_MISC_END_INDENT"
     };
 
+    enum ir_operand_type_t : uint8_t {
+        IO_NONE,
+        IO_REGISTER,    // Virtual register number, or one of ir_register_t
+        IO_IMMEDIATE,   // 32-bit value
+        IO_SYMBOL,      // Interned name or text (labels, strings, asm)
+        IO_LABEL,       // Local label, see ir_label()
+        IO_CONDITION,   // ir_condition_t
+        IO_ALU_OP,      // ir_alu_op_t
+        IO_COMP_OP      // ir_comp_op_t
+    };
+
+    // Registers that aren't allocated, above any virtual register
+    enum ir_register_t : uint32_t {
+        IR_REG_SP = 0xfffffff0,
+        IR_REG_FP,
+        IR_REG_PC,
+        IR_REG_LR,
+        IR_REG_TR,
+        IR_REG_A0
+    };
+
+    enum ir_condition_t : uint32_t {
+        IR_COND_EQ,
+        IR_COND_NE,
+        IR_COND_AL
+    };
+
+    enum ir_alu_op_t : uint32_t {
+        IR_ALU_ADD,
+        IR_ALU_SUB,
+        IR_ALU_MUL,
+        IR_ALU_DIV,
+        IR_ALU_MOD,
+        IR_ALU_AND,
+        IR_ALU_OR,
+        IR_ALU_XOR,
+        IR_ALU_SHL,
+        IR_ALU_SHR,
+        IR_ALU_NONE
+    };
+
+    enum ir_comp_op_t : uint32_t {
+        IR_COMP_EQ,
+        IR_COMP_NE,
+        IR_COMP_GT,
+        IR_COMP_GE,
+        IR_COMP_LT,
+        IR_COMP_LE,
+        IR_COMP_LAND,
+        IR_COMP_LOR,
+        IR_COMP_LXOR,
+        IR_COMP_NONE
+    };
+
+    // Indexed by ir_condition_t, ir_alu_op_t and ir_comp_op_t
+    const char* m_ir_condition_names[] = { "EQ", "NE", "AL" };
+    const char* m_ir_alu_op_names[] = { "+", "-", "*", "/", "%", "&", "|", "^", "<<", ">>", "?" };
+    const char* m_ir_comp_op_names[] = { "==", "!=", ">", ">=", "<", "<=", "&&", "||", "^^", "?" };
+
+    inline ir_alu_op_t get_ir_alu_op(std::string_view op) {
+        for (uint32_t i = 0; i < IR_ALU_NONE; i++)
+            if (op == m_ir_alu_op_names[i])
+                return (ir_alu_op_t)i;
+
+        return IR_ALU_NONE;
+    }
+
+    inline ir_comp_op_t get_ir_comp_op(std::string_view op) {
+        for (uint32_t i = 0; i < IR_COMP_NONE; i++)
+            if (op == m_ir_comp_op_names[i])
+                return (ir_comp_op_t)i;
+
+        return IR_COMP_NONE;
+    }
+
+    struct ir_operand_t {
+        ir_operand_type_t type = IO_NONE;
+
+        uint32_t value = 0;
+    };
+
+    inline ir_operand_t ir_reg(uint32_t r) { return { IO_REGISTER, r }; }
+    inline ir_operand_t ir_imm(uint32_t v) { return { IO_IMMEDIATE, v }; }
+    inline ir_operand_t ir_sym(symbol_id_t s) { return { IO_SYMBOL, s }; }
+    inline ir_operand_t ir_cond(ir_condition_t c) { return { IO_CONDITION, c }; }
+    inline ir_operand_t ir_alu(ir_alu_op_t op) { return { IO_ALU_OP, op }; }
+    inline ir_operand_t ir_comp(ir_comp_op_t op) { return { IO_COMP_OP, op }; }
+
+    // Local labels come in pairs per loop or conditional, L<n> and
+    // E<n> (else/end)
+    inline ir_operand_t ir_label(uint32_t n, bool e = false) {
+        return { IO_LABEL, (n << 1) | (uint32_t)e };
+    }
+
+    // 16 bytes, instructions are kept in flat per-function vectors
     struct ir_instruction_t {
         ir_opcode_t opcode;
 
-        std::string args[4];
+        ir_operand_type_t types[3] = { IO_NONE, IO_NONE, IO_NONE };
+
+        uint32_t args[3] = { 0, 0, 0 };
+
+        ir_instruction_t(ir_opcode_t opcode, ir_operand_t a = {}, ir_operand_t b = {}, ir_operand_t c = {}) : opcode(opcode) {
+            types[0] = a.type; args[0] = a.value;
+            types[1] = b.type; args[1] = b.value;
+            types[2] = c.type; args[2] = c.value;
+        }
     };
 
-    std::string print_ir_instruction(ir_instruction_t& ir) {
-        std::ostringstream ss;
+    // Text form of an operand, labels and registers are written like
+    // the translators expect them on their input (R0, L3, !L3, ...)
+    inline std::string print_ir_operand(symbol_table_t* symbols, ir_operand_type_t type, uint32_t value, bool definition = false) {
+        switch (type) {
+            case IO_REGISTER: {
+                switch (value) {
+                    case IR_REG_SP: return "SP";
+                    case IR_REG_FP: return "FP";
+                    case IR_REG_PC: return "PC";
+                    case IR_REG_LR: return "LR";
+                    case IR_REG_TR: return "TR";
+                    case IR_REG_A0: return "A0";
+                }
 
-        ss << m_ir_mnemonic_map[ir.opcode] << " ";
+                return "R" + std::to_string(value);
+            } break;
+
+            case IO_IMMEDIATE: return std::to_string(value);
+            case IO_SYMBOL   : return symbols->get_name(value);
+            case IO_CONDITION: return m_ir_condition_names[value];
+            case IO_ALU_OP   : return m_ir_alu_op_names[value];
+            case IO_COMP_OP  : return m_ir_comp_op_names[value];
 
-        int i = 0;
+            case IO_LABEL: {
+                return (definition ? "!" : "") + std::string((value & 1) ? "E" : "L") + std::to_string(value >> 1);
+            } break;
 
-        while (ir.args[i].size()) {
-            ss << ir.args[i++] << ", ";
+            default: break;
         }
 
+        return "";
+    }
+
+    inline std::string print_ir_operand(symbol_table_t* symbols, const ir_instruction_t& ir, int i) {
+        return print_ir_operand(symbols, ir.types[i], ir.args[i], ir.opcode == IR_LABEL);
+    }
+
+    // Used by --debug-ir
+    inline std::string print_ir_instruction(symbol_table_t* symbols, const ir_instruction_t& ir) {
+        std::ostringstream ss;
+
+        ss << m_ir_mnemonic_map[ir.opcode] << " ";
+
+        for (int i = 0; (i < 3) && ir.types[i]; i++)
+            ss << (i ? ", " : "\t") << print_ir_operand(symbols, ir, i);
+
         return ss.str();
     }
-}
\ No newline at end of file
+}
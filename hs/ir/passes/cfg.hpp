@@ -0,0 +1,227 @@
+#pragma once
+
+#include "../instruction.hpp"
+
+#include <unordered_map>
+#include <algorithm>
+#include <vector>
+#include <cstdint>
+
+namespace hs {
+    constexpr size_t m_ir_no_block = (size_t)-1;
+
+    // Instructions [begin, end) of a function, control only enters
+    // at begin and only leaves at end - 1
+    struct ir_block_t {
+        size_t begin, end;
+
+        // Successors, m_ir_no_block if there's none
+        size_t next[2];
+    };
+
+    // Control flow graph of a single function (or the code outside
+    // of functions). Blocks start at labels and after jumps, local
+    // labels are only unique within a function
+    class ir_cfg_t {
+        std::vector <ir_block_t> m_blocks;
+        std::vector <std::vector <size_t>> m_prev;
+        std::unordered_map <uint32_t, size_t> m_labels;
+
+        // Reverse postorder of the blocks reachable from the first one
+        std::vector <size_t> m_order;
+        std::vector <size_t> m_idom;
+
+        // Scratch space, kept around as passes build one per function
+        std::vector <uint8_t> m_visited;
+        std::vector <std::pair <size_t, int>> m_stack;
+        std::vector <size_t> m_index;
+
+        void add_block(size_t begin, size_t end) {
+            m_blocks.push_back({ begin, end, { m_ir_no_block, m_ir_no_block } });
+        }
+
+        size_t find_label(uint32_t label) {
+            auto it = m_labels.find(label);
+
+            return (it != m_labels.end()) ? it->second : m_ir_no_block;
+        }
+
+    public:
+        void build(const ir_instruction_t* code, size_t size) {
+            m_blocks.clear();
+            m_labels.clear();
+
+            size_t begin = 0;
+
+            for (size_t n = 0; n < size; n++) {
+                const ir_instruction_t& i = code[n];
+
+                if ((i.opcode == IR_LABEL) && (n != begin)) {
+                    add_block(begin, n);
+
+                    begin = n;
+                }
+
+                if ((i.opcode == IR_LABEL) && (i.types[0] == IO_LABEL))
+                    m_labels[i.args[0]] = m_blocks.size();
+
+                bool jump = (i.opcode == IR_CMPZB) || (i.opcode == IR_BRANCH) || (i.opcode == IR_RET);
+
+                if (jump && ((n + 1) < size)) {
+                    add_block(begin, n + 1);
+
+                    begin = n + 1;
+                }
+            }
+
+            add_block(begin, size);
+
+            m_prev.resize(m_blocks.size());
+
+            for (std::vector <size_t>& prev : m_prev)
+                prev.clear();
+
+            for (size_t b = 0; b < m_blocks.size(); b++) {
+                ir_block_t& block = m_blocks[b];
+
+                const ir_instruction_t& last = code[block.end - 1];
+
+                size_t fallthrough = ((b + 1) < m_blocks.size()) ? (b + 1) : m_ir_no_block;
+
+                switch (last.opcode) {
+                    case IR_RET: break;
+
+                    case IR_BRANCH: {
+                        block.next[0] = find_label(last.args[1]);
+
+                        if (last.args[0] != IR_COND_AL)
+                            block.next[1] = fallthrough;
+                    } break;
+
+                    case IR_CMPZB: {
+                        block.next[0] = find_label(last.args[2]);
+                        block.next[1] = fallthrough;
+                    } break;
+
+                    default: {
+                        block.next[0] = fallthrough;
+                    } break;
+                }
+
+                // Both edges might go to the same block
+                if (block.next[1] == block.next[0])
+                    block.next[1] = m_ir_no_block;
+
+                for (size_t next : block.next)
+                    if (next != m_ir_no_block)
+                        m_prev[next].push_back(b);
+            }
+        }
+
+        // Reverse postorder of the blocks reachable from the first
+        // one, find_dominators() does this too
+        void find_order() {
+            std::vector <uint8_t>& visited = m_visited;
+            std::vector <std::pair <size_t, int>>& stack = m_stack;
+
+            visited.assign(m_blocks.size(), 0);
+
+            m_order.clear();
+
+            stack.push_back({ 0, 0 });
+            visited[0] = 1;
+
+            while (stack.size()) {
+                auto& [b, n] = stack.back();
+
+                if (n == 2) {
+                    m_order.push_back(b);
+                    stack.pop_back();
+
+                    continue;
+                }
+
+                size_t next = m_blocks[b].next[n++];
+
+                if ((next != m_ir_no_block) && !visited[next]) {
+                    visited[next] = 1;
+
+                    stack.push_back({ next, 0 });
+                }
+            }
+
+            std::reverse(m_order.begin(), m_order.end());
+        }
+
+        // Cooper, Harvey and Kennedy's "A Simple, Fast Dominance
+        // Algorithm". Unreachable blocks have no dominator, nor does
+        // the first one
+        void find_dominators() {
+            find_order();
+
+            std::vector <size_t>& index = m_index;
+
+            index.assign(m_blocks.size(), m_ir_no_block);
+
+            for (size_t n = 0; n < m_order.size(); n++)
+                index[m_order[n]] = n;
+
+            m_idom.assign(m_blocks.size(), m_ir_no_block);
+            m_idom[0] = 0;
+
+            auto intersect = [&](size_t a, size_t b) {
+                while (a != b) {
+                    while (index[a] > index[b]) a = m_idom[a];
+                    while (index[b] > index[a]) b = m_idom[b];
+                }
+
+                return a;
+            };
+
+            for (bool changed = true; changed;) {
+                changed = false;
+
+                for (size_t n = 1; n < m_order.size(); n++) {
+                    size_t b = m_order[n];
+                    size_t idom = m_ir_no_block;
+
+                    for (size_t p : m_prev[b]) {
+                        if (m_idom[p] == m_ir_no_block)
+                            continue;
+
+                        idom = (idom == m_ir_no_block) ? p : intersect(p, idom);
+                    }
+
+                    if (m_idom[b] != idom) {
+                        m_idom[b] = idom;
+
+                        changed = true;
+                    }
+                }
+            }
+
+            m_idom[0] = m_ir_no_block;
+        }
+
+        std::vector <ir_block_t>& get_blocks() {
+            return m_blocks;
+        }
+
+        const std::vector <size_t>& get_predecessors(size_t b) {
+            return m_prev[b];
+        }
+
+        // Only valid after find_order() or find_dominators()
+        const std::vector <size_t>& get_order() {
+            return m_order;
+        }
+
+        size_t get_idom(size_t b) {
+            return m_idom[b];
+        }
+
+        bool is_reachable(size_t b) {
+            return (b == 0) || (m_idom[b] != m_ir_no_block);
+        }
+    };
+}
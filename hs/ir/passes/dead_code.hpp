@@ -0,0 +1,217 @@
+#pragma once
+
+#include "pass.hpp"
+#include "cfg.hpp"
+
+#include <algorithm>
+#include <vector>
+#include <cstdint>
+
+namespace hs {
+    // Removes instructions whose only effect is writing virtual
+    // registers that aren't read afterwards, i.e. the address loads
+    // left behind by function definitions:
+    //
+    //   MOVI R0, F<global>.f0    <- removed
+    //   MOVI R1, F<global>.main  <- removed
+    //   ...
+    //   MOVI R2, F<global>.main
+    //   CALLR R2
+    //
+    // Liveness is tracked backwards over each function's blocks
+    // (blocks are only rescanned off a worklist when what's live
+    // after them changes), every register is assumed live at
+    // barriers (inline assembly)
+    // and none after a RET. Calls only read their operand, callees
+    // can't see the caller's virtual registers. Reads done by
+    // removed instructions don't count, so copies only feeding each
+    // other (i.e. mem2reg's moves around a loop) go away too
+    class ir_dead_code_pass_t : public ir_pass_t {
+        ir_cfg_t m_cfg;
+
+        uint32_t m_registers = 0;
+
+        // Where the function being scanned starts
+        size_t m_offset = 0;
+
+        // Registers live at the current instruction, and the ones
+        // set since the last take_live() (some might be dead again)
+        std::vector <uint8_t> m_live;
+        std::vector <uint32_t> m_set;
+        std::vector <uint8_t> m_keep;
+
+        // Registers live when entering each block, sorted. Only a few
+        // registers are live at a time, a register per block matrix
+        // grows with the square of the function's size
+        std::vector <std::vector <uint32_t>> m_live_in;
+        std::vector <uint32_t> m_out;
+
+        // Blocks left to scan, in postorder at first
+        std::vector <size_t> m_work;
+        std::vector <uint8_t> m_queued;
+
+        void set_live(uint32_t reg, bool live) {
+            if (live && !m_live[reg])
+                m_set.push_back(reg);
+
+            m_live[reg] = live;
+        }
+
+        // Moves the live registers to out and clears m_live
+        void take_live(std::vector <uint32_t>& out) {
+            out.clear();
+
+            for (uint32_t reg : m_set) {
+                if (!m_live[reg])
+                    continue;
+
+                m_live[reg] = 0;
+
+                out.push_back(reg);
+            }
+
+            m_set.clear();
+
+            std::sort(out.begin(), out.end());
+        }
+
+        // Walks a block backwards starting with what's live after it,
+        // leaves what's live before it in m_live
+        void scan(const ir_instruction_t* code, size_t b, bool remove) {
+            ir_block_t& block = m_cfg.get_blocks()[b];
+
+            for (size_t next : block.next) {
+                if (next == m_ir_no_block)
+                    continue;
+
+                for (uint32_t reg : m_live_in[next])
+                    set_live(reg, true);
+            }
+
+            for (size_t n = block.end; n-- > block.begin;) {
+                const ir_instruction_t& i = code[n];
+
+                ir_access_t a = get_ir_access(i);
+
+                if (a.barrier) {
+                    for (uint32_t reg = 0; reg < m_registers; reg++)
+                        set_live(reg, true);
+                } else if (a.pure) {
+                    bool dead = true;
+
+                    for (int k = 0; k < 3; k++)
+                        if (a.writes & (1 << k))
+                            dead = dead && is_virtual_register(i.args[k]) && !m_live[i.args[k]];
+
+                    if (dead) {
+                        if (remove)
+                            m_keep[m_offset + n] = 0;
+
+                        continue;
+                    }
+                }
+
+                for (int k = 0; k < 3; k++)
+                    if ((a.writes & (1 << k)) && is_virtual_register(i.args[k]))
+                        set_live(i.args[k], false);
+
+                for (int k = 0; k < 3; k++)
+                    if ((a.reads & (1 << k)) && (i.types[k] == IO_REGISTER) && is_virtual_register(i.args[k]))
+                        set_live(i.args[k], true);
+            }
+        }
+
+        void run_function(const ir_instruction_t* code, size_t size) {
+            m_registers = 0;
+
+            for (size_t n = 0; n < size; n++)
+                for (int k = 0; k < 3; k++)
+                    if ((code[n].types[k] == IO_REGISTER) && is_virtual_register(code[n].args[k]))
+                        m_registers = std::max(m_registers, code[n].args[k] + 1);
+
+            if (!m_registers)
+                return;
+
+            m_cfg.build(code, size);
+            m_cfg.find_order();
+
+            size_t blocks = m_cfg.get_blocks().size();
+
+            m_live.assign(m_registers, 0);
+            m_set.clear();
+            m_live_in.resize(blocks);
+
+            for (std::vector <uint32_t>& in : m_live_in)
+                in.clear();
+
+            // Successors go first, then unreachable blocks
+            const std::vector <size_t>& order = m_cfg.get_order();
+
+            m_work.assign(order.rbegin(), order.rend());
+            m_queued.assign(blocks, 0);
+
+            for (size_t b : m_work)
+                m_queued[b] = 1;
+
+            for (size_t b = 0; b < blocks; b++) {
+                if (m_queued[b])
+                    continue;
+
+                m_queued[b] = 1;
+
+                m_work.push_back(b);
+            }
+
+            for (size_t w = 0; w < m_work.size(); w++) {
+                size_t b = m_work[w];
+
+                m_queued[b] = 0;
+
+                scan(code, b, false);
+                take_live(m_out);
+
+                if (m_out == m_live_in[b])
+                    continue;
+
+                m_live_in[b].swap(m_out);
+
+                for (size_t prev : m_cfg.get_predecessors(b)) {
+                    if (m_queued[prev])
+                        continue;
+
+                    m_queued[prev] = 1;
+
+                    m_work.push_back(prev);
+                }
+            }
+
+            for (size_t b = 0; b < blocks; b++) {
+                scan(code, b, true);
+                take_live(m_out);
+            }
+        }
+
+    public:
+        const char* get_name() override {
+            return "dead-code";
+        }
+
+        void run(std::vector <ir_instruction_t>& function) override {
+            m_keep.assign(function.size(), 1);
+
+            for_each_ir_function(m_symbols, function, [&](size_t begin, size_t end) {
+                m_offset = begin;
+
+                run_function(function.data() + begin, end - begin);
+            });
+
+            size_t kept = 0;
+
+            for (size_t n = 0; n < function.size(); n++)
+                if (m_keep[n])
+                    function[kept++] = function[n];
+
+            function.erase(function.begin() + kept, function.end());
+        }
+    };
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "pass.hpp"
+
+#include <unordered_map>
+#include <algorithm>
+#include <string_view>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+namespace hs {
+    // Removes functions that can't be reached from the entry code
+    // or data (arrays of function pointers, etc.). Functions whose
+    // name shows up in inline assembly are always kept
+    class ir_dead_functions_pass_t : public ir_pass_t {
+        // LABEL to IR_MISC_END_INDENT of a function
+        struct range_t {
+            size_t function, begin, end;
+
+            bool live = false;
+        };
+
+        std::unordered_map <symbol_id_t, range_t> m_ranges;
+        std::vector <symbol_id_t> m_pending;
+
+        void reference(symbol_id_t symbol) {
+            auto it = m_ranges.find(symbol);
+
+            if ((it == m_ranges.end()) || it->second.live)
+                return;
+
+            it->second.live = true;
+
+            m_pending.push_back(symbol);
+        }
+
+        void scan(const ir_instruction_t& i) {
+            for (int k = 0; k < 3; k++)
+                if (i.types[k] == IO_SYMBOL)
+                    reference(i.args[k]);
+        }
+
+    public:
+        const char* get_name() override {
+            return "dead-functions";
+        }
+
+        ir_pass_kind_t get_kind() override {
+            return PK_MODULE;
+        }
+
+        void run_module(std::vector <std::vector <ir_instruction_t>>& functions) override {
+            m_ranges.clear();
+            m_pending.clear();
+
+            std::string assembly;
+
+            for (size_t f = 0; f < functions.size(); f++) {
+                std::vector <ir_instruction_t>& function = functions[f];
+
+                for (size_t n = 0; n < function.size(); n++) {
+                    if (function[n].opcode == IR_PASSTHROUGH)
+                        assembly += m_symbols->get_name(function[n].args[0]);
+
+                    if (!is_function_label(m_symbols, function[n]))
+                        continue;
+
+                    size_t end = n;
+
+                    while ((end < function.size()) && (function[end].opcode != IR_MISC_END_INDENT))
+                        end++;
+
+                    m_ranges[function[n].args[0]] = { f, n, end };
+
+                    n = end;
+                }
+            }
+
+            for (auto& [symbol, range] : m_ranges) {
+                std::string_view name = m_symbols->get_name(symbol);
+
+                if (assembly.find(name.substr(name.find_last_of('.') + 1)) != std::string::npos)
+                    reference(symbol);
+            }
+
+            // Everything outside of functions is reachable
+            for (size_t f = 0; f < functions.size(); f++) {
+                std::vector <ir_instruction_t>& function = functions[f];
+
+                for (size_t n = 0; n < function.size(); n++) {
+                    if (is_function_label(m_symbols, function[n])) {
+                        n = m_ranges[function[n].args[0]].end;
+
+                        continue;
+                    }
+
+                    scan(function[n]);
+                }
+            }
+
+            while (m_pending.size()) {
+                range_t range = m_ranges[m_pending.back()];
+
+                m_pending.pop_back();
+
+                for (size_t n = range.begin + 1; n < range.end; n++)
+                    scan(functions[range.function][n]);
+            }
+
+            // Ranges are erased back to front, so earlier ones in the
+            // same function stay where they were
+            std::vector <range_t*> dead;
+
+            for (auto& [symbol, range] : m_ranges)
+                if (!range.live)
+                    dead.push_back(&range);
+
+            std::sort(dead.begin(), dead.end(), [](range_t* a, range_t* b) {
+                return (a->function != b->function) ? (a->function < b->function) : (a->begin > b->begin);
+            });
+
+            for (range_t* range : dead) {
+                std::vector <ir_instruction_t>& function = functions[range->function];
+
+                size_t end = std::min(range->end + 1, function.size());
+
+                function.erase(function.begin() + range->begin, function.begin() + end);
+            }
+
+            // The entry code is never empty
+            std::erase_if(functions, [](std::vector <ir_instruction_t>& f) {
+                return f.empty();
+            });
+        }
+    };
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "pass.hpp"
+#include "redundant_moves.hpp"
+#include "dead_code.hpp"
+#include "dead_functions.hpp"
+#include "peephole.hpp"
+#include "mem2reg.hpp"
+
+#include "../generator.hpp"
+#include "../../report.hpp"
+
+#include <string_view>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <string>
+
+namespace hs {
+    inline ir_pass_t* create_ir_pass(std::string_view name) {
+        if (name == "mem2reg"        ) return new ir_mem2reg_pass_t;
+        if (name == "redundant-moves") return new ir_redundant_moves_pass_t;
+        if (name == "dead-code"      ) return new ir_dead_code_pass_t;
+        if (name == "dead-functions" ) return new ir_dead_functions_pass_t;
+        if (name == "peephole"       ) return new ir_peephole_pass_t;
+
+        return nullptr;
+    }
+
+    // Passes run by each -O level, in order
+    const std::vector <std::vector <std::string>> m_ir_pass_levels = {
+        {},
+        { "mem2reg", "redundant-moves", "dead-code", "peephole" },
+        { "mem2reg", "redundant-moves", "dead-code", "peephole", "dead-functions" }
+    };
+
+    struct ir_pass_stats_t {
+        std::string name;
+
+        double ms = 0.0;
+
+        size_t before = 0, after = 0;
+
+        std::vector <std::pair <std::string, size_t>> counters;
+    };
+
+    // Runs IR passes between generation and translation
+    class ir_pass_manager_t {
+        std::vector <std::unique_ptr <ir_pass_t>> m_passes;
+        std::vector <ir_pass_stats_t> m_stats;
+
+        time_report_t* m_report = nullptr;
+
+        static size_t count(std::vector <std::vector <ir_instruction_t>>& functions) {
+            size_t instructions = 0;
+
+            for (std::vector <ir_instruction_t>& f : functions)
+                instructions += f.size();
+
+            return instructions;
+        }
+
+    public:
+        void set_time_report(time_report_t* report) {
+            m_report = report;
+        }
+
+        // Returns false if there's no pass with this name
+        bool add(std::string_view name) {
+            ir_pass_t* pass = create_ir_pass(name);
+
+            if (!pass)
+                return false;
+
+            m_passes.emplace_back(pass);
+
+            return true;
+        }
+
+        void add_level(int level) {
+            for (const std::string& name : m_ir_pass_levels.at(level))
+                add(name);
+        }
+
+        size_t get_pass_count() {
+            return m_passes.size();
+        }
+
+        void run(ir_generator_t* irg) {
+            std::vector <std::vector <ir_instruction_t>>& functions = *irg->get_functions();
+
+            m_stats.clear();
+
+            for (std::unique_ptr <ir_pass_t>& pass : m_passes) {
+                typedef std::chrono::steady_clock clock_t;
+
+                ir_pass_stats_t stats;
+
+                stats.name = pass->get_name();
+                stats.before = count(functions);
+
+                if (m_report) m_report->begin_span("optimize", stats.name);
+
+                auto start = clock_t::now();
+
+                pass->init(irg->get_symbols());
+
+                if (pass->get_kind() == PK_MODULE) {
+                    pass->run_module(functions);
+                } else {
+                    for (std::vector <ir_instruction_t>& f : functions)
+                        pass->run(f);
+                }
+
+                stats.ms = std::chrono::duration <double, std::milli> (clock_t::now() - start).count();
+                stats.after = count(functions);
+                stats.counters = pass->get_counters();
+
+                if (m_report) {
+                    m_report->count((stats.before > stats.after) ? (stats.before - stats.after) : 0);
+                    m_report->end_span();
+                }
+
+                m_stats.push_back(stats);
+            }
+        }
+
+        std::vector <ir_pass_stats_t>& get_stats() {
+            return m_stats;
+        }
+    };
+}
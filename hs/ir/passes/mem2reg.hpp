@@ -0,0 +1,595 @@
+#pragma once
+
+#include "pass.hpp"
+#include "cfg.hpp"
+
+#include <unordered_map>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <utility>
+#include <cstdint>
+
+namespace hs {
+    // Keeps locals and arguments in virtual registers instead of
+    // the frame. Every assignment to a variable becomes a new
+    // register (SSA, Cytron et al.) with phis where definitions
+    // meet. Phis and their arguments then share a register, whatever
+    // copies are left go at the end of their predecessors, i.e.
+    //
+    //   L0:                      L0:               <- R9 = phi(R9)
+    //   LOADF R1, 8, 4           MOV R1, R9
+    //   ALU ADD R1, R2     ->    ALU ADD R1, R2
+    //   LEAF R3, 8, 4            MOV R9, R1
+    //   STORE R3, R1             BRANCH AL, L0
+    //   BRANCH AL, L0
+    //
+    // Only slots whose address is never taken (LEAF used by
+    // anything other than a STORE to it) are promoted. Functions
+    // with inline assembly are left alone as it might use the
+    // arguments' defines
+    class ir_mem2reg_pass_t : public ir_pass_t {
+        static constexpr uint32_t m_none = 0xffffffff;
+
+        struct phi_t {
+            uint32_t var, reg;
+
+            // Incoming value for each predecessor
+            std::vector <uint32_t> args;
+
+            bool live = false;
+        };
+
+        ir_cfg_t m_cfg;
+
+        std::vector <ir_instruction_t> m_out;
+        std::vector <ir_instruction_t> m_code;
+        std::vector <uint8_t> m_removed;
+
+        // Frame offset of each promoted variable, the variable of
+        // each slot and the one whose address each register holds
+        std::vector <uint32_t> m_vars;
+        std::unordered_map <uint32_t, uint32_t> m_slots;
+        std::vector <uint32_t> m_address;
+
+        // Slots in the order they show up and whether their address
+        // is taken, times each register is written (up to 2)
+        std::vector <uint32_t> m_seen;
+        std::unordered_map <uint32_t, uint8_t> m_escaped;
+        std::vector <uint8_t> m_defs;
+
+        // Dominator tree, and the walk over it
+        std::vector <std::vector <size_t>> m_children;
+        std::vector <std::pair <size_t, size_t>> m_walk;
+
+        std::vector <phi_t> m_phis;
+        std::vector <uint8_t> m_used;
+        std::vector <uint32_t> m_root;
+        std::vector <std::vector <uint32_t>> m_block_phis;
+
+        // Current register of each variable, and the value it had
+        // when entering the function
+        std::vector <std::vector <uint32_t>> m_stacks;
+        std::vector <uint32_t> m_entry;
+        std::vector <uint32_t> m_pushed;
+
+        uint32_t m_next = 0;
+
+        size_t m_promoted = 0, m_placed = 0;
+
+        uint32_t current(uint32_t var) {
+            if (m_stacks[var].size())
+                return m_stacks[var].back();
+
+            if (m_entry[var] == m_none)
+                m_entry[var] = m_next++;
+
+            return m_entry[var];
+        }
+
+        uint32_t get_var(uint32_t slot) {
+            auto it = m_slots.find(slot);
+
+            return (it != m_slots.end()) ? it->second : m_none;
+        }
+
+        // Variable a STORE writes to, if promoted
+        uint32_t get_stored_var(const ir_instruction_t& i) {
+            if ((i.opcode != IR_STORE) || !is_virtual_register(i.args[0]) || (m_address[i.args[0]] == m_none))
+                return m_none;
+
+            return get_var(m_address[i.args[0]]);
+        }
+
+        void define(uint32_t var, uint32_t reg) {
+            m_stacks[var].push_back(reg);
+            m_pushed.push_back(var);
+        }
+
+        void rename(size_t b) {
+            ir_block_t& block = m_cfg.get_blocks()[b];
+
+            for (uint32_t p : m_block_phis[b]) {
+                m_phis[p].reg = m_next++;
+
+                define(m_phis[p].var, m_phis[p].reg);
+            }
+
+            for (size_t n = block.begin; n < block.end; n++) {
+                ir_instruction_t& i = m_code[n];
+
+                if (i.opcode == IR_LOADF) {
+                    uint32_t var = get_var(i.args[1]);
+
+                    if (var != m_none)
+                        i = { IR_MOV, ir_reg(i.args[0]), ir_reg(current(var)) };
+                } else if (i.opcode == IR_LEAF) {
+                    if (get_var(i.args[1]) != m_none)
+                        m_removed[n] = 1;
+                } else if (uint32_t var = get_stored_var(i); var != m_none) {
+                    define(var, m_next++);
+
+                    i = { IR_MOV, ir_reg(current(var)), ir_reg(i.args[1]) };
+                }
+            }
+
+            for (size_t next : block.next) {
+                if (next == m_ir_no_block)
+                    continue;
+
+                const std::vector <size_t>& prev = m_cfg.get_predecessors(next);
+
+                size_t j = std::find(prev.begin(), prev.end(), b) - prev.begin();
+
+                for (uint32_t p : m_block_phis[next])
+                    m_phis[p].args[j] = current(m_phis[p].var);
+            }
+        }
+
+        void undo(size_t mark) {
+            while (m_pushed.size() > mark) {
+                m_stacks[m_pushed.back()].pop_back();
+                m_pushed.pop_back();
+            }
+        }
+
+        // Finds the slots that can be promoted, false if there's none
+        bool find_vars(const ir_instruction_t* code, size_t size) {
+            uint32_t registers = 0;
+
+            for (size_t n = 0; n < size; n++) {
+                if (code[n].opcode == IR_PASSTHROUGH)
+                    return false;
+
+                for (int k = 0; k < 3; k++)
+                    if ((code[n].types[k] == IO_REGISTER) && is_virtual_register(code[n].args[k]))
+                        registers = std::max(registers, code[n].args[k] + 1);
+            }
+
+            std::unordered_map <uint32_t, uint8_t>& escaped = m_escaped;
+            std::vector <uint32_t>& slots = m_seen;
+            std::vector <uint8_t>& defs = m_defs;
+
+            escaped.clear();
+            slots.clear();
+            defs.assign(registers, 0);
+
+            m_address.assign(registers, m_none);
+
+            for (size_t n = 0; n < size; n++) {
+                const ir_instruction_t& i = code[n];
+
+                ir_access_t a = get_ir_access(i);
+
+                if ((i.opcode == IR_LOADF) || (i.opcode == IR_LEAF)) {
+                    auto [it, added] = escaped.try_emplace(i.args[1], 0);
+
+                    if (added)
+                        slots.push_back(i.args[1]);
+
+                    // Arrays, structs, etc.
+                    if (i.args[2] > 4)
+                        it->second = 1;
+
+                    if (i.opcode == IR_LEAF)
+                        m_address[i.args[0]] = i.args[1];
+                }
+
+                for (int k = 0; k < 3; k++)
+                    if ((a.writes & (1 << k)) && (i.types[k] == IO_REGISTER) && is_virtual_register(i.args[k]))
+                        defs[i.args[k]] = std::min(defs[i.args[k]] + 1, 2);
+            }
+
+            for (size_t n = 0; n < size; n++) {
+                const ir_instruction_t& i = code[n];
+
+                ir_access_t a = get_ir_access(i);
+
+                for (int k = 0; k < 3; k++) {
+                    if ((i.types[k] != IO_REGISTER) || !is_virtual_register(i.args[k]))
+                        continue;
+
+                    uint32_t slot = m_address[i.args[k]];
+
+                    if (slot == m_none)
+                        continue;
+
+                    bool read = (a.reads & (1 << k)) || a.barrier;
+
+                    if (!read)
+                        continue;
+
+                    // Only storing to it
+                    if ((i.opcode == IR_STORE) && (k == 0) && (i.args[1] != i.args[0]))
+                        continue;
+
+                    escaped[slot] = 1;
+                }
+            }
+
+            // Registers holding the address of different slots
+            for (uint32_t reg = 0; reg < registers; reg++)
+                if ((m_address[reg] != m_none) && (defs[reg] > 1))
+                    escaped[m_address[reg]] = 1;
+
+            m_vars.clear();
+            m_slots.clear();
+
+            for (uint32_t slot : slots) {
+                if (escaped[slot])
+                    continue;
+
+                m_slots[slot] = m_vars.size();
+                m_vars.push_back(slot);
+            }
+
+            m_next = registers;
+
+            return m_vars.size();
+        }
+
+        void place_phis() {
+            std::vector <ir_block_t>& blocks = m_cfg.get_blocks();
+
+            size_t count = blocks.size();
+
+            m_phis.clear();
+            m_block_phis.resize(count);
+
+            for (std::vector <uint32_t>& phis : m_block_phis)
+                phis.clear();
+
+            // Straight line code doesn't need any
+            if (count == 1)
+                return;
+
+            // Dominance frontiers
+            std::vector <std::vector <size_t>> df(count);
+
+            for (size_t b = 0; b < count; b++) {
+                const std::vector <size_t>& prev = m_cfg.get_predecessors(b);
+
+                if ((prev.size() < 2) || !m_cfg.is_reachable(b))
+                    continue;
+
+                for (size_t p : prev) {
+                    if (!m_cfg.is_reachable(p))
+                        continue;
+
+                    for (size_t r = p; r != m_cfg.get_idom(b); r = m_cfg.get_idom(r)) {
+                        if (df[r].size() && (df[r].back() == b))
+                            break;
+
+                        df[r].push_back(b);
+                    }
+                }
+            }
+
+            std::vector <std::vector <size_t>> defs(m_vars.size());
+
+            for (size_t b = 0; b < count; b++) {
+                if (!m_cfg.is_reachable(b))
+                    continue;
+
+                for (size_t n = blocks[b].begin; n < blocks[b].end; n++) {
+                    uint32_t var = get_stored_var(m_code[n]);
+
+                    if ((var != m_none) && (defs[var].empty() || (defs[var].back() != b)))
+                        defs[var].push_back(b);
+                }
+            }
+
+            std::vector <uint32_t> has_phi(count, m_none);
+            std::vector <uint32_t> queued(count, m_none);
+
+            for (uint32_t var = 0; var < m_vars.size(); var++) {
+                std::vector <size_t>& work = defs[var];
+
+                for (size_t b : work)
+                    queued[b] = var;
+
+                while (work.size()) {
+                    size_t b = work.back();
+
+                    work.pop_back();
+
+                    for (size_t f : df[b]) {
+                        if (has_phi[f] == var)
+                            continue;
+
+                        has_phi[f] = var;
+
+                        m_block_phis[f].push_back(m_phis.size());
+                        m_phis.push_back({ var, m_none, std::vector <uint32_t> (m_cfg.get_predecessors(f).size(), m_none) });
+
+                        if (queued[f] != var) {
+                            queued[f] = var;
+
+                            work.push_back(f);
+                        }
+                    }
+                }
+            }
+        }
+
+        // Phis only used by other dead phis are dropped, as are the
+        // copies they'd need
+        void find_live_phis() {
+            std::vector <uint32_t> phi_of(m_next, m_none);
+            std::vector <uint32_t> work;
+
+            for (uint32_t p = 0; p < m_phis.size(); p++)
+                phi_of[m_phis[p].reg] = p;
+
+            m_used.assign(m_next, 0);
+
+            auto use = [&](uint32_t reg) {
+                m_used[reg] = 1;
+
+                if (phi_of[reg] == m_none)
+                    return;
+
+                phi_t& phi = m_phis[phi_of[reg]];
+
+                if (phi.live)
+                    return;
+
+                phi.live = true;
+
+                work.push_back(phi_of[reg]);
+            };
+
+            for (size_t n = 0; n < m_code.size(); n++) {
+                if (m_removed[n])
+                    continue;
+
+                for (int k = 0; k < 3; k++)
+                    if ((m_code[n].types[k] == IO_REGISTER) && is_virtual_register(m_code[n].args[k]))
+                        use(m_code[n].args[k]);
+            }
+
+            while (work.size()) {
+                uint32_t p = work.back();
+
+                work.pop_back();
+
+                for (uint32_t reg : m_phis[p].args)
+                    use(reg);
+            }
+
+            for (phi_t& phi : m_phis)
+                m_placed += phi.live;
+        }
+
+        uint32_t find_root(uint32_t reg) {
+            while (m_root[reg] != reg)
+                reg = m_root[reg] = m_root[m_root[reg]];
+
+            return reg;
+        }
+
+        // Nothing has moved the versions of a variable around yet, so
+        // no two versions are live at the same time (the slot held one
+        // value at a time) and a phi's web can use a single register.
+        // Otherwise each phi takes one more, i.e. one per nested if
+        void coalesce() {
+            m_root.resize(m_next);
+
+            for (uint32_t reg = 0; reg < m_next; reg++)
+                m_root[reg] = reg;
+
+            for (phi_t& phi : m_phis) {
+                if (!phi.live)
+                    continue;
+
+                for (uint32_t arg : phi.args) {
+                    if (arg == m_none)
+                        continue;
+
+                    uint32_t a = find_root(phi.reg), b = find_root(arg);
+
+                    m_root[std::max(a, b)] = std::min(a, b);
+                }
+            }
+
+            for (size_t n = 0; n < m_code.size(); n++)
+                for (int k = 0; k < 3; k++)
+                    if ((m_code[n].types[k] == IO_REGISTER) && (m_code[n].args[k] < m_next))
+                        m_code[n].args[k] = find_root(m_code[n].args[k]);
+
+            for (phi_t& phi : m_phis) {
+                phi.reg = find_root(phi.reg);
+
+                for (uint32_t& arg : phi.args)
+                    if (arg != m_none)
+                        arg = find_root(arg);
+            }
+
+            for (uint32_t& reg : m_entry)
+                if (reg != m_none)
+                    reg = find_root(reg);
+
+            for (uint32_t reg = 0; reg < m_next; reg++)
+                if (m_used[reg])
+                    m_used[find_root(reg)] = 1;
+        }
+
+        void emit_copies(size_t b) {
+            ir_block_t& block = m_cfg.get_blocks()[b];
+
+            for (size_t next : block.next) {
+                if (next == m_ir_no_block)
+                    continue;
+
+                const std::vector <size_t>& prev = m_cfg.get_predecessors(next);
+
+                size_t j = std::find(prev.begin(), prev.end(), b) - prev.begin();
+
+                for (uint32_t p : m_block_phis[next]) {
+                    phi_t& phi = m_phis[p];
+
+                    if (phi.live && (phi.reg != phi.args[j]))
+                        m_out.push_back({ IR_MOV, ir_reg(phi.reg), ir_reg(phi.args[j]) });
+                }
+            }
+        }
+
+        void run_function(const ir_instruction_t* code, size_t size) {
+            if (!find_vars(code, size)) {
+                m_out.insert(m_out.end(), code, code + size);
+
+                return;
+            }
+
+            m_promoted += m_vars.size();
+
+            m_code.assign(code, code + size);
+            m_removed.assign(size, 0);
+
+            m_cfg.build(code, size);
+            m_cfg.find_dominators();
+
+            place_phis();
+
+            std::vector <ir_block_t>& blocks = m_cfg.get_blocks();
+
+            m_stacks.resize(m_vars.size());
+
+            for (std::vector <uint32_t>& stack : m_stacks)
+                stack.clear();
+            m_entry.assign(m_vars.size(), m_none);
+            m_pushed.clear();
+
+            // Walk the dominator tree, children go after their parent
+            // in reverse postorder
+            std::vector <std::vector <size_t>>& children = m_children;
+            std::vector <std::pair <size_t, size_t>>& stack = m_walk;
+
+            children.resize(blocks.size());
+
+            for (std::vector <size_t>& c : children)
+                c.clear();
+
+            for (size_t b : m_cfg.get_order())
+                if (b != 0)
+                    children[m_cfg.get_idom(b)].push_back(b);
+
+            stack.push_back({ 0, 0 });
+
+            while (stack.size()) {
+                auto [b, c] = stack.back();
+
+                if (c == 0) {
+                    stack.back().second = m_pushed.size() + 1;
+
+                    rename(b);
+
+                    for (size_t child : children[b])
+                        stack.push_back({ child, 0 });
+
+                    continue;
+                }
+
+                undo(c - 1);
+
+                stack.pop_back();
+            }
+
+            // Whatever unreachable code reads doesn't matter
+            for (size_t b = 0; b < blocks.size(); b++) {
+                if (m_cfg.is_reachable(b))
+                    continue;
+
+                rename(b);
+                undo(0);
+            }
+
+            find_live_phis();
+            coalesce();
+
+            size_t prologue = 1;
+
+            for (; prologue < size; prologue++) {
+                ir_opcode_t op = m_code[prologue].opcode;
+
+                if ((op != IR_MISC_BEGIN_INDENT) && (op != IR_DEFINE) && (op != IR_SUBSP))
+                    break;
+            }
+
+            for (size_t b = 0; b < blocks.size(); b++) {
+                ir_block_t& block = blocks[b];
+
+                size_t end = block.end;
+
+                switch (m_code[end - 1].opcode) {
+                    case IR_CMPZB: case IR_BRANCH: case IR_RET: end--; break;
+                    default: break;
+                }
+
+                for (size_t n = block.begin; n < end; n++) {
+                    if (!m_removed[n])
+                        m_out.push_back(m_code[n]);
+
+                    // Load arguments (and whatever uninitialized
+                    // locals hold) after the function's prologue
+                    if ((n + 1) != prologue)
+                        continue;
+
+                    for (uint32_t var = 0; var < m_vars.size(); var++)
+                        if ((m_entry[var] != m_none) && m_used[m_entry[var]])
+                            m_out.push_back({ IR_LOADF, ir_reg(m_entry[var]), ir_imm(m_vars[var]), ir_imm(4) });
+                }
+
+                emit_copies(b);
+
+                m_out.insert(m_out.end(), m_code.begin() + end, m_code.begin() + block.end);
+            }
+        }
+
+    public:
+        const char* get_name() override {
+            return "mem2reg";
+        }
+
+        void run(std::vector <ir_instruction_t>& function) override {
+            if (function.empty())
+                return;
+
+            m_out.clear();
+
+            for_each_ir_function(m_symbols, function, [&](size_t begin, size_t end) {
+                if (is_function_label(m_symbols, function[begin])) {
+                    run_function(function.data() + begin, end - begin);
+                } else {
+                    m_out.insert(m_out.end(), function.begin() + begin, function.begin() + end);
+                }
+            });
+
+            function.swap(m_out);
+        }
+
+        std::vector <std::pair <std::string, size_t>> get_counters() override {
+            return { { "promoted", m_promoted }, { "phis", m_placed } };
+        }
+    };
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "../instruction.hpp"
+#include "../../symbols.hpp"
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <cstdint>
+
+namespace hs {
+    // Which operands an instruction reads and writes, bit n stands
+    // for operand n (only IO_REGISTER operands matter)
+    struct ir_access_t {
+        uint8_t reads = 0, writes = 0;
+
+        // Register written without being an operand (SP on push, pop,
+        // etc.), 0 if none
+        uint32_t implicit = 0;
+
+        // Might read or write any register (asm, etc.)
+        bool barrier = false;
+
+        // Only reads its operand, but clobbers A0, LR and every other
+        // machine register. Virtual registers live across it are the
+        // allocator's problem, the callee can't see them
+        bool call = false;
+
+        // Control might come from or go somewhere else
+        bool boundary = false;
+
+        // Has no effect besides writing its operands
+        bool pure = false;
+    };
+
+    inline ir_access_t get_ir_access(const ir_instruction_t& i) {
+        ir_access_t a;
+
+        switch (i.opcode) {
+            case IR_MOV   : a.reads = 0b010; a.writes = 0b001; a.pure = true; break;
+            case IR_MOVI  : a.writes = 0b001; a.pure = true; break;
+            case IR_LOADF : a.writes = 0b001; a.pure = true; break;
+            case IR_LEAF  : a.writes = 0b001; a.pure = true; break;
+            case IR_ALU   : a.reads = 0b110; a.writes = 0b010; a.pure = true; break;
+            case IR_CMPR  : a.reads = 0b110; a.writes = 0b010; a.pure = true; break;
+
+            // Might be reading I/O ports, i.e. [0xffffffff]
+            case IR_LOADR : a.reads = 0b010; a.writes = 0b001; break;
+
+            case IR_STORE : a.reads = 0b011; break;
+            case IR_PUSHR : a.reads = 0b001; a.implicit = IR_REG_SP; break;
+            case IR_POPR  : a.writes = 0b001; a.implicit = IR_REG_SP; break;
+            case IR_ADDSP : a.implicit = IR_REG_SP; break;
+            case IR_SUBSP : a.implicit = IR_REG_SP; break;
+            case IR_DECSP : a.implicit = IR_REG_SP; break;
+            case IR_ADDFP : a.implicit = IR_REG_FP; break;
+            case IR_CMPZB : a.reads = 0b010; a.boundary = true; break;
+            case IR_BRANCH: a.boundary = true; break;
+            case IR_LABEL : a.boundary = true; break;
+            case IR_RET   : a.boundary = true; break;
+            case IR_CALLR : a.reads = 0b001; a.call = true; break;
+
+            // Directives and indentation don't touch registers
+            case IR_NOP: case IR_DEFINE: case IR_UNDEF:
+            case IR_MISC_BEGIN_INDENT: case IR_MISC_END_INDENT: break;
+
+            // Traps to the debugger, which only sees machine registers
+            // (A0 holds main's result by then)
+            case IR_DEBUG: break;
+
+            default: a.barrier = true; break;
+        }
+
+        return a;
+    }
+
+    // Registers above this are SP, FP, A0, etc. (see ir_register_t)
+    inline bool is_virtual_register(uint32_t reg) {
+        return reg < IR_REG_SP;
+    }
+
+    // Function labels are named F<scope>.name and carry the size
+    // of the function's frame
+    inline bool is_function_label(symbol_table_t* symbols, const ir_instruction_t& i) {
+        return (i.opcode == IR_LABEL) && (i.types[0] == IO_SYMBOL) &&
+               symbols->get_name(i.args[0]).starts_with("F<");
+    }
+
+    // Calls f(begin, end) for the code before the first function
+    // label and for each function, from its label to the next one
+    template <class F> void for_each_ir_function(symbol_table_t* symbols, const std::vector <ir_instruction_t>& code, F f) {
+        size_t begin = 0;
+
+        for (size_t n = 1; n <= code.size(); n++) {
+            if ((n != code.size()) && !is_function_label(symbols, code[n]))
+                continue;
+
+            f(begin, n);
+
+            begin = n;
+        }
+    }
+
+    enum ir_pass_kind_t {
+        PK_FUNCTION,
+        PK_MODULE
+    };
+
+    // Function passes see one function at a time, module passes
+    // see all of them (the first one being the entry code, the
+    // last one also holding data)
+    class ir_pass_t {
+    protected:
+        symbol_table_t* m_symbols = nullptr;
+
+    public:
+        virtual ~ir_pass_t() = default;
+
+        void init(symbol_table_t* symbols) {
+            m_symbols = symbols;
+        }
+
+        virtual const char* get_name() = 0;
+        virtual ir_pass_kind_t get_kind() { return PK_FUNCTION; };
+
+        virtual void run(std::vector <ir_instruction_t>&) {};
+        virtual void run_module(std::vector <std::vector <ir_instruction_t>>&) {};
+
+        // Extra statistics for --debug-passes
+        virtual std::vector <std::pair <std::string, size_t>> get_counters() { return {}; };
+    };
+}
@@ -0,0 +1,305 @@
+#pragma once
+
+#include "pass.hpp"
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <cstdint>
+
+namespace hs {
+    class ir_peephole_pass_t;
+
+    // A rule matches a sequence of opcodes, when() checks their
+    // operands and rewrite() writes the replacement to out. Rules
+    // see the instructions already rewritten, so they cascade
+    // (DECSP DECSP DECSP -> SUBSP 8, DECSP -> SUBSP 12)
+    struct ir_peephole_rule_t {
+        const char* name;
+
+        std::vector <ir_opcode_t> pattern;
+
+        bool (*when)(ir_peephole_pass_t& p, const ir_instruction_t* i);
+        void (*rewrite)(const ir_instruction_t* i, std::vector <ir_instruction_t>& out);
+    };
+
+    inline bool is_commutative(uint32_t op) {
+        switch (op) {
+            case IR_ALU_ADD: case IR_ALU_MUL:
+            case IR_ALU_AND: case IR_ALU_OR: case IR_ALU_XOR:
+                return true;
+        }
+
+        return false;
+    }
+
+    // a op b == b swap(op) a
+    inline ir_comp_op_t swap_comp_op(uint32_t op) {
+        switch (op) {
+            case IR_COMP_GT: return IR_COMP_LT;
+            case IR_COMP_GE: return IR_COMP_LE;
+            case IR_COMP_LT: return IR_COMP_GT;
+            case IR_COMP_LE: return IR_COMP_GE;
+        }
+
+        return (ir_comp_op_t)op;
+    }
+
+    // Size of the stack adjustment done by DECSP or SUBSP
+    inline uint32_t get_sp_decrement(const ir_instruction_t& i) {
+        return (i.opcode == IR_DECSP) ? 4 : i.args[0];
+    }
+
+    inline bool is_stack_adjustment(const ir_instruction_t& i) {
+        return (i.opcode == IR_DECSP) || (i.types[0] == IO_IMMEDIATE);
+    }
+
+    class ir_peephole_pass_t : public ir_pass_t {
+        std::vector <ir_instruction_t> m_out;
+        std::vector <ir_instruction_t> m_replacement;
+
+        std::vector <size_t> m_removed;
+
+        // Rules by the last opcode of their pattern
+        std::vector <size_t> m_rules[IR_MISC_END_INDENT + 1];
+
+        // Instructions yet to be pushed to m_out
+        const ir_instruction_t* m_next = nullptr;
+        const ir_instruction_t* m_end = nullptr;
+
+        bool match(const ir_peephole_rule_t& rule) {
+            size_t length = rule.pattern.size();
+
+            if (m_out.size() < length)
+                return false;
+
+            const ir_instruction_t* i = &m_out[m_out.size() - length];
+
+            for (size_t k = 0; k < length; k++)
+                if (i[k].opcode != rule.pattern[k])
+                    return false;
+
+            return !rule.when || rule.when(*this, i);
+        }
+
+        // Try rules on the end of m_out until none match
+        void reduce();
+
+    public:
+        // True if reg is written before being read by the remaining
+        // instructions. Only looks ahead within the basic block
+        bool is_dead(uint32_t reg) {
+            if (!is_virtual_register(reg))
+                return false;
+
+            int window = 64;
+
+            for (const ir_instruction_t* i = m_next; (i != m_end) && window--; i++) {
+                ir_access_t a = get_ir_access(*i);
+
+                if (i->opcode == IR_RET)
+                    return true;
+
+                if (a.barrier || a.boundary)
+                    return false;
+
+                for (int k = 0; k < 3; k++)
+                    if ((a.reads & (1 << k)) && (i->types[k] == IO_REGISTER) && (i->args[k] == reg))
+                        return false;
+
+                for (int k = 0; k < 3; k++)
+                    if ((a.writes & (1 << k)) && (i->args[k] == reg))
+                        return true;
+            }
+
+            return false;
+        }
+
+        const char* get_name() override {
+            return "peephole";
+        }
+
+        std::vector <std::pair <std::string, size_t>> get_counters() override;
+
+        void run(std::vector <ir_instruction_t>& function) override;
+    };
+
+    inline const std::vector <ir_peephole_rule_t> m_ir_peephole_rules = {
+        // ALU +, R1, R0; MOV R0, R1 -> ALU +, R0, R1
+        { "alu-swap", { IR_ALU, IR_MOV },
+            [](ir_peephole_pass_t& p, const ir_instruction_t* i) {
+                return is_commutative(i[0].args[0]) &&
+                       (i[1].args[0] == i[0].args[2]) && (i[1].args[1] == i[0].args[1]) &&
+                       p.is_dead(i[0].args[1]);
+            },
+            [](const ir_instruction_t* i, std::vector <ir_instruction_t>& out) {
+                out.push_back({IR_ALU, ir_alu((ir_alu_op_t)i[0].args[0]), ir_reg(i[0].args[2]), ir_reg(i[0].args[1])});
+            }
+        },
+
+        // CMPR <, R1, R0; MOV R0, R1 -> CMPR >, R0, R1
+        { "cmp-swap", { IR_CMPR, IR_MOV },
+            [](ir_peephole_pass_t& p, const ir_instruction_t* i) {
+                return (i[0].args[0] != IR_COMP_NONE) &&
+                       (i[1].args[0] == i[0].args[2]) && (i[1].args[1] == i[0].args[1]) &&
+                       p.is_dead(i[0].args[1]);
+            },
+            [](const ir_instruction_t* i, std::vector <ir_instruction_t>& out) {
+                out.push_back({IR_CMPR, ir_comp(swap_comp_op(i[0].args[0])), ir_reg(i[0].args[2]), ir_reg(i[0].args[1])});
+            }
+        },
+
+        // PUSHR R0; POPR R1 -> MOV R1, R0 (nothing if it's the same
+        // register)
+        { "push-pop", { IR_PUSHR, IR_POPR },
+            nullptr,
+            [](const ir_instruction_t* i, std::vector <ir_instruction_t>& out) {
+                if (i[0].args[0] != i[1].args[0])
+                    out.push_back({IR_MOV, ir_reg(i[1].args[0]), ir_reg(i[0].args[0])});
+            }
+        },
+
+        // Padding and empty blocks, control never depends on them
+        { "nop", { IR_NOP },
+            nullptr,
+            [](const ir_instruction_t*, std::vector <ir_instruction_t>&) {}
+        },
+
+        // ADDSP 0, SUBSP 0, ADDFP 0 (calls without arguments)
+        { "zero-add", { IR_ADDFP },
+            [](ir_peephole_pass_t&, const ir_instruction_t* i) {
+                return (i[0].types[0] == IO_IMMEDIATE) && !i[0].args[0];
+            },
+            [](const ir_instruction_t*, std::vector <ir_instruction_t>&) {}
+        },
+
+        { "zero-add", { IR_ADDSP },
+            [](ir_peephole_pass_t&, const ir_instruction_t* i) {
+                return (i[0].types[0] == IO_IMMEDIATE) && !i[0].args[0];
+            },
+            [](const ir_instruction_t*, std::vector <ir_instruction_t>&) {}
+        },
+
+        { "zero-add", { IR_SUBSP },
+            [](ir_peephole_pass_t&, const ir_instruction_t* i) {
+                return (i[0].types[0] == IO_IMMEDIATE) && !i[0].args[0];
+            },
+            [](const ir_instruction_t*, std::vector <ir_instruction_t>&) {}
+        },
+
+        // DECSP; DECSP -> SUBSP 8, and any mix of DECSP and SUBSP
+        { "sp-merge", { IR_DECSP, IR_DECSP },
+            nullptr,
+            [](const ir_instruction_t*, std::vector <ir_instruction_t>& out) {
+                out.push_back({IR_SUBSP, ir_imm(8)});
+            }
+        },
+
+        { "sp-merge", { IR_SUBSP, IR_DECSP },
+            [](ir_peephole_pass_t&, const ir_instruction_t* i) {
+                return is_stack_adjustment(i[0]);
+            },
+            [](const ir_instruction_t* i, std::vector <ir_instruction_t>& out) {
+                out.push_back({IR_SUBSP, ir_imm(get_sp_decrement(i[0]) + 4)});
+            }
+        },
+
+        { "sp-merge", { IR_DECSP, IR_SUBSP },
+            [](ir_peephole_pass_t&, const ir_instruction_t* i) {
+                return is_stack_adjustment(i[1]);
+            },
+            [](const ir_instruction_t* i, std::vector <ir_instruction_t>& out) {
+                out.push_back({IR_SUBSP, ir_imm(get_sp_decrement(i[1]) + 4)});
+            }
+        },
+
+        { "sp-merge", { IR_SUBSP, IR_SUBSP },
+            [](ir_peephole_pass_t&, const ir_instruction_t* i) {
+                return is_stack_adjustment(i[0]) && is_stack_adjustment(i[1]);
+            },
+            [](const ir_instruction_t* i, std::vector <ir_instruction_t>& out) {
+                out.push_back({IR_SUBSP, ir_imm(i[0].args[0] + i[1].args[0])});
+            }
+        },
+
+        { "sp-merge", { IR_ADDSP, IR_ADDSP },
+            [](ir_peephole_pass_t&, const ir_instruction_t* i) {
+                return is_stack_adjustment(i[0]) && is_stack_adjustment(i[1]);
+            },
+            [](const ir_instruction_t* i, std::vector <ir_instruction_t>& out) {
+                out.push_back({IR_ADDSP, ir_imm(i[0].args[0] + i[1].args[0])});
+            }
+        }
+    };
+
+    inline void ir_peephole_pass_t::reduce() {
+        bool changed = true;
+
+        while (changed) {
+            changed = false;
+
+            if (m_out.empty())
+                return;
+
+            for (size_t r : m_rules[m_out.back().opcode]) {
+                const ir_peephole_rule_t& rule = m_ir_peephole_rules[r];
+
+                if (!match(rule))
+                    continue;
+
+                size_t length = rule.pattern.size();
+
+                m_replacement.clear();
+
+                rule.rewrite(&m_out[m_out.size() - length], m_replacement);
+
+                m_out.erase(m_out.end() - length, m_out.end());
+                m_out.insert(m_out.end(), m_replacement.begin(), m_replacement.end());
+
+                m_removed[r] += length - m_replacement.size();
+
+                changed = m_replacement.size();
+
+                break;
+            }
+        }
+    }
+
+    inline void ir_peephole_pass_t::run(std::vector <ir_instruction_t>& function) {
+        if (m_removed.empty()) {
+            m_removed.resize(m_ir_peephole_rules.size());
+
+            for (size_t r = 0; r < m_ir_peephole_rules.size(); r++)
+                m_rules[m_ir_peephole_rules[r].pattern.back()].push_back(r);
+        }
+
+        m_out.clear();
+
+        m_end = function.data() + function.size();
+
+        for (m_next = function.data(); m_next != m_end;) {
+            m_out.push_back(*m_next++);
+
+            reduce();
+        }
+
+        function.swap(m_out);
+    }
+
+    // Instructions removed by each rule
+    inline std::vector <std::pair <std::string, size_t>> ir_peephole_pass_t::get_counters() {
+        std::vector <std::pair <std::string, size_t>> counters;
+
+        for (size_t r = 0; r < m_removed.size(); r++) {
+            const char* name = m_ir_peephole_rules[r].name;
+
+            if (counters.size() && (counters.back().first == name)) {
+                counters.back().second += m_removed[r];
+            } else {
+                counters.push_back({ name, m_removed[r] });
+            }
+        }
+
+        return counters;
+    }
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "pass.hpp"
+
+#include <algorithm>
+#include <vector>
+#include <cstdint>
+
+namespace hs {
+    // Forwards copies within a basic block, i.e.
+    //
+    //   MOV R0, R1          MOV R0, R1
+    //   STORE R2, R0   ->   STORE R2, R1
+    //
+    // and removes moves between registers already holding the same
+    // value (MOV R0, A0 ... MOV A0, R0). Moves left without uses are
+    // removed by dead-code
+    class ir_redundant_moves_pass_t : public ir_pass_t {
+        // Copies are indexed by register, virtual registers first and
+        // then SP, FP, etc. Clearing them only bumps m_epoch, entries
+        // from older epochs (or 0) don't count
+        struct copy_t {
+            uint32_t src, epoch;
+        };
+
+        static constexpr uint32_t m_machine_registers = (IR_REG_A0 - IR_REG_SP) + 1;
+
+        uint32_t m_registers = 0;
+        uint32_t m_epoch = 0;
+
+        // What each register is a copy of
+        std::vector <copy_t> m_sources;
+
+        // Registers copied from each register, some might have been
+        // overwritten since (find() tells)
+        std::vector <std::vector <uint32_t>> m_copies;
+        std::vector <uint32_t> m_copies_epoch;
+
+        size_t get_index(uint32_t reg) {
+            return is_virtual_register(reg) ? reg : (m_registers + (reg - IR_REG_SP));
+        }
+
+        uint32_t find(uint32_t reg) {
+            copy_t& c = m_sources[get_index(reg)];
+
+            return (c.epoch == m_epoch) ? c.src : reg;
+        }
+
+        void add(uint32_t dst, uint32_t src) {
+            size_t index = get_index(src);
+
+            if (m_copies_epoch[index] != m_epoch) {
+                m_copies[index].clear();
+                m_copies_epoch[index] = m_epoch;
+            }
+
+            m_copies[index].push_back(dst);
+            m_sources[get_index(dst)] = { src, m_epoch };
+        }
+
+        // reg now holds something else, copies of and to it are gone
+        void kill(uint32_t reg) {
+            size_t index = get_index(reg);
+
+            m_sources[index].epoch = 0;
+
+            if (m_copies_epoch[index] != m_epoch)
+                return;
+
+            for (uint32_t dst : m_copies[index])
+                if (find(dst) == reg)
+                    m_sources[get_index(dst)].epoch = 0;
+
+            m_copies[index].clear();
+        }
+
+    public:
+        const char* get_name() override {
+            return "redundant-moves";
+        }
+
+        void run(std::vector <ir_instruction_t>& function) override {
+            size_t n = 0;
+
+            m_registers = 0;
+
+            for (const ir_instruction_t& i : function)
+                for (int k = 0; k < 3; k++)
+                    if ((i.types[k] == IO_REGISTER) && is_virtual_register(i.args[k]))
+                        m_registers = std::max(m_registers, i.args[k] + 1);
+
+            m_epoch = 1;
+
+            m_sources.assign(m_registers + m_machine_registers, { 0, 0 });
+            m_copies.resize(m_registers + m_machine_registers);
+            m_copies_epoch.assign(m_registers + m_machine_registers, 0);
+
+            for (ir_instruction_t i : function) {
+                ir_access_t a = get_ir_access(i);
+
+                // Operands both read and written (ALU's first) can't
+                // be renamed. Only moves take SP, FP, etc. as sources
+                for (int k = 0; k < 3; k++) {
+                    if (!(a.reads & (1 << k)) || (a.writes & (1 << k)) || (i.types[k] != IO_REGISTER))
+                        continue;
+
+                    uint32_t src = find(i.args[k]);
+
+                    if ((i.opcode == IR_MOV) || is_virtual_register(src))
+                        i.args[k] = src;
+                }
+
+                if (a.barrier || (i.opcode == IR_LABEL)) {
+                    m_epoch++;
+                } else if (a.call) {
+                    // Copies between virtual registers survive calls
+                    for (uint32_t reg = IR_REG_SP; reg <= IR_REG_A0; reg++)
+                        kill(reg);
+                } else if (i.opcode == IR_MOV) {
+                    uint32_t dst = i.args[0], src = i.args[1];
+
+                    if ((dst == src) || (find(dst) == src))
+                        continue;
+
+                    kill(dst);
+                    add(dst, src);
+                } else {
+                    for (int k = 0; k < 3; k++)
+                        if ((a.writes & (1 << k)) && (i.types[k] == IO_REGISTER))
+                            kill(i.args[k]);
+
+                    if (a.implicit)
+                        kill(a.implicit);
+                }
+
+                function[n++] = i;
+            }
+
+            function.erase(function.begin() + n, function.end());
+        }
+    };
+}
@@ -3,7 +3,6 @@
 #include "translator.hpp"
 
 #include <sstream>
-#include <unordered_map>
 
 namespace hs {
     class ir_tr_hv1_t : public ir_translator_t {
@@ -11,72 +10,41 @@ namespace hs {
         
         error_logger_t* m_logger;
 
-        static std::string map_register(std::string reg) {
-            if (reg == "PC") return "pc";
-            if (reg == "SP") return "sp";
-            if (reg == "LR") return "lr";
-            if (reg == "FP") return "fp";
-            if (reg == "TR") return "tr";
-
-            if (reg[0] == 'A') {
-                return "a" + std::string(1, reg[1]);
-            }
-
-            if (reg[0] == 'R') {
-                int number = std::stoi(reg.substr(1)) + 1;
-
-                return "r" + std::to_string(number);
+        static std::string map_register(uint32_t reg) {
+            switch (reg) {
+                case IR_REG_PC: return "pc";
+                case IR_REG_SP: return "sp";
+                case IR_REG_LR: return "lr";
+                case IR_REG_FP: return "fp";
+                case IR_REG_TR: return "tr";
+                case IR_REG_A0: return "a0";
             }
 
-            return "r0";
+            return "r" + std::to_string(reg + 1);
         }
 
-        enum bop_t {
-            BP_ADD,
-            BP_SUB,
-            BP_MUL,
-            BP_DIV,
-            BP_AND,
-            BP_OR,
-            BP_XOR,
-            BP_SHL,
-            BP_SHR
-        };
-
-        std::unordered_map <std::string, bop_t> m_bop_map = {
-            { "+" , BP_ADD },
-            { "-" , BP_SUB },
-            { "*" , BP_MUL },
-            { "/" , BP_DIV },
-            { "&" , BP_AND },
-            { "|" , BP_OR  },
-            { "^" , BP_XOR },
-            { "<<", BP_SHL },
-            { ">>", BP_SHR }
-        };
-
-        std::string map_binary_op(std::string bop_str) {
-            bop_t bop = m_bop_map[bop_str];
-
+        static std::string map_binary_op(uint32_t bop) {
             switch (bop) {
-                case BP_ADD: return "add.u";
-                case BP_SUB: return "sub.u";
-                case BP_MUL: return "mul.u";
-                case BP_DIV: return "div.u";
-                case BP_AND: return "and";
-                case BP_OR : return "or";
-                case BP_XOR: return "xor";
-                case BP_SHL: return "lsl";
-                case BP_SHR: return "lsr";
+                case IR_ALU_ADD: return "add.u";
+                case IR_ALU_SUB: return "sub.u";
+                case IR_ALU_MUL: return "mul.u";
+                case IR_ALU_DIV: return "div.u";
+                case IR_ALU_AND: return "and";
+                case IR_ALU_OR : return "or";
+                case IR_ALU_XOR: return "xor";
+                case IR_ALU_SHL: return "lsl";
+                case IR_ALU_SHR: return "lsr";
             }
 
             return "unimplemented_operator";
         }
 
-        static std::string map_branch(std::string cond) {
-            if (cond == "EQ") return "beq";
-            if (cond == "NE") return "bne";
-            if (cond == "AL") return "bra";
+        static std::string map_branch(uint32_t cond) {
+            switch (cond) {
+                case IR_COND_EQ: return "beq";
+                case IR_COND_NE: return "bne";
+                case IR_COND_AL: return "bra";
+            }
 
             return "unimplemented_branch";
         }
@@ -108,9 +76,20 @@ namespace hs {
     public:
         void init(ir_generator_t* irg, error_logger_t* logger) override {
             m_ir = irg->get_functions();
+            m_symbols = irg->get_symbols();
             m_logger = logger;
         }
 
+        // r1 to r23, r24 is a0
+        std::vector <uint32_t> get_registers() override {
+            std::vector <uint32_t> registers;
+
+            for (uint32_t r = 0; r < 23; r++)
+                registers.push_back(r);
+
+            return registers;
+        }
+
         std::string translate() override {
             bool indented = false;
 
@@ -118,17 +97,19 @@ namespace hs {
 
             for (std::vector <ir_instruction_t>& f : *m_ir) {
                 for (ir_instruction_t& i : f) {
+                    trace(i);
+
                     if (indented) ss << "    ";
 
                     switch (i.opcode) {
                         case IR_LABEL: {
-                            ss << "\n" << fmt_label(i.args[0]) << ":";
+                            ss << "\n" << fmt_label(operand(i, 0)) << ":";
 
                             indented = true;
                         } break;
 
                         case IR_ADDSP: {
-                            ss << "add.u   sp, " << i.args[0];
+                            ss << "add.u   sp, " << operand(i, 0);
                         } break;
 
                         case IR_ALU: {
@@ -144,15 +125,15 @@ namespace hs {
                         } break;
                         
                         case IR_ADDFP: {
-                            ss << "add.u   fp, " << i.args[0];
+                            ss << "add.u   fp, " << operand(i, 0);
                         } break;
 
                         case IR_LEAF: {
-                            ss << "lea.l   " << map_register(i.args[0]) << ", [fp-" << i.args[1] << "]";
+                            ss << "lea.l   " << map_register(i.args[0]) << ", [fp-" << operand(i, 1) << "]";
                         } break;
 
                         case IR_LOADF: {
-                            ss << "load.l  " << map_register(i.args[0]) << ", [fp-" << i.args[1] << "]";
+                            ss << "load.l  " << map_register(i.args[0]) << ", [fp-" << operand(i, 1) << "]";
                         } break;
 
                         case IR_LOADR: {
@@ -164,7 +145,7 @@ namespace hs {
                         } break;
 
                         case IR_MOVI: {
-                            ss << ".load32 " << map_register(i.args[0]) << " " << fmt_label(i.args[1]);
+                            ss << ".load32 " << map_register(i.args[0]) << " " << fmt_label(operand(i, 1));
                         } break;
 
                         case IR_NOP: {
@@ -186,7 +167,7 @@ namespace hs {
                         } break;
 
                         case IR_PASSTHROUGH: {
-                            ss << i.args[0];
+                            ss << operand(i, 0);
                         } break;
 
                         case IR_STORE: {
@@ -194,53 +175,55 @@ namespace hs {
                         } break;
 
                         case IR_SUBSP: {
-                            ss << "sub.u   sp, " << i.args[0];
+                            ss << "sub.u   sp, " << operand(i, 0);
                         } break;
 
                         case IR_BRANCH: {
-                            ss << map_branch(i.args[0]) << std::string(8 - map_branch(i.args[0]).size(), ' ') << i.args[1];
+                            ss << map_branch(i.args[0]) << std::string(8 - map_branch(i.args[0]).size(), ' ') << operand(i, 1);
                         } break;
 
                         case IR_DEFSTR: {
-                            ss << ".asciiz \"" << i.args[0] << "\"";
+                            ss << ".asciiz \"" << operand(i, 0) << "\"";
                         } break;
 
                         case IR_DEFINE: {
-                            ss << "#define " << i.args[0] << " " << i.args[1];
+                            ss << "#define " << operand(i, 0) << " " << operand(i, 1);
                         } break;
                         
                         case IR_UNDEF: {
-                            ss << "#undef " << i.args[0];
+                            ss << "#undef " << operand(i, 0);
                         } break;
 
                         case IR_DEFV: {
-                            ss << ".dl " << fmt_label(i.args[1]);
+                            ss << ".dl " << fmt_label(operand(i, 0));
                         } break;
 
                         case IR_DEFBLOB: {
-                            ss << ".blob " << i.args[0];
+                            ss << ".blob " << operand(i, 0);
                         } break;
 
                         case IR_CMPZB: {
                             ss << "cmp     " << map_register(i.args[1]) << ", " << std::to_string(0) << std::endl;
-                            ss << map_branch(i.args[0]) << std::string(8 - map_branch(i.args[0]).size(), ' ') << i.args[2];
+                            ss << map_branch(i.args[0]) << std::string(8 - map_branch(i.args[0]).size(), ' ') << operand(i, 2);
                         } break;
 
                         case IR_SECTION: {
-                            ss << ".section " << i.args[0];
+                            ss << ".section " << operand(i, 0);
                         };
 
                         case IR_ORG: {
-                            ss << ".org " << i.args[0];
+                            ss << ".org " << operand(i, 0);
                         } break;
 
                         case IR_ENTRY: {
-                            ss << ".entry " << fmt_label(i.args[0]);
+                            ss << ".entry " << fmt_label(operand(i, 0));
                         };
                     }
 
                     ss << std::endl;
                 }
+
+                trace_end();
             }
 
             return ss.str();
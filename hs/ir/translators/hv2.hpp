@@ -3,7 +3,6 @@
 #include "translator.hpp"
 
 #include <sstream>
-#include <unordered_map>
 
 namespace hs {
     class ir_tr_hv2_t : public ir_translator_t {
@@ -11,105 +10,57 @@ namespace hs {
         
         error_logger_t* m_logger;
 
-        static std::string map_register(std::string reg) {
-            if (reg == "PC") return "pc";
-            if (reg == "SP") return "sp";
-            if (reg == "LR") return "lr";
-            if (reg == "FP") return "fp";
-            if (reg == "TR") return "tr";
-
-            if (reg[0] == 'A') {
-                return "a" + std::string(1, reg[1]);
-            }
-
-            if (reg[0] == 'R') {
-                int number = std::stoi(reg.substr(1));
-
-                return "x" + std::to_string(number);
+    public:
+        // These are also used by the hv2 encoder, see
+        // assembler/hv2/encoder.hpp
+        static std::string map_register(uint32_t reg) {
+            switch (reg) {
+                case IR_REG_PC: return "pc";
+                case IR_REG_SP: return "sp";
+                case IR_REG_LR: return "lr";
+                case IR_REG_FP: return "fp";
+                case IR_REG_TR: return "tr";
+                case IR_REG_A0: return "a0";
             }
 
-            return "unimplemented_register";
+            return "x" + std::to_string(reg);
         }
 
-        enum bop_t {
-            BP_ADD,
-            BP_SUB,
-            BP_MUL,
-            BP_DIV,
-            BP_AND,
-            BP_OR,
-            BP_XOR,
-            BP_SHL,
-            BP_SHR
-        };
-
-        enum cop_t {
-            CP_EQ,
-            CP_NE,
-            CP_GT,
-            CP_GE,
-            CP_LT,
-            CP_LE
-        };
-
-        std::unordered_map <std::string, bop_t> m_bop_map = {
-            { "+" , BP_ADD },
-            { "-" , BP_SUB },
-            { "*" , BP_MUL },
-            { "/" , BP_DIV },
-            { "&" , BP_AND },
-            { "|" , BP_OR  },
-            { "^" , BP_XOR },
-            { "<<", BP_SHL },
-            { ">>", BP_SHR }
-        };
-
-        std::unordered_map <std::string, cop_t> m_cop_map = {
-            { "==", CP_EQ },
-            { "!=", CP_NE },
-            { ">" , CP_GT },
-            { ">=", CP_GE },
-            { "<" , CP_LT },
-            { "<=", CP_LE }
-        };
-
-        std::string map_binary_op(std::string bop_str) {
-            bop_t bop = m_bop_map[bop_str];
-
+        static std::string map_binary_op(uint32_t bop) {
             switch (bop) {
-                case BP_ADD: return "add.u";
-                case BP_SUB: return "sub.u";
-                case BP_MUL: return "mul.u";
-                case BP_DIV: return "div.u";
-                case BP_AND: return "and.u";
-                case BP_OR : return "or.u";
-                case BP_XOR: return "xor.u";
-                case BP_SHL: return "lsl.u";
-                case BP_SHR: return "lsr.u";
+                case IR_ALU_ADD: return "add.u";
+                case IR_ALU_SUB: return "sub.u";
+                case IR_ALU_MUL: return "mul.u";
+                case IR_ALU_DIV: return "div.u";
+                case IR_ALU_AND: return "and.u";
+                case IR_ALU_OR : return "or.u";
+                case IR_ALU_XOR: return "xor.u";
+                case IR_ALU_SHL: return "lsl.u";
+                case IR_ALU_SHR: return "lsr.u";
             }
 
             return "unimplemented_binary_operator";
         }
 
-        std::string map_comp_op(std::string cop_str) {
-            cop_t cop = m_cop_map[cop_str];
-
+        static std::string map_comp_op(uint32_t cop) {
             switch (cop) {
-                case CP_EQ: return "seq";
-                case CP_NE: return "sne";
-                case CP_GT: return "sgt";
-                case CP_GE: return "sge";
-                case CP_LT: return "slt";
-                case CP_LE: return "sle";
+                case IR_COMP_EQ: return "seq";
+                case IR_COMP_NE: return "sne";
+                case IR_COMP_GT: return "sgt";
+                case IR_COMP_GE: return "sge";
+                case IR_COMP_LT: return "slt";
+                case IR_COMP_LE: return "sle";
             }
 
             return "unimplemented_comp_operator";
         }
 
-        static std::string map_branch(std::string cond) {
-            if (cond == "EQ") return "beq";
-            if (cond == "NE") return "bne";
-            if (cond == "AL") return "b";
+        static std::string map_branch(uint32_t cond) {
+            switch (cond) {
+                case IR_COND_EQ: return "beq";
+                case IR_COND_NE: return "bne";
+                case IR_COND_AL: return "b";
+            }
 
             return "unimplemented_branch";
         }
@@ -138,12 +89,161 @@ namespace hs {
             return ss.str();
         }
 
-    public:
         void init(ir_generator_t* irg, error_logger_t* logger) override {
             m_ir = irg->get_functions();
+            m_symbols = irg->get_symbols();
             m_logger = logger;
         }
 
+        // x0 to x24, the rest are zero, at, a0, fp, sp, lr and pc
+        std::vector <uint32_t> get_registers() override {
+            std::vector <uint32_t> registers;
+
+            for (uint32_t r = 0; r < 25; r++)
+                registers.push_back(r);
+
+            return registers;
+        }
+
+        // Translate a single instruction, indentation is handled
+        // by translate()
+        void translate_instruction(std::ostream& ss, ir_instruction_t& i) {
+            switch (i.opcode) {
+                case IR_LABEL: {
+                    ss << "\n" << fmt_label(operand(i, 0)) << ":";
+                } break;
+
+                case IR_ADDSP: {
+                    ss << "add.u   sp, " << operand(i, 0);
+                } break;
+
+                case IR_ALU: {
+                    ss << map_binary_op(i.args[0]) << "   " << map_register(i.args[1]) << ", " << map_register(i.args[1]) << ", " << map_register(i.args[2]);
+                } break;
+
+                case IR_CALLR: {
+                    ss << "call.r  " << map_register(i.args[0]);
+                } break;
+
+                case IR_DECSP: {
+                    ss << "sub.u   sp, 4";
+                } break;
+                
+                case IR_ADDFP: {
+                    ss << "add.u   fp, " << operand(i, 0);
+                } break;
+
+                case IR_LEAF: {
+                    ss << "lea.l   " << map_register(i.args[0]) << ", [fp-" << operand(i, 1) << "]";
+                } break;
+
+                case IR_LOADF: {
+                    ss << "load.l  " << map_register(i.args[0]) << ", [fp-" << operand(i, 1) << "]";
+                } break;
+
+                case IR_LOADR: {
+                    ss << "load.l  " << map_register(i.args[0]) << ", [" << map_register(i.args[1]) << "]";
+                } break;
+
+                case IR_MOV: {
+                    ss << "move    " << map_register(i.args[0]) << ", " << map_register(i.args[1]);
+                } break;
+
+                case IR_MOVI: {
+                    ss << "li.w    " << map_register(i.args[0]) << ", !" << fmt_label(operand(i, 1));
+                } break;
+
+                case IR_NOP: {
+                    ss << "nop     r0";
+                } break;
+
+                case IR_PUSHR: {
+                    ss << "push    " << map_register(i.args[0]);
+                } break;
+
+                case IR_POPR: {
+                    ss << "pop     " << map_register(i.args[0]);
+                } break;
+
+                case IR_RET: {
+                    ss << "ret     r0";
+                } break;
+
+                case IR_PASSTHROUGH: {
+                    ss << operand(i, 0);
+                } break;
+
+                case IR_STORE: {
+                    ss << "store.l [" << map_register(i.args[0]) << "], " << map_register(i.args[1]);
+                } break;
+
+                case IR_SUBSP: {
+                    ss << "sub.u   sp, " << operand(i, 0);
+                } break;
+
+                case IR_BRANCH: {
+                    ss << map_branch(i.args[0]) << std::string(8 - map_branch(i.args[0]).size(), ' ') << operand(i, 1);
+                } break;
+
+                case IR_DEFSTR: {
+                    ss << ".asciiz \"" << operand(i, 0) << "\"";
+                } break;
+
+                case IR_DEFINE: {
+                    ss << "#define " << operand(i, 0) << " " << operand(i, 1);
+                } break;
+
+                case IR_DEFBLOB: {
+                    ss << ".blob " << operand(i, 0);
+                } break;
+                
+                case IR_UNDEF: {
+                    ss << "#undef " << operand(i, 0);
+                } break;
+
+                case IR_DEFV: {
+                    ss << ".long " << fmt_label(operand(i, 0));
+                } break;
+
+                case IR_CMPZB: {
+                    std::string branch = map_branch(i.args[0]);
+
+                    ss << branch
+                       << std::string(8 - branch.size(), ' ')
+                       << map_register(i.args[1]) << ", "
+                       << "zero" << ", "
+                       << operand(i, 2);
+                } break;
+
+                case IR_CMPR: {
+                    ss << map_comp_op(i.args[0]) << "   "
+                       << map_register(i.args[1]) << ", "
+                       << map_register(i.args[1]) << ", "
+                       << map_register(i.args[2]);
+                } break;
+                
+                case IR_SECTION: {
+                    ss << ".section " << operand(i, 0);
+                } break;
+
+                case IR_ORG: {
+                    ss << ".org " << operand(i, 0);
+                } break;
+
+                case IR_ENTRY: {
+                    ss << ".entry !" << fmt_label(operand(i, 0));
+                } break;
+
+                case IR_DEBUG: {
+                    ss << "debug " << fmt_label(operand(i, 0));
+                } break;
+
+                case IR_ALIGN: {
+                    ss << ".align " << fmt_label(operand(i, 0));
+                } break;
+            }
+        }
+
         std::string translate() override {
             bool indented = false;
 
@@ -151,154 +251,20 @@ namespace hs {
 
             for (std::vector <ir_instruction_t>& f : *m_ir) {
                 for (ir_instruction_t& i : f) {
+                    trace(i);
+
                     if (indented)
                         ss << "    ";
 
-                    switch (i.opcode) {
-                        case IR_MISC_BEGIN_INDENT: {
-                            indented = true;
-                        } break;
-
-                        case IR_MISC_END_INDENT: {
-                            indented = false;
-                        } break;
-
-                        case IR_LABEL: {
-                            ss << "\n" << fmt_label(i.args[0]) << ":";
-                        } break;
-
-                        case IR_ADDSP: {
-                            ss << "add.u   sp, " << i.args[0];
-                        } break;
-
-                        case IR_ALU: {
-                            ss << map_binary_op(i.args[0]) << "   " << map_register(i.args[1]) << ", " << map_register(i.args[1]) << ", " << map_register(i.args[2]);
-                        } break;
-
-                        case IR_CALLR: {
-                            ss << "call.r  " << map_register(i.args[0]);
-                        } break;
-
-                        case IR_DECSP: {
-                            ss << "sub.u   sp, 4";
-                        } break;
-                        
-                        case IR_ADDFP: {
-                            ss << "add.u   fp, " << i.args[0];
-                        } break;
-
-                        case IR_LEAF: {
-                            ss << "lea.l   " << map_register(i.args[0]) << ", [fp-" << i.args[1] << "]";
-                        } break;
-
-                        case IR_LOADF: {
-                            ss << "load.l  " << map_register(i.args[0]) << ", [fp-" << i.args[1] << "]";
-                        } break;
-
-                        case IR_LOADR: {
-                            ss << "load.l  " << map_register(i.args[0]) << ", [" << map_register(i.args[1]) << "]";
-                        } break;
-
-                        case IR_MOV: {
-                            ss << "move    " << map_register(i.args[0]) << ", " << map_register(i.args[1]);
-                        } break;
-
-                        case IR_MOVI: {
-                            ss << "li.w    " << map_register(i.args[0]) << ", !" << fmt_label(i.args[1]);
-                        } break;
-
-                        case IR_NOP: {
-                            ss << "nop     r0";
-                        } break;
-
-                        case IR_PUSHR: {
-                            ss << "push    " << map_register(i.args[0]);
-                        } break;
-
-                        case IR_POPR: {
-                            ss << "pop     " << map_register(i.args[0]);
-                        } break;
-
-                        case IR_RET: {
-                            ss << "ret     r0";
-                        } break;
-
-                        case IR_PASSTHROUGH: {
-                            ss << i.args[0];
-                        } break;
-
-                        case IR_STORE: {
-                            ss << "store.l [" << map_register(i.args[0]) << "], " << map_register(i.args[1]);
-                        } break;
-
-                        case IR_SUBSP: {
-                            ss << "sub.u   sp, " << i.args[0];
-                        } break;
-
-                        case IR_BRANCH: {
-                            ss << map_branch(i.args[0]) << std::string(8 - map_branch(i.args[0]).size(), ' ') << i.args[1];
-                        } break;
-
-                        case IR_DEFSTR: {
-                            ss << ".asciiz \"" << i.args[0] << "\"";
-                        } break;
-
-                        case IR_DEFINE: {
-                            ss << "#define " << i.args[0] << " " << i.args[1];
-                        } break;
-
-                        case IR_DEFBLOB: {
-                            ss << ".blob " << i.args[0];
-                        } break;
-                        
-                        case IR_UNDEF: {
-                            ss << "#undef " << i.args[0];
-                        } break;
-
-                        case IR_DEFV: {
-                            ss << ".long " << fmt_label(i.args[1]);
-                        } break;
-
-                        case IR_CMPZB: {
-                            std::string branch = map_branch(i.args[0]);
-
-                            ss << branch
-                               << std::string(8 - branch.size(), ' ')
-                               << map_register(i.args[1]) << ", "
-                               << "zero" << ", "
-                               << i.args[2];
-                        } break;
-
-                        case IR_CMPR: {
-                            ss << map_comp_op(i.args[0]) << "   "
-                               << map_register(i.args[1]) << ", "
-                               << map_register(i.args[1]) << ", "
-                               << map_register(i.args[2]);
-                        } break;
-                        
-                        case IR_SECTION: {
-                            ss << ".section " << i.args[0];
-                        } break;
-
-                        case IR_ORG: {
-                            ss << ".org " << i.args[0];
-                        } break;
-
-                        case IR_ENTRY: {
-                            ss << ".entry !" << fmt_label(i.args[0]);
-                        } break;
-
-                        case IR_DEBUG: {
-                            ss << "debug " << fmt_label(i.args[0]);
-                        } break;
-
-                        case IR_ALIGN: {
-                            ss << ".align " << fmt_label(i.args[0]);
-                        } break;
-                    }
+                    if (i.opcode == IR_MISC_BEGIN_INDENT) indented = true;
+                    if (i.opcode == IR_MISC_END_INDENT) indented = false;
+
+                    translate_instruction(ss, i);
 
                     ss << std::endl;
                 }
+
+                trace_end();
             }
 
             return ss.str();
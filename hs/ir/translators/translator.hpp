@@ -5,13 +5,59 @@
 
 #include "../../error.hpp"
 #include "../../cli.hpp"
+#include "../../report.hpp"
 
 #include <vector>
 
 namespace hs {
     class ir_translator_t {
+    protected:
+        time_report_t* m_report = nullptr;
+        symbol_table_t* m_symbols = nullptr;
+
+        bool m_in_function = false;
+
+        // Open a new time report span whenever a function's
+        // label is found, every instruction is counted on the
+        // function it belongs to
+        void trace(const ir_instruction_t& i) {
+            if (!m_report) return;
+
+            if ((i.opcode == IR_LABEL) && (i.types[0] == IO_SYMBOL) && m_symbols->get_name(i.args[0]).starts_with("F<")) {
+                trace_end();
+
+                m_report->begin_span("translate", m_symbols->get_name(i.args[0]));
+
+                m_in_function = true;
+            }
+
+            m_report->count();
+        }
+
+        std::string operand(const ir_instruction_t& i, int n) {
+            return print_ir_operand(m_symbols, i, n);
+        }
+
+        const std::string& name(const ir_instruction_t& i, int n) {
+            return m_symbols->get_name(i.args[n]);
+        }
+
+        void trace_end() {
+            if (m_report && m_in_function) m_report->end_span();
+
+            m_in_function = false;
+        }
+
     public:
         virtual void init(hs::ir_generator_t*, hs::error_logger_t*) {};
         virtual std::string translate() { return ""; };
+
+        // Registers the allocator can use, numbered like the IR
+        // registers map_register() takes
+        virtual std::vector <uint32_t> get_registers() { return {}; };
+
+        void set_time_report(time_report_t* report) {
+            m_report = report;
+        }
     };
 }
\ No newline at end of file
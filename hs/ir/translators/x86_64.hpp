@@ -3,7 +3,6 @@
 #include "translator.hpp"
 
 #include <sstream>
-#include <unordered_map>
 
 namespace hs {
     class ir_tr_x86_64_t : public ir_translator_t {
@@ -11,75 +10,46 @@ namespace hs {
         
         error_logger_t* m_logger;
 
-        std::unordered_map <std::string, std::string> m_register_map = {
-            { "LR" , "<LR_unimplemented>" },
-            { "TR" , "<TR_unimplemented>" },
-            { "PC" , "%pc"  },
-            { "SP" , "%rsp" },
-            { "FP" , "%rbp" },
-            { "R0" , "%rax" },
-            { "R1" , "%rbx" },
-            { "R2" , "%rcx" },
-            { "R3" , "%rdx" },
-            { "R4" , "%rsi" },
-            { "R5" , "%rdi" },
-            { "R6" , "%r8"  },
-            { "R7" , "%r9"  },
-            { "R8" , "%r10" },
-            { "R9" , "%r11" },
-            { "R10", "%r12" },
-            { "R11", "%r13" },
-            { "R12", "%r14" },
-            { "R13", "%r15" },
-            { "A0" , "%r15" }
-        };
-
-        enum bop_t {
-            BP_ADD,
-            BP_SUB,
-            BP_MUL,
-            BP_DIV,
-            BP_AND,
-            BP_OR,
-            BP_XOR,
-            BP_SHL,
-            BP_SHR
-        };
-
-        std::unordered_map <std::string, bop_t> m_bop_map = {
-            { "+" , BP_ADD },
-            { "-" , BP_SUB },
-            { "*" , BP_MUL },
-            { "/" , BP_DIV },
-            { "&" , BP_AND },
-            { "|" , BP_OR  },
-            { "^" , BP_XOR },
-            { "<<", BP_SHL },
-            { ">>", BP_SHR }
-        };
-
-        std::string map_binary_op(std::string bop_str) {
-            bop_t bop = m_bop_map[bop_str];
+        static std::string map_register(uint32_t reg) {
+            static const char* names[] = {
+                "%rax", "%rbx", "%rcx", "%rdx", "%rsi", "%rdi", "%r8",
+                "%r9", "%r10", "%r11", "%r12", "%r13", "%r14", "%r15"
+            };
+
+            switch (reg) {
+                case IR_REG_LR: return "<LR_unimplemented>";
+                case IR_REG_TR: return "<TR_unimplemented>";
+                case IR_REG_PC: return "%pc";
+                case IR_REG_SP: return "%rsp";
+                case IR_REG_FP: return "%rbp";
+                case IR_REG_A0: return "%r15";
+            }
+
+            return (reg < 14) ? names[reg] : "";
+        }
 
+        static std::string map_binary_op(uint32_t bop) {
             switch (bop) {
-                case BP_ADD: return "add";
-                case BP_SUB: return "sub";
-                case BP_MUL: return "mul";
-                case BP_DIV: return "div";
-                case BP_AND: return "and";
-                case BP_OR : return "or";
-                case BP_XOR: return "xor";
-                case BP_SHL: return "shl";
-                case BP_SHR: return "shr";
+                case IR_ALU_ADD: return "add";
+                case IR_ALU_SUB: return "sub";
+                case IR_ALU_MUL: return "mul";
+                case IR_ALU_DIV: return "div";
+                case IR_ALU_AND: return "and";
+                case IR_ALU_OR : return "or";
+                case IR_ALU_XOR: return "xor";
+                case IR_ALU_SHL: return "shl";
+                case IR_ALU_SHR: return "shr";
             }
 
             return "unimplemented_operator";
         }
 
-        static std::string map_branch(std::string cond) {
-            if (cond == "EQ") return "je";
-            if (cond == "NE") return "jne";
-            if (cond == "AL") return "jmp";
+        static std::string map_branch(uint32_t cond) {
+            switch (cond) {
+                case IR_COND_EQ: return "je";
+                case IR_COND_NE: return "jne";
+                case IR_COND_AL: return "jmp";
+            }
 
             return "unimplemented_branch";
         }
@@ -111,9 +81,15 @@ namespace hs {
     public:
         void init(ir_generator_t* irg, error_logger_t* logger) override {
             m_ir = irg->get_functions();
+            m_symbols = irg->get_symbols();
             m_logger = logger;
         }
 
+        // %rax to %r13, except %rcx which shifts overwrite
+        std::vector <uint32_t> get_registers() override {
+            return { 0, 1, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13 };
+        }
+
         std::string translate() override {
             bool indented = false;
 
@@ -123,35 +99,37 @@ namespace hs {
 
             for (std::vector <ir_instruction_t>& f : *m_ir) {
                 for (ir_instruction_t& i : f) {
+                    trace(i);
+
                     if (indented) ss << "    ";
 
                     switch (i.opcode) {
                         case IR_LABEL: {
-                            ss << "\n" << fmt_label(i.args[0]) << ":";
+                            ss << "\n" << fmt_label(operand(i, 0)) << ":";
 
                             indented = true;
                         } break;
 
                         case IR_ADDSP: {
-                            ss << "add %esp, " << i.args[0];
+                            ss << "add %esp, " << operand(i, 0);
                         } break;
 
                         case IR_ALU: {
                             std::string bop = map_binary_op(i.args[0]);
 
                             if ((bop == "shl") || (bop == "shr")) {
-                                ss << "mov %rcx, " << m_register_map[i.args[2]] << "\n";
+                                ss << "mov %rcx, " << map_register(i.args[2]) << "\n";
                                 
                                 if (indented) ss << "    ";
 
-                                ss << bop << " %cl, " << m_register_map[i.args[1]]; 
+                                ss << bop << " %cl, " << map_register(i.args[1]); 
                             } else {
-                                ss << map_binary_op(i.args[0]) << " " << m_register_map[i.args[1]] << ", " << m_register_map[i.args[2]];
+                                ss << map_binary_op(i.args[0]) << " " << map_register(i.args[1]) << ", " << map_register(i.args[2]);
                             }
                         } break;
 
                         case IR_CALLR: {
-                            ss << "call " << m_register_map[i.args[0]];
+                            ss << "call " << map_register(i.args[0]);
                         } break;
 
                         case IR_DECSP: {
@@ -159,27 +137,27 @@ namespace hs {
                         } break;
                         
                         case IR_ADDFP: {
-                            ss << "add %ebp, " << i.args[0];
+                            ss << "add %ebp, " << operand(i, 0);
                         } break;
 
                         case IR_LEAF: {
-                            ss << "leal " << m_register_map[i.args[0]] << ", (%ebp-" << i.args[1] << ")";
+                            ss << "leal " << map_register(i.args[0]) << ", (%ebp-" << operand(i, 1) << ")";
                         } break;
 
                         case IR_LOADF: {
-                            ss << "movl " << m_register_map[i.args[0]] << ", (%ebp-" << i.args[1] << ")";
+                            ss << "movl " << map_register(i.args[0]) << ", (%ebp-" << operand(i, 1) << ")";
                         } break;
 
                         case IR_LOADR: {
-                            ss << "movl " << m_register_map[i.args[0]] << ", (" << m_register_map[i.args[1]] << ")";
+                            ss << "movl " << map_register(i.args[0]) << ", (" << map_register(i.args[1]) << ")";
                         } break;
 
                         case IR_MOV: {
-                            ss << "mov " << m_register_map[i.args[0]] << ", " << m_register_map[i.args[1]]; 
+                            ss << "mov " << map_register(i.args[0]) << ", " << map_register(i.args[1]); 
                         } break;
 
                         case IR_MOVI: {
-                            ss << "movabs " << m_register_map[i.args[0]] << ", " << fmt_label(i.args[1]);
+                            ss << "movabs " << map_register(i.args[0]) << ", " << fmt_label(operand(i, 1));
                         } break;
 
                         case IR_NOP: {
@@ -187,11 +165,11 @@ namespace hs {
                         } break;
 
                         case IR_PUSHR: {
-                            ss << "push " << m_register_map[i.args[0]];
+                            ss << "push " << map_register(i.args[0]);
                         } break;
 
                         case IR_POPR: {
-                            ss << "pop " << m_register_map[i.args[0]];
+                            ss << "pop " << map_register(i.args[0]);
                         } break;
 
                         case IR_RET: {
@@ -201,57 +179,59 @@ namespace hs {
                         } break;
 
                         case IR_PASSTHROUGH: {
-                            ss << i.args[0];
+                            ss << operand(i, 0);
                         } break;
 
                         case IR_STORE: {
-                            ss << "movl (" << m_register_map[i.args[0]] << "), " << m_register_map[i.args[1]];
+                            ss << "movl (" << map_register(i.args[0]) << "), " << map_register(i.args[1]);
                         } break;
 
                         case IR_SUBSP: {
-                            ss << "sub %esp, " << i.args[0];
+                            ss << "sub %esp, " << operand(i, 0);
                         } break;
 
                         case IR_BRANCH: {
-                            ss << map_branch(i.args[0]) << " " << i.args[1];
+                            ss << map_branch(i.args[0]) << " " << operand(i, 1);
                         } break;
 
                         case IR_DEFSTR: {
-                            ss << ".asciiz \"" << i.args[0] << "\"";
+                            ss << ".asciiz \"" << operand(i, 0) << "\"";
                         } break;
 
                         case IR_DEFINE: {
-                            ss << "#define " << i.args[0] << " " << i.args[1];
+                            ss << "#define " << operand(i, 0) << " " << operand(i, 1);
                         } break;
                         
                         case IR_UNDEF: {
-                            ss << "#undef " << i.args[0];
+                            ss << "#undef " << operand(i, 0);
                         } break;
 
                         case IR_DEFV: {
-                            ss << ".dl " << fmt_label(i.args[1]);
+                            ss << ".dl " << fmt_label(operand(i, 0));
                         } break;
 
                         case IR_CMPZB: {
-                            ss << "cmp " << m_register_map[i.args[1]] << ", 0x0\n";
-                            ss << map_branch(i.args[0]) << " " << i.args[2];
+                            ss << "cmp " << map_register(i.args[1]) << ", 0x0\n";
+                            ss << map_branch(i.args[0]) << " " << operand(i, 2);
                         } break;
 
                         case IR_SECTION: {
-                            ss << ".section " << i.args[0];
+                            ss << ".section " << operand(i, 0);
                         };
 
                         case IR_ORG: {
-                            ss << ".org " << i.args[0];
+                            ss << ".org " << operand(i, 0);
                         } break;
 
                         case IR_ENTRY: {
-                            ss << ".entry " << fmt_label(i.args[0]);
+                            ss << ".entry " << fmt_label(operand(i, 0));
                         };
                     }
 
                     ss << std::endl;
                 }
+
+                trace_end();
             }
 
             return ss.str();
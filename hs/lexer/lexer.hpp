@@ -3,500 +3,424 @@
 #include <iostream>
 #include <string>
 #include <cctype>
+#include <cstdint>
+#include <array>
 #include <unordered_map>
 
 #include "../stream.hpp"
 #include "../error.hpp"
+#include "../pipeline.hpp"
+#include "../source.hpp"
+#include "../precompiled.hpp"
+#include "../symbols.hpp"
+#include "../preprocessor/preprocessor.hpp"
 
 #include "token.hpp"
 
 namespace hs {
-    class lexer_t {
-        std::istream* m_input;
-        stream_t <lexer_token_t> m_output;
+    typedef spsc_queue_t <token_buffer_t> token_queue_t;
+
+    enum lexer_char_class_t : uint8_t {
+        CC_SPACE        = 0x01,
+        CC_IDENT_START  = 0x02,
+        CC_IDENT        = 0x04,
+        CC_DIGIT        = 0x08,
+        CC_NUMBER       = 0x10
+    };
 
-        error_logger_t* m_logger;
+    // ASCII only, std::isalpha() and friends depend on the locale
+    constexpr std::array <uint8_t, 256> make_lexer_char_classes() {
+        std::array <uint8_t, 256> classes = {};
 
-        unsigned int m_line = 0, m_offset = 0;
+        for (int c = 0; c < 256; c++) {
+            bool lower = (c >= 'a') && (c <= 'z');
+            bool upper = (c >= 'A') && (c <= 'Z');
+            bool digit = (c >= '0') && (c <= '9');
+            bool hex = digit || ((c >= 'a') && (c <= 'f')) || ((c >= 'A') && (c <= 'F'));
 
-        enum lex_status_t : int {
-            ST_NO_MATCH,
-            ST_MATCH,
-            ST_ERROR
-        };
+            if ((c == ' ') || ((c >= '\t') && (c <= '\r'))) classes[c] |= CC_SPACE;
+            if (lower || upper || (c == '_')) classes[c] |= CC_IDENT_START | CC_IDENT;
+            if (digit) classes[c] |= CC_DIGIT | CC_IDENT;
 
-        struct result_t {
-            lex_status_t status;
+            // Numeric literals (i.e. 0x1f, 0b101, 1.5)
+            if (hex || (c == 'b') || (c == 'x') || (c == '.')) classes[c] |= CC_NUMBER;
+        }
 
-            std::string error;
+        return classes;
+    }
 
-            unsigned int line = 0, offset = 0, len = 1;
-        };
+    constexpr std::array <uint8_t, 256> lexer_char_classes = make_lexer_char_classes();
 
-        typedef result_t (*lex_fn_t)(void);
+    inline bool is_class(char c, uint8_t cc) {
+        return lexer_char_classes[(uint8_t)c] & cc;
+    }
 
-        char m_current;
+    // DFA matching lexer_operators (see token.hpp). State 0 is the
+    // start state, a transition to state 0 means there's no match.
+    // State i + 1 accepts operator i
+    constexpr size_t lexer_operator_count = sizeof(lexer_operators) / sizeof(lexer_operator_t);
 
-        lexer_token_t m_current_token;
+    struct lexer_dfa_t {
+        uint8_t next[lexer_operator_count + 1][256] = {};
+        uint8_t accept[lexer_operator_count + 1] = {};
+    };
 
-#define CONSUME { m_current = m_input->get(); m_offset++; } 
-#define MATCH { ST_MATCH, "" };
-#define NO_MATCH { ST_NO_MATCH, "" };
-#define ERROR(msg, errl) { ST_ERROR, msg, m_line, m_offset, errl };
+    constexpr lexer_dfa_t make_lexer_dfa() {
+        lexer_dfa_t dfa;
 
-        result_t lex_asm_block() {
-            m_current_token.type = LT_ASM_BLOCK;
+        for (size_t i = 0; i < lexer_operator_count; i++) {
+            const char* text = lexer_operators[i].text;
 
-            ignore_whitespace();
+            size_t state = 0;
 
-            if (m_current != '{') {
-                return ERROR("Expected '{' after asm block declaration", 1);
-            }
+            // Follow the operator's prefix, it has to be there
+            for (size_t j = 0; text[j + 1]; j++) {
+                state = dfa.next[state][(uint8_t)text[j]];
 
-            int matching_braces = 1;
+                if (!state) throw "Operator prefix isn't an operator";
+            }
 
-            m_current_token.text.clear();
+            size_t last = 0;
 
-            CONSUME;
+            while (text[last + 1]) last++;
 
-            while (matching_braces) {
-                if (m_current == '\n') {
-                    m_offset = 0;
-                    m_line++;
-                }
+            dfa.next[state][(uint8_t)text[last]] = i + 1;
+            dfa.accept[i + 1] = i;
+        }
 
-                if (m_current == '{') matching_braces++;
-                if (m_current == '}') matching_braces--;
+        return dfa;
+    }
 
-                if (m_current == '}' && !matching_braces) {
-                    break;
-                }
+    constexpr lexer_dfa_t lexer_dfa = make_lexer_dfa();
 
-                m_current_token.text.push_back(m_current);
+    typedef stream_t <lexer_token_t, token_buffer_t> token_stream_t;
 
-                CONSUME;
-            }
+    // Same as std::stoull(text, nullptr, 0) without the copy, parsing
+    // stops at the first character that isn't a digit (i.e. "1.5" is
+    // 1, "0b101" is 0). Overflowing literals wrap around
+    inline uint64_t decode_numeric_literal(std::string_view text) {
+        int base = 10;
+        size_t i = 0;
 
-            CONSUME;
+        if ((text.size() > 1) && (text[0] == '0')) {
+            bool hex = (text.size() > 2) &&
+                       ((text[1] == 'x') || (text[1] == 'X')) &&
+                       std::isxdigit((unsigned char)text[2]);
 
-            return MATCH;
+            base = hex ? 16 : 8;
+            i = hex ? 2 : 0;
         }
 
-        result_t try_lex_identifier() {
-            if (!(std::isalpha(m_current) || m_current == '_')) return NO_MATCH;
+        uint64_t value = 0;
 
-            m_current_token.line = m_line;
-            m_current_token.offset = m_offset;
+        for (; i < text.size(); i++) {
+            char c = text[i];
+            int digit = 16;
 
-            m_current_token.text.push_back(m_current);
+            if ((c >= '0') && (c <= '9')) digit = c - '0';
+            if ((c >= 'a') && (c <= 'f')) digit = c - 'a' + 10;
+            if ((c >= 'A') && (c <= 'F')) digit = c - 'A' + 10;
 
-            CONSUME;
+            if (digit >= base) break;
 
-            while (std::isalnum(m_current) || m_current == '_') {
-                m_current_token.text.push_back(m_current);
+            value = (value * base) + digit;
+        }
 
-                CONSUME;
-            }
+        return value;
+    }
 
-            if (m_current_token.text == "asm") {
-                return lex_asm_block();
-            }
+    class lexer_t {
+        source_reader_t m_input;
+        token_stream_t m_output;
 
-            m_current_token.type = LT_IDENT;
+        // Tokens are sent in batches when streaming, see set_output()
+        token_queue_t* m_queue = nullptr;
+        token_buffer_t m_batch;
+        size_t m_batch_size = 0x400;
+        size_t m_count = 0;
 
-            return MATCH;
-        }
+        // Brace nesting, precompiled headers included inside
+        // blocks are spliced in as tokens
+        int m_depth = 0;
 
-#define SINGLE(c) \
-    m_current_token.text = c; \
-    m_current_token.line = m_line; \
-    m_current_token.offset = m_offset; \
-    CONSUME;
-
-        result_t try_lex_structural() {
-            switch (m_current) {
-                case '{': SINGLE("{"); m_current_token.type = LT_OPENING_BRACE  ; return MATCH;
-                case '}': SINGLE("}"); m_current_token.type = LT_CLOSING_BRACE  ; return MATCH;
-                case '(': SINGLE("("); m_current_token.type = LT_OPENING_PARENT ; return MATCH;
-                case ')': SINGLE(")"); m_current_token.type = LT_CLOSING_PARENT ; return MATCH;
-                case '[': SINGLE("["); m_current_token.type = LT_OPENING_BRACKET; return MATCH;
-                case ']': SINGLE("]"); m_current_token.type = LT_CLOSING_BRACKET; return MATCH;
-                case ':': SINGLE(":"); m_current_token.type = LT_COLON          ; return MATCH;
-                case ';': SINGLE(";"); m_current_token.type = LT_SEMICOLON      ; return MATCH;
-                case '.': SINGLE("."); m_current_token.type = LT_DOT            ; return MATCH;
-                case ',': SINGLE(","); m_current_token.type = LT_COMMA          ; return MATCH;
-            }
+        error_logger_t* m_logger;
 
-            return NO_MATCH;
-        }
+        // Identifiers are interned here, when set
+        symbol_table_t* m_symbols = nullptr;
 
-        result_t try_lex_operator() {
-            char next = m_input->peek();
-
-            switch (m_current) {
-                case '+': {
-                    switch (next) {
-                        case '=': {
-                            m_current_token.text = "+=";
-                            m_current_token.line = m_line;
-                            m_current_token.offset = m_offset;
-                            m_current_token.type = LT_OPERATOR_ASSIGN;
-
-                            CONSUME; CONSUME;
-                        } break;
-
-                        case '+': {
-                            m_current_token.text = "++";
-                            m_current_token.line = m_line;
-                            m_current_token.offset = m_offset;
-                            m_current_token.type = LT_OPERATOR_UNARY;
-
-                            CONSUME; CONSUME;
-                        } break;
-
-                        default: {
-                            SINGLE('+');
-
-                            m_current_token.type = LT_OPERATOR_BINARY;
-                        } break;
-                    }
+        unsigned int m_line = 0, m_offset = 0;
 
-                    return MATCH;
-                } break;
+        // Position of m_current on the input
+        size_t m_pos = 0;
 
-                case '-': {
-                    switch (next) {
-                        case '>': {
-                            m_current_token.text = "->";
-                            m_current_token.line = m_line;
-                            m_current_token.offset = m_offset;
-                            m_current_token.type = LT_ARROW;
+        // Input's over, or there was an error
+        bool m_done = false;
 
-                            CONSUME; CONSUME;
-                        } break;
+        enum lex_status_t : int {
+            ST_NO_MATCH,
+            ST_MATCH,
+            ST_ERROR
+        };
 
-                        case '-': {
-                            m_current_token.text = "--";
-                            m_current_token.line = m_line;
-                            m_current_token.offset = m_offset;
-                            m_current_token.type = LT_OPERATOR_UNARY;
+        struct result_t {
+            lex_status_t status;
 
-                            CONSUME; CONSUME;
-                        } break;
+            std::string error;
 
-                        case '=': {
-                            m_current_token.text = "-=";
-                            m_current_token.line = m_line;
-                            m_current_token.offset = m_offset;
-                            m_current_token.type = LT_OPERATOR_ASSIGN;
+            unsigned int line = 0, offset = 0, len = 1;
+        };
 
-                            CONSUME; CONSUME;
-                        } break;
+        typedef result_t (*lex_fn_t)(void);
 
-                        default: {
-                            SINGLE('-');
+        char m_current;
 
-                            m_current_token.type = LT_OPERATOR_BINARY;
-                        } break;
-                    }
+        // Tokens are spans of the input, [m_start, m_end) for the
+        // current token. Streamed input goes away as we go, so the
+        // text is copied to m_text instead (m_keep points to it)
+        lexer_token_t m_current_token;
 
-                    return MATCH;
-                } break;
+        size_t m_start = 0, m_end = 0;
 
-                case '*': {
-                    switch (next) {
-                        case '=': {
-                            m_current_token.text = "*=";
-                            m_current_token.line = m_line;
-                            m_current_token.offset = m_offset;
-                            m_current_token.type = LT_OPERATOR_ASSIGN;
+        std::string m_text;
+        std::string* m_keep = nullptr;
 
-                            CONSUME; CONSUME;
-                        } break;
+        std::string_view m_source;
 
-                        default: {
-                            SINGLE('*');
+        // Text that isn't on the input (i.e. char literals)
+        bool m_synthesized = false;
 
-                            m_current_token.type = LT_STAR;
-                        } break;
-                    }
+        // Preprocess as we go when set (see --integrated-preprocessor),
+        // this is the preprocessor of the file we're lexing
+        preprocessor_t* m_preprocessor = nullptr;
 
-                    return MATCH;
-                } break;
+        line_map_t* m_line_map = nullptr;
+        uint32_t m_file = 0;
 
-                case '/': {
-                    switch (next) {
-                        case '=': {
-                            m_current_token.text = "/=";
-                            m_current_token.line = m_line;
-                            m_current_token.offset = m_offset;
-                            m_current_token.type = LT_OPERATOR_ASSIGN;
+        // Files we're in the middle of while lexing an include,
+        // innermost last. Tokens from includes have their text
+        // copied, they can only be spans of the top level input
+        struct frame_t {
+            source_reader_t input;
+            std::string_view source;
+            std::string* keep;
 
-                            CONSUME; CONSUME;
-                        } break;
+            size_t pos;
+            char current;
+            unsigned int offset;
 
-                        default: {
-                            SINGLE('/');
+            preprocessor_t* preprocessor;
 
-                            m_current_token.type = LT_OPERATOR_BINARY;
-                        } break;
-                    }
+            // Where to resume on the line map
+            uint32_t file;
+            unsigned int file_line;
 
-                    return MATCH;
-                } break;
+            // What's being lexed on top of us
+            preprocessor_include_t include;
+        };
 
-                case '&': {
-                    switch (next) {
-                        case '=': {
-                            m_current_token.text = "&=";
-                            m_current_token.line = m_line;
-                            m_current_token.offset = m_offset;
-                            m_current_token.type = LT_OPERATOR_ASSIGN;
+        std::vector <frame_t> m_frames;
 
-                            CONSUME; CONSUME;
-                        } break;
+        // Define values are lexed once, on their first use
+        std::unordered_map <std::string, token_buffer_t> m_macros;
 
-                        case '&': {
-                            m_current_token.text = "&&";
-                            m_current_token.line = m_line;
-                            m_current_token.offset = m_offset;
-                            m_current_token.type = LT_OPERATOR_COMP;
+#define CONSUME { m_current = m_input.get(); m_offset++; m_pos++; } 
+#define MATCH { ST_MATCH, "" };
+#define NO_MATCH { ST_NO_MATCH, "" };
+#define ERROR(msg, errl) { ST_ERROR, msg, m_line, m_offset, errl };
 
-                            CONSUME; CONSUME;
-                        } break;
+        void begin_token(size_t start) {
+            m_current_token.line = m_line;
+            m_current_token.offset = m_offset;
+            m_current_token.value = 0;
 
-                        default: {
-                            SINGLE('&');
+            m_start = start;
+            m_synthesized = false;
 
-                            m_current_token.type = LT_AMPERSAND;
-                        } break;
-                    }
+            m_text.clear();
+        }
 
-                    return MATCH;
-                } break;
+        std::string_view get_text() {
+            if (m_keep || m_synthesized) return m_text;
 
-                case '|': {
-                    switch (next) {
-                        case '=': {
-                            m_current_token.text = "|=";
-                            m_current_token.line = m_line;
-                            m_current_token.offset = m_offset;
-                            m_current_token.type = LT_OPERATOR_ASSIGN;
+            return m_source.substr(m_start, m_end - m_start);
+        }
 
-                            CONSUME; CONSUME;
-                        } break;
+        result_t lex_asm_block() {
+            m_current_token.type = LT_ASM_BLOCK;
 
-                        case '|': {
-                            m_current_token.text = "||";
-                            m_current_token.line = m_line;
-                            m_current_token.offset = m_offset;
-                            m_current_token.type = LT_OPERATOR_COMP;
+            ignore_whitespace();
 
-                            CONSUME; CONSUME;
-                        } break;
+            if (m_current != '{') {
+                return ERROR("Expected '{' after asm block declaration", 1);
+            }
 
-                        default: {
-                            SINGLE('|');
+            int matching_braces = 1;
 
-                            m_current_token.type = LT_OPERATOR_BINARY;
-                        } break;
-                    }
+            m_text.clear();
 
-                    return MATCH;
-                } break;
+            CONSUME;
 
-                case '^': {
-                    switch (next) {
-                        case '=': {
-                            m_current_token.text = "^=";
-                            m_current_token.line = m_line;
-                            m_current_token.offset = m_offset;
-                            m_current_token.type = LT_OPERATOR_ASSIGN;
+            m_start = m_pos;
 
-                            CONSUME; CONSUME;
-                        } break;
+            // Defines apply to asm blocks too when preprocessing, so
+            // their text is ours instead of the input's
+            if (m_preprocessor)
+                m_synthesized = true;
 
-                        case '^': {
-                            m_current_token.text = "^^";
-                            m_current_token.line = m_line;
-                            m_current_token.offset = m_offset;
-                            m_current_token.type = LT_OPERATOR_COMP;
+            while (matching_braces) {
+                if (m_current == '\n') {
+                    m_offset = 0;
+                    m_line++;
+                }
 
-                            CONSUME; CONSUME;
-                        } break;
+                if (m_preprocessor && !m_input.eof()) {
+                    if (m_current == '#') {
+                        preprocessor_include_t include;
 
-                        default: {
-                            SINGLE('^');
+                        if (!m_preprocessor->directive(get_directive_line(), &include))
+                            continue;
 
-                            m_current_token.type = LT_OPERATOR_BINARY;
-                        } break;
-                    }
+                        if (include.preprocessor || include.precompiled)
+                            return ERROR("#include isn't supported inside asm blocks", 1);
 
-                    return MATCH;
-                } break;
-
-                case '!': {
-                    switch (next) {
-                        case '=': {
-                            m_current_token.text = "!=";
-                            m_current_token.line = m_line;
-                            m_current_token.offset = m_offset;
-                            m_current_token.type = LT_OPERATOR_COMP;
-                            
-                            CONSUME; CONSUME;
-                        } break;
-
-                        default: {
-                            SINGLE('!');
-
-                            m_current_token.type = LT_OPERATOR_UNARY;
-                        } break;
+                        continue;
                     }
 
-                    return MATCH;
-                } break;
+                    if (is_class(m_current, CC_IDENT_START)) {
+                        std::string name(1, m_current);
+
+                        size_t n = m_input.take_while(&name, [](char c) {
+                            return is_class(c, CC_IDENT);
+                        });
+
+                        m_offset += n;
+                        m_pos += n;
 
-                case '%': {
-                    switch (next) {
-                        case '=': {
-                            m_current_token.text = "%=";
-                            m_current_token.line = m_line;
-                            m_current_token.offset = m_offset;
-                            m_current_token.type = LT_OPERATOR_ASSIGN;
+                        const std::string* value = m_preprocessor->get_define(name);
 
-                            CONSUME; CONSUME;
-                        } break;
-                        default: {
-                            SINGLE('%');
+                        m_text.append(value ? *value : name);
 
-                            m_current_token.type = LT_OPERATOR_BINARY;
-                        } break;
+                        CONSUME;
+
+                        continue;
                     }
+                }
 
-                    return MATCH;
-                } break;
+                if (m_current == '{') matching_braces++;
+                if (m_current == '}') matching_braces--;
 
-                case '=': {
-                    switch (next) {
-                        case '=': {
-                            m_current_token.text = "==";
-                            m_current_token.line = m_line;
-                            m_current_token.offset = m_offset;
-                            m_current_token.type = LT_OPERATOR_COMP;
+                if (m_current == '}' && !matching_braces) {
+                    break;
+                }
 
-                            CONSUME; CONSUME;
-                        } break;
-                        default: {
-                            SINGLE("=");
+                if (m_keep || m_synthesized) m_text.push_back(m_current);
 
-                            m_current_token.type = LT_OPERATOR_ASSIGN;
-                        } break;
-                    }
+                CONSUME;
+            }
 
-                    return MATCH;
-                } break;
+            m_end = m_pos;
 
-                case '<': {
-                    switch (next) {
-                        case '=': {
-                            m_current_token.text = "<=";
-                            m_current_token.line = m_line;
-                            m_current_token.offset = m_offset;
-                            m_current_token.type = LT_OPERATOR_COMP;
+            CONSUME;
 
-                            CONSUME; CONSUME;
-                        } break;
+            return MATCH;
+        }
 
-                        case '<': {
-                            m_current_token.text = "<<";
-                            m_current_token.line = m_line;
-                            m_current_token.offset = m_offset;
-                            m_current_token.type = LT_OPERATOR_BINARY;
+        result_t try_lex_identifier() {
+            if (!is_class(m_current, CC_IDENT_START)) return NO_MATCH;
 
-                            CONSUME; CONSUME;
-                        } break;
+            begin_token(m_pos);
 
-                        default: {
-                            SINGLE("<");
+            if (m_keep) m_text.push_back(m_current);
 
-                            m_current_token.type = LT_OPERATOR_COMP;
-                        } break;
-                    }
+            size_t n = m_input.take_while(m_keep, [](char c) {
+                return is_class(c, CC_IDENT);
+            });
+
+            m_offset += n;
+            m_pos += n;
+
+            CONSUME;
 
-                    return MATCH;
-                } break;
+            m_end = m_pos;
 
-                case '>': {
-                    switch (next) {
-                        case '=': {
-                            m_current_token.text = ">=";
-                            m_current_token.line = m_line;
-                            m_current_token.offset = m_offset;
-                            m_current_token.type = LT_OPERATOR_COMP;
+            if (get_text() == "asm") {
+                return lex_asm_block();
+            }
 
-                            CONSUME; CONSUME;
-                        } break;
+            m_current_token.type = LT_IDENT;
 
-                        case '>': {
-                            m_current_token.text = ">>";
-                            m_current_token.line = m_line;
-                            m_current_token.offset = m_offset;
-                            m_current_token.type = LT_OPERATOR_BINARY;
+            return MATCH;
+        }
 
-                            CONSUME; CONSUME;
-                        } break;
+        // Operators and structural characters, longest match wins.
+        // All prefixes of operators are operators, so we can stop
+        // on the first character without a transition
+        result_t try_lex_operator() {
+            int state = lexer_dfa.next[0][(uint8_t)m_current];
 
-                        default: {
-                            SINGLE("<");
+            if (!state) return NO_MATCH;
 
-                            m_current_token.type = LT_OPERATOR_COMP;
-                        } break;
-                    }
+            begin_token(m_pos);
+
+            CONSUME;
 
-                    return MATCH;
-                } break;
+            while (int next = lexer_dfa.next[state][(uint8_t)m_current]) {
+                state = next;
 
-                case '~': SINGLE('~'); m_current_token.type = LT_OPERATOR_UNARY ; return MATCH;
+                CONSUME;
             }
 
-            return NO_MATCH;
-        }
+            m_end = m_pos;
+
+            const lexer_operator_t& op = lexer_operators[lexer_dfa.accept[state]];
 
-#undef SINGLE
+            if (m_keep) m_text = op.text;
+
+            m_current_token.type = op.type;
+
+            return MATCH;
+        }
 
         result_t try_lex_literal() {
-            if (std::isdigit(m_current)) {
+            if (is_class(m_current, CC_DIGIT)) {
                 // Parse numeric literal
 
-                m_current_token.line = m_line;
-                m_current_token.offset = m_offset;
+                begin_token(m_pos);
 
-                m_current_token.text.push_back(m_current);
+                if (m_keep) m_text.push_back(m_current);
 
-                CONSUME;
+                size_t n = m_input.take_while(m_keep, [](char c) {
+                    return is_class(c, CC_NUMBER);
+                });
 
-                while (std::isxdigit(m_current) || m_current == 'b' || m_current == 'x' || m_current == '.') {
-                    m_current_token.text.push_back(m_current);
+                m_offset += n;
+                m_pos += n;
 
-                    CONSUME;
-                }
+                CONSUME;
+
+                m_end = m_pos;
 
                 m_current_token.type = LT_LITERAL_NUMERIC;
+                m_current_token.value = decode_numeric_literal(get_text());
 
                 return MATCH;
             } else if (m_current == '\"') {
                 // Parse string literal
 
-                m_current_token.line = m_line;
-                m_current_token.offset = m_offset;
+                begin_token(m_pos + 1);
+
+                size_t n = m_input.take_until(m_keep, '\"');
+
+                m_offset += n;
+                m_pos += n;
 
                 CONSUME;
 
-                while (m_current != '\"') {
-                    m_current_token.text.push_back(m_current);
+                // Point at the opening quote, EOF has no location
+                if (m_current != '\"')
+                    return { ST_ERROR, "Unterminated string literal", m_current_token.line, m_current_token.offset, 1 };
 
-                    CONSUME;
-                }
+                m_end = m_pos;
 
                 CONSUME;
 
@@ -506,12 +430,14 @@ namespace hs {
             } else if (m_current == '\'') {
                 // Parse char literal
 
-                m_current_token.line = m_line;
-                m_current_token.offset = m_offset;
+                begin_token(m_pos);
 
                 CONSUME;
 
-                m_current_token.text = std::to_string((int)m_current);
+                m_text = std::to_string((int)m_current);
+                m_synthesized = true;
+
+                m_current_token.value = (int)m_current;
 
                 CONSUME;
 
@@ -529,7 +455,7 @@ namespace hs {
         }
 
         void ignore_whitespace() {
-            while (std::isspace(m_current)) {
+            while (is_class(m_current, CC_SPACE)) {
                 if (m_current == '\n') {
                     m_offset = 0;
                     m_line++;
@@ -537,7 +463,8 @@ namespace hs {
                     m_offset++;
                 }
 
-                m_current = m_input->get();
+                m_current = m_input.get();
+                m_pos++;
             }
         }
 
@@ -550,9 +477,9 @@ namespace hs {
     r = try_lex_##lt(); \
 \
     if (r.status == ST_MATCH) { \
-        m_output.put(m_current_token); \
+        put(); \
 \
-        continue; \
+        return true; \
     } \
     if (r.status == ST_ERROR) { \
         if (m_logger) m_logger->print_error( \
@@ -561,32 +488,352 @@ namespace hs {
             r.line, r.offset, 1 \
         ); \
 \
-        return; \
+        m_done = true; \
+\
+        return false; \
     }
 
-        bool fix_keyword(lexer_token_t* token) {
-            if (token->type != LT_IDENT) return false;
+        // Identifiers that aren't keywords get their symbol
+        void fix_keyword() {
+            if (m_current_token.type != LT_IDENT) return;
+
+            std::string_view text = get_text();
+
+            m_current_token.type = get_keyword_type(text);
+
+            if ((m_current_token.type == LT_IDENT) && m_symbols)
+                m_current_token.value = m_symbols->intern(text);
+        }
+
+        token_buffer_t* get_buffer() {
+            return m_queue ? &m_batch : m_output.data();
+        }
+
+        void commit(lexer_token_type_t type) {
+            m_count++;
+
+            if (type == LT_OPENING_BRACE) m_depth++;
+            if (type == LT_CLOSING_BRACE) m_depth--;
+
+            if (m_queue && (m_batch.size() == m_batch_size))
+                flush();
+        }
+
+        // Directive lines are handed to the current file's
+        // preprocessor, this takes the text after the '#' up to the
+        // end of the line. The newline is left on the input
+        std::string get_directive_line() {
+            std::string line;
+
+            m_current = m_input.get();
+            m_offset++;
+            m_pos++;
 
-            if (keyword_map.contains(token->text)) {
-                token->type = keyword_map[token->text];
+            if ((m_current == '\n') || (m_current == '\r') || m_input.eof())
+                return line;
 
+            line.push_back(m_current);
+
+            size_t n = m_input.take_while(&line, [](char c) {
+                return (c != '\n') && (c != '\r');
+            });
+
+            m_current = m_input.get();
+            m_offset += n + 1;
+            m_pos += n + 1;
+
+            return line;
+        }
+
+        bool lex_directive() {
+            unsigned int line = m_line, offset = m_offset;
+
+            preprocessor_include_t include;
+
+            if (!m_preprocessor->directive(get_directive_line(), &include))
                 return true;
+
+            if (include.precompiled)
+                return put_precompiled(include.path, line, offset);
+
+            if (include.preprocessor)
+                begin_file(std::move(include));
+
+            return true;
+        }
+
+        // Lex an include's file in place
+        void begin_file(preprocessor_include_t include) {
+            frame_t frame = {
+                m_input, m_source, m_keep,
+                m_pos, m_current, m_offset,
+                m_preprocessor,
+                m_file, 0
+            };
+
+            if (m_line_map)
+                m_line_map->lookup(m_line, frame.file, frame.file_line);
+
+            m_frames.push_back(std::move(frame));
+
+            frame_t& top = m_frames.back();
+
+            top.include = std::move(include);
+
+            m_preprocessor = top.include.preprocessor.get();
+            m_source = top.include.source->view();
+            m_keep = &m_text;
+
+            m_input.init(m_source);
+
+            m_current = m_input.get();
+            m_pos = 0;
+            m_offset = 0;
+
+            if (m_line_map) {
+                m_file = m_line_map->add_file(top.include.path, top.include.source);
+                m_line_map->enter(m_line, m_file, 0);
             }
+        }
 
-            return false;
+        // Back to the file that included the one we just finished
+        void end_file() {
+            frame_t& frame = m_frames.back();
+
+            frame.preprocessor->end_include(frame.include);
+
+            m_input = frame.input;
+            m_source = frame.source;
+            m_keep = frame.keep;
+            m_pos = frame.pos;
+            m_current = frame.current;
+            m_offset = frame.offset;
+            m_preprocessor = frame.preprocessor;
+            m_file = frame.file;
+
+            if (m_line_map)
+                m_line_map->enter(m_line, frame.file, frame.file_line);
+
+            m_frames.pop_back();
+        }
+
+        const token_buffer_t& get_macro(const std::string& value) {
+            auto it = m_macros.find(value);
+
+            if (it != m_macros.end())
+                return it->second;
+
+            lexer_t lexer;
+
+            lexer.init(value, m_logger);
+            lexer.lex();
+
+            token_buffer_t& tokens = m_macros[value];
+            token_buffer_t* output = lexer.get_output()->data();
+
+            for (size_t i = 0; i < output->size(); i++)
+                tokens.push((*output)[i]);
+
+            return tokens;
+        }
+
+        // Identifiers defined on the current file (or by its includes)
+        // are replaced by the tokens of their value
+        bool substitute() {
+            const std::string* value = m_preprocessor->get_define(get_text());
+
+            if (!value) return false;
+
+            const token_buffer_t& tokens = get_macro(*value);
+
+            for (size_t i = 0; i < tokens.size(); i++) {
+                lexer_token_t token = tokens[i];
+
+                token.line = m_current_token.line;
+                token.offset += m_current_token.offset;
+
+                put(token);
+            }
+
+            return true;
+        }
+
+        // Put the current token
+        void put() {
+            if (m_preprocessor && (m_current_token.type == LT_IDENT) && substitute())
+                return;
+
+            fix_keyword();
+
+            lexer_token_t& token = m_current_token;
+
+            if (m_keep || m_synthesized) {
+                get_buffer()->push(token.type, token.line, token.offset, m_text, token.value);
+            } else {
+                get_buffer()->push_span(token.type, token.line, token.offset, m_start, m_end - m_start, token.value);
+            }
+
+            commit(token.type);
+        }
+
+        // Tokens from somewhere else (i.e. precompiled headers),
+        // their symbols belong to another table
+        void put(lexer_token_t token) {
+            if ((token.type == LT_IDENT) && m_symbols)
+                token.value = m_symbols->intern(token.text);
+
+            get_buffer()->push(token);
+
+            commit(token.type);
+        }
+
+        void flush() {
+            if (m_batch.size())
+                m_queue->push(std::move(m_batch));
+
+            m_batch.clear();
         }
 
-        void fix_types() {
-            for (auto& token : m_output) {
-                if (fix_keyword(&token)) continue;
+        // Precompiled header markers (see preprocessor_t::load_precompiled())
+        // become a single token on the top level, the parser then
+        // takes the header's AST from the image
+        bool lex_precompiled() {
+            unsigned int line = m_line, offset = m_offset;
+
+            std::string path;
+
+            m_current = m_input.get();
+            m_pos++;
+
+            while ((m_current != m_precompiled_marker) && !m_input.eof()) {
+                path.push_back(m_current);
+
+                m_current = m_input.get();
+                m_pos++;
             }
+
+            // Skip the image's time and size, they're only there
+            // for the output cache
+            do {
+                m_current = m_input.get();
+                m_pos++;
+            } while ((m_current != m_precompiled_marker) && !m_input.eof());
+
+            m_current = m_input.get();
+            m_pos++;
+
+            return put_precompiled(path, line, offset);
+        }
+
+        bool put_precompiled(const std::string& path, unsigned int line, unsigned int offset) {
+            lexer_token_t token;
+
+            token.type = LT_PRECOMPILED;
+            token.line = line;
+            token.offset = offset;
+            token.text = path;
+
+            if (!m_depth) {
+                put(token);
+
+                return true;
+            }
+
+            precompiled_reader_t image;
+            token_buffer_t tokens;
+
+            if (!(image.load(path) && image.get_tokens(tokens))) {
+                if (m_logger) m_logger->print_error(
+                    "lexer",
+                    fmt("Couldn't load precompiled header \"%s\"", path.c_str()),
+                    token.line, token.offset, 1
+                );
+
+                return false;
+            }
+
+            for (size_t i = 0; i < tokens.size(); i++)
+                put(tokens[i]);
+
+            return true;
+        }
+
+        // Lex the next token (or the next precompiled header's),
+        // false once the input is over or on errors
+        bool lex_next() {
+            result_t r;
+
+            if (m_done) return false;
+
+            // Nobody's listening anymore
+            if (m_queue && m_queue->is_closed())
+                return false;
+
+            ignore_whitespace();
+
+            if (m_input.eof()) {
+                if (m_frames.size()) {
+                    end_file();
+
+                    return true;
+                }
+
+                m_done = true;
+
+                return false;
+            }
+
+            if (m_preprocessor && (m_current == '#'))
+                return lex_directive();
+
+            if (m_current == m_precompiled_marker) {
+                m_done = !lex_precompiled();
+
+                return !m_done;
+            }
+
+            TRY_LEX(identifier);
+            TRY_LEX(literal);
+            TRY_LEX(operator);
+
+            if (m_logger) m_logger->print_error(
+                "lexer",
+                fmt("Unexpected character \'" ESCAPE(37;1) "%c" ESCAPE(0) "\'", m_current),
+                m_line, m_offset, 1
+            );
+
+            m_done = true;
+
+            return false;
         }
 
     public:
-        void init(std::istream* input, error_logger_t* logger) {
-            m_input = input;
+        void init(std::string_view input, error_logger_t* logger) {
+            m_input.init(input);
+
+            m_source = input;
+            m_keep = nullptr;
+
+            m_output.data()->set_source(input);
+
+            m_current = m_input.get();
+            m_pos = 0;
+            m_done = false;
+            m_logger = logger;
+
+            m_frames.clear();
+        }
+
+        // Lex text chunks as they come in (see --streaming)
+        void init(text_queue_t* input, error_logger_t* logger) {
+            m_input.init(input);
+
+            m_source = std::string_view();
+            m_keep = &m_text;
 
-            m_current = m_input->get();
+            m_current = m_input.get();
+            m_pos = 0;
+            m_done = false;
             m_logger = logger;
         }
 
@@ -598,35 +845,60 @@ namespace hs {
             return m_output.eof();
         }
 
-        stream_t <lexer_token_t>* get_output() {
+        token_stream_t* get_output() {
             return &m_output;
         }
 
-        void lex() {
-            result_t r;
+        void set_symbols(symbol_table_t* symbols) {
+            m_symbols = symbols;
+        }
+
+        // Handle directives and defines while lexing, preprocessor
+        // is the top level file's. Lines of included files are
+        // added to line_map as we go
+        void set_preprocessor(preprocessor_t* preprocessor, line_map_t* line_map) {
+            m_preprocessor = preprocessor;
+            m_line_map = line_map;
+            m_file = 0;
+        }
 
-            while (!m_input->eof()) {
-                ignore_whitespace();
+        // Send tokens to a queue instead of our own output stream,
+        // the queue is closed once we're done
+        void set_output(token_queue_t* queue) {
+            m_queue = queue;
+        }
 
-                if (m_input->eof()) break;
+        size_t get_token_count() {
+            return m_count;
+        }
 
-                m_current_token.text.clear();
+        void lex() {
+            // Sources are usually 3 to 5 bytes per token, reserve for
+            // the worst case. Growing the output one reallocation at a
+            // time costs more than the scan itself
+            if (!m_queue)
+                m_output.data()->reserve(m_source.size() / 3);
 
-                TRY_LEX(identifier);
-                TRY_LEX(literal);
-                TRY_LEX(structural);
-                TRY_LEX(operator);
+            while (lex_next());
 
-                if (m_logger) m_logger->print_error(
-                    "lexer",
-                    fmt("Unexpected character \'" ESCAPE(37;1) "%c" ESCAPE(0) "\'", m_current),
-                    m_line, m_offset, 1
-                );
+            if (m_queue) {
+                flush();
 
-                return;
+                m_queue->close();
             }
+        }
+
+        // Lex at least count more tokens onto our output, unless the
+        // input ends first. Lets the parser pull tokens as it goes
+        // instead (see compiler_t::parse_lazy()), false when there
+        // was nothing left
+        bool lex(size_t count) {
+            size_t size = m_output.data()->size();
+
+            while ((m_output.data()->size() - size) < count)
+                if (!lex_next()) break;
 
-            fix_types();
+            return m_output.data()->size() != size;
         }
     };
 }
\ No newline at end of file
@@ -1,7 +1,9 @@
 #pragma once
 
 #include <string>
-#include <unordered_map>
+#include <string_view>
+#include <vector>
+#include <cstdint>
 
 namespace hs {
     enum lexer_token_type_t : int {
@@ -43,9 +45,16 @@ namespace hs {
         LT_KEYWORD_TYPE,
         LT_KEYWORD_BLOB,
         LT_ASM_BLOCK,
+        LT_PRECOMPILED
     };
 
-    std::unordered_map <std::string, lexer_token_type_t> keyword_map = {
+    struct lexer_keyword_t {
+        const char* text;
+
+        lexer_token_type_t type;
+    };
+
+    constexpr lexer_keyword_t lexer_keywords[] = {
         { "fn"      , LT_KEYWORD_FN      },
         { "return"  , LT_KEYWORD_RETURN  },
         { "const"   , LT_KEYWORD_CONST   },
@@ -63,6 +72,115 @@ namespace hs {
         { "type"    , LT_KEYWORD_TYPE    }
     };
 
+    // Perfect hash of keywords on their first and last characters
+    // and length. The seed is searched for at compile time, adding
+    // a keyword that collides for every seed fails the build
+    struct lexer_keyword_table_t {
+        static constexpr size_t size = 32;
+
+        uint32_t seed = 0;
+
+        // Index into lexer_keywords + 1, 0 for empty slots
+        uint8_t slots[size] = {};
+
+        static constexpr uint32_t hash(std::string_view text, uint32_t seed) {
+            return (((uint8_t)text.front() * seed) + (uint8_t)text.back() + text.size()) % size;
+        }
+    };
+
+    constexpr lexer_keyword_table_t make_lexer_keyword_table() {
+        constexpr size_t count = sizeof(lexer_keywords) / sizeof(lexer_keyword_t);
+
+        for (uint32_t seed = 1; seed < 0x1000; seed++) {
+            lexer_keyword_table_t table;
+
+            table.seed = seed;
+
+            bool collision = false;
+
+            for (size_t i = 0; (i < count) && !collision; i++) {
+                uint32_t h = lexer_keyword_table_t::hash(lexer_keywords[i].text, seed);
+
+                collision = table.slots[h];
+
+                table.slots[h] = i + 1;
+            }
+
+            if (!collision) return table;
+        }
+
+        throw "No perfect hash for keywords";
+    }
+
+    constexpr lexer_keyword_table_t lexer_keyword_table = make_lexer_keyword_table();
+
+    // LT_IDENT for anything that isn't a keyword
+    inline lexer_token_type_t get_keyword_type(std::string_view text) {
+        if (text.empty()) return LT_IDENT;
+
+        uint8_t slot = lexer_keyword_table.slots[lexer_keyword_table_t::hash(text, lexer_keyword_table.seed)];
+
+        if (slot && (text == lexer_keywords[slot - 1].text))
+            return lexer_keywords[slot - 1].type;
+
+        return LT_IDENT;
+    }
+
+    struct lexer_operator_t {
+        const char* text;
+
+        lexer_token_type_t type;
+    };
+
+    // Structural characters and operators, the lexer's DFA is
+    // generated from this table (see lexer.hpp). Every prefix of an
+    // operator must be an operator too
+    constexpr lexer_operator_t lexer_operators[] = {
+        { "{" , LT_OPENING_BRACE   },
+        { "}" , LT_CLOSING_BRACE   },
+        { "(" , LT_OPENING_PARENT  },
+        { ")" , LT_CLOSING_PARENT  },
+        { "[" , LT_OPENING_BRACKET },
+        { "]" , LT_CLOSING_BRACKET },
+        { ":" , LT_COLON           },
+        { ";" , LT_SEMICOLON       },
+        { "." , LT_DOT             },
+        { "," , LT_COMMA           },
+        { "+" , LT_OPERATOR_BINARY },
+        { "+=", LT_OPERATOR_ASSIGN },
+        { "++", LT_OPERATOR_UNARY  },
+        { "-" , LT_OPERATOR_BINARY },
+        { "->", LT_ARROW           },
+        { "--", LT_OPERATOR_UNARY  },
+        { "-=", LT_OPERATOR_ASSIGN },
+        { "*" , LT_STAR            },
+        { "*=", LT_OPERATOR_ASSIGN },
+        { "/" , LT_OPERATOR_BINARY },
+        { "/=", LT_OPERATOR_ASSIGN },
+        { "&" , LT_AMPERSAND       },
+        { "&=", LT_OPERATOR_ASSIGN },
+        { "&&", LT_OPERATOR_COMP   },
+        { "|" , LT_OPERATOR_BINARY },
+        { "|=", LT_OPERATOR_ASSIGN },
+        { "||", LT_OPERATOR_COMP   },
+        { "^" , LT_OPERATOR_BINARY },
+        { "^=", LT_OPERATOR_ASSIGN },
+        { "^^", LT_OPERATOR_COMP   },
+        { "!" , LT_OPERATOR_UNARY  },
+        { "!=", LT_OPERATOR_COMP   },
+        { "%" , LT_OPERATOR_BINARY },
+        { "%=", LT_OPERATOR_ASSIGN },
+        { "=" , LT_OPERATOR_ASSIGN },
+        { "==", LT_OPERATOR_COMP   },
+        { "<" , LT_OPERATOR_COMP   },
+        { "<=", LT_OPERATOR_COMP   },
+        { "<<", LT_OPERATOR_BINARY },
+        { ">" , LT_OPERATOR_COMP   },
+        { ">=", LT_OPERATOR_COMP   },
+        { ">>", LT_OPERATOR_BINARY },
+        { "~" , LT_OPERATOR_UNARY  }
+    };
+
     std::string lexer_token_type_names[] = {
         "LT_NONE",
         "LT_IDENT",
@@ -101,14 +219,121 @@ namespace hs {
         "LT_KEYWORD_STRUCT",
         "LT_KEYWORD_TYPE",
         "LT_KEYWORD_BLOB",
-        "LT_ASM_BLOCK"
+        "LT_ASM_BLOCK",
+        "LT_PRECOMPILED"
     };
 
+    // Tokens are stored on a token_buffer_t, this is a view of one.
+    // text lives as long as the buffer it came from
     struct lexer_token_t {
         unsigned int line = 0, offset = 0;
 
         lexer_token_type_t type = LT_NONE;
 
-        std::string text;
+        std::string_view text;
+
+        // Numeric literals are decoded by the lexer, identifiers
+        // get their symbol (see symbol_table_t)
+        uint64_t value = 0;
+    };
+
+    // Tokens stored column-wise. Text is either a span of the source
+    // the tokens were lexed from (see set_source()), or copied to the
+    // buffer's own storage when the source doesn't outlive the tokens
+    // (i.e. streaming, tokens from precompiled headers)
+    class token_buffer_t {
+        static constexpr uint32_t TEXT_OWNED = 0x80000000;
+
+        std::vector <uint8_t> m_types;
+        std::vector <uint32_t> m_lines, m_offsets;
+        std::vector <uint32_t> m_starts, m_lengths;
+        std::vector <uint64_t> m_values;
+
+        std::string_view m_source;
+        std::string m_storage;
+
+        void push_impl(lexer_token_type_t type, unsigned int line, unsigned int offset, uint32_t start, size_t length, uint64_t value) {
+            m_types.push_back(type);
+            m_lines.push_back(line);
+            m_offsets.push_back(offset);
+            m_starts.push_back(start);
+            m_lengths.push_back(length);
+            m_values.push_back(value);
+        }
+
+    public:
+        // What stream_t::get() returns
+        typedef lexer_token_t reference;
+
+        void set_source(std::string_view source) {
+            m_source = source;
+        }
+
+        void reserve(size_t count) {
+            m_types.reserve(count);
+            m_lines.reserve(count);
+            m_offsets.reserve(count);
+            m_starts.reserve(count);
+            m_lengths.reserve(count);
+            m_values.reserve(count);
+        }
+
+        void clear() {
+            m_types.clear();
+            m_lines.clear();
+            m_offsets.clear();
+            m_starts.clear();
+            m_lengths.clear();
+            m_values.clear();
+            m_storage.clear();
+        }
+
+        size_t size() const {
+            return m_types.size();
+        }
+
+        bool empty() const {
+            return m_types.empty();
+        }
+
+        // Token whose text is the source's [start, start + length)
+        void push_span(lexer_token_type_t type, unsigned int line, unsigned int offset, size_t start, size_t length, uint64_t value = 0) {
+            push_impl(type, line, offset, start, length, value);
+        }
+
+        void push(lexer_token_type_t type, unsigned int line, unsigned int offset, std::string_view text, uint64_t value = 0) {
+            push_impl(type, line, offset, m_storage.size() | TEXT_OWNED, text.size(), value);
+
+            m_storage.append(text);
+        }
+
+        void push(const lexer_token_t& token) {
+            push(token.type, token.line, token.offset, token.text, token.value);
+        }
+
+        lexer_token_type_t get_type(size_t index) const {
+            return (lexer_token_type_t)m_types[index];
+        }
+
+        std::string_view get_text(size_t index) const {
+            uint32_t start = m_starts[index];
+
+            if (start & TEXT_OWNED)
+                return std::string_view(m_storage).substr(start & ~TEXT_OWNED, m_lengths[index]);
+
+            return m_source.substr(start, m_lengths[index]);
+        }
+
+        lexer_token_t operator[](size_t index) const {
+            lexer_token_t token;
+
+            token.line = m_lines[index];
+            token.offset = m_offsets[index];
+            token.type = get_type(index);
+            token.text = get_text(index);
+            token.value = m_values[index];
+
+            return token;
+        }
     };
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include <iostream>
 #include <fstream>
 #include <cstdio>
+#include <mutex>
 
 #define _ESCAPE_BRACKET "["
 #define _ESCAPE_M       "m"
@@ -78,6 +79,10 @@ namespace _log {
 
     bool disable_logs = false;
 
+    // Serializes output lines and settings changes, logs may be
+    // written from several compiler instances at once (batch mode)
+    std::mutex lock;
+
     namespace settings {
         bool disable_escape = false;
         bool bright_colors = true;
@@ -111,10 +116,12 @@ namespace _log {
         if (disable_logs) return;
         if (!is_allowed(type)) return;
 
-        static char buf[0x400];
+        char buf[0x400];
 
         std::sprintf(buf, text.c_str(), args...);
 
+        std::lock_guard <std::mutex> guard(lock);
+
         const char** cols = settings::bright_colors ? colors_high : colors_low;
 
         if (settings::disable_escape) {
@@ -129,6 +136,8 @@ namespace _log {
     }
 
     void init(std::string app_name, std::string file_name = "", bool bright = true, bool no_escape = false) {
+        std::lock_guard <std::mutex> guard(lock);
+
         _log::settings::app_name = app_name;
         
         if (file_name.size())
@@ -5,9 +5,12 @@
 #include "expression.hpp"
 #include "parser.hpp"
 #include "output.hpp"
+#include "../symbols.hpp"
 
 #include <string>
-#include <stack>
+#include <unordered_map>
+#include <algorithm>
+#include <vector>
 
 #define WARNING(msg, expr) \
     if (m_logger) m_logger->print_warning( \
@@ -18,20 +21,63 @@
 
 namespace hs {
     struct contextualizer_t {
+        // Scopes are kept on a stack and identified by their index
+        // on it, a scope's parent is the one below it. Scope 0 is the
+        // global scope
+        struct scope_t {
+            // Qualified name of the function this scope belongs to,
+            // names defined on it are qualified with it
+            symbol_id_t function;
+
+            // Innermost function scope, lookups stop there. Names
+            // local to enclosing functions aren't visible (globals are)
+            size_t function_scope;
+
+            // Names defined on this scope, undefined when leaving it
+            std::vector <symbol_id_t> names;
+        };
+
+        struct binding_t {
+            size_t scope;
+            symbol_id_t qualified;
+        };
+
         parser_output_t* m_po;
-        std::stack <std::string> m_scope;
         error_logger_t* m_logger;
 
-        std::vector <std::string> m_dummy;
+        symbol_table_t* m_symbols;
+
+        std::vector <scope_t> m_scopes;
+
+        // Current scope, entries past it are kept around so their
+        // vectors can be reused
+        size_t m_scope = 0;
+
+        // Source name -> qualified name. Locals are stacked, the
+        // innermost definition last, so lookups don't depend on how
+        // deeply scopes are nested
+        std::unordered_map <symbol_id_t, symbol_id_t> m_globals;
+        std::unordered_map <symbol_id_t, std::vector <binding_t>> m_locals;
+
+        // Number of AST nodes visited, for --time-report
+        size_t m_nodes = 0;
 
-        std::vector <std::string> m_vars_in_global_scope;
-        std::stack <std::vector <std::string>> m_vars_in_current_scope;
+        // Nodes left to visit. The AST is walked with an explicit
+        // stack so deeply nested input can't overflow the native one
+        std::vector <expression_t*> m_stack;
+
+        // Pushed after a scope's contents, pops it
+        expression_t m_leave;
 
         void init(parser_t* parser, error_logger_t* logger) {
             m_po = parser->get_output();
+            m_symbols = parser->get_symbols();
             m_logger = logger;
 
-            m_scope.push("F<global>");
+            m_scopes.resize(1);
+            m_scopes[0].function = m_symbols->intern("F<global>");
+            m_scopes[0].function_scope = 0;
+            m_scope = 0;
         }
 
         std::string get_scope(std::string name) {
@@ -44,223 +90,269 @@ namespace hs {
             }
         }
 
-        std::string get_name_scope(std::string name) {
-            auto last_dot = name.find_last_of('.');
-            auto prev_dot = name.substr(last_dot - 1).find_last_of('.');
+        // Scope name for diagnostics
+        std::string get_scope_name() {
+            return get_scope(m_symbols->get_name(m_scopes[m_scope].function));
+        }
+
+        void push_scope(symbol_id_t function, bool is_function) {
+            if (++m_scope == m_scopes.size())
+                m_scopes.emplace_back();
+
+            scope_t& scope = m_scopes[m_scope];
+
+            scope.function = function;
+            scope.function_scope = is_function ? m_scope : m_scopes[m_scope - 1].function_scope;
+            scope.names.clear();
+        }
+
+        void pop_scope() {
+            for (symbol_id_t symbol : m_scopes[m_scope].names)
+                m_locals[symbol].pop_back();
+
+            m_scope--;
+        }
+
+        // Names without a symbol (i.e. anonymous functions, names
+        // from precompiled headers) are interned on first use
+        symbol_id_t get_symbol(std::string_view name, symbol_id_t& symbol) {
+            if (!symbol) symbol = m_symbols->intern(name);
+
+            return symbol;
+        }
+
+        // "name" -> "function.name", later stages refer to names by
+        // their qualified symbol
+        symbol_id_t qualify(std::string_view name, symbol_id_t function) {
+            std::string qualified = m_symbols->get_name(function);
 
-            if (prev_dot == std::string::npos) {
-                return name.substr(last_dot);
+            qualified.push_back('.');
+            qualified.append(name);
+
+            return m_symbols->intern(qualified);
+        }
+
+        // Define a name on the current scope, symbol is replaced
+        // with the qualified name's
+        void define(std::string_view name, symbol_id_t& symbol, expression_t* expr) {
+            get_symbol(name, symbol);
+
+            scope_t& scope = m_scopes[m_scope];
+
+            if (m_scope && m_globals.contains(symbol))
+                WARNING(
+                    fmt("Defining clashing name \"%s\" on scope %s",
+                        std::string(name).c_str(),
+                        get_scope_name().c_str()
+                    ),
+                    expr
+                );
+
+            bind(symbol, qualify(name, scope.function));
+        }
+
+        void bind(symbol_id_t& symbol, symbol_id_t qualified) {
+            if (m_scope) {
+                m_scopes[m_scope].names.push_back(symbol);
+                m_locals[symbol].push_back({ m_scope, qualified });
             } else {
-                return name.substr(prev_dot, last_dot - prev_dot);
+                m_globals[symbol] = qualified;
             }
 
-            return name;
+            symbol = qualified;
         }
 
-        void contextualize_impl(expression_t* expr) {
-            switch (expr->get_type()) {
-                case EX_FUNCTION_DEF: {
-                    function_def_t* fd = (function_def_t*)expr;
+        // Find a name on the current function's scopes, 0 if it
+        // isn't defined on them
+        symbol_id_t find_local(symbol_id_t symbol) {
+            auto it = m_locals.find(symbol);
 
-                    if (m_scope.top() == "F<global>") {
-                        m_vars_in_global_scope.push_back(fd->name);
-                    } else {
-                        auto global = std::find(
-                            std::begin(m_vars_in_global_scope),
-                            std::end(m_vars_in_global_scope),
-                            fd->name
-                        );
+            if ((it == m_locals.end()) || it->second.empty())
+                return 0;
 
-                        if (global != std::end(m_vars_in_global_scope))
-                            WARNING(
-                                fmt("Defining clashing name \"%s\" on scope %s",
-                                    fd->name.c_str(),
-                                    get_scope(m_scope.top()).c_str()
-                                ),
-                                fd
-                            );
+            binding_t& binding = it->second.back();
 
-                        m_vars_in_current_scope.top().push_back(fd->name);
-                    }
+            if (binding.scope < m_scopes[m_scope].function_scope)
+                return 0;
 
-                    fd->name = m_scope.top() + "." + fd->name;
+            return binding.qualified;
+        }
 
-                    m_vars_in_current_scope.push(m_dummy);
+        // Children are visited in the order they're pushed in
+        void later(expression_t* expr) {
+            if (expr) m_stack.push_back(expr);
+        }
 
-                    for (function_arg_t& arg : fd->args) {
-                        m_vars_in_current_scope.top().push_back(arg.name);
+        void leave() {
+            m_stack.push_back(&m_leave);
+        }
 
-                        arg.name = fd->name + "." + arg.name;
-                    }
+        void contextualize_impl(expression_t* root) {
+            later(root);
 
-                    m_scope.push(fd->name);
+            while (m_stack.size()) {
+                expression_t* expr = m_stack.back();
 
-                    contextualize_impl(fd->body);
+                m_stack.pop_back();
 
-                    m_vars_in_current_scope.pop();
-                    m_scope.pop();
-                } break;
+                if (expr == &m_leave) {
+                    pop_scope();
 
-                case EX_VARIABLE_DEF: {
-                    variable_def_t* vd = (variable_def_t*)expr;
+                    continue;
+                }
 
-                    if (m_scope.top() == "F<global>") {
-                        m_vars_in_global_scope.push_back(vd->name);
-                    } else {
-                        auto global = std::find(
-                            std::begin(m_vars_in_global_scope),
-                            std::end(m_vars_in_global_scope),
-                            vd->name
-                        );
+                size_t first = m_stack.size();
 
-                        if (global != std::end(m_vars_in_global_scope))
-                            WARNING(
-                                fmt("Defining clashing name \"%s\" on scope %s",
-                                    vd->name.c_str(),
-                                    get_scope(m_scope.top()).c_str()
-                                ),
-                                vd
-                            );
+                contextualize_node(expr);
 
-                        m_vars_in_current_scope.top().push_back(vd->name);
-                    }
+                std::reverse(m_stack.begin() + first, m_stack.end());
+            }
+        }
 
-                    vd->name = m_scope.top() + "." + vd->name;
-                } break;
+        void contextualize_node(expression_t* expr) {
+            m_nodes++;
 
-                case EX_NAME_REF: {
-                    name_ref_t* nr = (name_ref_t*)expr;
+            switch (expr->get_type()) {
+                case EX_FUNCTION_DEF: {
+                    function_def_t* fd = (function_def_t*)expr;
+
+                    define(fd->name, fd->symbol, fd);
 
-                    auto current = std::find(
-                        std::begin(m_vars_in_current_scope.top()),
-                        std::end(m_vars_in_current_scope.top()),
-                        nr->name
-                    );
+                    push_scope(fd->symbol, true);
 
-                    bool found_in_current_scope = current != std::end(m_vars_in_current_scope.top());
+                    for (function_arg_t& arg : fd->args) {
+                        get_symbol(arg.name, arg.symbol);
 
-                    if (found_in_current_scope) {
-                        nr->name = m_scope.top() + "." + nr->name;
+                        bind(arg.symbol, qualify(arg.name, fd->symbol));
                     }
 
-                    auto global = std::find(
-                        std::begin(m_vars_in_global_scope),
-                        std::end(m_vars_in_global_scope),
-                        nr->name
-                    );
+                    later(fd->body);
+                    leave();
+                } break;
 
-                    bool found_in_global_scope = global != std::end(m_vars_in_global_scope);
+                case EX_VARIABLE_DEF: {
+                    variable_def_t* vd = (variable_def_t*)expr;
 
-                    if (found_in_current_scope && found_in_global_scope) {
-                        WARNING(
-                            fmt("Clashing name \"%s\" on scope %s",
-                                (*current).c_str(),
-                                get_scope(m_scope.top()).c_str()
-                            ),
-                            nr
-                        );
+                    define(vd->name, vd->symbol, vd);
+                } break;
+
+                case EX_NAME_REF: {
+                    name_ref_t* nr = (name_ref_t*)expr;
+
+                    get_symbol(nr->name, nr->symbol);
+
+                    // Locals shadow globals, clashes are reported
+                    // where the local is defined
+                    symbol_id_t local = find_local(nr->symbol);
+
+                    if (local) {
+                        nr->symbol = local;
 
                         break;
                     }
 
-                    if (found_in_current_scope) break;
+                    auto global = m_globals.find(nr->symbol);
 
-                    if (found_in_global_scope) {
-                        nr->name = "F<global>." + nr->name;
+                    if (global != m_globals.end()) {
+                        nr->symbol = global->second;
                     } else {
                         WARNING(
                             fmt("Using undefined name \"%s\" on scope %s",
-                                nr->name.c_str(),
-                                get_scope(m_scope.top()).c_str()
+                                std::string(nr->name).c_str(),
+                                get_scope_name().c_str()
                             ),
                             nr
                         );
 
-                        nr->name = "<unknown>." + nr->name;
+                        nr->symbol = qualify(nr->name, m_symbols->intern("<unknown>"));
                     }
                 } break;
 
                 case EX_ARRAY_ACCESS: {
                     array_access_t* aa = (array_access_t*)expr;
 
-                    contextualize_impl(aa->type_or_name);
-                    contextualize_impl(aa->addr);
+                    later(aa->type_or_name);
+                    later(aa->addr);
                 } break;
 
                 case EX_ASSIGNMENT: {
                     assignment_t* as = (assignment_t*)expr;
 
-                    contextualize_impl(as->assignee);
-                    contextualize_impl(as->value);
+                    later(as->assignee);
+                    later(as->value);
                 } break;
 
                 case EX_BINARY_OP: {
                     binary_op_t* bo = (binary_op_t*)expr;
 
-                    contextualize_impl(bo->lhs);
-                    contextualize_impl(bo->rhs);
+                    later(bo->lhs);
+                    later(bo->rhs);
                 } break;
 
                 case EX_COMP_OP: {
                     comp_op_t* co = (comp_op_t*)expr;
 
-                    contextualize_impl(co->lhs);
-                    contextualize_impl(co->rhs);
+                    later(co->lhs);
+                    later(co->rhs);
                 } break;
 
                 case EX_EXPRESSION_BLOCK: {
                     expression_block_t* block = (expression_block_t*)expr;
 
+                    push_scope(m_scopes[m_scope].function, false);
+
                     for (expression_t* expr : block->block) {
-                        contextualize_impl(expr);
+                        later(expr);
                     }
+
+                    leave();
                 } break;
 
                 case EX_RETURN: {
                     return_expr_t* ret = (return_expr_t*)expr;
 
-                    contextualize_impl(ret->value);
+                    later(ret->value);
                 } break;
 
                 case EX_ARRAY: {
                     array_t* arr = (array_t*)expr;
 
                     for (expression_t* expr : arr->values) {
-                        contextualize_impl(expr);
+                        later(expr);
                     }
                 } break;
 
                 case EX_FUNCTION_CALL: {
                     function_call_t* fc = (function_call_t*)expr;
 
-                    contextualize_impl(fc->addr);
+                    later(fc->addr);
 
                     for (expression_t* expr : fc->args) {
-                        contextualize_impl(expr);
+                        later(expr);
                     }
                 } break;
 
                 case EX_INVOKE: {
                     invoke_expr_t* ie = (invoke_expr_t*)expr;
 
-                    contextualize_impl(ie->ptr);
+                    later(ie->ptr);
                 } break;
 
                 case EX_WHILE_LOOP: {
                     while_loop_t* wl = (while_loop_t*)expr;
 
-                    contextualize_impl(wl->condition);
-                    contextualize_impl(wl->body);
+                    later(wl->condition);
+                    later(wl->body);
                 } break;
 
                 case EX_IF_ELSE: {
                     if_else_t* ie = (if_else_t*)expr;
 
-                    contextualize_impl(ie->cond);
-                    contextualize_impl(ie->if_expr);
+                    later(ie->cond);
+                    later(ie->if_expr);
 
                     if (ie->else_expr)
-                        contextualize_impl(ie->else_expr);
+                        later(ie->else_expr);
                 } break;
 
                 case EX_BLOB: {
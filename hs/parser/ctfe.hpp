@@ -0,0 +1,333 @@
+#pragma once
+
+#include "expression.hpp"
+#include "visit.hpp"
+#include "../symbols.hpp"
+
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <cstdint>
+
+namespace hs {
+    // Compile-time function evaluation, runs calls to functions that
+    // only compute on their arguments and locals (arithmetic, loops,
+    // conditionals, calls to other such functions) so the call can be
+    // replaced by its result (see constant_folder_t).
+    //
+    // Anything with effects outside the call (memory accesses like
+    // [0xfffffffe], globals, asm, strings, arrays) or passing a name
+    // as an argument makes evaluation fail and the call is left for
+    // runtime. Values behave like they
+    // would on the target, see eval_binary_op() and eval_comp_op()
+    class interpreter_t {
+        struct local_t {
+            uint32_t value = 0;
+
+            bool set = false;
+        };
+
+        typedef std::unordered_map <symbol_id_t, local_t> frame_t;
+
+        std::unordered_map <symbol_id_t, function_def_t*> m_functions;
+
+        // Functions that failed to evaluate once, they're not tried
+        // again. This includes running out of steps, so the budget
+        // bounds the time spent on each function
+        std::unordered_set <symbol_id_t> m_failed;
+
+        std::vector <frame_t> m_frames;
+
+        uint64_t m_budget = 100000;
+        uint64_t m_steps = 0;
+
+        // Nesting of the evaluation, eval() recurses
+        static constexpr int m_max_depth = 1000;
+
+        int m_depth = 0;
+
+        bool m_returning = false;
+
+        uint32_t m_return_value = 0;
+
+        size_t m_evaluated = 0;
+
+        local_t* find_local(symbol_id_t symbol) {
+            if (m_frames.empty())
+                return nullptr;
+
+            auto it = m_frames.back().find(symbol);
+
+            return (it != m_frames.back().end()) ? &it->second : nullptr;
+        }
+
+        // The IR generator passes names (and blocks ending in one) by
+        // address, see EX_NAME_REF in generator.hpp. Evaluating calls
+        // like f(x) by value would compute something else
+        static bool is_passed_by_address(expression_t* arg) {
+            while ((arg->get_type() == EX_EXPRESSION_BLOCK) && ((expression_block_t*)arg)->block.size())
+                arg = ((expression_block_t*)arg)->block.back();
+
+            return arg->get_type() == EX_NAME_REF;
+        }
+
+        bool call(function_call_t* fc, uint32_t& value) {
+            if (fc->addr->get_type() != EX_NAME_REF)
+                return false;
+
+            symbol_id_t symbol = ((name_ref_t*)fc->addr)->symbol;
+
+            if (m_failed.contains(symbol) || !m_functions.contains(symbol))
+                return false;
+
+            function_def_t* fd = m_functions[symbol];
+
+            if (fd->args.size() != fc->args.size())
+                return false;
+
+            frame_t frame;
+
+            for (expression_t* arg : fc->args)
+                if (is_passed_by_address(arg))
+                    return false;
+
+            for (size_t i = 0; i < fc->args.size(); i++) {
+                uint32_t arg;
+
+                if (!eval(fc->args[i], arg))
+                    return false;
+
+                frame[fd->args[i].symbol] = { arg, true };
+            }
+
+            m_frames.push_back(std::move(frame));
+
+            bool ok = eval(fd->body, value);
+
+            m_frames.pop_back();
+
+            if (!ok) return false;
+
+            if (m_returning) {
+                value = m_return_value;
+
+                m_returning = false;
+            }
+
+            return true;
+        }
+
+        bool operands(expression_t* lhs, expression_t* rhs, uint32_t& a, uint32_t& b) {
+            if (!eval(lhs, a) || m_returning) return false;
+            if (!eval(rhs, b) || m_returning) return false;
+
+            return true;
+        }
+
+        bool result(eval_t r, uint32_t& value) {
+            if (r.type != ET_NUMERIC)
+                return false;
+
+            value = r.value;
+
+            return true;
+        }
+
+        bool assign(assignment_t* as, uint32_t& value) {
+            // Compound assignments are stored like plain ones by the
+            // IR generator, don't guess
+            if (as->op != "=")
+                return false;
+
+            if (!eval(as->value, value) || m_returning)
+                return false;
+
+            switch (as->assignee->get_type()) {
+                case EX_VARIABLE_DEF: {
+                    m_frames.back()[((variable_def_t*)as->assignee)->symbol] = { value, true };
+                } break;
+
+                case EX_NAME_REF: {
+                    local_t* local = find_local(((name_ref_t*)as->assignee)->symbol);
+
+                    if (!local)
+                        return false;
+
+                    *local = { value, true };
+                } break;
+
+                default: return false;
+            }
+
+            return true;
+        }
+
+        bool eval(expression_t* expr, uint32_t& value) {
+            if (!expr || (++m_steps > m_budget) || (m_depth >= m_max_depth))
+                return false;
+
+            m_depth++;
+
+            bool ok = eval_node(expr, value);
+
+            m_depth--;
+
+            return ok;
+        }
+
+        // Expressions that return from the function set m_returning,
+        // nodes stop evaluating their children when they see it
+        bool eval_node(expression_t* expr, uint32_t& value) {
+            switch (expr->get_type()) {
+                case EX_NUMERIC_LITERAL: {
+                    value = ((numeric_literal_t*)expr)->value;
+                } return true;
+
+                case EX_NAME_REF: {
+                    local_t* local = find_local(((name_ref_t*)expr)->symbol);
+
+                    if (!local || !local->set)
+                        return false;
+
+                    value = local->value;
+                } return true;
+
+                case EX_VARIABLE_DEF: {
+                    // Its value is its address, only usable as an
+                    // assignee
+                    m_frames.back()[((variable_def_t*)expr)->symbol] = local_t();
+
+                    value = 0;
+                } return true;
+
+                case EX_BINARY_OP: {
+                    binary_op_t* bo = (binary_op_t*)expr;
+
+                    uint32_t lhs, rhs;
+
+                    if (!operands(bo->lhs, bo->rhs, lhs, rhs))
+                        return false;
+
+                    return result(eval_binary_op(bo->op, lhs, rhs), value);
+                } break;
+
+                case EX_COMP_OP: {
+                    comp_op_t* co = (comp_op_t*)expr;
+
+                    uint32_t lhs, rhs;
+
+                    if (!operands(co->lhs, co->rhs, lhs, rhs))
+                        return false;
+
+                    return result(eval_comp_op(co->op, lhs, rhs), value);
+                } break;
+
+                case EX_ASSIGNMENT: {
+                    return assign((assignment_t*)expr, value);
+                } break;
+
+                case EX_EXPRESSION_BLOCK: {
+                    expression_block_t* eb = (expression_block_t*)expr;
+
+                    if (eb->block.empty())
+                        return false;
+
+                    for (expression_t* e : eb->block) {
+                        if (!eval(e, value))
+                            return false;
+
+                        if (m_returning)
+                            break;
+                    }
+                } return true;
+
+                case EX_IF_ELSE: {
+                    if_else_t* ie = (if_else_t*)expr;
+
+                    if (!eval(ie->cond, value) || m_returning)
+                        return false;
+
+                    // Without an else, the value is the condition's
+                    // like in generated code
+                    if (value) return eval(ie->if_expr, value);
+                    if (ie->else_expr) return eval(ie->else_expr, value);
+                } return true;
+
+                case EX_WHILE_LOOP: {
+                    while_loop_t* wl = (while_loop_t*)expr;
+
+                    while (true) {
+                        if (!eval(wl->condition, value) || m_returning)
+                            return false;
+
+                        if (!value)
+                            break;
+
+                        if (!eval(wl->body, value))
+                            return false;
+
+                        if (m_returning)
+                            break;
+                    }
+                } return true;
+
+                case EX_RETURN: {
+                    return_expr_t* re = (return_expr_t*)expr;
+
+                    if (!eval(re->value, m_return_value) || m_returning)
+                        return false;
+
+                    m_returning = true;
+                } return true;
+
+                case EX_FUNCTION_CALL: {
+                    return call((function_call_t*)expr, value);
+                } break;
+
+                default: return false;
+            }
+        }
+
+    public:
+        // Maximum number of expressions evaluated per call, 0
+        // disables evaluation
+        void set_budget(uint64_t steps) {
+            m_budget = steps;
+        }
+
+        void add_function(function_def_t* fd) {
+            m_functions[fd->symbol] = fd;
+        }
+
+        // Run a call whose arguments are constant, on success the
+        // result can be used in place of the call
+        eval_t evaluate(function_call_t* fc) {
+            if (!m_budget || (fc->addr->get_type() != EX_NAME_REF))
+                return eval_t();
+
+            m_steps = 0;
+            m_depth = 0;
+            m_returning = false;
+
+            uint32_t value;
+
+            if (!call(fc, value)) {
+                m_frames.clear();
+                m_returning = false;
+
+                m_failed.insert(((name_ref_t*)fc->addr)->symbol);
+
+                return eval_t();
+            }
+
+            m_evaluated++;
+
+            return { ET_NUMERIC, value };
+        }
+
+        // Number of calls replaced so far
+        size_t get_evaluated() {
+            return m_evaluated;
+        }
+    };
+}
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <memory_resource>
+#include <cstdint>
 
 #define HS_AST_PRINT_FORMAT_LISP
 #define HS_AST_PRINT_INDENT_SIZE 2
@@ -11,7 +14,7 @@ namespace hs {
         ET_NUMERIC
     };
 
-    enum expression_type_t {
+    enum expression_type_t : uint8_t {
         EX_NONE,
         EX_ARRAY_ACCESS,
         EX_ASSIGNMENT,
@@ -34,18 +37,40 @@ namespace hs {
         EX_RETURN
     };
 
-    class eval_t {
-        eval_type_t type;
+    // Nodes are created on the compilation's arena (see arena_t) and
+    // never destroyed, so their strings and child vectors use it too
+    typedef std::pmr::string ast_string_t;
 
-        uint64_t value;
+    template <class T> using ast_vector_t = std::pmr::vector <T>;
+
+    // Result of evaluating an expression at compile time, ET_NULL
+    // if it can't be
+    struct eval_t {
+        eval_type_t type = ET_NULL;
+
+        uint64_t value = 0;
     };
 
+    // Nodes aren't polymorphic, they're tagged with their kind
+    // instead. Consumers switch on get_type() and cast, or use
+    // visit() (see visit.hpp)
     class expression_t {
     public:
         int line, offset, len;
 
-        virtual std::string print(int hierarchy) { return "<undefined>"; };
-        virtual eval_t eval() { return eval_t(); };
-        virtual expression_type_t get_type() { return EX_NONE; };
+        expression_type_t kind;
+
+        expression_t(expression_type_t kind = EX_NONE) : kind(kind) {}
+
+        expression_type_t get_type() {
+            return kind;
+        }
+
+        // Defined in visit.hpp, dispatches to the node's print()
+        std::string print(int hierarchy);
+
+        // Defined in visit.hpp. Operands aren't evaluated, they're
+        // expected to be folded already (see constant_folder_t)
+        eval_t eval();
     };
 }
\ No newline at end of file
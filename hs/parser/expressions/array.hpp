@@ -10,9 +10,11 @@ namespace hs {
     struct array_t : public expression_t {
         type_t type;
         unsigned int size = 0;
-        std::vector <expression_t*> values;
+        ast_vector_t <expression_t*> values;
 
-        std::string print(int hierarchy) override {
+        array_t(std::pmr::memory_resource* arena) : expression_t(EX_ARRAY), type(arena), values(arena) {}
+
+        std::string print(int hierarchy) {
             std::ostringstream ss;
 
             ss << std::string(hierarchy * HS_AST_PRINT_INDENT_SIZE, ' ');
@@ -34,9 +36,5 @@ namespace hs {
 #endif
             return ss.str();
         }
-
-        expression_type_t get_type() override {
-            return EX_ARRAY;
-        }
     };
 }
\ No newline at end of file
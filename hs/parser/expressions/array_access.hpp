@@ -14,7 +14,9 @@ namespace hs {
         expression_t* type_or_name = nullptr;
         expression_t* addr = nullptr;
 
-        std::string print(int hierarchy) override {
+        array_access_t() : expression_t(EX_ARRAY_ACCESS) {}
+
+        std::string print(int hierarchy) {
             std::ostringstream ss;
 
             ss << std::string(hierarchy, ' ');
@@ -26,9 +28,5 @@ namespace hs {
 #endif
             return ss.str();
         }
-
-        expression_type_t get_type() override {
-            return EX_ARRAY_ACCESS;
-        }
     };
 }
\ No newline at end of file
@@ -8,9 +8,11 @@
 
 namespace hs {
     struct asm_block_t : public expression_t {
-        std::string assembly;
+        ast_string_t assembly;
 
-        std::string print(int hierarchy) override {
+        asm_block_t(std::pmr::memory_resource* arena) : expression_t(EX_ASM_BLOCK), assembly(arena) {}
+
+        std::string print(int hierarchy) {
             std::ostringstream ss;
 
             ss << std::string(hierarchy, ' ');
@@ -22,9 +24,5 @@ namespace hs {
 #endif
             return ss.str();
         }
-
-        expression_type_t get_type() override {
-            return EX_ASM_BLOCK;
-        }
     };
 }
\ No newline at end of file
@@ -8,11 +8,13 @@
 
 namespace hs {
     struct assignment_t : public expression_t {
-        std::string op;
+        ast_string_t op;
         expression_t* assignee = nullptr;
         expression_t* value = nullptr;
 
-        std::string print(int hierarchy) override {
+        assignment_t(std::pmr::memory_resource* arena) : expression_t(EX_ASSIGNMENT), op(arena) {}
+
+        std::string print(int hierarchy) {
             std::ostringstream ss;
 
             ss << std::string(hierarchy, ' ');
@@ -24,9 +26,5 @@ namespace hs {
 #endif
             return ss.str();
         }
-
-        expression_type_t get_type() override {
-            return EX_ASSIGNMENT;
-        }
     };
 }
\ No newline at end of file
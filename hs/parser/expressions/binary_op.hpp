@@ -1,9 +1,11 @@
 #pragma once
 
 #include "../expression.hpp"
+#include "numeric_literal.hpp"
 #include "type.hpp"
 
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <iomanip>
 
@@ -15,12 +17,41 @@ namespace hs {
         BOP_DIV = '/'
     };
 
+    // Folded as 32-bit unsigned, like the target's ALU. Division
+    // by zero is left for runtime
+    inline eval_t eval_binary_op(std::string_view op, uint32_t a, uint32_t b) {
+        uint32_t r;
+
+        if      (op == "+" ) r = a + b;
+        else if (op == "-" ) r = a - b;
+        else if (op == "*" ) r = a * b;
+        else if (op == "&" ) r = a & b;
+        else if (op == "|" ) r = a | b;
+        else if (op == "^" ) r = a ^ b;
+        else if (op == "<<") r = (b < 32) ? (a << b) : 0;
+        else if (op == ">>") r = (b < 32) ? (a >> b) : 0;
+        else if ((op == "/") && b) r = a / b;
+        else if ((op == "%") && b) r = a % b;
+        else return eval_t();
+
+        return { ET_NUMERIC, r };
+    }
+
     struct binary_op_t : public expression_t {
-        std::string op;
+        ast_string_t op;
         expression_t* lhs = nullptr;
         expression_t* rhs = nullptr;
 
-        std::string print(int hierarchy) override {
+        binary_op_t(std::pmr::memory_resource* arena) : expression_t(EX_BINARY_OP), op(arena) {}
+
+        eval_t eval() {
+            if ((lhs->get_type() != EX_NUMERIC_LITERAL) || (rhs->get_type() != EX_NUMERIC_LITERAL))
+                return eval_t();
+
+            return eval_binary_op(op, ((numeric_literal_t*)lhs)->value, ((numeric_literal_t*)rhs)->value);
+        }
+
+        std::string print(int hierarchy) {
             std::ostringstream ss;
 
             ss << std::string(hierarchy * HS_AST_PRINT_INDENT_SIZE, ' ');
@@ -32,9 +63,5 @@ namespace hs {
 #endif
             return ss.str();
         }
-
-        expression_type_t get_type() override {
-            return EX_BINARY_OP;
-        }
     };
 }
\ No newline at end of file
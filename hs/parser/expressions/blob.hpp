@@ -8,10 +8,11 @@
 namespace hs {
     struct blob_t : public expression_t {
         unsigned int size = 0;
+        ast_string_t file;
 
-        std::string file;
+        blob_t(std::pmr::memory_resource* arena) : expression_t(EX_BLOB), file(arena) {}
 
-        std::string print(int hierarchy) override {
+        std::string print(int hierarchy) {
             std::ostringstream ss;
 
             ss << std::string(hierarchy * HS_AST_PRINT_INDENT_SIZE, ' ');
@@ -20,9 +21,5 @@ namespace hs {
 
             return ss.str();
         }
-
-        expression_type_t get_type() override {
-            return EX_BLOB;
-        }
     };
 }
\ No newline at end of file
@@ -1,19 +1,48 @@
 #pragma once
 
 #include "../expression.hpp"
+#include "numeric_literal.hpp"
 #include "type.hpp"
 
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <iomanip>
 
 namespace hs {
+    // Compared as 32-bit signed, like the target's set instructions
+    inline eval_t eval_comp_op(std::string_view op, int32_t a, int32_t b) {
+        bool r;
+
+        if      (op == "==") r = a == b;
+        else if (op == "!=") r = a != b;
+        else if (op == "<" ) r = a < b;
+        else if (op == "<=") r = a <= b;
+        else if (op == ">" ) r = a > b;
+        else if (op == ">=") r = a >= b;
+        else if (op == "&&") r = a && b;
+        else if (op == "||") r = a || b;
+        else if (op == "^^") r = !a != !b;
+        else return eval_t();
+
+        return { ET_NUMERIC, r };
+    }
+
     struct comp_op_t : public expression_t {
-        std::string op;
+        ast_string_t op;
         expression_t* lhs = nullptr;
         expression_t* rhs = nullptr;
 
-        std::string print(int hierarchy) override {
+        comp_op_t(std::pmr::memory_resource* arena) : expression_t(EX_COMP_OP), op(arena) {}
+
+        eval_t eval() {
+            if ((lhs->get_type() != EX_NUMERIC_LITERAL) || (rhs->get_type() != EX_NUMERIC_LITERAL))
+                return eval_t();
+
+            return eval_comp_op(op, (uint32_t)((numeric_literal_t*)lhs)->value, (uint32_t)((numeric_literal_t*)rhs)->value);
+        }
+
+        std::string print(int hierarchy) {
             std::ostringstream ss;
 
             ss << std::string(hierarchy * HS_AST_PRINT_INDENT_SIZE, ' ');
@@ -25,9 +54,5 @@ namespace hs {
 #endif
             return ss.str();
         }
-
-        expression_type_t get_type() override {
-            return EX_COMP_OP;
-        }
     };
 }
\ No newline at end of file
@@ -9,9 +9,11 @@
 
 namespace hs {
     struct expression_block_t : public expression_t {
-        std::vector <expression_t*> block;
+        ast_vector_t <expression_t*> block;
 
-        std::string print(int hierarchy) override {
+        expression_block_t(std::pmr::memory_resource* arena) : expression_t(EX_EXPRESSION_BLOCK), block(arena) {}
+
+        std::string print(int hierarchy) {
             std::ostringstream ss;
 
             ss << std::string(hierarchy, ' ');
@@ -30,9 +32,5 @@ namespace hs {
 
             return ss.str();
         }
-
-        expression_type_t get_type() override {
-            return EX_EXPRESSION_BLOCK;
-        }
     };
 }
\ No newline at end of file
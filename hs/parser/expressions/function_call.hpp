@@ -10,9 +10,11 @@
 namespace hs {
     struct function_call_t : public expression_t {
         expression_t* addr = nullptr;
-        std::vector <expression_t*> args;
+        ast_vector_t <expression_t*> args;
 
-        std::string print(int hierarchy) override {
+        function_call_t(std::pmr::memory_resource* arena) : expression_t(EX_FUNCTION_CALL), args(arena) {}
+
+        std::string print(int hierarchy) {
             std::ostringstream ss;
 
             ss << std::string(hierarchy * HS_AST_PRINT_INDENT_SIZE, ' ');
@@ -42,9 +44,5 @@ namespace hs {
 #endif
             return ss.str();
         }
-
-        expression_type_t get_type() override {
-            return EX_FUNCTION_CALL;
-        }
     };
 }
\ No newline at end of file
@@ -2,24 +2,41 @@
 
 #include "../expression.hpp"
 #include "type.hpp"
+#include "../../symbols.hpp"
 
 #include <string>
 #include <vector>
 #include <sstream>
 
 namespace hs {
+    // Allocator-aware, so args' strings end up on the same arena as
+    // their function_def_t's vector
     struct function_arg_t {
-        std::string type;
-        std::string name;
+        typedef std::pmr::polymorphic_allocator <> allocator_type;
+
+        ast_string_t type;
+        ast_string_t name;
+        symbol_id_t symbol = 0;
+
+        function_arg_t(const allocator_type& alloc = {}) : type(alloc), name(alloc) {}
+
+        function_arg_t(const function_arg_t& other, const allocator_type& alloc = {}) :
+            type(other.type, alloc), name(other.name, alloc), symbol(other.symbol) {}
+
+        function_arg_t(function_arg_t&& other, const allocator_type& alloc) :
+            type(std::move(other.type), alloc), name(std::move(other.name), alloc), symbol(other.symbol) {}
     };
 
     struct function_def_t : public expression_t {
-        std::string name;
+        ast_string_t name;
+        symbol_id_t symbol = 0;
         expression_t* body = nullptr;
-        std::string type;
-        std::vector <function_arg_t> args;
+        ast_string_t type;
+        ast_vector_t <function_arg_t> args;
 
-        std::string print(int hierarchy) override {
+        function_def_t(std::pmr::memory_resource* arena) : expression_t(EX_FUNCTION_DEF), name(arena), type(arena), args(arena) {}
+
+        std::string print(int hierarchy) {
             std::ostringstream ss;
 
             ss << std::string(hierarchy * HS_AST_PRINT_INDENT_SIZE, ' ');
@@ -43,9 +60,5 @@ namespace hs {
 #endif
             return ss.str();
         }
-
-        expression_type_t get_type() override {
-            return EX_FUNCTION_DEF;
-        }
     };
 }
\ No newline at end of file
@@ -12,7 +12,9 @@ namespace hs {
         expression_t* if_expr = nullptr;
         expression_t* else_expr = nullptr;
 
-        std::string print(int hierarchy) override {
+        if_else_t() : expression_t(EX_IF_ELSE) {}
+
+        std::string print(int hierarchy) {
             std::ostringstream ss;
 
             ss << std::string(hierarchy, ' ');
@@ -24,9 +26,5 @@ namespace hs {
 #endif
             return ss.str();
         }
-
-        expression_type_t get_type() override {
-            return EX_IF_ELSE;
-        }
     };
 }
\ No newline at end of file
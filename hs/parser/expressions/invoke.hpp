@@ -11,7 +11,9 @@ namespace hs {
     struct invoke_expr_t : public expression_t {
         expression_t* ptr = nullptr;
 
-        std::string print(int hierarchy) override {
+        invoke_expr_t() : expression_t(EX_INVOKE) {}
+
+        std::string print(int hierarchy) {
             std::ostringstream ss;
 
             ss << std::string(hierarchy, '\t');
@@ -19,9 +21,5 @@ namespace hs {
 
             return ss.str();
         }
-
-        expression_type_t get_type() override {
-            return EX_INVOKE;
-        }
     };
 }
\ No newline at end of file
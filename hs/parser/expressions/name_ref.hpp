@@ -2,15 +2,19 @@
 
 #include "../expression.hpp"
 #include "type.hpp"
+#include "../../symbols.hpp"
 
 #include <string>
 #include <sstream>
 
 namespace hs {
     struct name_ref_t : public expression_t {
-        std::string name;
+        ast_string_t name;
+        symbol_id_t symbol = 0;
 
-        std::string print(int hierarchy) override {
+        name_ref_t(std::pmr::memory_resource* arena) : expression_t(EX_NAME_REF), name(arena) {}
+
+        std::string print(int hierarchy) {
             std::ostringstream ss;
 
             ss << std::string(hierarchy, ' ');
@@ -22,9 +26,5 @@ namespace hs {
 #endif
             return ss.str();
         }
-
-        expression_type_t get_type() override {
-            return EX_NAME_REF;
-        }
     };
 }
\ No newline at end of file
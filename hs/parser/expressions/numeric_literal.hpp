@@ -10,7 +10,13 @@ namespace hs {
     struct numeric_literal_t : public expression_t {
         uint64_t value;
 
-        std::string print(int hierarchy) override {
+        numeric_literal_t() : expression_t(EX_NUMERIC_LITERAL) {}
+
+        eval_t eval() {
+            return { ET_NUMERIC, value };
+        }
+
+        std::string print(int hierarchy) {
             std::ostringstream ss;
 
             ss << std::string(hierarchy * HS_AST_PRINT_INDENT_SIZE, ' ');
@@ -22,9 +28,5 @@ namespace hs {
 #endif
             return ss.str();
         }
-
-        expression_type_t get_type() override {
-            return EX_NUMERIC_LITERAL;
-        }
     };
 }
\ No newline at end of file
@@ -7,7 +7,9 @@ namespace hs {
     struct return_expr_t : public expression_t {
         expression_t* value;
 
-        std::string print(int hierarchy) override {
+        return_expr_t() : expression_t(EX_RETURN) {}
+
+        std::string print(int hierarchy) {
             std::ostringstream ss;
 
             ss << std::string(hierarchy * HS_AST_PRINT_INDENT_SIZE, ' ');
@@ -19,9 +21,5 @@ namespace hs {
 #endif
             return ss.str();
         }
-
-        expression_type_t get_type() override {
-            return EX_RETURN;
-        }
     };
 }
\ No newline at end of file
@@ -8,9 +8,11 @@
 
 namespace hs {
     struct string_literal_t : public expression_t {
-        std::string str;
+        ast_string_t str;
 
-        std::string print(int hierarchy) override {
+        string_literal_t(std::pmr::memory_resource* arena) : expression_t(EX_STRING_LITERAL), str(arena) {}
+
+        std::string print(int hierarchy) {
             std::ostringstream ss;
 
             ss << std::string(hierarchy * HS_AST_PRINT_INDENT_SIZE, ' ');
@@ -22,9 +24,5 @@ namespace hs {
 #endif
             return ss.str();
         }
-
-        expression_type_t get_type() override {
-            return EX_STRING_LITERAL;
-        }
     };
 }
\ No newline at end of file
@@ -5,7 +5,7 @@
 #include <unordered_map>
 
 namespace hs {
-    std::unordered_map <std::string, size_t> types = {
+    const std::unordered_map <std::string, size_t> types = {
         { "none", 0 },
         { "u8"  , 1 },
         { "u16" , 2 },
@@ -15,7 +15,7 @@ namespace hs {
         { "i32" , 4 }
     };
 
-    std::unordered_map <std::string, std::string> type_aliases = {
+    const std::unordered_map <std::string, std::string> type_aliases = {
         { "void" , "none" },
         { "byte" , "u8"   },
         { "uchar", "u8"   },
@@ -25,10 +25,22 @@ namespace hs {
         { "long" , "u32"  }
     };
 
+    // Both tables are shared between compilations (i.e. batch
+    // mode workers), so they must only ever be read
+    inline size_t get_type_size(const std::string& type) {
+        auto alias = type_aliases.find(type);
+
+        auto it = types.find(alias != type_aliases.end() ? alias->second : type);
+
+        return (it != types.end()) ? it->second : 0;
+    }
+
     struct type_t : public expression_t {
-        std::string type;
+        ast_string_t type;
 
-        std::string print(int hierarchy) override {
+        type_t(std::pmr::memory_resource* arena) : expression_t(EX_TYPE), type(arena) {}
+
+        std::string print(int hierarchy) {
             std::ostringstream ss;
 
             ss << std::string(hierarchy, ' ');
@@ -40,9 +52,5 @@ namespace hs {
 #endif
             return ss.str();
         }
-
-        expression_type_t get_type() override {
-            return EX_TYPE;
-        }
     };
 }
\ No newline at end of file
@@ -2,16 +2,20 @@
 
 #include "../expression.hpp"
 #include "type.hpp"
+#include "../../symbols.hpp"
 
 #include <string>
 #include <sstream>
 
 namespace hs {
     struct variable_def_t : public expression_t {
-        std::string type;
-        std::string name;
+        ast_string_t type;
+        ast_string_t name;
+        symbol_id_t symbol = 0;
 
-        std::string print(int hierarchy) override {
+        variable_def_t(std::pmr::memory_resource* arena) : expression_t(EX_VARIABLE_DEF), type(arena), name(arena) {}
+
+        std::string print(int hierarchy) {
             std::ostringstream ss;
 
             ss << std::string(hierarchy, ' ');
@@ -23,9 +27,5 @@ namespace hs {
 #endif
             return ss.str();
         }
-
-        expression_type_t get_type() override {
-            return EX_VARIABLE_DEF;
-        }
     };
 }
\ No newline at end of file
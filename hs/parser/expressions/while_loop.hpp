@@ -11,7 +11,9 @@ namespace hs {
         expression_t* condition = nullptr;
         expression_t* body = nullptr;
 
-        std::string print(int hierarchy) override {
+        while_loop_t() : expression_t(EX_WHILE_LOOP) {}
+
+        std::string print(int hierarchy) {
             std::ostringstream ss;
 
             ss << std::string(hierarchy, ' ');
@@ -23,9 +25,5 @@ namespace hs {
 #endif
             return ss.str();
         }
-
-        expression_type_t get_type() override {
-            return EX_WHILE_LOOP;
-        }
     };
 }
\ No newline at end of file
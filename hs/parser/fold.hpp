@@ -0,0 +1,195 @@
+#pragma once
+
+#include "../arena.hpp"
+
+#include "expression.hpp"
+#include "visit.hpp"
+#include "ctfe.hpp"
+
+#include <vector>
+#include <cstddef>
+
+namespace hs {
+    // Replaces operations on constants with numeric literals holding
+    // their result, i.e. (+ (* 2 4) x) becomes (+ 8 x).
+    //
+    // The tree is walked bottom-up with an explicit stack, so
+    // operands are folded before the operations using them, and
+    // eval() only ever has to look at literals. Calls with constant
+    // arguments are run by the interpreter, if there's one
+    class constant_folder_t {
+        arena_t* m_arena = nullptr;
+        interpreter_t* m_interpreter = nullptr;
+
+        struct slot_t {
+            expression_t** expr;
+
+            bool visited;
+        };
+
+        std::vector <slot_t> m_stack;
+
+        size_t m_folded = 0;
+
+        void later(expression_t*& expr) {
+            if (expr) m_stack.push_back({ &expr, false });
+        }
+
+        void push_children(expression_t* expr) {
+            switch (expr->get_type()) {
+                case EX_FUNCTION_DEF: {
+                    later(((function_def_t*)expr)->body);
+                } break;
+
+                case EX_ARRAY_ACCESS: {
+                    array_access_t* aa = (array_access_t*)expr;
+
+                    later(aa->type_or_name);
+                    later(aa->addr);
+                } break;
+
+                case EX_ASSIGNMENT: {
+                    assignment_t* as = (assignment_t*)expr;
+
+                    later(as->assignee);
+                    later(as->value);
+                } break;
+
+                case EX_BINARY_OP: {
+                    binary_op_t* bo = (binary_op_t*)expr;
+
+                    later(bo->lhs);
+                    later(bo->rhs);
+                } break;
+
+                case EX_COMP_OP: {
+                    comp_op_t* co = (comp_op_t*)expr;
+
+                    later(co->lhs);
+                    later(co->rhs);
+                } break;
+
+                case EX_EXPRESSION_BLOCK: {
+                    for (expression_t*& e : ((expression_block_t*)expr)->block)
+                        later(e);
+                } break;
+
+                case EX_RETURN: {
+                    later(((return_expr_t*)expr)->value);
+                } break;
+
+                case EX_ARRAY: {
+                    for (expression_t*& e : ((array_t*)expr)->values)
+                        later(e);
+                } break;
+
+                case EX_FUNCTION_CALL: {
+                    function_call_t* fc = (function_call_t*)expr;
+
+                    later(fc->addr);
+
+                    for (expression_t*& e : fc->args)
+                        later(e);
+                } break;
+
+                case EX_INVOKE: {
+                    later(((invoke_expr_t*)expr)->ptr);
+                } break;
+
+                case EX_WHILE_LOOP: {
+                    while_loop_t* wl = (while_loop_t*)expr;
+
+                    later(wl->condition);
+                    later(wl->body);
+                } break;
+
+                case EX_IF_ELSE: {
+                    if_else_t* ie = (if_else_t*)expr;
+
+                    later(ie->cond);
+                    later(ie->if_expr);
+                    later(ie->else_expr);
+                } break;
+
+                default: break;
+            }
+        }
+
+        void fold_node(expression_t** slot) {
+            expression_t* expr = *slot;
+
+            eval_t value;
+
+            switch (expr->get_type()) {
+                case EX_BINARY_OP:
+                case EX_COMP_OP: {
+                    value = expr->eval();
+                } break;
+
+                case EX_FUNCTION_CALL: {
+                    function_call_t* fc = (function_call_t*)expr;
+
+                    if (!m_interpreter)
+                        return;
+
+                    for (expression_t* arg : fc->args)
+                        if (arg->get_type() != EX_NUMERIC_LITERAL)
+                            return;
+
+                    value = m_interpreter->evaluate(fc);
+                } break;
+
+                default: return;
+            }
+
+            if (value.type != ET_NUMERIC)
+                return;
+
+            numeric_literal_t* nl = m_arena->create <numeric_literal_t> ();
+
+            nl->line = expr->line;
+            nl->offset = expr->offset;
+            nl->len = expr->len;
+            nl->value = value.value;
+
+            *slot = nl;
+
+            m_folded++;
+        }
+
+    public:
+        void init(arena_t* arena, interpreter_t* interpreter = nullptr) {
+            m_arena = arena;
+            m_interpreter = interpreter;
+        }
+
+        // Fold the tree under expr, expr itself might be replaced
+        void fold(expression_t*& expr) {
+            later(expr);
+
+            while (m_stack.size()) {
+                slot_t& slot = m_stack.back();
+
+                if (slot.visited) {
+                    expression_t** expr = slot.expr;
+
+                    m_stack.pop_back();
+
+                    fold_node(expr);
+
+                    continue;
+                }
+
+                slot.visited = true;
+
+                // Might reallocate the stack, slot is invalid after
+                push_children(*slot.expr);
+            }
+        }
+
+        // Number of operations replaced so far
+        size_t get_folded() {
+            return m_folded;
+        }
+    };
+}
@@ -5,6 +5,8 @@
 
 #include "../stream.hpp"
 #include "../error.hpp"
+#include "../precompiled.hpp"
+#include "../arena.hpp"
 
 #include "expression.hpp"
 #include "output.hpp"
@@ -29,6 +31,8 @@
 #include "expressions/type.hpp"
 #include "expressions/blob.hpp"
 
+#include "visit.hpp"
+
 #include <cassert>
 
 #define ERROR(msg) \
@@ -40,43 +44,201 @@
     return nullptr;
 
 namespace hs {
+    // The parser keeps its own stack of frames instead of recursing,
+    // so deeply nested input (long operator chains, nested blocks)
+    // can't overflow the native stack. Each frame is a parse_*
+    // function that's waiting on an expression, resumed with it
+    // when it's done
+    enum parser_frame_kind_t {
+        PF_EXPRESSION,
+        PF_STATEMENT,
+        PF_CHAIN,
+        PF_RIGHTSIDE,
+        PF_FUNCTION_DEF,
+        PF_WHILE_LOOP,
+        PF_IF_ELSE,
+        PF_RETURN,
+        PF_INVOKE,
+        PF_ARRAY,
+        PF_ARRAY_ACCESS,
+        PF_FUNCTION_CALL,
+        PF_EXPRESSION_BLOCK,
+        PF_BINARY_OP,
+        PF_COMP_OP,
+        PF_ASSIGNMENT
+    };
+
+    struct parser_frame_t {
+        parser_frame_kind_t kind;
+        int state;
+
+        // Left hand side of operations, calls and accesses
+        expression_t* lhs;
+
+        // Node being built
+        expression_t* node = nullptr;
+
+        // What the last child frame returned
+        expression_t* result = nullptr;
+
+        unsigned int count = 0;
+        bool parenthesized = false;
+    };
+
     class parser_t {
-        stream_t <lexer_token_t>* m_input;
+        token_stream_t* m_input;
         error_logger_t* m_logger;
 
         lexer_token_t m_current;
         parser_output_t m_output;
 
+        symbol_table_t* m_symbols = nullptr;
+
+        // Expressions are created here
+        arena_t* m_arena = nullptr;
+
+        // is_type() results by symbol, -1 when not known yet
+        std::vector <int8_t> m_type_cache;
+
         int m_anonymous_functions = 0;
 
-        std::string get_anonymous_function_name() {
-            std::string name = "<anonymous_";
+        std::vector <parser_frame_t> m_frames;
+
+        // Returned by frames that are waiting on a child
+        expression_t m_pending;
+
+        expression_t* enter(parser_frame_kind_t kind, expression_t* lhs = nullptr) {
+            m_frames.push_back({ kind, 0, lhs });
+
+            return &m_pending;
+        }
+
+        expression_t* resume(parser_frame_t& f) {
+            switch (f.kind) {
+                case PF_EXPRESSION      : return parse_expression(f);
+                case PF_STATEMENT       : return parse_statement(f);
+                case PF_CHAIN           : return parse_chain(f);
+                case PF_RIGHTSIDE       : return parse_rightside_operation(f);
+                case PF_FUNCTION_DEF    : return parse_function_def(f);
+                case PF_WHILE_LOOP      : return parse_while_loop(f);
+                case PF_IF_ELSE         : return parse_if_else(f);
+                case PF_RETURN          : return parse_return(f);
+                case PF_INVOKE          : return parse_invoke(f);
+                case PF_ARRAY           : return parse_array(f);
+                case PF_ARRAY_ACCESS    : return parse_array_access(f);
+                case PF_FUNCTION_CALL   : return parse_function_call(f);
+                case PF_EXPRESSION_BLOCK: return parse_expression_block(f);
+                case PF_BINARY_OP       : return parse_binary_op(f);
+                case PF_COMP_OP         : return parse_comp_op(f);
+                case PF_ASSIGNMENT      : return parse_assignment(f);
+            }
+
+            return nullptr;
+        }
+
+        // Run frames until the one entered here returns
+        expression_t* run(parser_frame_kind_t kind) {
+            size_t bottom = m_frames.size();
+
+            expression_t* result = nullptr;
+
+            enter(kind);
+
+            while (m_frames.size() > bottom) {
+                parser_frame_t& f = m_frames.back();
+
+                f.result = result;
+
+                expression_t* expr = resume(f);
+
+                if (expr == &m_pending)
+                    continue;
+
+                m_frames.pop_back();
+
+                result = expr;
+            }
 
-            name += std::to_string(m_anonymous_functions++);
-            name += ">";
+            return result;
+        }
 
-            return name;
+        // Left without a symbol, the contextualizer interns it. We
+        // might be running alongside the lexer (see --streaming), so
+        // only the lexer interns while parsing
+        void name_anonymous_function(function_def_t* def) {
+            def->name = "<anonymous_";
+            def->name += std::to_string(m_anonymous_functions++);
+            def->name += ">";
         }
     
     public:
-        void init(stream_t <lexer_token_t>* input, error_logger_t* logger) {
+        void init(token_stream_t* input, error_logger_t* logger) {
             m_input = input;
             m_logger = logger;
         }
 
-        bool is_type(std::string ident) {
-            return types.contains(ident) || type_aliases.contains(ident); 
+        // Has to be the table the lexer interned identifiers on
+        void set_symbols(symbol_table_t* symbols) {
+            m_symbols = symbols;
+        }
+
+        symbol_table_t* get_symbols() {
+            return m_symbols;
+        }
+
+        // Has to outlive the AST, and everything that looks at it
+        void set_arena(arena_t* arena) {
+            m_arena = arena;
+        }
+
+        arena_t* get_arena() {
+            return m_arena;
+        }
+
+        bool is_type(std::string_view ident) {
+            std::string name(ident);
+
+            return types.contains(name) || type_aliases.contains(name); 
+        }
+
+        // Identifier tokens only, symbol 0 means the lexer didn't
+        // intern it
+        bool is_type(const lexer_token_t& token) {
+            if (!token.value)
+                return is_type(token.text);
+
+            if (token.value >= m_type_cache.size())
+                m_type_cache.resize(token.value + 1, -1);
+
+            int8_t& cached = m_type_cache[token.value];
+
+            if (cached < 0)
+                cached = is_type(token.text);
+
+            return cached;
         }
 
         expression_t* parse_expression_impl();
-        expression_t* parse_expression();
+        expression_t* parse_expression(parser_frame_t& f);
+
+        expression_t* parse_function_def(parser_frame_t& f) {
+            if (f.state) {
+                function_def_t* def = (function_def_t*)f.node;
+
+                def->body = f.result;
+
+                if (!def->body) return nullptr;
+
+                return def;
+            }
 
-        expression_t* parse_function_def() {
             if (m_current.type != LT_KEYWORD_FN) {
                 assert(false); // ??
             }
 
-            function_def_t* def = new function_def_t;
+            function_def_t* def = m_arena->create <function_def_t> ();
+
+            f.node = def;
 
             def->line = m_current.line;
             def->offset = m_current.offset;
@@ -86,20 +248,20 @@ namespace hs {
 
             switch (m_current.type) {
                 case LT_ARROW: {
-                    def->name = get_anonymous_function_name();
+                    name_anonymous_function(def);
 
                     goto parse_function_type;
                 } break;
                 
                 case LT_COLON: {
-                    def->name = get_anonymous_function_name();
+                    name_anonymous_function(def);
                     def->type = "<any>";
 
                     goto parse_function_body;
                 } break;
 
                 case LT_OPENING_PARENT: {
-                    def->name = get_anonymous_function_name();
+                    name_anonymous_function(def);
 
                     goto parse_function_args;
                 } break;
@@ -112,6 +274,7 @@ namespace hs {
             }
 
             def->name = m_current.text;
+            def->symbol = m_current.value;
 
             parse_remaining_prototype:
 
@@ -139,6 +302,7 @@ namespace hs {
                     do_parse_arg:
 
                     arg.name = m_current.text;
+                    arg.symbol = m_current.value;
 
                     m_current = m_input->get();
 
@@ -152,8 +316,8 @@ namespace hs {
                         ERROR("Expected " ESCAPE(37;1) "argument type" ESCAPE(0));
                     }
 
-                    if (!is_type(m_current.text)) {
-                        ERROR(fmt("Identifier \"" ESCAPE(37;1) "%s" ESCAPE(0) "\" does not name a type", m_current.text.c_str()));
+                    if (!is_type(m_current)) {
+                        ERROR(fmt("Identifier \"" ESCAPE(37;1) "%s" ESCAPE(0) "\" does not name a type", std::string(m_current.text).c_str()));
                     }
 
                     arg.type = m_current.text;
@@ -189,8 +353,8 @@ namespace hs {
                         ERROR("Expected " ESCAPE(37;1) "type" ESCAPE(0) " after " ESCAPE(37;1) "->" ESCAPE(0) " on function definition");
                     }
 
-                    if (!is_type(m_current.text)) {
-                        ERROR(fmt("Identifier \"" ESCAPE(37;1) "%s" ESCAPE(0) "\" does not name a type", m_current.text.c_str()));
+                    if (!is_type(m_current)) {
+                        ERROR(fmt("Identifier \"" ESCAPE(37;1) "%s" ESCAPE(0) "\" does not name a type", std::string(m_current.text).c_str()));
                     }
 
                     def->type = m_current.text;
@@ -203,9 +367,9 @@ namespace hs {
 
                     m_current = m_input->get();
 
-                    def->body = parse_expression();
+                    f.state = 1;
 
-                    if (!def->body) return nullptr;
+                    return enter(PF_EXPRESSION);
                 } break;
 
                 default: {
@@ -221,19 +385,13 @@ namespace hs {
                 assert(false); // ??
             }
 
-            numeric_literal_t* num = new numeric_literal_t;
+            numeric_literal_t* num = m_arena->create <numeric_literal_t> ();
 
             num->line = m_current.line;
             num->offset = m_current.offset;
             num->len = m_current.text.size();
 
-            if (!std::isdigit(m_current.text[0])) {
-                // This is a char literal
-                
-                num->value = m_current.text[0];
-            } else {
-                num->value = std::stoull(m_current.text, nullptr, 0);
-            }
+            num->value = m_current.value;
 
             m_current = m_input->get();
 
@@ -245,7 +403,7 @@ namespace hs {
                 assert(false); // ??
             }
 
-            string_literal_t* str = new string_literal_t;
+            string_literal_t* str = m_arena->create <string_literal_t> ();
 
             str->line = m_current.line;
             str->offset = m_current.offset;
@@ -258,12 +416,20 @@ namespace hs {
             return str;
         }
 
-        expression_t* parse_invoke() {
+        expression_t* parse_invoke(parser_frame_t& f) {
+            if (f.state) {
+                invoke_expr_t* invoke = (invoke_expr_t*)f.node;
+
+                invoke->ptr = f.result;
+
+                return invoke;
+            }
+
             if (m_current.type != LT_KEYWORD_INVOKE) {
                 assert(false); // ??
             }
 
-            invoke_expr_t* invoke = new invoke_expr_t;
+            invoke_expr_t* invoke = m_arena->create <invoke_expr_t> ();
 
             invoke->line = m_current.line;
             invoke->offset = m_current.offset;
@@ -271,13 +437,22 @@ namespace hs {
 
             m_current = m_input->get();
 
-            invoke->ptr = parse_expression();
+            f.node = invoke;
+            f.state = 1;
 
-            return invoke;
+            return enter(PF_EXPRESSION);
         }
 
-        expression_t* parse_binary_op(expression_t* lhs) {
-            binary_op_t* bop = new binary_op_t;
+        expression_t* parse_binary_op(parser_frame_t& f) {
+            if (f.state) {
+                binary_op_t* bop = (binary_op_t*)f.node;
+
+                bop->rhs = f.result;
+
+                return bop;
+            }
+
+            binary_op_t* bop = m_arena->create <binary_op_t> ();
 
             bop->line = m_current.line;
             bop->offset = m_current.offset;
@@ -287,14 +462,24 @@ namespace hs {
 
             m_current = m_input->get();
             
-            bop->lhs = lhs;
-            bop->rhs = parse_expression();
+            bop->lhs = f.lhs;
+
+            f.node = bop;
+            f.state = 1;
 
-            return bop;
+            return enter(PF_EXPRESSION);
         }
 
-        expression_t* parse_comp_op(expression_t* lhs) {
-            comp_op_t* cop = new comp_op_t;
+        expression_t* parse_comp_op(parser_frame_t& f) {
+            if (f.state) {
+                comp_op_t* cop = (comp_op_t*)f.node;
+
+                cop->rhs = f.result;
+
+                return cop;
+            }
+
+            comp_op_t* cop = m_arena->create <comp_op_t> ();
 
             cop->line = m_current.line;
             cop->offset = m_current.offset;
@@ -304,14 +489,16 @@ namespace hs {
 
             m_current = m_input->get();
             
-            cop->lhs = lhs;
-            cop->rhs = parse_expression();
+            cop->lhs = f.lhs;
 
-            return cop;
+            f.node = cop;
+            f.state = 1;
+
+            return enter(PF_EXPRESSION);
         }
 
         expression_t* parse_variable_def(std::string type) {
-            variable_def_t* var = new variable_def_t;
+            variable_def_t* var = m_arena->create <variable_def_t> ();
 
             var->line = m_current.line;
             var->offset = m_current.offset;
@@ -319,6 +506,7 @@ namespace hs {
 
             var->type = type;
             var->name = m_current.text;
+            var->symbol = m_current.value;
 
             m_current = m_input->get();
 
@@ -326,7 +514,7 @@ namespace hs {
         }
 
         expression_t* parse_blob() {
-            blob_t* blob = new blob_t;
+            blob_t* blob = m_arena->create <blob_t> ();
 
             if (m_current.type != LT_KEYWORD_BLOB) {
                 assert(false); // ??
@@ -349,8 +537,13 @@ namespace hs {
             return blob;
         }
 
-        expression_t* parse_array() {
-            array_t* arr = new array_t;
+        expression_t* parse_array(parser_frame_t& f) {
+            if (f.state)
+                return parse_array_values(f);
+
+            array_t* arr = m_arena->create <array_t> ();
+
+            f.node = arr;
 
             if (m_current.type != LT_KEYWORD_ARRAY) {
                 assert(false); // ??
@@ -372,11 +565,10 @@ namespace hs {
                 ERROR("Expected type after [");
             }
 
-            if (!is_type(m_current.text)) {
-                ERROR(fmt("Identifier \"" ESCAPE(37;1) "%s" ESCAPE(0) "\" does not name a type", m_current.text.c_str()));
+            if (!is_type(m_current)) {
+                ERROR(fmt("Identifier \"" ESCAPE(37;1) "%s" ESCAPE(0) "\" does not name a type", std::string(m_current.text).c_str()));
             }
 
-            arr->type = type_t();
             arr->type.type = m_current.text;
 
             m_current = m_input->get();
@@ -388,12 +580,7 @@ namespace hs {
                     ERROR("Expected numeric literal after [");
                 }
 
-                if (!std::isdigit(m_current.text[0])) {
-                    // This is a char literal
-                    arr->size = m_current.text[0];
-                } else {
-                    arr->size = std::stoull(m_current.text, nullptr, 0);
-                }
+                arr->size = m_current.value;
 
                 m_current = m_input->get();
             }
@@ -405,49 +592,55 @@ namespace hs {
             m_current = m_input->get();
 
             if (m_current.type == LT_OPENING_BRACE) {
-                expression_t* lhs;
-                expression_t* op;
-
                 m_current = m_input->get();
 
-                unsigned int real_size = 0;
+                f.state = 1;
 
-                while (m_current.type != LT_CLOSING_BRACE) {
-                    lhs = parse_expression();
+                return parse_array_values(f);
+            }
 
-                    do {
-                        op = parse_rightside_operation(lhs);
+            if (!arr->size) {
+                ERROR("Cannot define zero-sized arrays");
+            }
 
-                        if (op) lhs = op;
-                    } while (op);
+            return arr;
+        }
 
-                    arr->values.push_back(lhs);
-                    real_size++;
+        // Array initializer, f.count is the number of values so far
+        expression_t* parse_array_values(parser_frame_t& f) {
+            array_t* arr = (array_t*)f.node;
 
-                    if (m_current.type == LT_CLOSING_BRACE) break;
+            if (f.state == 2) {
+                arr->values.push_back(f.result);
+                f.count++;
 
+                if (m_current.type != LT_CLOSING_BRACE) {
                     if (m_current.type != LT_COMMA) {
                         ERROR("Expressions on arrays must be separated by commas");
                     }
 
                     m_current = m_input->get();
                 }
+            }
 
-                if (m_current.type == LT_CLOSING_BRACE) {
-                    if ((real_size != arr->size) && (arr->size != 0)) {
-                        if (m_logger) m_logger->print_warning(
-                            "parser",
-                            "Array size doesn't match declared size",
-                            m_current.line, m_current.offset, m_current.text.size(), true
-                        );
-                    }
+            if (m_current.type != LT_CLOSING_BRACE) {
+                f.state = 2;
 
-                    arr->size = real_size;
-                }
+                return enter(PF_STATEMENT);
+            }
 
-                m_current = m_input->get();
+            if ((f.count != arr->size) && (arr->size != 0)) {
+                if (m_logger) m_logger->print_warning(
+                    "parser",
+                    "Array size doesn't match declared size",
+                    m_current.line, m_current.offset, m_current.text.size(), true
+                );
             }
 
+            arr->size = f.count;
+
+            m_current = m_input->get();
+
             if (!arr->size) {
                 ERROR("Cannot define zero-sized arrays");
             }
@@ -456,7 +649,7 @@ namespace hs {
         }
 
         expression_t* parse_name_ref(std::string name) {
-            name_ref_t* ref = new name_ref_t;
+            name_ref_t* ref = m_arena->create <name_ref_t> ();
 
             ref->line = m_current.line;
             ref->offset = m_current.offset;
@@ -467,12 +660,62 @@ namespace hs {
             return ref;
         }
 
-        expression_t* parse_if_else() {
+        expression_t* parse_if_else(parser_frame_t& f) {
+            if_else_t* ifl = (if_else_t*)f.node;
+
+            switch (f.state) {
+                case 1: {
+                    ifl->cond = f.result;
+
+                    if (m_current.type != LT_CLOSING_PARENT) {
+                        ERROR("Expected closing parenthesis after if condition");
+                    }
+
+                    m_current = m_input->get();
+
+                    if (m_current.type != LT_COLON) {
+                        ERROR("Expected colon after closing parenthesis");
+                    }
+
+                    m_current = m_input->get();
+
+                    f.state = 2;
+
+                    return enter(PF_EXPRESSION);
+                } break;
+
+                case 2: {
+                    ifl->if_expr = f.result;
+
+                    if (m_current.type == LT_KEYWORD_ELSE) {
+                        m_current = m_input->get();
+
+                        if (m_current.type != LT_COLON) {
+                            ERROR("Expected colon after else");
+                        }
+
+                        m_current = m_input->get();
+
+                        f.state = 3;
+
+                        return enter(PF_EXPRESSION);
+                    }
+
+                    return ifl;
+                } break;
+
+                case 3: {
+                    ifl->else_expr = f.result;
+
+                    return ifl;
+                } break;
+            }
+
             if (m_current.type != LT_KEYWORD_IF) {
                 assert(false); // ??
             }
 
-            if_else_t* ifl = new if_else_t;
+            ifl = m_arena->create <if_else_t> ();
 
             ifl->line = m_current.line;
             ifl->offset = m_current.offset;
@@ -486,43 +729,48 @@ namespace hs {
 
             m_current = m_input->get();
 
-            ifl->cond = parse_expression();
+            f.node = ifl;
+            f.state = 1;
 
-            if (m_current.type != LT_CLOSING_PARENT) {
-                ERROR("Expected closing parenthesis after if condition");
-            }
+            return enter(PF_EXPRESSION);
+        }
 
-            m_current = m_input->get();
+        expression_t* parse_while_loop(parser_frame_t& f) {
+            while_loop_t* whl = (while_loop_t*)f.node;
 
-            if (m_current.type != LT_COLON) {
-                ERROR("Expected colon after closing parenthesis");
-            }
+            switch (f.state) {
+                case 1: {
+                    whl->condition = f.result;
 
-            m_current = m_input->get();
+                    if (m_current.type != LT_CLOSING_PARENT) {
+                        ERROR("Expected closing parenthesis after while loop condition");
+                    }
 
-            ifl->if_expr = parse_expression();
+                    m_current = m_input->get();
 
-            if (m_current.type == LT_KEYWORD_ELSE) {
-                m_current = m_input->get();
+                    if (m_current.type != LT_COLON) {
+                        ERROR("Expected colon after closing parenthesis");
+                    }
 
-                if (m_current.type != LT_COLON) {
-                    ERROR("Expected colon after else");
-                }
+                    m_current = m_input->get();
 
-                m_current = m_input->get();
+                    f.state = 2;
 
-                ifl->else_expr = parse_expression();
-            }
+                    return enter(PF_EXPRESSION);
+                } break;
 
-            return ifl;
-        }
+                case 2: {
+                    whl->body = f.result;
+
+                    return whl;
+                } break;
+            }
 
-        expression_t* parse_while_loop() {
             if (m_current.type != LT_KEYWORD_WHILE) {
                 assert(false); // ??
             }
 
-            while_loop_t* whl = new while_loop_t;
+            whl = m_arena->create <while_loop_t> ();
 
             whl->line = m_current.line;
             whl->offset = m_current.offset;
@@ -536,29 +784,24 @@ namespace hs {
 
             m_current = m_input->get();
 
-            whl->condition = parse_expression();
-
-            if (m_current.type != LT_CLOSING_PARENT) {
-                ERROR("Expected closing parenthesis after while loop condition");
-            }
-
-            m_current = m_input->get();
+            f.node = whl;
+            f.state = 1;
 
-            if (m_current.type != LT_COLON) {
-                ERROR("Expected colon after closing parenthesis");
-            }
+            return enter(PF_EXPRESSION);
+        }
 
-            m_current = m_input->get();
+        expression_t* parse_return(parser_frame_t& f) {
+            if (f.state) {
+                return_expr_t* ret = (return_expr_t*)f.node;
 
-            whl->body = parse_expression();
+                ret->value = f.result;
 
-            return whl;
-        }
+                return ret;
+            }
 
-        expression_t* parse_return() {
             assert(m_current.type == LT_KEYWORD_RETURN);
 
-            return_expr_t* ret = new return_expr_t;
+            return_expr_t* ret = m_arena->create <return_expr_t> ();
 
             ret->line = m_current.line;
             ret->offset = m_current.offset;
@@ -566,55 +809,68 @@ namespace hs {
 
             m_current = m_input->get();
 
-            ret->value = parse_expression();
+            f.node = ret;
+            f.state = 1;
 
-            return ret;
+            return enter(PF_EXPRESSION);
         }
 
-        expression_t* parse_array_access(expression_t* lhs) {
-            array_access_t* access = new array_access_t;
-
-            access->line = m_current.line;
-            access->offset = m_current.offset;
-            access->len = m_current.text.size();
+        expression_t* parse_array_access(parser_frame_t& f) {
+            if (f.state) {
+                array_access_t* access = (array_access_t*)f.node;
 
-            access->type_or_name = lhs;
+                access->addr = f.result;
 
-            access->addr = parse_expression();
+                if (m_current.type != LT_CLOSING_BRACKET) {
+                    ERROR("Expected closing bracket on array access expression");
+                }
 
-            if (m_current.type != LT_CLOSING_BRACKET) {
-                ERROR("Expected closing bracket on array access expression");
+                m_current = m_input->get();
 
-                return nullptr;
+                return access;
             }
 
-            m_current = m_input->get();
+            array_access_t* access = m_arena->create <array_access_t> ();
+
+            access->line = m_current.line;
+            access->offset = m_current.offset;
+            access->len = m_current.text.size();
+
+            access->type_or_name = f.lhs;
+
+            f.node = access;
+            f.state = 1;
 
-            return access;
+            return enter(PF_EXPRESSION);
         }
 
-        expression_t* parse_function_call(expression_t* addr) {
-            function_call_t* call = new function_call_t;
+        expression_t* parse_function_call(parser_frame_t& f) {
+            function_call_t* call = (function_call_t*)f.node;
 
-            call->line = m_current.line;
-            call->offset = m_current.offset;
-            call->len = m_current.text.size();
+            if (!f.state) {
+                call = m_arena->create <function_call_t> ();
 
-            call->addr = addr;
+                call->line = m_current.line;
+                call->offset = m_current.offset;
+                call->len = m_current.text.size();
 
-            if (m_current.type == LT_CLOSING_PARENT) {
-                m_current = m_input->get();
+                call->addr = f.lhs;
 
-                return call;
-            }
+                if (m_current.type == LT_CLOSING_PARENT) {
+                    m_current = m_input->get();
 
-            while (m_current.type != LT_CLOSING_PARENT) {
-                call->args.push_back(parse_expression());
+                    return call;
+                }
+
+                f.node = call;
+                f.state = 1;
+            } else {
+                call->args.push_back(f.result);
 
                 if (m_current.type == LT_CLOSING_PARENT) {
                     m_current = m_input->get();
 
-                    break;
+                    return call;
                 }
 
                 if (m_current.type != LT_COMMA) {
@@ -624,28 +880,40 @@ namespace hs {
                 m_current = m_input->get();
             }
 
+            if (m_current.type != LT_CLOSING_PARENT)
+                return enter(PF_EXPRESSION);
+
             return call;
         }
 
-        expression_t* parse_assignment(expression_t* lhs) {
-            assignment_t* assign = new assignment_t;
+        expression_t* parse_assignment(parser_frame_t& f) {
+            if (f.state) {
+                assignment_t* assign = (assignment_t*)f.node;
+
+                assign->value = f.result;
+
+                return assign;
+            }
+
+            assignment_t* assign = m_arena->create <assignment_t> ();
 
             assign->line = m_current.line;
             assign->offset = m_current.offset;
             assign->len = m_current.text.size();
 
-            assign->assignee = lhs;
+            assign->assignee = f.lhs;
             assign->op = m_current.text;
 
             m_current = m_input->get();
 
-            assign->value = parse_expression();
+            f.node = assign;
+            f.state = 1;
 
-            return assign; 
+            return enter(PF_EXPRESSION);
         }
 
         expression_t* parse_asm_block() {
-            asm_block_t* asm_block = new asm_block_t;
+            asm_block_t* asm_block = m_arena->create <asm_block_t> ();
 
             asm_block->line = m_current.line;
             asm_block->offset = m_current.offset;
@@ -657,28 +925,22 @@ namespace hs {
             return asm_block;
         }
 
-        expression_t* parse_expression_block() {
-            expression_block_t* block = new expression_block_t;
+        expression_t* parse_expression_block(parser_frame_t& f) {
+            expression_block_t* block = (expression_block_t*)f.node;
 
-            block->line = m_current.line;
-            block->offset = m_current.offset;
-            block->len = m_current.text.size();
+            if (!f.state) {
+                block = m_arena->create <expression_block_t> ();
 
-            expression_t* lhs;
-            expression_t* op;
+                block->line = m_current.line;
+                block->offset = m_current.offset;
+                block->len = m_current.text.size();
 
-            m_current = m_input->get();
-
-            while (m_current.type != LT_CLOSING_BRACE) {
-                lhs = parse_expression();
-
-                do {
-                    op = parse_rightside_operation(lhs);
-
-                    if (op) lhs = op;
-                } while (op);
+                m_current = m_input->get();
 
-                block->block.push_back(lhs);
+                f.node = block;
+                f.state = 1;
+            } else {
+                block->block.push_back(f.result);
 
                 if (m_current.type != LT_SEMICOLON) {
                     ERROR("Expressions on blocks must be separated by semicolons");
@@ -687,35 +949,99 @@ namespace hs {
                 m_current = m_input->get();
             }
 
+            if (m_current.type != LT_CLOSING_BRACE)
+                return enter(PF_STATEMENT);
+
             m_current = m_input->get();
 
             return block;
         }
 
-        expression_t* parse_rightside_operation(expression_t* lhs) {
+        bool is_rightside_operation() {
+            switch (m_current.type) {
+                case LT_OPERATOR_BINARY: case LT_STAR: case LT_AMPERSAND:
+                case LT_OPERATOR_COMP:
+                case LT_OPENING_PARENT:
+                case LT_OPENING_BRACKET:
+                case LT_OPERATOR_ASSIGN:
+                    return true;
+
+                default: return false;
+            }
+        }
+
+        // Apply operations on f.lhs until there are none left
+        expression_t* parse_chain(parser_frame_t& f) {
+            if (f.state) {
+                if (!f.result)
+                    return f.lhs;
+
+                f.lhs = f.result;
+            }
+
+            if (!is_rightside_operation())
+                return f.lhs;
+
+            f.state = 1;
+
+            return enter(PF_RIGHTSIDE, f.lhs);
+        }
+
+        // An expression, and whatever operations follow it
+        expression_t* parse_statement(parser_frame_t& f) {
+            switch (f.state) {
+                case 0: {
+                    f.state = 1;
+
+                    return enter(PF_EXPRESSION);
+                } break;
+
+                case 1: {
+                    if (is_rightside_operation()) {
+                        f.state = 2;
+
+                        return enter(PF_CHAIN, f.result);
+                    }
+                } break;
+            }
+
+            return f.result;
+        }
+
+        expression_t* parse_rightside_operation(parser_frame_t& f) {
             switch (m_current.type) {
                 case LT_OPERATOR_BINARY: case LT_STAR: case LT_AMPERSAND: {
-                    return parse_binary_op(lhs);
+                    f.kind = PF_BINARY_OP;
+
+                    return parse_binary_op(f);
                 } break;
 
                 case LT_OPERATOR_COMP: {
-                    return parse_comp_op(lhs);
+                    f.kind = PF_COMP_OP;
+
+                    return parse_comp_op(f);
                 } break;
 
                 case LT_OPENING_PARENT: {
                     m_current = m_input->get();
 
-                    return parse_function_call(lhs);
+                    f.kind = PF_FUNCTION_CALL;
+
+                    return parse_function_call(f);
                 } break;
 
                 case LT_OPENING_BRACKET: {
                     m_current = m_input->get();
 
-                    return parse_array_access(lhs);
+                    f.kind = PF_ARRAY_ACCESS;
+
+                    return parse_array_access(f);
                 } break;
 
                 case LT_OPERATOR_ASSIGN: {
-                    return parse_assignment(lhs);
+                    f.kind = PF_ASSIGNMENT;
+
+                    return parse_assignment(f);
                 } break;
 
                 default: return nullptr;
@@ -728,20 +1054,45 @@ namespace hs {
             return &m_output;
         }
 
+        int get_anonymous_function_count() {
+            return m_anonymous_functions;
+        }
+
+        // Take a precompiled header's expressions straight from its
+        // image (see lexer_t::lex_precompiled())
+        bool parse_precompiled() {
+            precompiled_reader_t image;
+
+            if (!(image.load(std::string(m_current.text)) && image.get_source(m_output.source, m_anonymous_functions, m_arena))) {
+                if (m_logger) m_logger->print_error(
+                    "parser",
+                    fmt("Couldn't load precompiled header \"%s\"", std::string(m_current.text).c_str()),
+                    m_current.line, m_current.offset, 1
+                );
+
+                return false;
+            }
+
+            m_anonymous_functions += image.contents.anonymous_functions;
+
+            return true;
+        }
+
         bool parse() {
             expression_t* lhs;
-            expression_t* op;
 
             m_current = m_input->get();
 
             while (m_current.type != LT_NONE) {
-                lhs = parse_expression();
+                if (m_current.type == LT_PRECOMPILED) {
+                    if (!parse_precompiled()) return false;
+
+                    m_current = m_input->get();
 
-                do {
-                    op = parse_rightside_operation(lhs);
+                    continue;
+                }
 
-                    if (op) lhs = op;
-                } while (op);
+                lhs = run(PF_STATEMENT);
 
                 // Handle ; thing
                 if (lhs == (expression_t*)10) {
@@ -766,24 +1117,26 @@ namespace hs {
     };
 }
 
+// Expressions that need to parse others get a frame, and the
+// frame is returned
 hs::expression_t* hs::parser_t::parse_expression_impl() {
     hs::expression_t* expr;
  
     switch (m_current.type) {
         case LT_KEYWORD_FN: {
-            expr = parse_function_def();
+            return enter(PF_FUNCTION_DEF);
         } break;
 
         case LT_KEYWORD_WHILE: {
-            expr = parse_while_loop();
+            return enter(PF_WHILE_LOOP);
         } break;
 
         case LT_KEYWORD_RETURN: {
-            expr = parse_return();
+            return enter(PF_RETURN);
         } break;
 
         case LT_KEYWORD_ARRAY: {
-            expr = parse_array();
+            return enter(PF_ARRAY);
         } break;
 
         case LT_KEYWORD_BLOB: {
@@ -791,7 +1144,7 @@ hs::expression_t* hs::parser_t::parse_expression_impl() {
         } break;
 
         case LT_KEYWORD_IF: {
-            expr = parse_if_else();
+            return enter(PF_IF_ELSE);
         } break;
 
         case LT_LITERAL_NUMERIC: {
@@ -803,11 +1156,11 @@ hs::expression_t* hs::parser_t::parse_expression_impl() {
         } break;
 
         case LT_KEYWORD_INVOKE: {
-            expr = parse_invoke();
+            return enter(PF_INVOKE);
         } break;
 
         case LT_OPENING_BRACKET: {
-            type_t* none = new type_t;
+            type_t* none = m_arena->create <type_t> ();
 
             none->line = m_current.line;
             none->offset = m_current.offset;
@@ -817,19 +1170,19 @@ hs::expression_t* hs::parser_t::parse_expression_impl() {
 
             m_current = m_input->get();
 
-            expr = parse_array_access(none);
+            return enter(PF_ARRAY_ACCESS, none);
         } break;
 
         case LT_IDENT: {
-            bool type = is_type(m_current.text);
+            bool type = is_type(m_current);
 
             if (type) {
-                std::string type = m_current.text;
+                std::string type(m_current.text);
 
                 m_current = m_input->get();
 
                 if (m_current.type == LT_IDENT) {
-                    variable_def_t* var = new variable_def_t;
+                    variable_def_t* var = m_arena->create <variable_def_t> ();
 
                     var->line = m_current.line;
                     var->offset = m_current.offset;
@@ -837,12 +1190,13 @@ hs::expression_t* hs::parser_t::parse_expression_impl() {
 
                     var->type = type;
                     var->name = m_current.text;
+                    var->symbol = m_current.value;
 
                     expr = var;
 
                     m_current = m_input->get();
                 } else {
-                    type_t* type_expr = new type_t;
+                    type_t* type_expr = m_arena->create <type_t> ();
 
                     type_expr->line = m_current.line;
                     type_expr->offset = m_current.offset;
@@ -853,13 +1207,14 @@ hs::expression_t* hs::parser_t::parse_expression_impl() {
                     expr = type_expr;
                 }
             } else {
-                name_ref_t* name = new name_ref_t;
+                name_ref_t* name = m_arena->create <name_ref_t> ();
 
                 name->line = m_current.line;
                 name->offset = m_current.offset;
                 name->len = m_current.text.size();
 
                 name->name = m_current.text;
+                name->symbol = m_current.value;
 
                 expr = name;
 
@@ -868,7 +1223,7 @@ hs::expression_t* hs::parser_t::parse_expression_impl() {
         } break;
 
         case LT_OPENING_BRACE: {
-            expr = parse_expression_block();
+            return enter(PF_EXPRESSION_BLOCK);
         } break;
 
         case LT_ASM_BLOCK: {
@@ -880,7 +1235,7 @@ hs::expression_t* hs::parser_t::parse_expression_impl() {
         } break;
 
         default: {
-            ERROR(fmt("Unhandled token \"" ESCAPE(37;1) "%s" ESCAPE(0) "\"", m_current.text.c_str()));
+            ERROR(fmt("Unhandled token \"" ESCAPE(37;1) "%s" ESCAPE(0) "\"", std::string(m_current.text).c_str()));
 
             expr = nullptr;
         };
@@ -889,39 +1244,45 @@ hs::expression_t* hs::parser_t::parse_expression_impl() {
     return expr;
 }
 
-hs::expression_t* hs::parser_t::parse_expression() {
-    expression_t* lhs;
-    expression_t* op;
+hs::expression_t* hs::parser_t::parse_expression(parser_frame_t& f) {
+    switch (f.state) {
+        case 0: {
+            f.parenthesized = m_current.type == LT_OPENING_PARENT;
+            f.state = 1;
 
-    bool parenthesized = m_current.type == LT_OPENING_PARENT;
+            if (f.parenthesized) {
+                m_current = m_input->get();
 
-    if (parenthesized) {
-        parenthesized = true;
+                return enter(PF_EXPRESSION);
+            }
 
-        m_current = m_input->get();
+            // Might push a frame, f is only safe to use if it didn't
+            expression_t* expr = parse_expression_impl();
 
-        lhs = hs::parser_t::parse_expression();
-    } else {
-        lhs = hs::parser_t::parse_expression_impl();
-    }
+            if (expr == &m_pending)
+                return expr;
 
-    do {
-        op = parse_rightside_operation(lhs);
+            f.result = expr;
+        } [[fallthrough]];
 
-        if (op) lhs = op;
-    } while (op);
-    
-    if (parenthesized) {
+        case 1: {
+            if (is_rightside_operation()) {
+                f.state = 2;
+
+                return enter(PF_CHAIN, f.result);
+            }
+        } break;
+    }
+
+    if (f.parenthesized) {
         if (m_current.type != LT_CLOSING_PARENT) {
             ERROR("Expected \'" ESCAPE(37;1) ")" ESCAPE(0)"\'");
-
-            return nullptr;
         } else {
             m_current = m_input->get();
         }
     }
 
-    return lhs;
+    return f.result;
 }
 
 #undef ERROR
\ No newline at end of file
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "expression.hpp"
+
+#include "expressions/expression_block.hpp"
+#include "expressions/numeric_literal.hpp"
+#include "expressions/string_literal.hpp"
+#include "expressions/function_call.hpp"
+#include "expressions/array_access.hpp"
+#include "expressions/variable_def.hpp"
+#include "expressions/function_def.hpp"
+#include "expressions/assignment.hpp"
+#include "expressions/while_loop.hpp"
+#include "expressions/asm_block.hpp"
+#include "expressions/binary_op.hpp"
+#include "expressions/name_ref.hpp"
+#include "expressions/comp_op.hpp"
+#include "expressions/if_else.hpp"
+#include "expressions/return.hpp"
+#include "expressions/invoke.hpp"
+#include "expressions/array.hpp"
+#include "expressions/type.hpp"
+#include "expressions/blob.hpp"
+
+#include <string>
+#include <type_traits>
+
+namespace hs {
+    // Call f with expr cast to its node type, i.e.
+    //
+    //   visit(expr, [](auto* e) { ... });
+    //
+    // Untagged nodes (EX_NONE) are passed as expression_t*
+    template <class F> decltype(auto) visit(expression_t* expr, F&& f) {
+        switch (expr->kind) {
+            case EX_ARRAY_ACCESS    : return f((array_access_t*)expr);
+            case EX_ASSIGNMENT      : return f((assignment_t*)expr);
+            case EX_BINARY_OP       : return f((binary_op_t*)expr);
+            case EX_COMP_OP         : return f((comp_op_t*)expr);
+            case EX_EXPRESSION_BLOCK: return f((expression_block_t*)expr);
+            case EX_FUNCTION_CALL   : return f((function_call_t*)expr);
+            case EX_FUNCTION_DEF    : return f((function_def_t*)expr);
+            case EX_INVOKE          : return f((invoke_expr_t*)expr);
+            case EX_NAME_REF        : return f((name_ref_t*)expr);
+            case EX_NUMERIC_LITERAL : return f((numeric_literal_t*)expr);
+            case EX_STRING_LITERAL  : return f((string_literal_t*)expr);
+            case EX_TYPE            : return f((type_t*)expr);
+            case EX_VARIABLE_DEF    : return f((variable_def_t*)expr);
+            case EX_ASM_BLOCK       : return f((asm_block_t*)expr);
+            case EX_WHILE_LOOP      : return f((while_loop_t*)expr);
+            case EX_ARRAY           : return f((array_t*)expr);
+            case EX_BLOB            : return f((blob_t*)expr);
+            case EX_IF_ELSE         : return f((if_else_t*)expr);
+            case EX_RETURN          : return f((return_expr_t*)expr);
+            case EX_NONE            : break;
+        }
+
+        return f(expr);
+    }
+
+    inline std::string expression_t::print(int hierarchy) {
+        return visit(this, [hierarchy](auto* e) -> std::string {
+            if constexpr (std::is_same_v <decltype(e), expression_t*>) {
+                return "<undefined>";
+            } else {
+                return e->print(hierarchy);
+            }
+        });
+    }
+
+    inline eval_t expression_t::eval() {
+        switch (kind) {
+            case EX_NUMERIC_LITERAL: return ((numeric_literal_t*)this)->eval();
+            case EX_BINARY_OP      : return ((binary_op_t*)this)->eval();
+            case EX_COMP_OP        : return ((comp_op_t*)this)->eval();
+
+            default: return eval_t();
+        }
+    }
+}
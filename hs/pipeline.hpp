@@ -0,0 +1,146 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <streambuf>
+#include <cstddef>
+
+namespace hs {
+    // Bounded queue connecting two stages of the streaming front
+    // end (see compiler_t::parse_streaming()), there's exactly one
+    // producer and one consumer per queue.
+    //
+    // Items are chunks of work (i.e. a block of text, a batch of
+    // tokens), so taking a lock per item is cheap. Either side can
+    // close the queue: the consumer closes it to stop a producer
+    // early (i.e. on a parse error), pushes to a closed queue fail
+    template <class T> class spsc_queue_t {
+        std::vector <T> m_slots;
+
+        size_t m_head = 0, m_size = 0;
+
+        bool m_closed = false;
+
+        std::mutex m_lock;
+        std::condition_variable m_not_empty, m_not_full;
+
+    public:
+        spsc_queue_t(size_t capacity) : m_slots(capacity) {}
+
+        bool push(T&& item) {
+            std::unique_lock <std::mutex> lock(m_lock);
+
+            m_not_full.wait(lock, [this] { return m_closed || (m_size < m_slots.size()); });
+
+            if (m_closed)
+                return false;
+
+            m_slots[(m_head + m_size++) % m_slots.size()] = std::move(item);
+
+            m_not_empty.notify_one();
+
+            return true;
+        }
+
+        // Returns false once the queue is closed and drained
+        bool pop(T& item) {
+            std::unique_lock <std::mutex> lock(m_lock);
+
+            m_not_empty.wait(lock, [this] { return m_closed || m_size; });
+
+            if (!m_size)
+                return false;
+
+            item = std::move(m_slots[m_head]);
+
+            m_head = (m_head + 1) % m_slots.size();
+            m_size--;
+
+            m_not_full.notify_one();
+
+            return true;
+        }
+
+        void close() {
+            std::lock_guard <std::mutex> lock(m_lock);
+
+            m_closed = true;
+
+            m_not_empty.notify_all();
+            m_not_full.notify_all();
+        }
+
+        bool is_closed() {
+            std::lock_guard <std::mutex> lock(m_lock);
+
+            return m_closed;
+        }
+    };
+
+    typedef spsc_queue_t <std::string> text_queue_t;
+
+    // Write end of a text queue, characters are sent in chunks. The
+    // read end is a source_reader_t (see source.hpp)
+    class text_queue_writer_t : public std::streambuf {
+        text_queue_t* m_queue;
+
+        std::string m_chunk;
+
+        size_t m_chunk_size;
+        size_t m_written = 0;
+
+        bool send() {
+            char* base = pbase();
+
+            m_chunk.resize(pptr() - base);
+            m_written += m_chunk.size();
+
+            bool ok = !m_chunk.size() || m_queue->push(std::move(m_chunk));
+
+            m_chunk.resize(m_chunk_size);
+
+            setp(m_chunk.data(), m_chunk.data() + m_chunk.size());
+
+            return ok;
+        }
+
+    protected:
+        int_type overflow(int_type c) override {
+            send();
+
+            if (traits_type::eq_int_type(c, traits_type::eof()))
+                return traits_type::not_eof(c);
+
+            *pptr() = traits_type::to_char_type(c);
+
+            pbump(1);
+
+            return c;
+        }
+
+        int sync() override {
+            return send() ? 0 : -1;
+        }
+
+    public:
+        text_queue_writer_t(text_queue_t* queue, size_t chunk_size = 0x10000) :
+            m_queue(queue), m_chunk_size(chunk_size) {
+            m_chunk.resize(m_chunk_size);
+
+            setp(m_chunk.data(), m_chunk.data() + m_chunk.size());
+        }
+
+        // Send whatever is left and let the reader know we're done
+        void close() {
+            send();
+
+            m_queue->close();
+        }
+
+        size_t get_written() {
+            return m_written;
+        }
+    };
+}
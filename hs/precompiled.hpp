@@ -0,0 +1,713 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <filesystem>
+#include <ostream>
+#include <cstdint>
+#include <cstring>
+
+#include "source.hpp"
+#include "arena.hpp"
+#include "lexer/token.hpp"
+#include "preprocessor/include_cache.hpp"
+
+#include "parser/expression.hpp"
+#include "parser/expressions/expression_block.hpp"
+#include "parser/expressions/numeric_literal.hpp"
+#include "parser/expressions/string_literal.hpp"
+#include "parser/expressions/function_call.hpp"
+#include "parser/expressions/array_access.hpp"
+#include "parser/expressions/variable_def.hpp"
+#include "parser/expressions/function_def.hpp"
+#include "parser/expressions/assignment.hpp"
+#include "parser/expressions/while_loop.hpp"
+#include "parser/expressions/asm_block.hpp"
+#include "parser/expressions/binary_op.hpp"
+#include "parser/expressions/name_ref.hpp"
+#include "parser/expressions/comp_op.hpp"
+#include "parser/expressions/if_else.hpp"
+#include "parser/expressions/return.hpp"
+#include "parser/expressions/invoke.hpp"
+#include "parser/expressions/array.hpp"
+#include "parser/expressions/type.hpp"
+#include "parser/expressions/blob.hpp"
+
+// Precompiled header image (see --precompile), all integers are
+// stored in host byte order:
+//
+//   "HSPCH" <version>                      8 bytes
+//   <u32 count> <u32 size> <bytes>...      String table
+//   <u32 count> (<str path> <i64 time> <u64 size>)...
+//                                          Files the image depends on
+//   <u32 count> (<str name> <str value>)...
+//                                          Define map
+//   <u8 once> <str guard> <u32 anonymous functions>
+//   <u32 count> (<u32 line> <u32 offset> <u32 type> <str text> <u64 value>)...
+//                                          Token stream
+//   <u32 count> <expression>...            AST, in preorder
+//
+// <str> is an index into the string table. Expressions start with
+// their expression_type_t (0xff for null pointers), followed by
+// line, offset, len and their own fields
+namespace hs {
+    static const char m_precompiled_magic[8] = { 'H', 'S', 'P', 'C', 'H', 0, 0, 2 };
+
+    // Including a precompiled header emits a marker instead of the
+    // header's text, the lexer then takes the header's tokens or AST
+    // from the image (see lexer_t::lex_precompiled()):
+    //
+    //   \x01 <image path> \x01 <image time>:<image size> \x01
+    //
+    // The image's time and size make the preprocessed text (and so
+    // the output cache key) change when the image is rebuilt
+    static const char m_precompiled_marker = '\x01';
+
+    static std::string get_precompiled_marker(const include_dependency_t& image) {
+        return m_precompiled_marker + image.path + m_precompiled_marker +
+               std::to_string(image.time.time_since_epoch().count()) + ":" +
+               std::to_string(image.size) + m_precompiled_marker;
+    }
+
+    // "std/string" -> "std/string.hpch"
+    static std::string get_precompiled_path(std::string path) {
+        return std::filesystem::path(path).replace_extension(".hpch").string();
+    }
+
+    struct precompiled_contents_t {
+        std::vector <include_dependency_t> dependencies;
+        std::vector <std::pair <std::string, std::string>> defines;
+        token_buffer_t* tokens = nullptr;
+        std::vector <expression_t*>* source = nullptr;
+        std::string guard;
+        bool once = false;
+        int anonymous_functions = 0;
+    };
+
+    class precompiled_writer_t {
+        std::vector <std::string> m_strings;
+        std::unordered_map <std::string, uint32_t> m_string_map;
+
+        std::string m_body;
+
+        uint32_t intern(const std::string& str) {
+            auto it = m_string_map.find(str);
+
+            if (it != m_string_map.end())
+                return it->second;
+
+            m_strings.push_back(str);
+            m_string_map.insert({ str, m_strings.size() - 1 });
+
+            return m_strings.size() - 1;
+        }
+
+        template <class T> void put(T value) {
+            m_body.append((const char*)&value, sizeof(T));
+        }
+
+        void put_string(std::string_view str) {
+            put <uint32_t> (intern(std::string(str)));
+        }
+
+        void put_expression(expression_t* expr) {
+            if (!expr) {
+                put <uint8_t> (0xff);
+
+                return;
+            }
+
+            expression_type_t type = expr->get_type();
+
+            put <uint8_t> (type);
+            put <int32_t> (expr->line);
+            put <int32_t> (expr->offset);
+            put <int32_t> (expr->len);
+
+            switch (type) {
+                case EX_ARRAY_ACCESS: {
+                    array_access_t* e = (array_access_t*)expr;
+
+                    put_expression(e->type_or_name);
+                    put_expression(e->addr);
+                } break;
+
+                case EX_ASSIGNMENT: {
+                    assignment_t* e = (assignment_t*)expr;
+
+                    put_string(e->op);
+                    put_expression(e->assignee);
+                    put_expression(e->value);
+                } break;
+
+                case EX_BINARY_OP: {
+                    binary_op_t* e = (binary_op_t*)expr;
+
+                    put_string(e->op);
+                    put_expression(e->lhs);
+                    put_expression(e->rhs);
+                } break;
+
+                case EX_COMP_OP: {
+                    comp_op_t* e = (comp_op_t*)expr;
+
+                    put_string(e->op);
+                    put_expression(e->lhs);
+                    put_expression(e->rhs);
+                } break;
+
+                case EX_EXPRESSION_BLOCK: {
+                    expression_block_t* e = (expression_block_t*)expr;
+
+                    put_expressions(e->block);
+                } break;
+
+                case EX_FUNCTION_CALL: {
+                    function_call_t* e = (function_call_t*)expr;
+
+                    put_expression(e->addr);
+                    put_expressions(e->args);
+                } break;
+
+                case EX_FUNCTION_DEF: {
+                    function_def_t* e = (function_def_t*)expr;
+
+                    put_string(e->name);
+                    put_string(e->type);
+                    put_expression(e->body);
+                    put <uint32_t> (e->args.size());
+
+                    for (function_arg_t& arg : e->args) {
+                        put_string(arg.type);
+                        put_string(arg.name);
+                    }
+                } break;
+
+                case EX_INVOKE: {
+                    put_expression(((invoke_expr_t*)expr)->ptr);
+                } break;
+
+                case EX_NAME_REF: {
+                    put_string(((name_ref_t*)expr)->name);
+                } break;
+
+                case EX_NUMERIC_LITERAL: {
+                    put <uint64_t> (((numeric_literal_t*)expr)->value);
+                } break;
+
+                case EX_STRING_LITERAL: {
+                    put_string(((string_literal_t*)expr)->str);
+                } break;
+
+                case EX_TYPE: {
+                    put_string(((type_t*)expr)->type);
+                } break;
+
+                case EX_VARIABLE_DEF: {
+                    variable_def_t* e = (variable_def_t*)expr;
+
+                    put_string(e->type);
+                    put_string(e->name);
+                } break;
+
+                case EX_ASM_BLOCK: {
+                    put_string(((asm_block_t*)expr)->assembly);
+                } break;
+
+                case EX_WHILE_LOOP: {
+                    while_loop_t* e = (while_loop_t*)expr;
+
+                    put_expression(e->condition);
+                    put_expression(e->body);
+                } break;
+
+                case EX_ARRAY: {
+                    array_t* e = (array_t*)expr;
+
+                    put_string(e->type.type);
+                    put <uint32_t> (e->size);
+                    put_expressions(e->values);
+                } break;
+
+                case EX_BLOB: {
+                    blob_t* e = (blob_t*)expr;
+
+                    put_string(e->file);
+                    put <uint32_t> (e->size);
+                } break;
+
+                case EX_IF_ELSE: {
+                    if_else_t* e = (if_else_t*)expr;
+
+                    put_expression(e->cond);
+                    put_expression(e->if_expr);
+                    put_expression(e->else_expr);
+                } break;
+
+                case EX_RETURN: {
+                    put_expression(((return_expr_t*)expr)->value);
+                } break;
+
+                default: break;
+            }
+        }
+
+        template <class V> void put_expressions(V& exprs) {
+            put <uint32_t> (exprs.size());
+
+            for (expression_t* expr : exprs)
+                put_expression(expr);
+        }
+
+    public:
+        void write(std::ostream* output, precompiled_contents_t& contents) {
+            put <uint32_t> (contents.dependencies.size());
+
+            for (include_dependency_t& dep : contents.dependencies) {
+                put_string(dep.path);
+                put <int64_t> (dep.time.time_since_epoch().count());
+                put <uint64_t> (dep.size);
+            }
+
+            put <uint32_t> (contents.defines.size());
+
+            for (auto& p : contents.defines) {
+                put_string(p.first);
+                put_string(p.second);
+            }
+
+            put <uint8_t> (contents.once);
+            put_string(contents.guard);
+            put <uint32_t> (contents.anonymous_functions);
+            put <uint32_t> (contents.tokens->size());
+
+            for (size_t i = 0; i < contents.tokens->size(); i++) {
+                lexer_token_t token = (*contents.tokens)[i];
+
+                put <uint32_t> (token.line);
+                put <uint32_t> (token.offset);
+                put <uint32_t> (token.type);
+                put_string(token.text);
+                put <uint64_t> (token.value);
+            }
+
+            put_expressions(*contents.source);
+
+            // String table goes first, so readers can resolve
+            // strings as they go
+            std::string table;
+
+            uint32_t count = m_strings.size();
+
+            table.append((const char*)&count, sizeof(count));
+
+            for (std::string& str : m_strings) {
+                uint32_t size = str.size();
+
+                table.append((const char*)&size, sizeof(size));
+                table.append(str);
+            }
+
+            output->write(m_precompiled_magic, sizeof(m_precompiled_magic));
+            output->write(table.data(), table.size());
+            output->write(m_body.data(), m_body.size());
+        }
+    };
+
+    // Precompiled header image, strings are views into the mapped
+    // file. Everything up to the token stream is read on load(),
+    // tokens and the AST are only read when needed
+    class precompiled_reader_t {
+        source_buffer_t m_file;
+
+        std::vector <std::string_view> m_strings;
+
+        const char* m_ptr = nullptr;
+        const char* m_end = nullptr;
+        const char* m_tokens = nullptr;
+
+        bool m_ok = true;
+
+        arena_t* m_arena = nullptr;
+
+        template <class T> T get() {
+            T value = 0;
+
+            if ((size_t)(m_end - m_ptr) < sizeof(T)) {
+                m_ok = false;
+                m_ptr = m_end;
+
+                return value;
+            }
+
+            std::memcpy(&value, m_ptr, sizeof(T));
+
+            m_ptr += sizeof(T);
+
+            return value;
+        }
+
+        std::string_view get_string_view() {
+            uint32_t index = get <uint32_t> ();
+
+            if (index >= m_strings.size()) {
+                m_ok = false;
+
+                return "";
+            }
+
+            return m_strings[index];
+        }
+
+        std::string get_string() {
+            return std::string(get_string_view());
+        }
+
+        // Counts can't be larger than what's left of the file,
+        // guards against allocating huge vectors on broken images
+        uint32_t get_count() {
+            uint32_t count = get <uint32_t> ();
+
+            if (count > (size_t)(m_end - m_ptr)) {
+                m_ok = false;
+
+                return 0;
+            }
+
+            return count;
+        }
+
+        expression_t* get_expression(int anonymous_offset) {
+            uint8_t type = get <uint8_t> ();
+
+            if ((type == 0xff) || !m_ok)
+                return nullptr;
+
+            int line = get <int32_t> ();
+            int offset = get <int32_t> ();
+            int len = get <int32_t> ();
+
+            expression_t* expr = nullptr;
+
+            switch (type) {
+                case EX_ARRAY_ACCESS: {
+                    array_access_t* e = m_arena->create <array_access_t> ();
+
+                    e->type_or_name = get_expression(anonymous_offset);
+                    e->addr = get_expression(anonymous_offset);
+
+                    expr = e;
+                } break;
+
+                case EX_ASSIGNMENT: {
+                    assignment_t* e = m_arena->create <assignment_t> ();
+
+                    e->op = get_string_view();
+                    e->assignee = get_expression(anonymous_offset);
+                    e->value = get_expression(anonymous_offset);
+
+                    expr = e;
+                } break;
+
+                case EX_BINARY_OP: {
+                    binary_op_t* e = m_arena->create <binary_op_t> ();
+
+                    e->op = get_string_view();
+                    e->lhs = get_expression(anonymous_offset);
+                    e->rhs = get_expression(anonymous_offset);
+
+                    expr = e;
+                } break;
+
+                case EX_COMP_OP: {
+                    comp_op_t* e = m_arena->create <comp_op_t> ();
+
+                    e->op = get_string_view();
+                    e->lhs = get_expression(anonymous_offset);
+                    e->rhs = get_expression(anonymous_offset);
+
+                    expr = e;
+                } break;
+
+                case EX_EXPRESSION_BLOCK: {
+                    expression_block_t* e = m_arena->create <expression_block_t> ();
+
+                    get_expressions(e->block, anonymous_offset);
+
+                    expr = e;
+                } break;
+
+                case EX_FUNCTION_CALL: {
+                    function_call_t* e = m_arena->create <function_call_t> ();
+
+                    e->addr = get_expression(anonymous_offset);
+
+                    get_expressions(e->args, anonymous_offset);
+
+                    expr = e;
+                } break;
+
+                case EX_FUNCTION_DEF: {
+                    function_def_t* e = m_arena->create <function_def_t> ();
+
+                    e->name = get_string_view();
+                    e->type = get_string_view();
+                    e->body = get_expression(anonymous_offset);
+
+                    uint32_t count = get_count();
+
+                    for (uint32_t i = 0; i < count; i++) {
+                        function_arg_t& arg = e->args.emplace_back();
+
+                        arg.type = get_string_view();
+                        arg.name = get_string_view();
+                    }
+
+                    // Anonymous functions are numbered in parse order,
+                    // continue from wherever the includer is
+                    if (anonymous_offset && !e->name.compare(0, 11, "<anonymous_")) {
+                        int n = std::atoi(e->name.c_str() + 11);
+
+                        e->name = "<anonymous_" + std::to_string(n + anonymous_offset) + ">";
+                    }
+
+                    expr = e;
+                } break;
+
+                case EX_INVOKE: {
+                    invoke_expr_t* e = m_arena->create <invoke_expr_t> ();
+
+                    e->ptr = get_expression(anonymous_offset);
+
+                    expr = e;
+                } break;
+
+                case EX_NAME_REF: {
+                    name_ref_t* e = m_arena->create <name_ref_t> ();
+
+                    e->name = get_string_view();
+
+                    expr = e;
+                } break;
+
+                case EX_NUMERIC_LITERAL: {
+                    numeric_literal_t* e = m_arena->create <numeric_literal_t> ();
+
+                    e->value = get <uint64_t> ();
+
+                    expr = e;
+                } break;
+
+                case EX_STRING_LITERAL: {
+                    string_literal_t* e = m_arena->create <string_literal_t> ();
+
+                    e->str = get_string_view();
+
+                    expr = e;
+                } break;
+
+                case EX_TYPE: {
+                    type_t* e = m_arena->create <type_t> ();
+
+                    e->type = get_string_view();
+
+                    expr = e;
+                } break;
+
+                case EX_VARIABLE_DEF: {
+                    variable_def_t* e = m_arena->create <variable_def_t> ();
+
+                    e->type = get_string_view();
+                    e->name = get_string_view();
+
+                    expr = e;
+                } break;
+
+                case EX_ASM_BLOCK: {
+                    asm_block_t* e = m_arena->create <asm_block_t> ();
+
+                    e->assembly = get_string_view();
+
+                    expr = e;
+                } break;
+
+                case EX_WHILE_LOOP: {
+                    while_loop_t* e = m_arena->create <while_loop_t> ();
+
+                    e->condition = get_expression(anonymous_offset);
+                    e->body = get_expression(anonymous_offset);
+
+                    expr = e;
+                } break;
+
+                case EX_ARRAY: {
+                    array_t* e = m_arena->create <array_t> ();
+
+                    e->type.type = get_string_view();
+                    e->size = get <uint32_t> ();
+
+                    get_expressions(e->values, anonymous_offset);
+
+                    expr = e;
+                } break;
+
+                case EX_BLOB: {
+                    blob_t* e = m_arena->create <blob_t> ();
+
+                    e->file = get_string_view();
+                    e->size = get <uint32_t> ();
+
+                    expr = e;
+                } break;
+
+                case EX_IF_ELSE: {
+                    if_else_t* e = m_arena->create <if_else_t> ();
+
+                    e->cond = get_expression(anonymous_offset);
+                    e->if_expr = get_expression(anonymous_offset);
+                    e->else_expr = get_expression(anonymous_offset);
+
+                    expr = e;
+                } break;
+
+                case EX_RETURN: {
+                    return_expr_t* e = m_arena->create <return_expr_t> ();
+
+                    e->value = get_expression(anonymous_offset);
+
+                    expr = e;
+                } break;
+
+                default: {
+                    m_ok = false;
+
+                    return nullptr;
+                }
+            }
+
+            expr->line = line;
+            expr->offset = offset;
+            expr->len = len;
+
+            return expr;
+        }
+
+        template <class V> void get_expressions(V& exprs, int anonymous_offset) {
+            uint32_t count = get_count();
+
+            for (uint32_t i = 0; (i < count) && m_ok; i++)
+                exprs.push_back(get_expression(anonymous_offset));
+        }
+
+    public:
+        precompiled_contents_t contents;
+
+        bool load(std::string path) {
+            if (!m_file.open(path)) return false;
+
+            std::string_view data = m_file.view();
+
+            if ((data.size() < sizeof(m_precompiled_magic)) ||
+                std::memcmp(data.data(), m_precompiled_magic, sizeof(m_precompiled_magic)))
+                return false;
+
+            m_ptr = data.data() + sizeof(m_precompiled_magic);
+            m_end = data.data() + data.size();
+
+            uint32_t count = get_count();
+
+            m_strings.reserve(count);
+
+            for (uint32_t i = 0; (i < count) && m_ok; i++) {
+                uint32_t size = get_count();
+
+                m_strings.push_back(std::string_view(m_ptr, size));
+
+                m_ptr += size;
+            }
+
+            count = get_count();
+
+            for (uint32_t i = 0; (i < count) && m_ok; i++) {
+                include_dependency_t dep;
+
+                dep.path = get_string();
+                dep.time = std::filesystem::file_time_type(std::filesystem::file_time_type::duration(get <int64_t> ()));
+                dep.size = get <uint64_t> ();
+
+                contents.dependencies.push_back(dep);
+            }
+
+            count = get_count();
+
+            for (uint32_t i = 0; (i < count) && m_ok; i++) {
+                std::string name = get_string();
+
+                contents.defines.push_back({ name, get_string() });
+            }
+
+            contents.once = get <uint8_t> ();
+            contents.guard = get_string();
+            contents.anonymous_functions = get <uint32_t> ();
+
+            m_tokens = m_ptr;
+
+            return m_ok;
+        }
+
+        // Images go stale when any of the files they were built
+        // from change
+        bool is_up_to_date() {
+            for (include_dependency_t& dep : contents.dependencies) {
+                include_dependency_t current;
+
+                if (!include_cache_t::get_dependency(dep.path, current) || (current.time != dep.time) || (current.size != dep.size))
+                    return false;
+            }
+
+            return true;
+        }
+
+        // Token text is copied, the image is unmapped when
+        // the reader goes away
+        bool get_tokens(token_buffer_t& tokens) {
+            m_ptr = m_tokens;
+
+            uint32_t count = get_count();
+
+            tokens.reserve(count);
+
+            for (uint32_t i = 0; (i < count) && m_ok; i++) {
+                lexer_token_t token;
+
+                token.line = get <uint32_t> ();
+                token.offset = get <uint32_t> ();
+                token.type = (lexer_token_type_t)get <uint32_t> ();
+                token.text = get_string_view();
+                token.value = get <uint64_t> ();
+
+                tokens.push(token);
+            }
+
+            return m_ok;
+        }
+
+        // Expressions are created on arena
+        bool get_source(std::vector <expression_t*>& source, int anonymous_offset, arena_t* arena) {
+            m_arena = arena;
+            m_ptr = m_tokens;
+
+            uint32_t count = get_count();
+
+            // Skip the token stream
+            for (uint32_t i = 0; (i < count) && m_ok; i++)
+                m_ptr += std::min((size_t)(m_end - m_ptr), (sizeof(uint32_t) * 4) + sizeof(uint64_t));
+
+            get_expressions(source, anonymous_offset);
+
+            return m_ok;
+        }
+    };
+}
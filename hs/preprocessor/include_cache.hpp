@@ -0,0 +1,153 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <filesystem>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace hs {
+    // A file an include's output depends on, along with the state
+    // it was in when the include was processed
+    struct include_dependency_t {
+        std::string path;
+
+        std::filesystem::file_time_type time;
+        uintmax_t size;
+    };
+
+    struct include_cache_entry_t {
+        std::string text;
+
+        std::vector <std::pair <std::string, std::string>> defines;
+        std::vector <include_dependency_t> dependencies;
+
+        // Once-only files have #pragma once or an include guard
+        std::string guard;
+
+        bool once = false;
+    };
+
+    // Includes seen during a single compilation, keyed by their
+    // resolved path. Includes are preprocessed starting with an empty
+    // define map, so the path is enough to identify their output
+    struct include_memo_t {
+        std::unordered_map <std::string, std::shared_ptr <const include_cache_entry_t>> entries;
+
+        // Once-only files that were already included, and the files
+        // each include guard belongs to
+        std::unordered_set <std::string> included;
+        std::unordered_map <std::string, std::string> guards;
+    };
+
+    // Keeps the output of preprocessed include files around between
+    // compilations (i.e. compile server requests, batch jobs).
+    // Included files are always preprocessed starting with an empty
+    // define map, so their output only depends on the contents of
+    // the file itself, and the files it includes
+    class include_cache_t {
+        std::unordered_map <std::string, std::shared_ptr <const include_cache_entry_t>> m_entries;
+
+        std::mutex m_lock;
+
+        size_t m_hits = 0, m_misses = 0;
+
+        // Entries put while journaling, compile server jobs run in a
+        // child process and send these back to the server's cache
+        std::vector <std::pair <std::string, std::shared_ptr <const include_cache_entry_t>>> m_journal;
+
+        bool m_journaling = false;
+
+    public:
+        static bool get_dependency(std::string path, include_dependency_t& dep) {
+            std::error_code ec;
+
+            dep.path = path;
+            dep.time = std::filesystem::last_write_time(path, ec);
+
+            if (ec) return false;
+
+            dep.size = std::filesystem::file_size(path, ec);
+
+            return !ec;
+        }
+
+        // Nested includes are resolved using the search paths, so
+        // these are part of the key too
+        static std::string get_key(std::string path, const std::vector <std::string>& include_paths, std::string system_include) {
+            std::string key = path + '\n' + system_include;
+
+            for (const std::string& p : include_paths)
+                key += '\n' + p;
+
+            return key;
+        }
+
+        std::shared_ptr <const include_cache_entry_t> get(std::string key) {
+            std::shared_ptr <const include_cache_entry_t> entry;
+
+            {
+                std::lock_guard <std::mutex> guard(m_lock);
+
+                auto it = m_entries.find(key);
+
+                if (it == m_entries.end()) {
+                    m_misses++;
+
+                    return nullptr;
+                }
+
+                entry = it->second;
+            }
+
+            // Entry is stale if any of the files changed
+            for (const include_dependency_t& dep : entry->dependencies) {
+                include_dependency_t current;
+
+                if (!get_dependency(dep.path, current) || (current.time != dep.time) || (current.size != dep.size)) {
+                    std::lock_guard <std::mutex> guard(m_lock);
+
+                    m_entries.erase(key);
+                    m_misses++;
+
+                    return nullptr;
+                }
+            }
+
+            std::lock_guard <std::mutex> guard(m_lock);
+
+            m_hits++;
+
+            return entry;
+        }
+
+        void put(std::string key, std::shared_ptr <const include_cache_entry_t> entry) {
+            std::lock_guard <std::mutex> guard(m_lock);
+
+            m_entries[key] = entry;
+
+            if (m_journaling)
+                m_journal.push_back({ key, entry });
+        }
+
+        void set_journaling(bool journaling) {
+            m_journaling = journaling;
+        }
+
+        std::vector <std::pair <std::string, std::shared_ptr <const include_cache_entry_t>>> take_journal() {
+            std::lock_guard <std::mutex> guard(m_lock);
+
+            return std::move(m_journal);
+        }
+
+        size_t get_hits() {
+            return m_hits;
+        }
+
+        size_t get_misses() {
+            return m_misses;
+        }
+    };
+}
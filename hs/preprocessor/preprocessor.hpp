@@ -2,16 +2,40 @@
 #pragma once
 
 #include "../error.hpp"
+#include "../source.hpp"
+#include "../precompiled.hpp"
+
+#include "include_cache.hpp"
 
 #include <iostream>
 #include <sstream>
 #include <fstream>
 #include <unordered_map>
+#include <filesystem>
+#include <algorithm>
+#include <memory>
 
 namespace hs {
+    class preprocessor_t;
+
+    // What a token mode #include wants lexed (see lexer_t), either
+    // a file along with the preprocessor for its directives, or a
+    // precompiled image. Nothing when the file was already included
+    struct preprocessor_include_t {
+        std::unique_ptr <preprocessor_t> preprocessor;
+        std::shared_ptr <source_buffer_t> source;
+
+        std::string path;
+
+        bool precompiled = false;
+    };
+
     class preprocessor_t {
-        std::istream* m_input;
+        source_reader_t m_input;
         std::stringstream m_output;
+
+        // Output goes to m_output unless redirected, see set_output()
+        std::ostream* m_sink = &m_output;
         error_logger_t* m_logger;
 
         char m_current;
@@ -21,7 +45,8 @@ namespace hs {
             PD_INCLUDE,
             PD_DEFINE,
             PD_UNDEF,
-            PD_MACRO
+            PD_MACRO,
+            PD_PRAGMA
         };
 
         std::vector <std::string>* m_include_paths;
@@ -29,193 +54,416 @@ namespace hs {
 
         std::unordered_map <std::string, std::string> m_define_map;
 
+        include_cache_t* m_cache = nullptr;
+
+        // Files our output depends on, and whether any of our
+        // includes failed (failed includes aren't cached)
+        std::vector <include_dependency_t> m_dependencies;
+
+        bool m_failed = false;
+
+        // Includes seen on this compilation, shared with the
+        // preprocessors of our includes
+        include_memo_t m_memo_storage;
+        include_memo_t* m_memo = &m_memo_storage;
+
+        // File has #pragma once
+        bool m_once = false;
+
+        // Whether to use precompiled images of our includes
+        bool m_use_precompiled = false;
+
         std::unordered_map <std::string, directive_t> m_directive_map = {
             { "include", PD_INCLUDE },
             { "define" , PD_DEFINE  },
             { "undef"  , PD_UNDEF   },
-            { "macro"  , PD_MACRO   }
+            { "macro"  , PD_MACRO   },
+            { "pragma" , PD_PRAGMA  }
         };
 
-        inline void ignore_whitespace(bool output = true) {
-            while (isspace(m_current)) {
-                if (output) m_output.put(m_current);
+        // Include (or image) the file a token mode #include resolved to
+        std::string m_resolved;
 
-                m_current = m_input->get();
-            }
+        // Directives are handled a line at a time, the parse_*()
+        // functions below take what's left of the directive's line
+        // and remove what they parse off it
+        std::string parse_string(std::string_view& line) {
+            line = ltrim(line);
+
+            if (!(line.size() && (line[0] == '\"'))) return "";
+
+            size_t end = line.find('\"', 1);
+
+            if (end == std::string_view::npos) end = line.size();
+
+            std::string str(line.substr(1, end - 1));
+
+            line.remove_prefix(std::min(end + 1, line.size()));
+
+            return str;
         }
 
-        std::string parse_string() {
-            if (m_current != '\"') return "";
+        std::string parse_name(std::string_view& line) {
+            line = ltrim(line);
 
-            std::string str;
+            if (!(line.size() && (std::isalpha(line[0]) || (line[0] == '_'))))
+                return "";
 
-            m_current = m_input->get();
+            size_t end = 1;
 
-            while (m_current != '\"') {
-                str.push_back(m_current);
+            while ((end < line.size()) && (std::isalnum(line[end]) || (line[end] == '_'))) end++;
 
-                m_current = m_input->get();
-            }
+            std::string name(line.substr(0, end));
 
-            m_current = m_input->get();
+            line.remove_prefix(end);
 
-            return str;
+            return name;
+        }
+
+        directive_t parse_directive(std::string_view& line) {
+            size_t end = 0;
+
+            while ((end < line.size()) && std::isalpha(line[end])) end++;
+
+            auto it = m_directive_map.find(std::string(line.substr(0, end)));
+
+            line.remove_prefix(end);
+
+            return (it != m_directive_map.end()) ? it->second : PD_NONE;
         }
 
-        directive_t parse_directive() {
-            if (!std::isalpha(m_current)) {
-                return PD_NONE;
+        // Find an include on the search paths, system include path last
+        bool resolve_include(std::string filename, std::string& resolved) {
+            std::error_code ec;
+
+            for (std::string path : *m_include_paths) {
+                resolved = path + "/" + filename;
+
+                if (std::filesystem::is_regular_file(resolved, ec))
+                    return true;
             }
 
-            std::string directive_text;
+            resolved = m_system_include + "/" + filename;
+
+            return std::filesystem::is_regular_file(resolved, ec);
+        }
+
+        void emit_include(const include_cache_entry_t& entry, bool text) {
+            m_define_map.insert(entry.defines.begin(), entry.defines.end());
+
+            if (text) m_sink->write(entry.text.data(), entry.text.size());
+
+            m_dependencies.insert(m_dependencies.end(), entry.dependencies.begin(), entry.dependencies.end());
+        }
+
+        void mark_included(const std::string& resolved, const include_cache_entry_t& entry) {
+            if (!entry.once)
+                return;
+
+            m_memo->included.insert(resolved);
+
+            if (entry.guard.size())
+                m_memo->guards[entry.guard] = resolved;
+        }
+
+        // Includes with an up to date precompiled image only emit a
+        // marker, the lexer picks the header up from the image
+        std::shared_ptr <include_cache_entry_t> load_precompiled(std::string resolved) {
+            if (!m_use_precompiled)
+                return nullptr;
+
+            std::string path = get_precompiled_path(resolved);
+            std::error_code ec;
+
+            if (!std::filesystem::is_regular_file(path, ec))
+                return nullptr;
+
+            precompiled_reader_t image;
+            include_dependency_t dep;
+
+            if (!(image.load(path) && image.is_up_to_date() && include_cache_t::get_dependency(path, dep)))
+                return nullptr;
+
+            auto entry = std::make_shared <include_cache_entry_t> ();
 
-            while (std::isalpha(m_current)) {
-                directive_text.push_back(m_current);
+            entry->text = get_precompiled_marker(dep);
+            entry->defines = image.contents.defines;
+            entry->dependencies = image.contents.dependencies;
+            entry->dependencies.push_back(dep);
+            entry->guard = image.contents.guard;
+            entry->once = image.contents.once;
 
-                m_current = m_input->get();
+            return entry;
+        }
+
+        std::shared_ptr <const include_cache_entry_t> preprocess_include(std::string resolved) {
+            std::string key;
+
+            if (m_cache) {
+                key = include_cache_t::get_key(resolved, *m_include_paths, m_system_include);
+
+                // Outputs with precompiled markers can't be used by
+                // preprocessors that don't use images (i.e. assembly)
+                if (m_use_precompiled)
+                    key += "\n<precompiled>";
+
+                auto entry = m_cache->get(key);
+
+                if (entry) {
+                    m_memo->entries[resolved] = entry;
+
+                    return entry;
+                }
             }
 
-            if (!m_directive_map.contains(directive_text)) {
-                return PD_NONE;
+            auto entry = load_precompiled(resolved);
+
+            if (entry) {
+                if (m_cache)
+                    m_cache->put(key, entry);
+
+                m_memo->entries[resolved] = entry;
+
+                return entry;
             }
 
-            return m_directive_map[directive_text];
-        }
+            source_buffer_t file;
 
-        bool parse_include_directive() {
-            ignore_whitespace(false);
+            if (!file.open(resolved)) {
+                if (m_logger) m_logger->print_error(
+                    "preprocessor",
+                    fmt("Couldn't read file \"%s\" for #include", resolved.c_str()), 0, 0, false
+                );
 
-            std::string filename = parse_string();
+                m_failed = true;
 
-            if (!filename.size()) {
-                // Error :P
+                return nullptr;
+            }
 
-                return false;
+            preprocessor_t include;
+            include_dependency_t dep;
+
+            if (include_cache_t::get_dependency(resolved, dep)) {
+                include.m_dependencies.push_back(dep);
+            } else {
+                include.m_failed = true;
             }
 
-            std::ifstream file;
+            include.m_memo = m_memo;
+            include.m_use_precompiled = m_use_precompiled;
+            include.set_include_cache(m_cache);
+            include.init(file.view(), m_include_paths, m_system_include, m_logger);
+            include.preprocess();
 
-            for (std::string path : *m_include_paths) {
-                file.open(path + "/" + filename, std::ios::binary);
+            entry = std::make_shared <include_cache_entry_t> ();
 
-                if (file.is_open() && file.good()) {
-                    goto found;
-                }
+            // Don't output the EOF char from the included file
+            entry->text = include.get_output()->view();
+            entry->text.erase(std::remove(entry->text.begin(), entry->text.end(), (char)-1), entry->text.end());
+
+            // Get defines from the processed file, these are
+            // accumulated into our own defines
+            entry->defines.assign(include.m_define_map.begin(), include.m_define_map.end());
+            entry->dependencies = include.m_dependencies;
+            entry->guard = get_include_guard(file.view());
+            entry->once = include.m_once || entry->guard.size();
+
+            m_failed |= include.m_failed;
+
+            // Failed includes are preprocessed (and reported) again
+            // every time they're included
+            if (include.m_failed)
+                return entry;
+
+            if (m_cache)
+                m_cache->put(key, entry);
+
+            m_memo->entries[resolved] = entry;
+
+            return entry;
+        }
+
+        bool parse_include_directive(std::string_view line, preprocessor_include_t* include) {
+            std::string filename = parse_string(line);
+
+            if (!filename.size()) {
+                // Error :P
+
+                return false;
             }
 
-            file.open(m_system_include + "/" + filename, std::ios::binary);
+            std::string resolved;
 
-            if (!(file.is_open() && file.good())) {
+            if (!resolve_include(filename, resolved)) {
                 // Include wasn't found on any of the paths
                 if (m_logger) m_logger->print_error(
                     "preprocessor",
                     fmt("File \"%s\" for #include wasn't found", filename.c_str()), 0, 0, false
                 );
 
+                m_failed = true;
+
                 return false;
             }
 
-            found:
+            // The same file can be reached through different paths
+            std::error_code ec;
 
-            preprocessor_t include;
+            std::filesystem::path canonical = std::filesystem::weakly_canonical(resolved, ec);
 
-            include.init(&file, m_include_paths, m_system_include, m_logger);
-            include.preprocess();
+            if (!ec) resolved = canonical.string();
+
+            std::shared_ptr <const include_cache_entry_t> entry;
+
+            auto it = m_memo->entries.find(resolved);
+
+            if (it != m_memo->entries.end()) {
+                entry = it->second;
+
+                // Once-only includes only get their defines
+                // merged on subsequent includes, files don't see
+                // defines from other files otherwise
+                if (entry->once && m_memo->included.contains(resolved)) {
+                    emit_include(*entry, false);
+
+                    return true;
+                }
+            } else if (!include) {
+                entry = preprocess_include(resolved);
+
+                if (!entry) return false;
+            }
 
-            // Get defines from the processed file and accumulate
-            // them into our own defines
-            auto* map = include.get_define_map();
+            if (include)
+                return include_file(resolved, entry, *include);
 
-            for (auto& p : *map) {
-                m_define_map.insert(p);
+            emit_include(*entry, true);
+            mark_included(resolved, *entry);
+
+            return true;
+        }
+
+        // Token mode, files are lexed in place instead of pasting
+        // their output. Only images are memoized up front, memo
+        // entries of files we lexed are added by end_include()
+        bool include_file(const std::string& resolved, std::shared_ptr <const include_cache_entry_t> entry, preprocessor_include_t& include) {
+            if (!entry) {
+                entry = load_precompiled(resolved);
+
+                if (entry) m_memo->entries[resolved] = entry;
+            }
+
+            // Up to date image, its entry's text is a marker
+            if (entry && entry->text.size()) {
+                include.precompiled = true;
+                include.path = entry->text.substr(1, entry->text.find(m_precompiled_marker, 1) - 1);
+
+                emit_include(*entry, false);
+                mark_included(resolved, *entry);
+
+                return true;
             }
-            
-            auto file_output = include.get_output();
 
-            char c = file_output->get();
+            auto source = std::make_shared <source_buffer_t> ();
+
+            if (!source->open(resolved)) {
+                if (m_logger) m_logger->print_error(
+                    "preprocessor",
+                    fmt("Couldn't read file \"%s\" for #include", resolved.c_str()), 0, 0, false
+                );
+
+                m_failed = true;
+
+                return false;
+            }
 
-            while (!file_output->eof()) {
-                // Don't output the EOF char from the included file
-                if (!iseof(c)) m_output.put(c);
+            auto preprocessor = std::make_unique <preprocessor_t> ();
+            include_dependency_t dep;
 
-                c = file_output->get();
+            if (include_cache_t::get_dependency(resolved, dep)) {
+                preprocessor->m_dependencies.push_back(dep);
+            } else {
+                preprocessor->m_failed = true;
             }
 
+            preprocessor->m_memo = m_memo;
+            preprocessor->m_use_precompiled = m_use_precompiled;
+            preprocessor->m_resolved = resolved;
+            preprocessor->init(source->view(), m_include_paths, m_system_include, m_logger);
+
+            include.preprocessor = std::move(preprocessor);
+            include.source = source;
+            include.path = resolved;
+
             return true;
         }
 
-        const std::string WHITESPACE = " \n\r\t\f\v";
+        const std::string_view WHITESPACE = " \n\r\t\f\v";
 
-        std::string ltrim(const std::string &s) {
+        std::string_view ltrim(std::string_view s) {
             size_t start = s.find_first_not_of(WHITESPACE);
 
-            return (start == std::string::npos) ? "" : s.substr(start);
+            return (start == std::string_view::npos) ? "" : s.substr(start);
         }
         
-        std::string rtrim(const std::string &s) {
+        std::string_view rtrim(std::string_view s) {
             size_t end = s.find_last_not_of(WHITESPACE);
 
-            return (end == std::string::npos) ? "" : s.substr(0, end + 1);
+            return (end == std::string_view::npos) ? "" : s.substr(0, end + 1);
         }
         
-        std::string trim(const std::string &s) {
+        std::string_view trim(std::string_view s) {
             return rtrim(ltrim(s));
         }
 
-        bool parse_undef_directive() {
-            ignore_whitespace(false);
+        bool parse_undef_directive(std::string_view line) {
+            std::string name = parse_name(line);
 
-            if (!(std::isalpha(m_current) || (m_current == '_')))
+            if (!name.size())
                 return false;
 
-            std::string name;
-
-            name.push_back(m_current);
-
-            m_current = m_input->get();
-
-            while (std::isalpha(m_current) || (m_current == '_') || std::isdigit(m_current)) {
-                name.push_back(m_current);
-
-                m_current = m_input->get();
-            }
-
             if (m_define_map.contains(name)) {
                 m_define_map.erase(name);
             }
 
-            return true;
-        }
-
-        bool parse_define_directive() {
-            ignore_whitespace(false);
+            // Undefining an include guard lets its file be
+            // included again
+            auto guard = m_memo->guards.find(name);
 
-            if (!(std::isalpha(m_current) || (m_current == '_')))
-                return false;
+            if (guard != m_memo->guards.end()) {
+                m_memo->included.erase(guard->second);
+                m_memo->guards.erase(guard);
+            }
 
-            std::string name, value;
+            return true;
+        }
 
-            name.push_back(m_current);
+        // Only #pragma once for now, other pragmas are ignored
+        bool parse_pragma_directive(std::string_view line) {
+            size_t start = line.find_first_not_of(" \t");
 
-            m_current = m_input->get();
+            if (start == std::string_view::npos)
+                return true;
 
-            while (std::isalpha(m_current) || (m_current == '_') || std::isdigit(m_current)) {
-                name.push_back(m_current);
+            size_t end = start;
 
-                m_current = m_input->get();
-            }
+            while ((end < line.size()) && std::isalpha(line[end])) end++;
 
-            ignore_whitespace(false);
+            if (line.substr(start, end - start) == "once")
+                m_once = true;
 
-            while ((!isnewline(m_current)) && !m_input->eof()) {
-                value.push_back(m_current);
+            return true;
+        }
 
-                m_current = m_input->get();
-            }
+        bool parse_define_directive(std::string_view line) {
+            std::string name = parse_name(line);
 
-            value = trim(value);
+            if (!name.size())
+                return false;
 
-            m_define_map.insert({name, value});
+            // Value is the rest of the line (and might be empty, i.e.
+            // include guards)
+            m_define_map.insert({name, std::string(trim(line))});
 
             return true;
         }
@@ -229,84 +477,223 @@ namespace hs {
         }
 
         void ignore_until_eol(bool output) {
-            while ((!isnewline(m_current)) && !m_input->eof()) {
-                if (output) m_output.put(m_current);
+            while ((!isnewline(m_current)) && !m_input.eof()) {
+                if (output) m_sink->put(m_current);
 
-                m_current = m_input->get();
+                m_current = m_input.get();
             }
 
             while (isnewline(m_current)) {
-                if (output) m_output.put(m_current);
+                if (output) m_sink->put(m_current);
 
-                m_current = m_input->get();
+                m_current = m_input.get();
             }
 
-            if (m_current != -1) m_output.put(m_current);
+            if (m_current != -1) m_sink->put(m_current);
         }
 
         std::string m_name;
     
     public:
+        void set_include_cache(include_cache_t* cache) {
+            m_cache = cache;
+        }
+
+        void set_use_precompiled(bool use) {
+            m_use_precompiled = use;
+        }
+
+        std::vector <include_dependency_t>* get_dependencies() {
+            return &m_dependencies;
+        }
+
+        bool is_once() {
+            return m_once;
+        }
+
+        // Recognize files wrapped in a C-style include guard:
+        //
+        //   #ifndef NAME
+        //   #define NAME
+        //   ...
+        //   #endif
+        //
+        // We don't do conditionals, so guards would otherwise be
+        // ignored and guarded files included every time. Comments
+        // are allowed around the guard. Returns the guard's name
+        static std::string get_include_guard(std::string_view text) {
+            std::vector <std::string_view> lines;
+
+            size_t pos = 0;
+
+            while (pos < text.size()) {
+                size_t end = text.find('\n', pos);
+
+                if (end == std::string_view::npos) end = text.size();
+
+                std::string_view line = text.substr(pos, end - pos);
+
+                size_t start = line.find_first_not_of(" \t\r\f\v");
+
+                if (start != std::string_view::npos)
+                    lines.push_back(line.substr(start));
+
+                pos = end + 1;
+            }
+
+            auto word = [](std::string_view line, size_t start) {
+                size_t begin = line.find_first_not_of(" \t", start);
+
+                if (begin == std::string_view::npos) return std::string_view();
+
+                size_t end = begin;
+
+                while ((end < line.size()) && (std::isalnum(line[end]) || (line[end] == '_'))) end++;
+
+                return line.substr(begin, end - begin);
+            };
+
+            auto is_comment = [&word](std::string_view line) {
+                std::string_view directive = word(line, 1);
+
+                return (line[0] == '#') && (directive != "ifndef") && (directive != "endif") &&
+                       (directive != "include") && (directive != "define") &&
+                       (directive != "undef") && (directive != "macro") &&
+                       (directive != "pragma");
+            };
+
+            size_t first = 0, last = lines.size();
+
+            while ((first < last) && is_comment(lines[first])) first++;
+            while ((last > first) && is_comment(lines[last - 1])) last--;
+
+            // #ifndef, #define and #endif at least
+            if ((last - first) < 3) return "";
+
+            std::string_view ifndef = lines[first], define = lines[first + 1], endif = lines[last - 1];
+
+            if ((ifndef[0] != '#') || (word(ifndef, 1) != "ifndef")) return "";
+            if ((define[0] != '#') || (word(define, 1) != "define")) return "";
+            if ((endif[0] != '#') || (word(endif, 1) != "endif")) return "";
+
+            std::string_view name = word(ifndef, ifndef.find("ifndef") + 6);
+
+            // The guard must define itself, without a value
+            size_t value = define.find("define") + 6;
+
+            if (!name.size() || (word(define, value) != name)) return "";
+
+            size_t rest = define.find_first_not_of(" \t\r", define.find(name, value) + name.size());
+
+            if (rest != std::string_view::npos) return "";
+
+            return std::string(name);
+        }
+
         std::unordered_map <std::string, std::string>* get_define_map() {
             return &m_define_map;
         }
 
-        void init(std::istream* input, std::vector <std::string>* include_paths, std::string system_include_path, error_logger_t* logger) {
-            m_input = input;
+        // Handle a directive, line is what comes after the '#' up to
+        // the end of the line. Includes are pasted on our output,
+        // unless include is set (token mode)
+        bool directive(std::string_view line, preprocessor_include_t* include = nullptr) {
+            switch (parse_directive(line)) {
+                case PD_INCLUDE: return parse_include_directive(line, include);
+                case PD_DEFINE: return parse_define_directive(line);
+                case PD_UNDEF: return parse_undef_directive(line);
+                case PD_PRAGMA: return parse_pragma_directive(line);
+            }
+
+            // Comment
+            return true;
+        }
+
+        // Token mode, the lexer looks identifiers up here instead
+        const std::string* get_define(std::string_view name) {
+            if (m_define_map.empty())
+                return nullptr;
+
+            m_name.assign(name.data(), name.size());
+
+            auto it = m_define_map.find(m_name);
+
+            return (it != m_define_map.end()) ? &it->second : nullptr;
+        }
+
+        // Token mode, called once the lexer is done with an include's
+        // file. We get its defines, and it gets memoized
+        void end_include(preprocessor_include_t& include) {
+            preprocessor_t& file = *include.preprocessor;
+
+            auto entry = std::make_shared <include_cache_entry_t> ();
+
+            entry->defines.assign(file.m_define_map.begin(), file.m_define_map.end());
+            entry->dependencies = file.m_dependencies;
+            entry->guard = get_include_guard(include.source->view());
+            entry->once = file.m_once || entry->guard.size();
+
+            m_failed |= file.m_failed;
+
+            if (!file.m_failed)
+                m_memo->entries[file.m_resolved] = entry;
+
+            emit_include(*entry, false);
+            mark_included(file.m_resolved, *entry);
+        }
+
+        void init(std::string_view input, std::vector <std::string>* include_paths, std::string system_include_path, error_logger_t* logger) {
+            m_input.init(input);
             m_logger = logger;
             m_include_paths = include_paths;
             m_system_include = system_include_path;
 
-            m_current = m_input->get();
+            m_current = m_input.get();
         }
 
         std::stringstream* get_output() {
             return &m_output;
         }
 
+        // Send output somewhere else (i.e. a queue to the lexer),
+        // get_output() is empty in that case
+        void set_output(std::ostream* output) {
+            m_sink = output;
+        }
+
         void preprocess() {
-            while (!m_input->eof()) {
+            while (!m_input.eof()) {
                 // Handle preprocessor directive or comment
                 if (m_current == '#') {
-                    m_current = m_input->get();
-
-                    directive_t directive = parse_directive();
-
-                    switch (directive) {
-                        case PD_INCLUDE: {
-                            if (!parse_include_directive()) break;
-                        } break;
-                        
-                        case PD_DEFINE: {
-                            if (!parse_define_directive()) break;
-                        } break;
-
-                        case PD_UNDEF: {
-                            if (!parse_undef_directive()) break;
-                        } break;
-                    }
+                    std::string line;
+
+                    m_current = m_input.get();
 
                     while ((!isnewline(m_current)) && (!iseof(m_current))) {
-                        m_current = m_input->get();
+                        line.push_back(m_current);
+
+                        m_current = m_input.get();
                     }
 
+                    directive(line);
+
                     // We could discard newlines, but this would mismatch processed
                     // line numbers vs source line numbers, also inline comments
                     // would screw the next line
 
                     // Handle LF or CRLF
-                    // if (isnewline(m_current)) m_current = m_input->get();
-                    // if (isnewline(m_current)) m_current = m_input->get();
+                    // if (isnewline(m_current)) m_current = m_input.get();
+                    // if (isnewline(m_current)) m_current = m_input.get();
                 } else if (std::isalpha(m_current) || (m_current == '_')) {
                     // Handle name stuff
                     m_name.push_back(m_current);
 
-                    m_current = m_input->get();
+                    m_current = m_input.get();
 
                     while (std::isalpha(m_current) || (m_current == '_') || std::isdigit(m_current)) {
                         m_name.push_back(m_current);
 
-                        m_current = m_input->get();
+                        m_current = m_input.get();
                     }
 
                     // if is preprocessor token then replace else
@@ -316,13 +703,13 @@ namespace hs {
                     }
 
                     for (char c : m_name)
-                        m_output.put(c);
+                        m_sink->put(c);
                     
                     m_name.clear();
                 } else {
-                    m_output.put(m_current);
+                    m_sink->put(m_current);
 
-                    m_current = m_input->get();
+                    m_current = m_input.get();
                 }
             }
         }
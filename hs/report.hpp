@@ -0,0 +1,233 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdint>
+#include <sstream>
+#include <iomanip>
+#include <ostream>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+namespace hs {
+    // A timed region of the pipeline, either a whole stage or a
+    // smaller span inside one (i.e. a single function)
+    struct time_report_event_t {
+        std::string name;
+        std::string category;
+
+        uint64_t start = 0, duration = 0;
+
+        // Peak RSS is only tracked for stages
+        int64_t rss_delta = 0;
+
+        // Work done inside this event
+        uint64_t count = 0;
+
+        std::vector <std::pair <std::string, uint64_t>> counters;
+    };
+
+    class time_report_t {
+        typedef std::chrono::steady_clock clock_t;
+
+        clock_t::time_point m_epoch = clock_t::now();
+
+        std::vector <time_report_event_t> m_events;
+        std::vector <size_t> m_open;
+
+        size_t m_stage = 0;
+        int64_t m_stage_rss = 0;
+
+        bool m_stage_open = false;
+        bool m_enabled = false;
+
+        uint64_t now() {
+            return std::chrono::duration_cast <std::chrono::microseconds> (clock_t::now() - m_epoch).count();
+        }
+
+        // Peak resident set size in KiB, unavailable on Windows
+        static int64_t get_peak_rss() {
+#ifdef _WIN32
+            return 0;
+#else
+            struct rusage usage;
+
+            getrusage(RUSAGE_SELF, &usage);
+
+            return usage.ru_maxrss;
+#endif
+        }
+
+        static std::string escape(const std::string& str) {
+            std::string escaped;
+
+            for (char c : str) {
+                if ((c == '\"') || (c == '\\'))
+                    escaped.push_back('\\');
+
+                escaped.push_back(c);
+            }
+
+            return escaped;
+        }
+
+    public:
+        void enable() {
+            m_enabled = true;
+        }
+
+        bool is_enabled() {
+            return m_enabled;
+        }
+
+        void begin(std::string stage) {
+            if (!m_enabled) return;
+
+            if (m_stage_open) end();
+
+            time_report_event_t event;
+
+            event.name = stage;
+            event.category = "stage";
+            event.start = now();
+
+            m_stage = m_events.size();
+            m_stage_rss = get_peak_rss();
+            m_stage_open = true;
+
+            m_events.push_back(event);
+        }
+
+        void end() {
+            if (!m_stage_open) return;
+
+            // Close any spans left open by this stage
+            while (m_open.size())
+                end_span();
+
+            m_events[m_stage].duration = now() - m_events[m_stage].start;
+            m_events[m_stage].rss_delta = get_peak_rss() - m_stage_rss;
+
+            m_stage_open = false;
+        }
+
+        // Counters are attached to the last stage that was begun
+        void counter(std::string name, uint64_t value) {
+            if (!(m_enabled && m_events.size())) return;
+
+            m_events[m_stage].counters.push_back({ name, value });
+        }
+
+        void begin_span(std::string category, std::string name) {
+            if (!m_enabled) return;
+
+            time_report_event_t event;
+
+            event.name = name;
+            event.category = category;
+            event.start = now();
+
+            m_open.push_back(m_events.size());
+            m_events.push_back(event);
+        }
+
+        // Count work on the innermost open span
+        void count(uint64_t n = 1) {
+            if (m_open.size()) m_events[m_open.back()].count += n;
+        }
+
+        void end_span() {
+            if (!m_open.size()) return;
+
+            time_report_event_t& event = m_events[m_open.back()];
+
+            event.duration = now() - event.start;
+
+            m_open.pop_back();
+        }
+
+        void print_table(std::ostream& out, std::string filename) {
+            std::ostringstream ss;
+
+            uint64_t total = 0;
+
+            ss << "Time report for " << (filename.size() ? filename : "<stdin>") << ":\n";
+            ss << "  " << std::left << std::setw(18) << "stage"
+               << std::right << std::setw(12) << "wall (ms)"
+               << std::setw(16) << "peak RSS (KiB)"
+               << "  counters\n";
+
+            for (time_report_event_t& event : m_events) {
+                if (event.category != "stage") continue;
+
+                total += event.duration;
+
+                ss << "  " << std::left << std::setw(18) << event.name
+                   << std::right << std::setw(12) << std::fixed << std::setprecision(3) << (event.duration / 1000.0)
+                   << std::setw(16) << ((event.rss_delta >= 0) ? "+" : "") + std::to_string(event.rss_delta)
+                   << " ";
+
+                for (auto& c : event.counters)
+                    ss << " " << c.first << "=" << c.second;
+
+                ss << "\n";
+            }
+
+            ss << "  " << std::left << std::setw(18) << "total"
+               << std::right << std::setw(12) << std::fixed << std::setprecision(3) << (total / 1000.0)
+               << std::setw(16) << get_peak_rss() << "\n";
+
+            bool header = false;
+
+            for (time_report_event_t& event : m_events) {
+                if (event.category != "irgen") continue;
+
+                if (!header) {
+                    ss << "IR instructions per function:\n";
+
+                    header = true;
+                }
+
+                ss << "  " << std::left << std::setw(40) << event.name
+                   << std::right << std::setw(8) << event.count
+                   << std::setw(12) << std::fixed << std::setprecision(3) << (event.duration / 1000.0) << " ms\n";
+            }
+
+            out << ss.str();
+        }
+
+        // Chrome trace-event format, load in chrome://tracing or
+        // https://ui.perfetto.dev
+        void write_trace(std::ostream& out) {
+            out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+            for (size_t i = 0; i < m_events.size(); i++) {
+                time_report_event_t& event = m_events[i];
+
+                out << (i ? ",\n" : "\n")
+                    << "{\"name\":\"" << escape(event.name) << "\","
+                    << "\"cat\":\"" << event.category << "\","
+                    << "\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+                    << "\"ts\":" << event.start << ","
+                    << "\"dur\":" << event.duration << ","
+                    << "\"args\":{";
+
+                if (event.category == "stage") {
+                    out << "\"peak_rss_delta_kib\":" << event.rss_delta;
+
+                    for (auto& c : event.counters)
+                        out << ",\"" << escape(c.first) << "\":" << c.second;
+                } else {
+                    out << "\"instructions\":" << event.count;
+                }
+
+                out << "}}";
+            }
+
+            out << "\n]}\n";
+        }
+    };
+}
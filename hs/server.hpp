@@ -0,0 +1,692 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <iterator>
+#include <functional>
+#include <memory>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <csignal>
+#endif
+
+#include "error.hpp"
+#include "cli.hpp"
+#include "preprocessor/include_cache.hpp"
+
+// Compile server protocol, all messages are sequences of
+// length-prefixed strings:
+//
+// Request : <cwd> <argc> <argv...> <stdin>
+// Response: <exit code> <output>
+//
+// Output contains everything the compilation wrote to stdout,
+// including the compiled program when using --stdout
+//
+// Each request is compiled in a child process, which answers the
+// client itself and sends the include cache entries it added back
+// to the server through a pipe:
+//
+// Job     : [<key> <entry>...]
+namespace hs {
+    typedef std::function <int(int, const char**, include_cache_t*)> server_handler_t;
+
+    // Way more than any sane command line
+    constexpr long m_server_max_args = 4096;
+
+    // $XDG_RUNTIME_DIR is private to the user, /tmp isn't so we
+    // use a directory of our own there
+    static std::string get_default_socket_dir() {
+#ifdef _WIN32
+        return "";
+#else
+        const char* runtime = std::getenv("XDG_RUNTIME_DIR");
+
+        if (runtime && *runtime) return runtime;
+
+        return "/tmp/hs-" + std::to_string(getuid());
+#endif
+    }
+
+    static std::string get_default_socket_path() {
+        return get_default_socket_dir() + "/hs.sock";
+    }
+
+#ifndef _WIN32
+    // Creates the directory if it's not there, false if it's not
+    // ours or other users can get in
+    static bool make_private_dir(std::string path) {
+        mkdir(path.c_str(), 0700);
+
+        struct stat st;
+
+        if (lstat(path.c_str(), &st) < 0) return false;
+
+        return S_ISDIR(st.st_mode) && (st.st_uid == getuid()) && !(st.st_mode & 077);
+    }
+#endif
+
+#ifndef _WIN32
+    static bool socket_write(int fd, const void* buf, size_t size) {
+        const char* ptr = (const char*)buf;
+
+        while (size) {
+            ssize_t n = write(fd, ptr, size);
+
+            if (n <= 0) return false;
+
+            ptr += n;
+            size -= n;
+        }
+
+        return true;
+    }
+
+    static bool socket_read(int fd, void* buf, size_t size) {
+        char* ptr = (char*)buf;
+
+        while (size) {
+            ssize_t n = read(fd, ptr, size);
+
+            if (n <= 0) return false;
+
+            ptr += n;
+            size -= n;
+        }
+
+        return true;
+    }
+
+    static bool socket_write_string(int fd, const std::string& str) {
+        uint32_t size = str.size();
+
+        return socket_write(fd, &size, sizeof(size)) && socket_write(fd, str.data(), size);
+    }
+
+    static bool socket_read_string(int fd, std::string& str) {
+        uint32_t size;
+
+        if (!socket_read(fd, &size, sizeof(size))) return false;
+
+        str.resize(size);
+
+        return socket_read(fd, str.data(), size);
+    }
+
+    static int socket_connect(std::string path) {
+        sockaddr_un addr;
+
+        if (path.size() >= sizeof(addr.sun_path)) return -1;
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+        if (fd < 0) return -1;
+
+        std::memset(&addr, 0, sizeof(addr));
+
+        addr.sun_family = AF_UNIX;
+
+        std::strcpy(addr.sun_path, path.c_str());
+
+        if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+            close(fd);
+
+            return -1;
+        }
+
+        return fd;
+    }
+
+    static void buffer_write_string(std::string& buf, const std::string& str) {
+        uint32_t size = str.size();
+
+        buf.append((const char*)&size, sizeof(size));
+        buf.append(str);
+    }
+
+    static bool buffer_read_string(const std::string& buf, size_t& pos, std::string& str) {
+        uint32_t size;
+
+        if ((buf.size() - pos) < sizeof(size)) return false;
+
+        std::memcpy(&size, buf.data() + pos, sizeof(size));
+
+        pos += sizeof(size);
+
+        if ((buf.size() - pos) < size) return false;
+
+        str.assign(buf, pos, size);
+
+        pos += size;
+
+        return true;
+    }
+
+    // <key> <text> <guard> <once> <define count> <name> <value>...
+    // <dependency count> <path> <time> <size>...
+    static void buffer_write_entry(std::string& buf, const std::string& key, const include_cache_entry_t& entry) {
+        buffer_write_string(buf, key);
+        buffer_write_string(buf, entry.text);
+        buffer_write_string(buf, entry.guard);
+        buffer_write_string(buf, entry.once ? "1" : "0");
+        buffer_write_string(buf, std::to_string(entry.defines.size()));
+
+        for (const auto& [name, value] : entry.defines) {
+            buffer_write_string(buf, name);
+            buffer_write_string(buf, value);
+        }
+
+        buffer_write_string(buf, std::to_string(entry.dependencies.size()));
+
+        for (const include_dependency_t& dep : entry.dependencies) {
+            buffer_write_string(buf, dep.path);
+            buffer_write_string(buf, std::to_string(dep.time.time_since_epoch().count()));
+            buffer_write_string(buf, std::to_string(dep.size));
+        }
+    }
+
+    // Key is read by the caller, running out of entries isn't an error
+    static bool buffer_read_entry(const std::string& buf, size_t& pos, include_cache_entry_t& entry) {
+        std::string once, count;
+
+        if (!buffer_read_string(buf, pos, entry.text)) return false;
+        if (!buffer_read_string(buf, pos, entry.guard)) return false;
+        if (!buffer_read_string(buf, pos, once)) return false;
+        if (!buffer_read_string(buf, pos, count)) return false;
+
+        entry.once = once == "1";
+        entry.defines.resize(std::strtoull(count.c_str(), nullptr, 10));
+
+        for (auto& [name, value] : entry.defines)
+            if (!buffer_read_string(buf, pos, name) || !buffer_read_string(buf, pos, value)) return false;
+
+        if (!buffer_read_string(buf, pos, count)) return false;
+
+        entry.dependencies.resize(std::strtoull(count.c_str(), nullptr, 10));
+
+        for (include_dependency_t& dep : entry.dependencies) {
+            std::string time, size;
+
+            if (!buffer_read_string(buf, pos, dep.path)) return false;
+            if (!buffer_read_string(buf, pos, time)) return false;
+            if (!buffer_read_string(buf, pos, size)) return false;
+
+            dep.time = std::filesystem::file_time_type(std::filesystem::file_time_type::duration(std::strtoll(time.c_str(), nullptr, 10)));
+            dep.size = std::strtoull(size.c_str(), nullptr, 10);
+        }
+
+        return true;
+    }
+
+    // Signal handlers can't get to the server, the socket is removed
+    // when it's killed or crashes
+    static char m_server_socket[sizeof(sockaddr_un::sun_path)];
+
+    static const int m_server_signals[] = {
+        SIGINT, SIGTERM, SIGHUP, SIGQUIT,
+        SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT
+    };
+
+    static void server_signal_handler(int sig) {
+        unlink(m_server_socket);
+
+        std::signal(sig, SIG_DFL);
+        std::raise(sig);
+    }
+
+    // Written to on SIGCHLD so poll() wakes up to reap children
+    static int m_server_wake[2] = { -1, -1 };
+
+    static void server_child_handler(int) {
+        int saved = errno;
+
+        if (write(m_server_wake[1], "", 1) < 0) {}
+
+        errno = saved;
+    }
+#endif
+
+    class server_t {
+#ifndef _WIN32
+        // A request being compiled by a child process
+        struct job_t {
+            pid_t pid;
+
+            // Kept open to report the child crashing, -1 once it exits
+            int client;
+
+            // Include cache entries coming from the child, -1 once
+            // the child closes it
+            int pipe;
+
+            std::string entries;
+        };
+
+        std::vector <job_t> m_jobs;
+#endif
+
+        error_logger_t* m_logger;
+        std::string m_path;
+        include_cache_t m_cache;
+        server_handler_t m_handler;
+        int m_fd = -1;
+
+#ifndef _WIN32
+        void respond(int fd, std::string code, std::string output) {
+            socket_write_string(fd, code);
+            socket_write_string(fd, output);
+        }
+
+        // Runs in the child process, answers the client on fd and
+        // sends the include cache entries it added to out
+        void run_job(int fd, int out) {
+            std::string cwd, argc, input;
+            std::vector <std::string> args;
+
+            if (!socket_read_string(fd, cwd)) return;
+            if (!socket_read_string(fd, argc)) return;
+
+            char* end;
+
+            long count = std::strtol(argc.c_str(), &end, 10);
+
+            if (argc.empty() || *end || (count < 0) || (count > m_server_max_args)) {
+                respond(fd, "-1", fmt("hs: error: Invalid argument count \"%s\"\n", argc.c_str()));
+
+                return;
+            }
+
+            args.resize(count);
+
+            for (std::string& arg : args)
+                if (!socket_read_string(fd, arg)) return;
+
+            if (!socket_read_string(fd, input)) return;
+
+            if (chdir(cwd.c_str()) < 0) {
+                respond(fd, "-1", fmt("hs: error: Couldn't change directory to \"%s\"\n", cwd.c_str()));
+
+                return;
+            }
+
+            std::vector <const char*> argv = { "hs" };
+
+            for (std::string& arg : args) {
+                // Don't let clients start servers or clients
+                if ((arg == "--server") || (arg == "--client")) continue;
+
+                argv.push_back(arg.c_str());
+            }
+
+            std::stringstream in(input), output;
+
+            std::cin.rdbuf(in.rdbuf());
+            std::cout.rdbuf(output.rdbuf());
+
+            m_cache.set_journaling(true);
+
+            int ec = m_handler(argv.size(), argv.data(), &m_cache);
+
+            std::cout.flush();
+
+            respond(fd, std::to_string(ec), output.str());
+
+            std::string entries;
+
+            for (auto& [key, entry] : m_cache.take_journal())
+                buffer_write_entry(entries, key, *entry);
+
+            socket_write(out, entries.data(), entries.size());
+        }
+
+        void start(int fd) {
+            int job[2];
+
+            if (pipe(job) < 0) {
+                respond(fd, "-1", "hs: error: Couldn't start compilation\n");
+                close(fd);
+
+                return;
+            }
+
+            pid_t pid = fork();
+
+            if (pid < 0) {
+                close(job[0]);
+                close(job[1]);
+
+                respond(fd, "-1", "hs: error: Couldn't start compilation\n");
+                close(fd);
+
+                return;
+            }
+
+            if (!pid) {
+                for (int sig : m_server_signals)
+                    std::signal(sig, SIG_DFL);
+
+                std::signal(SIGCHLD, SIG_DFL);
+
+                close(m_fd);
+                close(job[0]);
+                close(m_server_wake[0]);
+                close(m_server_wake[1]);
+
+                for (job_t& other : m_jobs) {
+                    if (other.client >= 0) close(other.client);
+                    if (other.pipe >= 0) close(other.pipe);
+                }
+
+                run_job(fd, job[1]);
+
+                // Don't run the server's exit handlers
+                _exit(0);
+            }
+
+            close(job[1]);
+
+            m_jobs.push_back({ pid, fd, job[0], "" });
+        }
+
+        // Keeps the includes the job preprocessed for later requests
+        void read_entries(job_t& job) {
+            char buf[65536];
+
+            ssize_t n = read(job.pipe, buf, sizeof(buf));
+
+            if (n > 0) {
+                job.entries.append(buf, n);
+
+                return;
+            }
+
+            if ((n < 0) && (errno == EINTR))
+                return;
+
+            close(job.pipe);
+
+            job.pipe = -1;
+
+            size_t pos = 0;
+
+            std::string key;
+
+            while (buffer_read_string(job.entries, pos, key)) {
+                auto entry = std::make_shared <include_cache_entry_t> ();
+
+                if (!buffer_read_entry(job.entries, pos, *entry)) break;
+
+                m_cache.put(key, entry);
+            }
+
+            std::string().swap(job.entries);
+        }
+
+        void reap() {
+            char buf[64];
+
+            while (read(m_server_wake[0], buf, sizeof(buf)) > 0);
+
+            int status;
+
+            pid_t pid;
+
+            while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+                for (job_t& job : m_jobs) {
+                    if (job.pid != pid)
+                        continue;
+
+                    // Children answer their clients unless they die
+                    if (WIFSIGNALED(status)) {
+                        int sig = WTERMSIG(status);
+
+                        respond(job.client, std::to_string(128 + sig), fmt("hs: error: Compilation crashed (%s)\n", strsignal(sig)));
+                    } else if (WEXITSTATUS(status)) {
+                        respond(job.client, std::to_string(WEXITSTATUS(status)), "hs: error: Compilation ended unexpectedly\n");
+                    }
+
+                    close(job.client);
+
+                    job.client = -1;
+                }
+            }
+
+            std::erase_if(m_jobs, [](job_t& job) {
+                return (job.client < 0) && (job.pipe < 0);
+            });
+        }
+#endif
+
+    public:
+        bool init(cli_parser_t* cli, error_logger_t* logger, server_handler_t handler) {
+            m_logger = logger;
+            m_handler = handler;
+            m_path = cli->is_set(ST_SOCKET) ? cli->get_setting(ST_SOCKET) : get_default_socket_path();
+
+#ifdef _WIN32
+            m_logger->print_error("hs", "Compile server unsupported on this platform", 0, 0, 0, false, true);
+
+            return false;
+#else
+            sockaddr_un addr;
+
+            if (m_path.size() >= sizeof(addr.sun_path)) {
+                m_logger->print_error("hs", fmt("Socket path \"%s\" too long", m_path.c_str()), 0, 0, 0, false, true);
+
+                return false;
+            }
+
+            if (!cli->is_set(ST_SOCKET) && !make_private_dir(get_default_socket_dir())) {
+                m_logger->print_error("hs", fmt("Socket directory \"%s\" isn't private", get_default_socket_dir().c_str()), 0, 0, 0, false, true);
+
+                return false;
+            }
+
+            int other = socket_connect(m_path);
+
+            if (other >= 0) {
+                close(other);
+
+                m_logger->print_error("hs", fmt("Another server is already listening on \"%s\"", m_path.c_str()), 0, 0, 0, false, true);
+
+                return false;
+            }
+
+            m_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+            std::memset(&addr, 0, sizeof(addr));
+
+            addr.sun_family = AF_UNIX;
+
+            std::strcpy(addr.sun_path, m_path.c_str());
+
+            // Nobody's listening, this is a stale socket from a server
+            // that couldn't clean up
+            unlink(m_path.c_str());
+
+            if ((m_fd < 0) || (bind(m_fd, (sockaddr*)&addr, sizeof(addr)) < 0)) {
+                m_logger->print_error("hs", fmt("Couldn't listen on \"%s\"", m_path.c_str()), 0, 0, 0, false, true);
+
+                return false;
+            }
+
+            std::strcpy(m_server_socket, m_path.c_str());
+
+            for (int sig : m_server_signals)
+                std::signal(sig, server_signal_handler);
+
+            if (listen(m_fd, 16) < 0) {
+                m_logger->print_error("hs", fmt("Couldn't listen on \"%s\"", m_path.c_str()), 0, 0, 0, false, true);
+
+                return false;
+            }
+
+            if (pipe(m_server_wake) < 0) {
+                m_logger->print_error("hs", "Couldn't create the server's wake up pipe", 0, 0, 0, false, true);
+
+                return false;
+            }
+
+            fcntl(m_server_wake[0], F_SETFL, O_NONBLOCK);
+            fcntl(m_server_wake[1], F_SETFL, O_NONBLOCK);
+
+            std::signal(SIGCHLD, server_child_handler);
+
+            // Clients disconnecting early shouldn't kill us
+            std::signal(SIGPIPE, SIG_IGN);
+
+            return true;
+#endif
+        }
+
+        ~server_t() {
+#ifndef _WIN32
+            if (!m_server_socket[0]) return;
+
+            close(m_fd);
+            unlink(m_server_socket);
+
+            m_server_socket[0] = '\0';
+#endif
+        }
+
+        // Each request is compiled in a child process so requests
+        // run concurrently, and compilations that change the working
+        // directory or crash don't take the server with them
+        void serve() {
+#ifndef _WIN32
+            _log(info, "Listening on %s", m_path.c_str());
+
+            std::vector <pollfd> fds;
+
+            while (true) {
+                fds.clear();
+
+                fds.push_back({ m_fd, POLLIN, 0 });
+                fds.push_back({ m_server_wake[0], POLLIN, 0 });
+
+                for (job_t& job : m_jobs)
+                    if (job.pipe >= 0)
+                        fds.push_back({ job.pipe, POLLIN, 0 });
+
+                if (poll(fds.data(), fds.size(), -1) < 0)
+                    continue;
+
+                for (size_t n = 2; n < fds.size(); n++) {
+                    if (!fds[n].revents)
+                        continue;
+
+                    for (job_t& job : m_jobs)
+                        if (job.pipe == fds[n].fd)
+                            read_entries(job);
+                }
+
+                reap();
+
+                if (fds[0].revents & POLLIN) {
+                    int fd = accept(m_fd, nullptr, nullptr);
+
+                    if (fd >= 0) start(fd);
+                }
+            }
+#endif
+        }
+    };
+
+    class client_t {
+        error_logger_t* m_logger;
+        std::string m_path;
+
+        // Using the default socket, only trusted if its directory is
+        bool m_default = false;
+
+    public:
+        void init(cli_parser_t* cli, error_logger_t* logger) {
+            m_logger = logger;
+            m_path = cli->is_set(ST_SOCKET) ? cli->get_setting(ST_SOCKET) : get_default_socket_path();
+            m_default = !cli->is_set(ST_SOCKET);
+        }
+
+        // Returns false if the server couldn't be reached, exit code
+        // is only valid when the compilation went through
+        bool compile(int argc, const char** argv, int* ec) {
+#ifdef _WIN32
+            return false;
+#else
+            if (m_default && !make_private_dir(get_default_socket_dir())) return false;
+
+            int fd = socket_connect(m_path);
+
+            if (fd < 0) return false;
+
+            std::vector <std::string> args;
+
+            bool read_stdin = false;
+
+            for (int i = 1; i < argc; i++) {
+                std::string arg(argv[i]);
+
+                if (arg == "--client") continue;
+
+                // Socket path is only meaningful to us
+                if (arg == "--socket") { i++; continue; }
+
+                if ((arg == "--stdin") || (arg == "--stdio"))
+                    read_stdin = true;
+
+                args.push_back(arg);
+            }
+
+            std::string input;
+
+            if (read_stdin)
+                input.assign(std::istreambuf_iterator <char> (std::cin), std::istreambuf_iterator <char> ());
+
+            char cwd[4096];
+
+            bool ok = getcwd(cwd, sizeof(cwd)) && socket_write_string(fd, cwd);
+
+            ok = ok && socket_write_string(fd, std::to_string(args.size()));
+
+            for (std::string& arg : args)
+                ok = ok && socket_write_string(fd, arg);
+
+            ok = ok && socket_write_string(fd, input);
+
+            std::string code, output;
+
+            ok = ok && socket_read_string(fd, code) && socket_read_string(fd, output);
+
+            close(fd);
+
+            if (!ok) {
+                m_logger->print_error("hs", "Lost connection to compile server", 0, 0, 0, false, true);
+
+                *ec = -1;
+
+                return true;
+            }
+
+            std::cout.write(output.data(), output.size());
+            std::cout.flush();
+
+            *ec = std::atoi(code.c_str());
+
+            return true;
+#endif
+        }
+    };
+}
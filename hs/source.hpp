@@ -0,0 +1,332 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "pipeline.hpp"
+
+namespace hs {
+    // Source text shared by the preprocessor, lexer and diagnostics.
+    // Files are memory mapped, standard input is read once, and the
+    // line index used for diagnostics is only built when needed
+    class source_buffer_t {
+        const char* m_data = "";
+        size_t m_size = 0;
+
+        // Slurped input, when we couldn't map it
+        std::string m_storage;
+
+        void* m_map = nullptr;
+
+        // Offset of the start of each line
+        std::vector <size_t> m_lines;
+
+        void release() {
+#ifndef _WIN32
+            if (m_map) munmap(m_map, m_size);
+#endif
+
+            m_map = nullptr;
+            m_data = "";
+            m_size = 0;
+
+            m_storage.clear();
+            m_lines.clear();
+        }
+
+        void build_line_index() {
+            m_lines.push_back(0);
+
+            for (size_t i = 0; i < m_size; i++)
+                if (m_data[i] == '\n') m_lines.push_back(i + 1);
+        }
+
+    public:
+        source_buffer_t() = default;
+        source_buffer_t(const source_buffer_t&) = delete;
+        source_buffer_t& operator=(const source_buffer_t&) = delete;
+
+        ~source_buffer_t() {
+            release();
+        }
+
+        bool open(std::string path) {
+            release();
+
+#ifndef _WIN32
+            int fd = ::open(path.c_str(), O_RDONLY);
+
+            if (fd < 0) return false;
+
+            struct stat st;
+
+            if (fstat(fd, &st) < 0) {
+                close(fd);
+
+                return false;
+            }
+
+            // Empty files can't be mapped, and there's nothing to map
+            // on pipes and the like
+            if (S_ISREG(st.st_mode) && st.st_size) {
+                void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+                if (map != MAP_FAILED) {
+                    close(fd);
+
+                    m_map = map;
+                    m_data = (const char*)map;
+                    m_size = st.st_size;
+
+                    return true;
+                }
+            }
+
+            close(fd);
+#endif
+
+            std::ifstream file(path, std::ios::binary);
+
+            if (!(file.is_open() && file.good())) return false;
+
+            read(&file);
+
+            return true;
+        }
+
+        void read(std::istream* input) {
+            release();
+
+            m_storage.assign(std::istreambuf_iterator <char> (*input), std::istreambuf_iterator <char> ());
+
+            m_data = m_storage.data();
+            m_size = m_storage.size();
+        }
+
+        std::string_view view() {
+            return std::string_view(m_data, m_size);
+        }
+
+        size_t size() {
+            return m_size;
+        }
+
+        size_t get_line_count() {
+            if (m_lines.empty()) build_line_index();
+
+            return m_lines.size();
+        }
+
+        // Line without its trailing newline
+        std::string_view get_line(size_t line) {
+            if (line >= get_line_count()) return "";
+
+            size_t start = m_lines[line];
+            size_t end = ((line + 1) < m_lines.size()) ? (m_lines[line + 1] - 1) : m_size;
+
+            return std::string_view(m_data + start, end - start);
+        }
+    };
+
+    // Lines of the token stream when includes are lexed in place (see
+    // --integrated-preprocessor) count on across files, like they
+    // would on the preprocessed text. This maps them back to the
+    // file and line they came from
+    class line_map_t {
+        struct file_t {
+            std::string name;
+
+            source_buffer_t* source;
+        };
+
+        // Lines from line on are file's, starting at file_line
+        struct entry_t {
+            unsigned int line;
+            uint32_t file;
+            unsigned int file_line;
+        };
+
+        std::vector <file_t> m_files;
+        std::vector <entry_t> m_entries;
+
+        // Included files' sources, kept around for diagnostics
+        std::vector <std::shared_ptr <source_buffer_t>> m_sources;
+
+    public:
+        void clear() {
+            m_files.clear();
+            m_entries.clear();
+            m_sources.clear();
+        }
+
+        bool empty() {
+            return m_entries.empty();
+        }
+
+        uint32_t add_file(std::string name, source_buffer_t* source) {
+            m_files.push_back({ name, source });
+
+            return m_files.size() - 1;
+        }
+
+        uint32_t add_file(std::string name, std::shared_ptr <source_buffer_t> source) {
+            m_sources.push_back(source);
+
+            return add_file(name, source.get());
+        }
+
+        void enter(unsigned int line, uint32_t file, unsigned int file_line) {
+            // Nothing came from the last file
+            if (m_entries.size() && (m_entries.back().line == line))
+                m_entries.pop_back();
+
+            m_entries.push_back({ line, file, file_line });
+        }
+
+        // Entries are added in line order
+        bool lookup(unsigned int line, uint32_t& file, unsigned int& file_line) {
+            auto it = std::upper_bound(m_entries.begin(), m_entries.end(), line, [](unsigned int line, const entry_t& entry) {
+                return line < entry.line;
+            });
+
+            if (it == m_entries.begin())
+                return false;
+
+            it--;
+
+            file = it->file;
+            file_line = it->file_line + (line - it->line);
+
+            return true;
+        }
+
+        const std::string& get_name(uint32_t file) {
+            return m_files[file].name;
+        }
+
+        source_buffer_t* get_source(uint32_t file) {
+            return m_files[file].source;
+        }
+    };
+
+    // Scans text through a pointer instead of an std::istream, the
+    // text comes either from a buffer or in chunks from a queue (see
+    // --streaming). get(), peek() and eof() behave like their
+    // std::istream counterparts, so EOF reads as -1
+    class source_reader_t {
+        const char* m_ptr = nullptr;
+        const char* m_end = nullptr;
+
+        bool m_eof = false;
+
+        text_queue_t* m_queue = nullptr;
+
+        std::string m_chunk;
+
+        bool refill() {
+            if (!m_queue) return false;
+
+            do {
+                if (!m_queue->pop(m_chunk)) return false;
+            } while (m_chunk.empty());
+
+            m_ptr = m_chunk.data();
+            m_end = m_ptr + m_chunk.size();
+
+            return true;
+        }
+
+    public:
+        void init(std::string_view text) {
+            m_ptr = text.data();
+            m_end = m_ptr + text.size();
+            m_eof = false;
+            m_queue = nullptr;
+        }
+
+        void init(text_queue_t* queue) {
+            m_ptr = nullptr;
+            m_end = nullptr;
+            m_eof = false;
+            m_queue = queue;
+        }
+
+        inline char get() {
+            if ((m_ptr == m_end) && !refill()) {
+                m_eof = true;
+
+                return -1;
+            }
+
+            return *m_ptr++;
+        }
+
+        inline char peek() {
+            if ((m_ptr == m_end) && !refill()) {
+                m_eof = true;
+
+                return -1;
+            }
+
+            return *m_ptr;
+        }
+
+        inline bool eof() {
+            return m_eof;
+        }
+
+        // Bulk versions of get(), skip characters while pred holds
+        // (or until c is found) and return how many were skipped.
+        // They're appended to str unless it's null. The character
+        // that stopped the scan is left for the next get()
+        template <class F> size_t take_while(std::string* str, F pred) {
+            size_t count = 0;
+
+            while (true) {
+                const char* ptr = m_ptr;
+
+                while ((ptr != m_end) && pred(*ptr)) ptr++;
+
+                if (str) str->append(m_ptr, ptr - m_ptr);
+
+                count += ptr - m_ptr;
+                m_ptr = ptr;
+
+                if ((ptr != m_end) || !refill())
+                    return count;
+            }
+        }
+
+        size_t take_until(std::string* str, char c) {
+            size_t count = 0;
+
+            while (true) {
+                const char* ptr = (m_ptr != m_end) ? (const char*)std::memchr(m_ptr, c, m_end - m_ptr) : m_end;
+
+                if (!ptr) ptr = m_end;
+
+                if (str) str->append(m_ptr, ptr - m_ptr);
+
+                count += ptr - m_ptr;
+                m_ptr = ptr;
+
+                if ((ptr != m_end) || !refill())
+                    return count;
+            }
+        }
+    };
+}
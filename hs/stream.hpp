@@ -1,10 +1,15 @@
 #pragma once
 
 #include <vector>
+#include <functional>
 
 namespace hs {
-    template <class T> class stream_t {
-        typedef std::vector<T> vector_t;
+    // B is the buffer items are kept on, buffers other than
+    // std::vector (i.e. token_buffer_t) define their own reference
+    // type, which is what get() and peek() return
+    template <class T, class B = std::vector<T>> class stream_t {
+        typedef B vector_t;
+        typedef typename B::reference reference_t;
 
         T m_dummy;
 
@@ -12,25 +17,58 @@ namespace hs {
 
         size_t m_pos = 0;
 
+        // Appends the next batch of items to the buffer, returns
+        // false when there's nothing left. Called when the buffer
+        // runs out, so only a batch or two are ever kept around
+        std::function <bool(vector_t&)> m_source;
+
+        // Pull until the buffer has more than size items
+        bool pull(size_t size) {
+            while (m_buf.size() <= size)
+                if (!m_source(m_buf)) return false;
+
+            return true;
+        }
+
+        bool refill() {
+            if (!m_source) return false;
+
+            m_buf.clear();
+            m_pos = 0;
+
+            return pull(0);
+        }
+
     public:
+        // Items are pulled from source as they're read instead of
+        // being put beforehand. Items already read are dropped on
+        // every refill, so begin()/end() only cover the current batch
+        void set_source(std::function <bool(vector_t&)> source) {
+            m_source = source;
+        }
+
         vector_t* data() {
             return &m_buf;
         }
 
-        typename std::vector<T>::iterator begin() {
+        auto begin() {
             return m_buf.begin();
         }
 
-        typename std::vector<T>::iterator end() {
+        auto end() {
             return m_buf.end();
         }
 
         bool eof() {
-            return m_pos == m_buf.size();
+            if (m_pos == m_buf.size())
+                return !refill();
+
+            return false;
         }
 
-        T& peek() {
-            if ((m_pos + 1) == m_buf.size()) return m_dummy;
+        reference_t peek() {
+            if ((m_pos + 1) >= m_buf.size())
+                if (!(m_source && pull(m_pos + 1))) return m_dummy;
 
             return m_buf[m_pos + 1];
         }
@@ -39,7 +77,11 @@ namespace hs {
             m_buf.push_back(data);
         }
 
-        T& get() {
+        void put(T&& data) {
+            m_buf.push_back(std::move(data));
+        }
+
+        reference_t get() {
             if (this->eof()) return m_dummy;
 
             return m_buf[m_pos++];
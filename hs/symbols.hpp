@@ -0,0 +1,97 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+namespace hs {
+    typedef uint32_t symbol_id_t;
+
+    // Interned names, identifiers are interned by the lexer and
+    // later stages compare and hash symbols instead of strings.
+    //
+    // There's one table per compilation (see compiler_t), so batch
+    // workers don't need to share one. Symbol 0 is the empty name
+    class symbol_table_t {
+        // Deque elements don't move, so names can be handed out
+        // by reference
+        std::deque <std::string> m_names;
+        std::vector <uint32_t> m_hashes;
+
+        // Open addressing, linear probing. Slots hold symbol + 1,
+        // 0 for empty slots. Kept at most half full
+        std::vector <uint32_t> m_slots = std::vector <uint32_t> (256);
+
+        // 32-bit FNV-1a
+        static uint32_t hash(std::string_view name) {
+            uint32_t h = 0x811c9dc5;
+
+            for (char c : name) {
+                h ^= (uint8_t)c;
+                h *= 0x01000193;
+            }
+
+            return h;
+        }
+
+        void grow() {
+            std::vector <uint32_t> slots(m_slots.size() * 2);
+
+            size_t mask = slots.size() - 1;
+
+            for (symbol_id_t symbol = 0; symbol < m_names.size(); symbol++) {
+                size_t i = m_hashes[symbol] & mask;
+
+                while (slots[i]) i = (i + 1) & mask;
+
+                slots[i] = symbol + 1;
+            }
+
+            m_slots.swap(slots);
+        }
+
+    public:
+        symbol_table_t() {
+            intern("");
+        }
+
+        symbol_table_t(const symbol_table_t&) = delete;
+        symbol_table_t& operator=(const symbol_table_t&) = delete;
+
+        symbol_id_t intern(std::string_view name) {
+            uint32_t h = hash(name);
+
+            size_t mask = m_slots.size() - 1;
+            size_t i = h & mask;
+
+            while (uint32_t slot = m_slots[i]) {
+                if ((m_hashes[slot - 1] == h) && (m_names[slot - 1] == name))
+                    return slot - 1;
+
+                i = (i + 1) & mask;
+            }
+
+            symbol_id_t symbol = m_names.size();
+
+            m_names.emplace_back(name);
+            m_hashes.push_back(h);
+
+            m_slots[i] = symbol + 1;
+
+            if ((m_names.size() * 2) > m_slots.size())
+                grow();
+
+            return symbol;
+        }
+
+        const std::string& get_name(symbol_id_t symbol) {
+            return m_names[symbol];
+        }
+
+        size_t size() {
+            return m_names.size();
+        }
+    };
+}
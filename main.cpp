@@ -4,20 +4,10 @@
 #include <cctype>
 #include <stack>
 
-#include "hs/compiler.hpp"
+#include "hs/driver.hpp"
 
 int main(int argc, const char* argv[]) {
     _log::init("hs");
 
-    hs::compiler_t compiler;
-
-    if (!compiler.init(argc, argv)) {
-        return -1;
-    }
-
-    if (!compiler.compile()) {
-        return -1;
-    }
-
-    return 0;
+    return hs::run(argc, argv);
 }
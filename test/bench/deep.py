@@ -0,0 +1,21 @@
+# Writes a program that's too deep for a recursive front end
+#
+# usage: deep.py chain <terms>   x = x + x + ... + x
+#        deep.py nest <depth>    if (x): { if (x): { ... }; };
+
+import sys
+
+kind, n = sys.argv[1], int(sys.argv[2])
+
+out = sys.stdout
+
+out.write('fn main() -> u32: {\n    u32 x = 1;\n')
+
+if kind == 'chain':
+    out.write('    x = x' + (' + x' * (n - 1)) + ';\n')
+elif kind == 'nest':
+    out.write('    ' + ('if (x): {' * n) + 'x = 2;' + ('};' * n) + '\n')
+else:
+    sys.exit('Unknown kind "' + kind + '"')
+
+out.write('    x;\n};\n')
@@ -0,0 +1,57 @@
+#!/bin/sh
+# Compiles deeply nested inputs with a 1 MiB stack, anything
+# recursing per nesting level crashes. Front end times come from
+# --bench-ast, full compiles (-O0 and -O2) have to finish within
+# LIMIT seconds (default 60), which catches passes that go
+# quadratic on depth
+#
+# usage: test/bench/deep.sh [hs binary]
+
+HS=${1:-bin/hs}
+DIR=$(dirname "$0")
+TMP=$(mktemp -d)
+LIMIT=${LIMIT:-60}
+FAILS=0
+
+trap 'rm -rf "$TMP"' EXIT
+
+ulimit -s 1024
+
+fail() {
+    echo "FAIL: $1"
+
+    FAILS=$((FAILS + 1))
+}
+
+for CASE in "chain 100000" "chain 1000000" "nest 50000"; do
+    set -- $CASE
+
+    python3 "$DIR/deep.py" $1 $2 > "$TMP/$1$2.hs"
+
+    echo "$1 $2:"
+
+    "$HS" "$TMP/$1$2.hs" -O2 --bench-ast -o /dev/null || fail "$1 $2 --bench-ast exited with $?"
+
+    for O in -O0 -O2; do
+        START=$(date +%s.%N)
+
+        timeout $LIMIT "$HS" "$TMP/$1$2.hs" $O -o /dev/null
+        EC=$?
+
+        END=$(date +%s.%N)
+
+        if [ $EC -eq 124 ]; then
+            fail "$1 $2 $O took more than ${LIMIT}s"
+        elif [ $EC -ne 0 ]; then
+            fail "$1 $2 $O exited with $EC"
+        else
+            awk "BEGIN { printf \"  compile $O: %.3fs\\n\", $END - $START }"
+        fi
+    done
+done
+
+if [ $FAILS -ne 0 ]; then
+    echo "$FAILS case(s) failed"
+
+    exit 1
+fi
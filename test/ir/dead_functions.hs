@@ -0,0 +1,11 @@
+fn unused_a -> int: {
+    1;
+};
+
+fn unused_b(x: u32) -> u32: {
+    x + 2;
+};
+
+fn main -> int: {
+    3;
+};
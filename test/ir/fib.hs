@@ -0,0 +1,13 @@
+fn fib(n: u32) -> u32: {
+    u32 r = n;
+
+    if (n > 1): {
+        r = fib(n - 1) + fib(n - 2);
+    };
+
+    r;
+};
+
+fn main -> int: {
+    fib(10);
+};
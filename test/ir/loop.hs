@@ -0,0 +1,35 @@
+fn fib(n: u32) -> u32: {
+    u32 a = 0;
+    u32 b = 1;
+    u32 t = 0;
+    u32 i = 0;
+
+    while (i != n): {
+        t = a + b;
+        a = b;
+        b = t;
+        i = i + 1;
+    };
+
+    a;
+};
+
+fn swap(n: u32) -> u32: {
+    u32 a = 1;
+    u32 b = 2;
+    u32 t = 0;
+    u32 i = 0;
+
+    while (i != n): {
+        t = a;
+        a = b;
+        b = t;
+        i = i + 1;
+    };
+
+    (a * 10) + b;
+};
+
+fn main -> int: {
+    fib(10) + swap(3);
+};
@@ -0,0 +1,43 @@
+fn twice(x: u32) -> u32: {
+    x + x;
+};
+
+fn sum(a: u32) -> u32: {
+    u32 c = twice(a + 0);
+
+    u32 v0 = a + 0;
+    u32 v1 = a + 1;
+    u32 v2 = a + 2;
+    u32 v3 = a + 3;
+    u32 v4 = a + 4;
+    u32 v5 = a + 5;
+    u32 v6 = a + 6;
+    u32 v7 = a + 7;
+    u32 v8 = a + 8;
+    u32 v9 = a + 9;
+    u32 v10 = a + 10;
+    u32 v11 = a + 11;
+    u32 v12 = a + 12;
+    u32 v13 = a + 13;
+    u32 v14 = a + 14;
+    u32 v15 = a + 15;
+    u32 v16 = a + 16;
+    u32 v17 = a + 17;
+    u32 v18 = a + 18;
+    u32 v19 = a + 19;
+    u32 v20 = a + 20;
+    u32 v21 = a + 21;
+    u32 v22 = a + 22;
+    u32 v23 = a + 23;
+    u32 v24 = a + 24;
+    u32 v25 = a + 25;
+    u32 v26 = a + 26;
+    u32 v27 = a + 27;
+    u32 v28 = a + 28;
+    u32 v29 = a + 29;
+    (((((((((((((((((((((((((((((v0 + v1) + v2) + v3) + v4) + v5) + v6) + v7) + v8) + v9) + v10) + v11) + v12) + v13) + v14) + v15) + v16) + v17) + v18) + v19) + v20) + v21) + v22) + v23) + v24) + v25) + v26) + v27) + v28) + v29) + c;
+};
+
+fn main -> int: {
+    sum(1);
+};
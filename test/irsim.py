@@ -0,0 +1,136 @@
+# Runs a function from hs's --debug-ir output (allocated IR) and
+# prints what it returns in A0
+#
+# usage: irsim.py <ir file> <function label> [args...]
+
+import sys, re
+
+MASK = 0xffffffff
+
+def signed(x):
+    x &= MASK
+
+    return x - (1 << 32) if x & 0x80000000 else x
+
+def load(path):
+    code, labels = [], {}
+
+    for line in open(path).read().split('\n'):
+        line = line.strip()
+
+        # Skip log messages
+        if not line or line.startswith('hs:'):
+            continue
+
+        parts = line.split(None, 1)
+        args = [a.strip() for a in parts[1].split(',')] if len(parts) > 1 else []
+
+        if parts[0] == 'LABEL':
+            labels.setdefault(args[0].lstrip('!'), []).append(len(code))
+
+        code.append((parts[0], args))
+
+    return code, labels
+
+def run(code, labels, function, args):
+    regs, mem = {}, {}
+    sp = fp = 0x100000
+
+    def push(v):
+        nonlocal sp
+        sp -= 4
+        mem[sp] = v
+
+    def pop():
+        nonlocal sp
+        sp += 4
+        return mem[sp - 4]
+
+    def get(r):
+        return { 'SP': sp, 'FP': fp }.get(r, regs.get(r, 0))
+
+    def set(r, v):
+        nonlocal sp, fp
+
+        if r == 'SP': sp = v
+        elif r == 'FP': fp = v
+        else: regs[r] = (v & MASK) if isinstance(v, int) else v
+
+    # Same sequence the generator emits for calls
+    push(fp)
+
+    for a in args:
+        push(a)
+
+    fp = sp + (4 * len(args))
+
+    push(-1)
+
+    pc = start = labels[function][0]
+    calls = []
+
+    # Local labels are only unique within a function
+    def find(label):
+        return next(n for n in labels[label] if n > start)
+
+    alu = {
+        '+' : lambda x, y: x + y,  '-' : lambda x, y: x - y,
+        '*' : lambda x, y: x * y,  '/' : lambda x, y: x // y if y else 0,
+        '&' : lambda x, y: x & y,  '|' : lambda x, y: x | y,
+        '^' : lambda x, y: x ^ y,  '<<': lambda x, y: x << y,
+        '>>': lambda x, y: x >> y
+    }
+
+    cmp = {
+        '==': lambda x, y: x == y, '!=': lambda x, y: x != y,
+        '<' : lambda x, y: x < y,  '<=': lambda x, y: x <= y,
+        '>' : lambda x, y: x > y,  '>=': lambda x, y: x >= y
+    }
+
+    for _ in range(10 ** 7):
+        op, a = code[pc]
+        pc += 1
+
+        if op in ('LABEL', 'DEFINE', 'UNDEF', 'NOP') or op.startswith('IR_MISC'):
+            continue
+
+        if op == 'MOVI':
+            set(a[0], int(a[1], 0) if re.match(r'^\d', a[1]) else a[1])
+        elif op == 'MOV'  : set(a[0], get(a[1]))
+        elif op == 'DECSP': sp -= 4
+        elif op == 'ADDSP': sp += int(a[0])
+        elif op == 'SUBSP': sp -= int(a[0])
+        elif op == 'ADDFP': fp += int(a[0])
+        elif op == 'STORE': mem[get(a[0])] = get(a[1])
+        elif op == 'LOADF': set(a[0], mem[fp - int(a[1])])
+        elif op == 'LEAF' : set(a[0], fp - int(a[1]))
+        elif op == 'LOADR': set(a[0], mem[get(a[1])])
+        elif op == 'PUSHR': push(get(a[0]))
+        elif op == 'POPR' : set(a[0], pop())
+        elif op == 'ALU'  : set(a[1], alu[a[0]](get(a[1]), get(a[2])))
+        elif op == 'CMPR' : set(a[1], int(cmp[a[0]](signed(get(a[1])), signed(get(a[2])))))
+        elif op == 'CMPZB':
+            if get(a[1]) == 0:
+                pc = find(a[2])
+        elif op == 'BRANCH':
+            pc = find(a[1])
+        elif op == 'CALLR':
+            calls.append((pc, start))
+            push(pc)
+
+            pc = start = labels[get(a[0])][0]
+        elif op == 'RET':
+            if not calls:
+                return regs['A0']
+
+            pop()
+
+            pc, start = calls.pop()
+        else:
+            raise Exception('Unsupported instruction ' + op)
+
+    raise Exception('Ran for too long')
+
+code, labels = load(sys.argv[1])
+
+print(run(code, labels, sys.argv[2], [int(x) for x in sys.argv[3:]]))
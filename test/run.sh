@@ -0,0 +1,133 @@
+#!/bin/sh
+# Regression tests. IR pass and register allocator tests run their
+# main on irsim.py at each -O level
+#
+# usage: test/run.sh [hs binary]
+
+HS=${1:-bin/hs}
+HS=$(cd "$(dirname "$HS")" && pwd)/$(basename "$HS")
+DIR=$(cd "$(dirname "$0")" && pwd)
+TMP=$(mktemp -d)
+FAILS=0
+
+trap 'rm -rf "$TMP"' EXIT
+
+fail() {
+    echo "FAIL: $1"
+
+    FAILS=$((FAILS + 1))
+}
+
+# expect <test> <value main returns>
+expect() {
+    for O in -O0 -O1 -O2; do
+        if ! "$HS" "$DIR/ir/$1.hs" $O -o /dev/null --debug-ir > "$TMP/ir" 2>&1; then
+            fail "$1 $O doesn't compile"
+
+            continue
+        fi
+
+        GOT=$(python3 "$DIR/irsim.py" "$TMP/ir" "F<global>.main" 2>&1 | tail -n 1)
+
+        [ "$GOT" = "$2" ] || fail "$1 $O returned $GOT, expected $2"
+    done
+}
+
+# Calls in the middle of expressions, temporaries live across them
+expect fib 55
+
+# More live values than hv2 has registers
+expect spill 467
+
+"$HS" "$DIR/ir/spill.hs" -O1 -o /dev/null --time-report 2>&1 | grep -q "spilled=[1-9]" ||
+    fail "spill doesn't spill anymore"
+
+# Loop-carried copies mem2reg's phis turn into (including a swap)
+expect loop 76
+
+"$HS" "$DIR/ir/loop.hs" -O1 -o /dev/null --debug-passes 2>&1 | grep -q "phis *[1-9]" ||
+    fail "loop doesn't get phis anymore"
+
+# Only main should survive -O2
+expect dead_functions 3
+
+for O in -O1 -O2; do
+    "$HS" "$DIR/ir/dead_functions.hs" $O -o /dev/null --debug-ir > "$TMP/ir" 2>&1
+
+    COUNT=$(grep -c "LABEL.*F<global>\.unused" "$TMP/ir")
+
+    [ "$O" = -O1 ] && [ "$COUNT" != 2 ] && fail "dead_functions -O1 removed functions"
+    [ "$O" = -O2 ] && [ "$COUNT" != 0 ] && fail "dead_functions -O2 kept unused functions"
+done
+
+# Deeply nested ifs, phis of the same variable share a register
+# instead of taking one (and a spill) per level
+python3 "$DIR/bench/deep.py" nest 4000 > "$TMP/nest.hs"
+
+if timeout 60 "$HS" "$TMP/nest.hs" -O2 -o /dev/null --time-report --debug-ir > "$TMP/ir" 2>&1; then
+    grep -q "spilled=0 " "$TMP/ir" || fail "nest -O2 spills"
+
+    GOT=$(python3 "$DIR/irsim.py" "$TMP/ir" "F<global>.main" 2>&1 | tail -n 1)
+
+    [ "$GOT" = 2 ] || fail "nest -O2 returned $GOT, expected 2"
+else
+    fail "nest -O2 didn't compile within 60s"
+fi
+
+# Rebuilding a precompiled header has to change the output cache key
+mkdir "$TMP/pch"
+
+printf 'fn value -> int: {\n    1;\n};\n' > "$TMP/pch/h.hs"
+printf '#include "h.hs"\n\nfn main -> int: {\n    value();\n};\n' > "$TMP/pch/m.hs"
+
+(
+    cd "$TMP/pch"
+
+    "$HS" h.hs --precompile -o h.hpch
+    "$HS" m.hs -o 1.out --cache-dir cache
+
+    printf 'fn value -> int: {\n    2;\n};\n' > h.hs
+
+    "$HS" h.hs --precompile -o h.hpch
+    "$HS" m.hs -o 2.out --cache-dir cache
+    "$HS" m.hs -o fresh.out
+)
+
+cmp -s "$TMP/pch/1.out" "$TMP/pch/fresh.out" && fail "precompiled header change didn't change the output"
+cmp -s "$TMP/pch/2.out" "$TMP/pch/fresh.out" || fail "cache hit on a stale precompiled header"
+
+# Compile server, --stdio output goes back to the client instead
+# of a file on the server
+"$HS" --server --socket "$TMP/hs.sock" > /dev/null 2>&1 &
+SERVER=$!
+
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    [ -S "$TMP/hs.sock" ] && break
+
+    sleep 0.1
+done
+
+if [ -S "$TMP/hs.sock" ]; then
+    mkdir "$TMP/client"
+
+    "$HS" "$DIR/ir/fib.hs" -o "$TMP/local.out"
+
+    (cd "$TMP/client" && "$HS" --client --socket "$TMP/hs.sock" --stdio < "$DIR/ir/fib.hs" > "$TMP/stdio.out")
+
+    cmp -s "$TMP/local.out" "$TMP/stdio.out" || fail "server --stdio output differs"
+
+    [ -e "$TMP/client/a.out" ] && fail "server --stdio wrote a.out"
+else
+    fail "server didn't start"
+fi
+
+kill $SERVER
+wait $SERVER 2> /dev/null
+
+if [ $FAILS -ne 0 ]; then
+    echo "$FAILS test(s) failed"
+
+    exit 1
+fi
+
+echo "All tests passed"